@@ -0,0 +1,241 @@
+#include <Benchmark.hpp>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QThread>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <string>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace hdrv::bench {
+
+namespace {
+
+double median(std::vector<double> values)
+{
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  return n == 0 ? 0.0 : n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2.0;
+}
+
+// Of the whole process, not affected by resetPeakRss().
+uint64_t processPeakRss()
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters{};
+  return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return uint64_t(usage.ru_maxrss); // bytes on macOS, KiB elsewhere
+#else
+  return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+double mebibytes(uint64_t bytes)
+{
+  return double(bytes) / double(1 << 20);
+}
+
+}
+
+void addOptions(QCommandLineParser& parser)
+{
+  parser.addOptions({
+    { "repetitions", "Timed runs of each benchmark (default 5).", "n" },
+    { "warmup", "Untimed runs before them (default 1).", "n" },
+    { "filter", "Only run benchmarks whose name contains <text>, may be repeated.", "text" },
+    { "output", "Write the JSON report to <file> instead of stdout.", "file" },
+  });
+}
+
+bool readOptions(QCommandLineParser const& parser, Options& options)
+{
+  bool ok = true;
+  auto number = [&](QString const& name, int& value, int minimum) {
+    if (parser.isSet(name)) {
+      bool valid = false;
+      value = parser.value(name).toInt(&valid);
+      if (!valid || value < minimum) {
+        std::fprintf(stderr, "Invalid value for --%s.\n", qPrintable(name));
+        ok = false;
+      }
+    }
+  };
+  number("repetitions", options.repetitions, 1);
+  number("warmup", options.warmup, 0);
+  options.filters = parser.values("filter");
+  options.output = parser.value("output");
+  return ok;
+}
+
+Runner::Runner(QString const& tool, Options const& options)
+  : tool_(tool)
+  , options_(options)
+{}
+
+bool Runner::selected(QString const& name) const
+{
+  return options_.filters.isEmpty()
+    || std::any_of(options_.filters.begin(), options_.filters.end(), [&](QString const& f) { return name.contains(f); });
+}
+
+void Runner::run(QString const& name, uint64_t bytes, uint64_t pixels, std::function<bool()> const& body,
+  std::function<void()> const& setup)
+{
+  if (!begin(name)) {
+    return;
+  }
+  std::vector<double> samples;
+  for (int i = 0; i < options_.warmup + options_.repetitions; ++i) {
+    if (setup) {
+      setup();
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool ok = body();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!ok) {
+      std::fprintf(stderr, "  failed\n");
+      failed_ = true;
+      return;
+    }
+    if (i >= options_.warmup) {
+      samples.push_back(seconds);
+    }
+  }
+  add(name, bytes, pixels, samples);
+}
+
+void Runner::runEach(QString const& name, uint64_t bytes, uint64_t pixels, int count,
+  std::function<bool(int)> const& body)
+{
+  if (!begin(name)) {
+    return;
+  }
+  std::vector<double> samples;
+  for (int i = -options_.warmup; i < count; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = body(std::max(i, 0));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!ok) {
+      std::fprintf(stderr, "  failed\n");
+      failed_ = true;
+      return;
+    }
+    if (i >= 0) {
+      samples.push_back(seconds);
+    }
+  }
+  add(name, bytes, pixels, samples);
+}
+
+void Runner::add(QString const& name, uint64_t bytes, uint64_t pixels, std::vector<double> const& samples)
+{
+  if (samples.empty()) {
+    return;
+  }
+  double m = median(samples);
+  QJsonArray values;
+  for (double s : samples) {
+    values.append(s);
+  }
+  QJsonObject result {
+    { "name", name },
+    { "samples", values },
+    { "median", m },
+    { "min", *std::min_element(samples.begin(), samples.end()) },
+    { "mean", std::accumulate(samples.begin(), samples.end(), 0.0) / double(samples.size()) },
+    { "bytes", qint64(bytes) },
+    { "pixels", qint64(pixels) },
+    { "peakRssMiB", mebibytes(peakRss()) },
+  };
+  if (m > 0.0) {
+    result["mbPerSecond"] = double(bytes) / m / 1e6;
+    result["megapixelsPerSecond"] = double(pixels) / m / 1e6;
+  }
+  std::fprintf(stderr, "  %.3f ms, %.1f MB/s, %.1f Mpixels/s\n", m * 1000.0, result["mbPerSecond"].toDouble(),
+    result["megapixelsPerSecond"].toDouble());
+  results_.push_back(result);
+}
+
+void Runner::fail(QString const& name, char const* reason)
+{
+  std::fprintf(stderr, "  %s failed: %s\n", qPrintable(name), reason);
+  failed_ = true;
+}
+
+bool Runner::begin(QString const& name)
+{
+  if (!selected(name)) {
+    return false;
+  }
+  std::fprintf(stderr, "%s\n", qPrintable(name));
+  resetPeakRss();
+  return true;
+}
+
+int Runner::finish()
+{
+  QJsonArray benchmarks;
+  for (auto const& result : results_) {
+    benchmarks.append(result);
+  }
+  QJsonObject report {
+    { "tool", tool_ },
+    { "threads", QThread::idealThreadCount() },
+    { "repetitions", options_.repetitions },
+    { "context", context_ },
+    { "benchmarks", benchmarks },
+  };
+  report["peakRssMiB"] = mebibytes(processPeakRss());
+  auto json = QJsonDocument(report).toJson();
+  if (options_.output.isEmpty()) {
+    std::fwrite(json.constData(), 1, size_t(json.size()), stdout);
+  } else {
+    QFile file(options_.output);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate) || file.write(json) != json.size()) {
+      std::fprintf(stderr, "Could not write %s\n", qPrintable(options_.output));
+      return 2;
+    }
+  }
+  return failed_ ? 2 : 0;
+}
+
+uint64_t peakRss()
+{
+#if defined(__linux__)
+  // VmHWM, unlike ru_maxrss, follows resets through clear_refs.
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::stoull(line.substr(6)) * 1024;
+    }
+  }
+#endif
+  return processPeakRss();
+}
+
+void resetPeakRss()
+{
+#if defined(__linux__)
+  std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+}
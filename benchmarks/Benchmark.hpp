@@ -0,0 +1,81 @@
+#pragma once
+
+#include <QCommandLineParser>
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Runs timed benchmarks and collects their results in the JSON report shared by
+// hdrv-bench and hdrv-render-bench, which hdrv-bench-compare reads:
+//
+//   { "tool": "hdrv-bench", "threads": 16, "peakRssMiB": 812.4, "context": { ... },
+//     "benchmarks": [ { "name": "exr.load/zip/noise", "samples": [0.081, ...],
+//       "median": 0.08, "min": 0.079, "mean": 0.081, "bytes": 50331648,
+//       "pixels": 4194304, "mbPerSecond": 629.1, "megapixelsPerSecond": 52.4,
+//       "peakRssMiB": 420.3 } ] }
+//
+// Samples are seconds per repetition. Throughput is computed from the median
+// and the uncompressed size of the pixels, so codecs compare on equal terms.
+
+namespace hdrv::bench {
+
+struct Options
+{
+  int repetitions = 5;
+  int warmup = 1;
+  QStringList filters; // benchmarks whose name contains one of them, all if empty
+  QString output;      // JSON file, stdout if empty
+};
+
+// Adds --repetitions, --warmup, --filter and --output to a parser.
+void addOptions(QCommandLineParser& parser);
+// Reads them once the arguments were parsed. False after printing an error.
+bool readOptions(QCommandLineParser const& parser, Options& options);
+
+class Runner
+{
+public:
+  Runner(QString const& tool, Options const& options);
+
+  bool selected(QString const& name) const;
+
+  // Times `body` (which returns false on failure) `repetitions` times after
+  // `warmup` untimed runs. `setup` runs untimed before each run.
+  void run(QString const& name, uint64_t bytes, uint64_t pixels, std::function<bool()> const& body,
+    std::function<void()> const& setup = {});
+  // Times each of `count` calls of `body(i)` as a sample of its own, after
+  // `warmup` untimed calls, eg. for frame times.
+  void runEach(QString const& name, uint64_t bytes, uint64_t pixels, int count, std::function<bool(int)> const& body);
+  // Adds samples (seconds) measured by the caller.
+  void add(QString const& name, uint64_t bytes, uint64_t pixels, std::vector<double> const& samples);
+  // Marks a benchmark measured by the caller as failed, it is not reported.
+  void fail(QString const& name, char const* reason);
+
+  // Extra information about the run, eg. image size or GPU.
+  void setContext(QString const& key, QJsonValue const& value) { context_[key] = value; }
+
+  Options const& options() const { return options_; }
+
+  // Writes the report. Returns the exit code, 2 if a benchmark failed.
+  int finish();
+
+private:
+  bool begin(QString const& name);
+
+  QString tool_;
+  Options options_;
+  QJsonObject context_;
+  std::vector<QJsonObject> results_;
+  bool failed_ = false;
+};
+
+// Resident memory high-water mark in bytes since the last reset. Resets are
+// only possible on Linux, elsewhere this is the peak of the whole process.
+uint64_t peakRss();
+void resetPeakRss();
+
+}
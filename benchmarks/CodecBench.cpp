@@ -0,0 +1,226 @@
+// Benchmarks of the image codecs and pixel kernels, runs without a GPU:
+// hdrv-bench [--size WxH] [--filter text] [--repetitions n] [--output report.json]
+//
+// Images are synthetic and the same on every run, so reports of different
+// builds and machines can be compared with hdrv-bench-compare.
+
+#include <Benchmark.hpp>
+
+#include <image/Image.hpp>
+#include <image/Metrics.hpp>
+#include <image/Thumbnail.hpp>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QRegularExpression>
+#include <QTemporaryDir>
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+using namespace hdrv;
+
+namespace {
+
+struct Synthetic
+{
+  QString name;
+  Image image;
+};
+
+// xorshift, deterministic on every platform unlike the std distributions.
+struct Random
+{
+  uint32_t state = 2463534242u;
+
+  float next()
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return float(state >> 8) / float(1 << 24);
+  }
+};
+
+template<typename Pixel>
+Image generate(int width, int height, Pixel const& pixel)
+{
+  std::vector<uint8_t> data(size_t(width) * size_t(height) * 3 * sizeof(float));
+  auto values = reinterpret_cast<float*>(data.data());
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x, values += 3) {
+      pixel(x, y, values);
+    }
+  }
+  return Image(width, height, 3, Image::Float, std::move(data));
+}
+
+std::vector<Synthetic> syntheticImages(int width, int height)
+{
+  std::vector<Synthetic> images;
+  // Smooth, compresses well.
+  images.push_back({ "gradient", generate(width, height, [&](int x, int y, float* rgb) {
+    rgb[0] = float(x) / float(width);
+    rgb[1] = float(y) / float(height);
+    rgb[2] = 0.5f * (rgb[0] + rgb[1]);
+  }) });
+  // Hardly compresses at all.
+  Random random;
+  images.push_back({ "noise", generate(width, height, [&](int, int, float* rgb) {
+    rgb[0] = random.next();
+    rgb[1] = random.next();
+    rgb[2] = random.next();
+  }) });
+  // Twenty stops with some grain, as rendered images are.
+  images.push_back({ "hdr", generate(width, height, [&](int x, int y, float* rgb) {
+    float stops = 20.0f * float(x + y) / float(width + height) - 10.0f;
+    for (int c = 0; c < 3; ++c) {
+      rgb[c] = std::exp2(stops + 0.25f * random.next());
+    }
+  }) });
+  // Noise with one in a hundred pixels NaN or infinite.
+  images.push_back({ "nan", generate(width, height, [&](int, int, float* rgb) {
+    float special = random.next();
+    for (int c = 0; c < 3; ++c) {
+      rgb[c] = special < 0.005f ? std::numeric_limits<float>::quiet_NaN()
+        : special < 0.01f       ? std::numeric_limits<float>::infinity()
+                                : random.next();
+    }
+  }) });
+  return images;
+}
+
+struct Codec
+{
+  QString name;
+  QString extension;
+  std::function<Result<bool>(Image const&, std::string const&)> store;
+  std::function<Result<Image>(std::string const&)> load;
+};
+
+std::vector<Codec> codecs()
+{
+  std::vector<Codec> codecs = {
+    { "pfm", "pfm", [](Image const& i, std::string const& p) { return i.storePFM(p); },
+      [](std::string const& p) { return Image::loadPFM(p); } },
+    { "pic", "hdr", [](Image const& i, std::string const& p) { return i.storePIC(p); },
+      [](std::string const& p) { return Image::loadPIC(p); } },
+  };
+  std::pair<char const*, EXROptions::Compression> compressions[] = { { "none", EXROptions::None },
+    { "rle", EXROptions::RLE }, { "zips", EXROptions::ZIPS }, { "zip", EXROptions::ZIP }, { "piz", EXROptions::PIZ } };
+  for (auto const& [name, compression] : compressions) {
+    EXROptions options;
+    options.compression = compression;
+    codecs.push_back({ QString("exr/") + name, "exr",
+      [options](Image const& i, std::string const& p) { return i.storeEXR(p, options); },
+      [](std::string const& p) { return Image::loadEXR(p); } });
+  }
+  return codecs;
+}
+
+bool check(Result<bool> const& result)
+{
+  if (!result) {
+    std::fprintf(stderr, "  %s\n", result.error().c_str());
+  }
+  return bool(result);
+}
+
+bool check(Result<Image> const& result)
+{
+  if (!result) {
+    std::fprintf(stderr, "  %s\n", result.error().c_str());
+  }
+  return bool(result);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("hdrv-bench");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Benchmarks loading and storing images and the pixel kernels of hdrv.");
+  parser.addHelpOption();
+  bench::addOptions(parser);
+  QCommandLineOption sizeOption("size", "Size of the synthetic images (default 2048x2048).", "WxH", "2048x2048");
+  parser.addOption(sizeOption);
+  parser.process(app);
+
+  bench::Options options;
+  auto size = QRegularExpression("^(\\d+)x(\\d+)$").match(parser.value(sizeOption));
+  int width = size.captured(1).toInt();
+  int height = size.captured(2).toInt();
+  if (!bench::readOptions(parser, options) || width <= 0 || height <= 0) {
+    parser.showHelp(1);
+  }
+
+  QTemporaryDir directory;
+  if (!directory.isValid()) {
+    std::fprintf(stderr, "Could not create a temporary directory.\n");
+    return 1;
+  }
+
+  bench::Runner runner("hdrv-bench", options);
+  runner.setContext("width", width);
+  runner.setContext("height", height);
+
+  uint64_t pixels = uint64_t(width) * uint64_t(height);
+  auto images = syntheticImages(width, height);
+  for (auto const& synthetic : images) {
+    auto const& name = synthetic.name;
+    auto const& image = synthetic.image;
+    uint64_t bytes = image.sizeInBytes();
+    for (auto const& codec : codecs()) {
+      std::string path = QDir(directory.path()).filePath(name + "." + codec.extension).toStdString();
+      runner.run(codec.name + ".store/" + name, bytes, pixels, [&] { return check(codec.store(image, path)); });
+      bool interleave = codec.name == "exr/none" && runner.selected("exr.interleave/" + name);
+      if (runner.selected(codec.name + ".load/" + name) || interleave) {
+        if (QFile::exists(QString::fromStdString(path)) || check(codec.store(image, path))) {
+          runner.run(codec.name + ".load/" + name, bytes, pixels, [&] { return check(codec.load(path)); });
+        }
+      }
+      // The EXR loader times converting tinyexr's planar channels to
+      // interleaved pixels on its own, read back from its histogram.
+      if (interleave && QFile::exists(QString::fromStdString(path))) {
+        std::fprintf(stderr, "exr.interleave/%s\n", qPrintable(name));
+        bench::resetPeakRss();
+        auto& convert = metrics::histogram("load.exr.convert");
+        std::vector<double> samples;
+        for (int i = 0; i < options.warmup + options.repetitions; ++i) {
+          double before = convert.summary().sum;
+          if (!check(codec.load(path))) {
+            samples.clear();
+            break;
+          }
+          if (i >= options.warmup) {
+            samples.push_back((convert.summary().sum - before) / 1000.0);
+          }
+        }
+        runner.add("exr.interleave/" + name, bytes, pixels, samples);
+      }
+      QFile::remove(QString::fromStdString(path));
+    }
+
+    std::string png = QDir(directory.path()).filePath(name + ".png").toStdString();
+    runner.run("png.store/" + name, bytes, pixels, [&] { return check(image.storeImage(png, 1.0f, 2.2f)); });
+    QFile::remove(QString::fromStdString(png));
+
+    runner.run("scaleByHalf/" + name, bytes, pixels, [&] { return check(image.scaleByHalf()); });
+
+    // As the file browser thumbnailers do it: reduced load, then 8 bit pixels.
+    std::string exr = QDir(directory.path()).filePath(name + ".exr").toStdString();
+    if (runner.selected("thumbnail/" + name) && check(image.storeEXR(exr))) {
+      runner.run("thumbnail/" + name, bytes, pixels, [&] {
+        auto thumbnail = loadThumbnail(exr, 256);
+        return check(thumbnail) && !thumbnailPixels(thumbnail.value()).empty();
+      });
+      QFile::remove(QString::fromStdString(exr));
+    }
+  }
+  return runner.finish();
+}
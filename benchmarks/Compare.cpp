@@ -0,0 +1,236 @@
+// Compares benchmark reports of hdrv-bench and hdrv-render-bench:
+//   hdrv-bench-compare --save <name> <report.json>   keeps a report as baseline
+//   hdrv-bench-compare --list                        lists the baselines
+//   hdrv-bench-compare <baseline> <report.json>      compares a report with a
+//                                                    baseline (name or file)
+//
+// Each benchmark is compared by the median of its samples. A bootstrap of the
+// samples gives a confidence interval of the change, only changes whose
+// interval lies entirely beyond the threshold count as faster or slower, so
+// noisy benchmarks do not fail the comparison. Exits with 1 if a benchmark got
+// slower, 2 if a report could not be read.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct Report
+{
+  QString tool;
+  QJsonObject context;
+  std::map<QString, std::vector<double>> samples; // seconds by benchmark name
+};
+
+std::optional<Report> readReport(QString const& path)
+{
+  QFile file(path);
+  if (!file.open(QFile::ReadOnly)) {
+    std::fprintf(stderr, "Could not read %s\n", qPrintable(path));
+    return std::nullopt;
+  }
+  QJsonParseError error;
+  auto json = QJsonDocument::fromJson(file.readAll(), &error).object();
+  if (error.error != QJsonParseError::NoError || !json["benchmarks"].isArray()) {
+    std::fprintf(stderr, "%s is not a benchmark report\n", qPrintable(path));
+    return std::nullopt;
+  }
+  Report report;
+  report.tool = json["tool"].toString();
+  report.context = json["context"].toObject();
+  for (auto const& value : json["benchmarks"].toArray()) {
+    auto benchmark = value.toObject();
+    std::vector<double> samples;
+    for (auto const& sample : benchmark["samples"].toArray()) {
+      samples.push_back(sample.toDouble());
+    }
+    if (!samples.empty()) {
+      report.samples[benchmark["name"].toString()] = std::move(samples);
+    }
+  }
+  return report;
+}
+
+double median(std::vector<double> values)
+{
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2.0;
+}
+
+struct Change
+{
+  double ratio; // current / baseline median time
+  double low;   // confidence interval of the ratio
+  double high;
+};
+
+// Percentile bootstrap of the ratio of medians. Seeded, so the same reports
+// always give the same interval.
+Change compare(std::vector<double> const& baseline, std::vector<double> const& current, double confidence)
+{
+  Change change;
+  change.ratio = median(current) / median(baseline);
+  int const resamples = 2000;
+  std::mt19937 random(1);
+  auto resample = [&](std::vector<double> const& samples) {
+    std::vector<double> result(samples.size());
+    for (auto& value : result) {
+      value = samples[random() % samples.size()];
+    }
+    return median(result);
+  };
+  std::vector<double> ratios(resamples);
+  for (auto& ratio : ratios) {
+    ratio = resample(current) / resample(baseline);
+  }
+  std::sort(ratios.begin(), ratios.end());
+  double tail = (1.0 - confidence) / 2.0;
+  change.low = ratios[size_t(tail * (resamples - 1))];
+  change.high = ratios[size_t((1.0 - tail) * (resamples - 1))];
+  return change;
+}
+
+QString percent(double ratio)
+{
+  return QString::asprintf("%+.1f%%", (ratio - 1.0) * 100.0);
+}
+
+QString duration(double seconds)
+{
+  return seconds >= 1.0 ? QString::asprintf("%.2f s", seconds)
+    : seconds >= 1e-3   ? QString::asprintf("%.2f ms", seconds * 1e3)
+                        : QString::asprintf("%.1f us", seconds * 1e6);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("hdrv-bench-compare");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Keeps benchmark reports as baselines and compares reports with them.");
+  parser.addHelpOption();
+  parser.addOptions({
+    { "save", "Keep <report.json> as baseline <name>.", "name" },
+    { "list", "List the baselines." },
+    { "baselines", "Directory of the baselines (default in the user's data directory).", "directory" },
+    { "threshold", "Changes in percent below which benchmarks count as unchanged (default 5).", "percent", "5" },
+    { "confidence", "Confidence level of the intervals in percent (default 95).", "percent", "95" },
+    { "filter", "Only compare benchmarks whose name contains <text>, may be repeated.", "text" },
+  });
+  parser.addPositionalArgument("baseline", "Name of a baseline or a report file to compare with.", "[baseline]");
+  parser.addPositionalArgument("report", "Report of hdrv-bench or hdrv-render-bench.");
+  parser.process(app);
+
+  QDir baselines(parser.isSet("baselines") ? parser.value("baselines")
+      : QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/hdrv/baselines");
+  auto arguments = parser.positionalArguments();
+
+  if (parser.isSet("list")) {
+    for (auto const& file : baselines.entryInfoList({ "*.json" }, QDir::Files, QDir::Time)) {
+      auto report = readReport(file.filePath());
+      std::printf("%-24s %-20s %s\n", qPrintable(file.completeBaseName()),
+        qPrintable(file.lastModified().toString("yyyy-MM-dd hh:mm")), report ? qPrintable(report->tool) : "");
+    }
+    return 0;
+  }
+
+  if (parser.isSet("save")) {
+    if (arguments.size() != 1) {
+      parser.showHelp(1);
+    }
+    if (!readReport(arguments[0])) {
+      return 2;
+    }
+    QString target = baselines.filePath(parser.value("save") + ".json");
+    if (!baselines.mkpath(".") || (QFile::exists(target) && !QFile::remove(target))
+      || !QFile::copy(arguments[0], target)) {
+      std::fprintf(stderr, "Could not write %s\n", qPrintable(target));
+      return 2;
+    }
+    std::printf("Saved %s\n", qPrintable(target));
+    return 0;
+  }
+
+  bool ok = false;
+  double threshold = parser.value("threshold").toDouble(&ok) / 100.0;
+  bool valid = ok && threshold >= 0.0;
+  double confidence = parser.value("confidence").toDouble(&ok) / 100.0;
+  valid = valid && ok && confidence > 0.0 && confidence < 1.0;
+  if (arguments.size() != 2 || !valid) {
+    parser.showHelp(1);
+  }
+  QString baselinePath = QFileInfo::exists(arguments[0]) ? arguments[0] : baselines.filePath(arguments[0] + ".json");
+  auto baseline = readReport(baselinePath);
+  auto current = readReport(arguments[1]);
+  if (!baseline || !current) {
+    return 2;
+  }
+  if (baseline->tool != current->tool || baseline->context != current->context) {
+    std::printf("Note: the reports come from different tools or settings, compare with care.\n\n");
+  }
+
+  auto filters = parser.values("filter");
+  auto selected = [&](QString const& name) {
+    return filters.isEmpty() || std::any_of(filters.begin(), filters.end(), [&](auto const& f) { return name.contains(f); });
+  };
+
+  int width = 9;
+  for (auto const& [name, samples] : current->samples) {
+    width = std::max(width, int(name.size()));
+  }
+  std::printf("%-*s %10s %10s %8s %7s  %-19s\n", width, "benchmark", "baseline", "current", "change", "speedup",
+    QString::asprintf("%g%% interval", confidence * 100.0).toUtf8().constData());
+
+  int slower = 0;
+  int faster = 0;
+  for (auto const& [name, samples] : current->samples) {
+    if (!selected(name)) {
+      continue;
+    }
+    auto base = baseline->samples.find(name);
+    if (base == baseline->samples.end()) {
+      std::printf("%-*s %10s %10s  new\n", width, qPrintable(name), "", qPrintable(duration(median(samples))));
+      continue;
+    }
+    auto change = compare(base->second, samples, confidence);
+    char const* verdict = "";
+    if (change.low > 1.0 + threshold) {
+      verdict = "slower";
+      ++slower;
+    } else if (change.high < 1.0 / (1.0 + threshold)) {
+      verdict = "faster";
+      ++faster;
+    }
+    std::printf("%-*s %10s %10s %8s %6.2fx  %-19s %s\n", width, qPrintable(name),
+      qPrintable(duration(median(base->second))), qPrintable(duration(median(samples))),
+      qPrintable(percent(change.ratio)), 1.0 / change.ratio,
+      qPrintable("[" + percent(change.low) + ", " + percent(change.high) + "]"), verdict);
+  }
+  for (auto const& [name, samples] : baseline->samples) {
+    if (selected(name) && !current->samples.count(name)) {
+      std::printf("%-*s %10s %10s  missing\n", width, qPrintable(name), qPrintable(duration(median(samples))), "");
+    }
+  }
+
+  std::printf("\n%d faster, %d slower beyond %g%%\n", faster, slower, threshold * 100.0);
+  return slower > 0 ? 1 : 0;
+}
@@ -0,0 +1,316 @@
+// Benchmarks of ImageRenderer, drawing into an offscreen framebuffer:
+// hdrv-render-bench [--viewport WxH] [--sizes 1024,4096] [--frames n] [--output report.json]
+//
+// Needs OpenGL 3.3 but no GPU, Mesa's software rasterizer will do:
+//   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run hdrv-render-bench
+//
+// Every sample waits for the GL commands to finish (glFinish), so the times
+// include the work of the GPU and not just issuing the commands.
+
+#include <Benchmark.hpp>
+
+#include <model/ImageDocument.hpp>
+#include <view/ImageRenderer.hpp>
+
+#include <QGuiApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QRegularExpression>
+#include <QThreadPool>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+using namespace hdrv;
+
+namespace {
+
+QSize parseSize(QString const& text)
+{
+  auto match = QRegularExpression("^(\\d+)x(\\d+)$").match(text);
+  return match.hasMatch() ? QSize(match.captured(1).toInt(), match.captured(2).toInt()) : QSize();
+}
+
+struct Format
+{
+  char const* name;
+  Image::Format format;
+  int channels;
+};
+
+Format const formats[] = {
+  { "float1", Image::Float, 1 },
+  { "float3", Image::Float, 3 },
+  { "float4", Image::Float, 4 },
+  { "short3", Image::Short, 3 },
+  { "byte4", Image::Byte, 4 },
+};
+
+// Diagonal gradient, so minified frames sample every mip level. Layers are
+// stored one after another.
+std::shared_ptr<Image> gradient(int width, int height, Image::Format format, int channels,
+  std::vector<Image::Layer> layers = {})
+{
+  std::vector<int> planes = { channels };
+  if (!layers.empty()) {
+    planes.clear();
+    for (auto const& layer : layers) {
+      planes.push_back(layer.channels);
+    }
+  }
+  size_t pixels = size_t(width) * size_t(height);
+  size_t count = 0;
+  for (int c : planes) {
+    count += pixels * size_t(c);
+  }
+  std::vector<uint8_t> data(count * (format == Image::Float ? 4 : format == Image::Short ? 2 : 1));
+  size_t i = 0;
+  for (int c : planes) {
+    for (size_t pixel = 0; pixel < pixels; ++pixel) {
+      float value = float(pixel % size_t(width) + pixel / size_t(width)) / float(width + height);
+      for (int k = 0; k < c; ++k, ++i) {
+        switch (format) {
+          case Image::Float: reinterpret_cast<float*>(data.data())[i] = 4.0f * value; break;
+          case Image::Short: reinterpret_cast<uint16_t*>(data.data())[i] = uint16_t(value * 65535.0f); break;
+          case Image::Byte: data[i] = uint8_t(value * 255.0f); break;
+        }
+      }
+    }
+  }
+  if (layers.empty()) {
+    return std::make_shared<Image>(width, height, channels, format, std::move(data));
+  }
+  return std::make_shared<Image>(width, height, format, std::move(data), std::move(layers));
+}
+
+// Layers as in a render with AOVs.
+std::shared_ptr<Image> layered(int width, int height)
+{
+  std::vector<Image::Layer> layers = { { "", 4, Image::Color, 0 }, { "diffuse", 3, Image::Color, 0 },
+    { "specular", 3, Image::Color, 0 }, { "normal", 3, Image::Normal, 0 }, { "depth", 1, Image::Depth, 0 } };
+  size_t offset = 0;
+  for (auto& layer : layers) {
+    layer.offset = offset;
+    offset += size_t(width) * size_t(height) * size_t(layer.channels) * sizeof(float);
+  }
+  return gradient(width, height, Image::Float, 4, std::move(layers));
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  QGuiApplication app(argc, argv);
+  QCoreApplication::setApplicationName("hdrv-render-bench");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Benchmarks texture uploads and frames of the hdrv image renderer.");
+  parser.addHelpOption();
+  bench::addOptions(parser);
+  parser.addOptions({
+    { "viewport", "Size of the framebuffer drawn into (default 1920x1080).", "WxH", "1920x1080" },
+    { "sizes", "Comma separated image sizes for the uploads (default 1024,4096).", "sizes", "1024,4096" },
+    { "frames", "Frames drawn for each frame time benchmark (default 120).", "n", "120" },
+  });
+  parser.process(app);
+
+  bench::Options options;
+  QSize viewport = parseSize(parser.value("viewport"));
+  bool ok = false;
+  int frameCount = parser.value("frames").toInt(&ok);
+  std::vector<int> sizes;
+  for (auto const& size : parser.value("sizes").split(',')) {
+    sizes.push_back(size.toInt());
+    ok = ok && sizes.back() > 0;
+  }
+  if (!bench::readOptions(parser, options) || !ok || frameCount <= 0 || viewport.isEmpty()) {
+    parser.showHelp(1);
+  }
+
+  // The shaders use `attribute` and `varying`, which need the compatibility profile.
+  QSurfaceFormat format;
+  format.setVersion(3, 3);
+  format.setProfile(QSurfaceFormat::CompatibilityProfile);
+  QOpenGLContext context;
+  context.setFormat(format);
+  QOffscreenSurface surface;
+  surface.setFormat(format);
+  surface.create();
+  if (!context.create() || !context.makeCurrent(&surface)) {
+    std::fprintf(stderr, "Could not create an OpenGL context.\n");
+    return 1;
+  }
+  auto gl = context.functions();
+  QOpenGLFramebufferObject framebuffer(viewport);
+  framebuffer.bind();
+
+  bench::Runner runner("hdrv-render-bench", options);
+  runner.setContext("renderer", reinterpret_cast<char const*>(gl->glGetString(GL_RENDERER)));
+  runner.setContext("version", reinterpret_cast<char const*>(gl->glGetString(GL_VERSION)));
+  runner.setContext("viewport", parser.value("viewport"));
+
+  ImageRenderer renderer;
+  renderer.init();
+  renderer.setRenderRegion({ QPoint(0, 0), viewport });
+  renderer.setClearColor(QColor(64, 64, 64));
+  ImageSettings settings{ QVector2D(0.0f, 0.0f), 1.0f, 0.0f, 2.2f, ImageDocument::DisplayMode::Default };
+  renderer.setSettings(settings);
+
+  // Documents as the viewer has them for files, or for live images whose
+  // regions are updated in place. Only the textures of files are streamed.
+  // Documents compute statistics in the background, wait for that so it does
+  // not take time from the benchmarks.
+  auto document = [](std::shared_ptr<Image> const& image, bool live = false) {
+    auto result = std::make_unique<ImageDocument>("bench", image, nullptr, live);
+    QThreadPool::globalInstance()->waitForDone();
+    return result;
+  };
+  auto frame = [&](std::shared_ptr<Image> const& image, int layer) {
+    renderer.setCurrent(image, layer);
+    renderer.setSettings(settings);
+    renderer.paint();
+    gl->glFinish();
+    return gl->glGetError() == GL_NO_ERROR;
+  };
+  // Makes documents current with all their textures uploaded, frames of images
+  // still streamed would draw what stands in for them.
+  auto show = [&](std::vector<ImageDocument*> const& docs) {
+    renderer.setCurrent(docs.front()->image(), 0);
+    renderer.updateImages(docs);
+    while (renderer.uploading()) {
+      renderer.paint();
+    }
+    gl->glFinish();
+  };
+  uint64_t viewportPixels = uint64_t(viewport.width()) * uint64_t(viewport.height());
+
+  // Creating the textures of a new image, including their mip levels. Large
+  // images are streamed over several frames, as many as that takes are drawn.
+  for (int size : sizes) {
+    for (auto const& f : formats) {
+      QString name = QString("upload/%1/%2").arg(f.name).arg(size);
+      if (!runner.selected(name)) {
+        continue;
+      }
+      auto doc = document(gradient(size, size, f.format, f.channels));
+      auto const& image = *doc->image();
+      renderer.setCurrent(doc->image(), 0);
+      runner.run(name, image.sizeInBytes(), uint64_t(size) * uint64_t(size), [&] {
+        renderer.updateImages({ doc.get() });
+        while (renderer.uploading()) {
+          renderer.paint();
+        }
+        gl->glFinish();
+        return gl->glGetError() == GL_NO_ERROR;
+      }, [&] {
+        renderer.updateImages({});
+        gl->glFinish();
+      });
+      renderer.updateImages({});
+    }
+  }
+
+  int size = sizes.back();
+  auto doc = document(gradient(size, size, Image::Float, 3));
+  auto image = doc->image();
+  show({ doc.get() });
+
+  // Frames while a new image is streamed, the first one creates its textures.
+  // At least 2048 pixels wide, smaller images are uploaded at once.
+  if (runner.selected("frame/streaming")) {
+    std::fprintf(stderr, "frame/streaming\n");
+    bench::resetPeakRss();
+    int streamedSize = std::max(size, 2048);
+    auto streamed = document(gradient(streamedSize, streamedSize, Image::Float, 4));
+    std::vector<double> samples;
+    bool first = true;
+    bool uploading = false;
+    while (first || renderer.uploading()) {
+      auto start = std::chrono::steady_clock::now();
+      if (first) {
+        renderer.updateImages({ doc.get(), streamed.get() });
+        first = false;
+        uploading = renderer.uploading();
+      }
+      frame(streamed->image(), 0);
+      samples.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    if (uploading) {
+      runner.add("frame/streaming", 0, viewportPixels, samples);
+    } else {
+      runner.fail("frame/streaming", "the image was not streamed");
+    }
+    renderer.updateImages({ doc.get() });
+  }
+
+  // A tile of a live image written by a renderer, as streamed over IPC.
+  if (runner.selected("update/float3/tile256")) {
+    auto live = document(gradient(size, size, Image::Float, 3), true);
+    renderer.updateImages({ doc.get(), live.get() });
+    int tileSize = std::min(size, 256);
+    QRect tile((size - tileSize) / 2, (size - tileSize) / 2, tileSize, tileSize);
+    runner.run("update/float3/tile256", uint64_t(tile.width()) * tile.height() * 3 * sizeof(float),
+      uint64_t(tile.width()) * tile.height(), [&] {
+        live->updateRegion(tile);
+        renderer.updateImages({ doc.get(), live.get() });
+        gl->glFinish();
+        return gl->glGetError() == GL_NO_ERROR;
+      });
+    renderer.updateImages({ doc.get() });
+  }
+
+  // Panning at 100%, a full turn around the image center.
+  runner.runEach("frame/pan", 0, viewportPixels, frameCount, [&](int i) {
+    float angle = 6.2831853f * float(i) / float(frameCount);
+    settings.position = QVector2D(std::cos(angle), std::sin(angle)) * float(size) / 4.0f;
+    settings.scale = 1.0f;
+    return frame(image, 0);
+  });
+  // Zooming from the whole image minified to 8x magnified.
+  runner.runEach("frame/zoom", 0, viewportPixels, frameCount, [&](int i) {
+    float fit = float(std::min(viewport.width(), viewport.height())) / float(size);
+    settings.position = QVector2D(0.0f, 0.0f);
+    settings.scale = fit * std::pow(8.0f / fit, float(i) / float(std::max(frameCount - 1, 1)));
+    return frame(image, 0);
+  });
+  settings.scale = 1.0f;
+  settings.position = QVector2D(0.0f, 0.0f);
+
+  // Showing another layer of an image whose textures all exist.
+  auto layers = document(layered(size, size));
+  show({ doc.get(), layers.get() });
+  int layerCount = int(layers->image()->layers().size());
+  runner.runEach("frame/layers", 0, viewportPixels, frameCount,
+    [&](int i) { return frame(layers->image(), i % layerCount); });
+
+  // Comparison with a second image, difference with highlighted changes and
+  // side by side.
+  auto reference = document(gradient(size, size, Image::Float, 3));
+  show({ doc.get(), reference.get() });
+  ImageComparison comparison(reference->image());
+  for (int y = 0; y < 4; ++y) {
+    for (int x = 0; x < 8; ++x) {
+      comparison.changedRegions.push_back(QRect(x * size / 8, y * size / 4, size / 16, size / 8));
+    }
+  }
+  std::pair<char const*, ImageDocument::ComparisonMode> modes[] = {
+    { "difference", ImageDocument::ComparisonMode::Difference },
+    { "sideBySide", ImageDocument::ComparisonMode::SideBySide } };
+  for (auto const& [name, mode] : modes) {
+    comparison.mode = mode;
+    renderer.setComparison(comparison);
+    runner.runEach(QString("frame/compare/") + name, 0, viewportPixels, frameCount, [&](int i) {
+      comparison.separator = float(i) / float(frameCount);
+      renderer.setComparison(comparison);
+      return frame(image, 0);
+    });
+  }
+  renderer.setComparison(std::nullopt);
+  renderer.updateImages({});
+
+  framebuffer.release();
+  return runner.finish();
+}
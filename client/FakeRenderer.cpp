@@ -0,0 +1,97 @@
+// Stands in for a renderer streaming its progress to the viewer: renders a
+// noisy HDR test scene in tiles over several passes into a shared image and
+// reports each finished tile. Exercises the client library and shows how fast
+// the viewer takes updates.
+//
+//   hdrv-fake-renderer [width height [passes [tile size]]]
+
+#include <HdrvClient.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+namespace {
+
+// Sky gradient with a bright sun over a checkered ground, plus its depth.
+void shade(float u, float v, float out[3], float& depth)
+{
+  if (v < 0.55f) {
+    float sun = std::hypot(u - 0.7f, v - 0.2f) < 0.03f ? 50.0f : 0.0f;
+    out[0] = 0.3f + 0.4f * v + sun;
+    out[1] = 0.5f + 0.4f * v + sun;
+    out[2] = 1.0f + sun;
+    depth = 1000.0f;
+  } else {
+    depth = 0.5f / (v - 0.5f);
+    bool check = (int(std::floor((u - 0.5f) * depth * 4.0f)) + int(std::floor(depth))) % 2 == 0;
+    float light = check ? 0.8f : 0.2f;
+    out[0] = out[1] = out[2] = light;
+  }
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  int width = argc > 2 ? std::atoi(argv[1]) : 1280;
+  int height = argc > 2 ? std::atoi(argv[2]) : 720;
+  int passes = argc > 3 ? std::atoi(argv[3]) : 16;
+  int tile = argc > 4 ? std::atoi(argv[4]) : 64;
+  if (width <= 0 || height <= 0 || passes <= 0 || tile <= 0) {
+    std::fprintf(stderr, "usage: %s [width height [passes [tile size]]]\n", argv[0]);
+    return 2;
+  }
+
+  hdrv::client::Connection viewer;
+  if (!viewer.open()) {
+    std::fprintf(stderr, "%s\n", viewer.error().c_str());
+    return 1;
+  }
+  auto image = viewer.createImage("fake render", width, height,
+    { { "", 3, hdrv::client::Display::Color }, { "Z", 1, hdrv::client::Display::Depth } });
+  if (!image) {
+    std::fprintf(stderr, "%s\n", viewer.error().c_str());
+    return 1;
+  }
+
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> jitter(0.0f, 1.0f);
+  auto start = std::chrono::steady_clock::now();
+  long long updates = 0;
+  for (int pass = 0; pass < passes; ++pass) {
+    for (int ty = 0; ty < height; ty += tile) {
+      for (int tx = 0; tx < width; tx += tile) {
+        int tw = std::min(tile, width - tx);
+        int th = std::min(tile, height - ty);
+        for (int y = ty; y < ty + th; ++y) {
+          for (int x = tx; x < tx + tw; ++x) {
+            // One jittered sample per pass, averaged with the previous ones.
+            float sample[3];
+            float depth;
+            shade((x + jitter(random)) / width, (y + jitter(random)) / height, sample, depth);
+            float* color = image->pixel(x, y, 0);
+            for (int c = 0; c < 3; ++c) {
+              color[c] += (sample[c] - color[c]) / float(pass + 1);
+            }
+            *image->pixel(x, y, 1) = depth;
+          }
+        }
+        if (!viewer.update(*image, tx, ty, tw, th)) {
+          std::fprintf(stderr, "%s\n", viewer.error().c_str());
+          return 1;
+        }
+        ++updates;
+      }
+    }
+  }
+  viewer.closeImage(*image);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double megabytes = double(width) * height * 4 * sizeof(float) * passes / (1 << 20);
+  std::printf("%lld updates in %.2f s: %.0f updates/s, %.1f MB/s of pixels\n",
+    updates, seconds, updates / seconds, megabytes / seconds);
+  return 0;
+}
@@ -0,0 +1,295 @@
+#include <HdrvClient.hpp>
+
+#include <view/IPCProtocol.hpp>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace hdrv::client {
+
+namespace {
+
+// Where QLocalServer puts the socket of a name on Unix.
+std::string socketPath(std::string const& server)
+{
+  if (!server.empty() && server[0] == '/') {
+    return server;
+  }
+  char const* tmp = std::getenv("TMPDIR");
+  std::string directory = tmp && *tmp ? tmp : "/tmp";
+  while (directory.size() > 1 && directory.back() == '/') {
+    directory.pop_back();
+  }
+  return directory + "/" + server;
+}
+
+void writeLayers(ipc::MessageWriter& message, std::vector<Layer> const& layers)
+{
+  message.write(uint32_t(layers.size()));
+  for (auto const& layer : layers) {
+    message.write(layer.name).write(uint32_t(layer.channels)).write(uint32_t(layer.display));
+  }
+}
+
+#ifdef MSG_NOSIGNAL
+constexpr int sendFlags = MSG_NOSIGNAL; // a closed viewer is an error, not SIGPIPE
+#else
+constexpr int sendFlags = 0;
+#endif
+
+}
+
+SharedImage::~SharedImage()
+{
+  if (memory_) {
+    munmap(memory_, size_);
+  }
+}
+
+Connection::~Connection()
+{
+  close();
+}
+
+bool Connection::open(std::string const& server)
+{
+  close();
+  std::string path = socketPath(server);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    return fail("Socket path too long: " + path);
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (socket_ < 0 || connect(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+    close();
+    return fail("No viewer listening at " + path);
+  }
+  std::vector<uint8_t> hello(ipc::magic, ipc::magic + sizeof(ipc::magic));
+  auto version = reinterpret_cast<uint8_t const*>(&ipc::version);
+  hello.insert(hello.end(), version, version + sizeof(ipc::version));
+  if (!send(hello) || !receiveReply()) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void Connection::close()
+{
+  if (socket_ >= 0) {
+    ::close(socket_);
+    socket_ = -1;
+  }
+}
+
+std::unique_ptr<SharedImage> Connection::createImage(std::string const& name, int width, int height,
+  std::vector<Layer> const& layers)
+{
+  if (width <= 0 || height <= 0 || layers.empty()) {
+    fail("Image is empty.");
+    return nullptr;
+  }
+  std::unique_ptr<SharedImage> image(new SharedImage);
+  image->id_ = nextId_++;
+  image->width_ = width;
+  image->height_ = height;
+  image->layers_ = layers;
+  size_t floats = 0;
+  for (auto const& layer : layers) {
+    floats += size_t(width) * height * layer.channels;
+  }
+  image->size_ = floats * sizeof(float);
+
+  // Unlinked as soon as the viewer mapped it, so nothing is left behind when
+  // either process dies.
+  std::string memory = "/hdrv-" + std::to_string(getpid()) + "-" + std::to_string(image->id_);
+  int fd = shm_open(memory.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    fail("Could not create shared memory " + memory + ": " + std::strerror(errno));
+    return nullptr;
+  }
+  void* mapped = MAP_FAILED;
+  if (ftruncate(fd, off_t(image->size_)) == 0) {
+    mapped = mmap(nullptr, image->size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    shm_unlink(memory.c_str());
+    fail("Could not map shared memory " + memory + ": " + std::strerror(errno));
+    return nullptr;
+  }
+  image->memory_ = mapped;
+  float* pixels = static_cast<float*>(mapped);
+  for (auto const& layer : layers) {
+    image->layer_.push_back(pixels);
+    pixels += size_t(width) * height * layer.channels;
+  }
+
+  ipc::MessageWriter message(ipc::MessageType::CreateSharedImage);
+  message.write(image->id_).write(int32_t(width)).write(int32_t(height)).write(uint32_t(2)); // Image::Float
+  message.write(name).write(memory);
+  writeLayers(message, layers);
+  bool created = send(message.finish()) && receiveReply();
+  shm_unlink(memory.c_str());
+  return created ? std::move(image) : nullptr;
+}
+
+bool Connection::update(SharedImage const& image, int x, int y, int width, int height)
+{
+  ipc::MessageWriter message(ipc::MessageType::UpdateRegion);
+  message.write(image.id_).write(int32_t(x)).write(int32_t(y)).write(int32_t(width)).write(int32_t(height));
+  return send(message.finish());
+}
+
+std::unique_ptr<ViewerImage> Connection::createTiledImage(std::string const& name, int width, int height,
+  std::vector<Layer> const& layers)
+{
+  if (width <= 0 || height <= 0 || layers.empty()) {
+    fail("Image is empty.");
+    return nullptr;
+  }
+  std::unique_ptr<ViewerImage> image(new ViewerImage);
+  image->id_ = nextId_++;
+  image->width_ = width;
+  image->height_ = height;
+  image->layers_ = layers;
+  ipc::MessageWriter message(ipc::MessageType::CreateImage);
+  message.write(image->id_).write(int32_t(width)).write(int32_t(height)).write(name);
+  writeLayers(message, layers);
+  return send(message.finish()) && receiveReply() ? std::move(image) : nullptr;
+}
+
+bool Connection::sendTile(ViewerImage const& image, int x, int y, int width, int height, void const* pixels,
+  PixelType type, int layer, int firstChannel, int channels)
+{
+  if (layer < 0 || layer >= int(image.layers_.size())) {
+    return fail("No such layer.");
+  }
+  channels = channels < 0 ? image.layers_[layer].channels - firstChannel : channels;
+  size_t size = size_t(width) * height * channels * (type == PixelType::Half ? sizeof(uint16_t) : sizeof(float));
+  if (width <= 0 || height <= 0 || channels <= 0 || size > ipc::maxMessageSize - 64) {
+    return fail("Invalid tile size.");
+  }
+  ipc::MessageWriter message(ipc::MessageType::Tile);
+  message.write(image.id_).write(int32_t(x)).write(int32_t(y)).write(int32_t(width)).write(int32_t(height));
+  message.write(uint32_t(layer)).write(uint32_t(firstChannel)).write(uint32_t(channels)).write(uint32_t(type));
+  return send(message.finish(size), pixels, size);
+}
+
+bool Connection::sync()
+{
+  return send(ipc::MessageWriter(ipc::MessageType::Sync).finish()) && receiveReply();
+}
+
+bool Connection::closeImage(ViewerImage const& image)
+{
+  ipc::MessageWriter message(ipc::MessageType::CloseImage);
+  message.write(image.id_);
+  return send(message.finish());
+}
+
+bool Connection::query(std::string const& request, std::string& result, std::vector<uint8_t>* data)
+{
+  ipc::MessageWriter message(ipc::MessageType::Query);
+  message.write(request);
+  return send(message.finish()) && receiveReply(&result, data);
+}
+
+bool Connection::stats(std::string& result)
+{
+  return send(ipc::MessageWriter(ipc::MessageType::Stats).finish()) && receiveReply(&result);
+}
+
+bool Connection::send(std::vector<uint8_t> const& data, void const* trailing, size_t trailingSize)
+{
+  if (socket_ < 0) {
+    return fail("Not connected.");
+  }
+  // Message and trailing pixels go out in one call, without joining them first.
+  iovec parts[2] = { { const_cast<uint8_t*>(data.data()), data.size() }, { const_cast<void*>(trailing), trailingSize } };
+  msghdr message{};
+  message.msg_iov = parts;
+  message.msg_iovlen = trailingSize > 0 ? 2 : 1;
+  while (message.msg_iovlen > 0) {
+    auto n = sendmsg(socket_, &message, sendFlags);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      close();
+      return fail("Connection to the viewer lost.");
+    }
+    // Skips what was sent, a part may have gone out partially.
+    while (message.msg_iovlen > 0 && size_t(n) >= message.msg_iov->iov_len) {
+      n -= message.msg_iov->iov_len;
+      ++message.msg_iov;
+      --message.msg_iovlen;
+    }
+    if (message.msg_iovlen > 0) {
+      message.msg_iov->iov_base = static_cast<uint8_t*>(message.msg_iov->iov_base) + n;
+      message.msg_iov->iov_len -= size_t(n);
+    }
+  }
+  return true;
+}
+
+bool Connection::receiveReply(std::string* result, std::vector<uint8_t>* data)
+{
+  auto receive = [this](void* data, size_t size) {
+    auto p = static_cast<uint8_t*>(data);
+    while (size > 0) {
+      auto n = recv(socket_, p, size, 0);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      p += n;
+      size -= size_t(n);
+    }
+    return true;
+  };
+  ipc::MessageHeader header;
+  std::vector<uint8_t> payload;
+  if (receive(&header, sizeof(header)) && header.type == ipc::MessageType::Reply && header.size <= ipc::maxMessageSize) {
+    payload.resize(header.size);
+    if (receive(payload.data(), payload.size())) {
+      ipc::MessageReader reader(payload.data(), payload.size());
+      auto status = reader.read<int32_t>();
+      auto error = reader.readString();
+      if (status == 0 && result) {
+        *result = reader.readString();
+        auto size = reader.remaining();
+        auto bytes = reader.readBytes(size);
+        if (data) {
+          data->assign(bytes, bytes + size);
+        }
+      }
+      if (!reader.ok()) {
+        return fail("Malformed reply from the viewer.");
+      }
+      return status == 0 ? true : fail(error);
+    }
+  }
+  close();
+  return fail("Connection to the viewer lost.");
+}
+
+bool Connection::fail(std::string const& error)
+{
+  error_ = error;
+  return false;
+}
+
+}
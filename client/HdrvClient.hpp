@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Client library for streaming images into a running hdrv viewer, eg. the
+// progress of a renderer. Images live in POSIX shared memory: the client writes
+// pixels and tells the viewer which region changed, the viewer uploads just
+// that region from the shared memory. Does not depend on Qt.
+//
+//   hdrv::client::Connection viewer;
+//   if (viewer.open()) {
+//     auto image = viewer.createImage("render", 1920, 1080, { { "", 4 } });
+//     // write to image->pixel(x, y), then
+//     viewer.update(*image, x, y, width, height);
+//   }
+//
+// Clients that cannot share memory send tiles of pixels instead, see
+// createTiledImage().
+
+namespace hdrv::client {
+
+// How the viewer shows a layer, matches Image::Display.
+enum class Display : uint32_t { Color, Luminance, Depth, Normal };
+
+struct Layer
+{
+  std::string name;
+  int channels = 4; // 1 to 4
+  Display display = Display::Color;
+};
+
+// An image opened in the viewer by a Connection.
+class ViewerImage
+{
+public:
+  virtual ~ViewerImage() = default;
+  ViewerImage(ViewerImage const&) = delete;
+  ViewerImage& operator=(ViewerImage const&) = delete;
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int channels(int layer = 0) const { return layers_[layer].channels; }
+  std::vector<Layer> const& layers() const { return layers_; }
+
+protected:
+  friend class Connection;
+  ViewerImage() = default;
+
+  uint32_t id_ = 0;
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<Layer> layers_;
+};
+
+// 32 bit float pixels shared with the viewer. Layers follow each other, rows
+// run from top to bottom with interleaved channels.
+class SharedImage : public ViewerImage
+{
+public:
+  ~SharedImage() override;
+
+  float* pixel(int x, int y, int layer = 0) { return layer_[layer] + (size_t(y) * width_ + x) * layers_[layer].channels; }
+
+private:
+  friend class Connection;
+  SharedImage() = default;
+
+  std::vector<float*> layer_;
+  void* memory_ = nullptr;
+  size_t size_ = 0;
+};
+
+enum class PixelType : uint32_t { Float, Half };
+
+class Connection
+{
+public:
+  Connection() = default;
+  ~Connection();
+  Connection(Connection const&) = delete;
+  Connection& operator=(Connection const&) = delete;
+
+  // Connects to the viewer listening on `server` (the socket name, or a path
+  // starting with '/'). False if no viewer is running.
+  bool open(std::string const& server = "hdrv");
+  bool isOpen() const { return socket_ >= 0; }
+  void close();
+
+  // Description of the last failure.
+  std::string const& error() const { return error_; }
+
+  // Creates an image cleared to zero and opens it in the viewer. Null on failure.
+  std::unique_ptr<SharedImage> createImage(std::string const& name, int width, int height,
+    std::vector<Layer> const& layers);
+  // Tells the viewer the pixels of all layers in a region were written. Does
+  // not wait for the viewer, updates faster than it draws are merged.
+  bool update(SharedImage const& image, int x, int y, int width, int height);
+
+  // For clients without shared memory: creates an image held by the viewer,
+  // whose pixels are sent with sendTile(). Null on failure.
+  std::unique_ptr<ViewerImage> createTiledImage(std::string const& name, int width, int height,
+    std::vector<Layer> const& layers);
+  // Sends pixels of `channels` channels of a layer starting at `firstChannel`,
+  // rows from top to bottom. `pixels` points to 32 bit floats, or 16 bit half
+  // floats (as uint16_t) for PixelType::Half. Does not wait for the viewer.
+  bool sendTile(ViewerImage const& image, int x, int y, int width, int height, void const* pixels,
+    PixelType type = PixelType::Float, int layer = 0, int firstChannel = 0, int channels = -1);
+
+  // Waits until the viewer handled everything sent before.
+  bool sync();
+  // The viewer keeps showing the image, but no longer expects updates.
+  bool closeImage(ViewerImage const& image);
+
+  // Asks a viewer started with --headless about an image file, eg.
+  // {"command": "statistics", "path": "/renders/a.exr", "region": [0, 0, 64, 64]}.
+  // Requests and results are JSON, see viewer/model/ImageQueries.hpp. Pixels
+  // asked for as "binary" arrive in `data` as 32 bit floats.
+  bool query(std::string const& request, std::string& result, std::vector<uint8_t>* data = nullptr);
+  // Performance counters and histograms of the viewer as JSON, see viewer/image/Metrics.hpp.
+  bool stats(std::string& result);
+
+private:
+  bool send(std::vector<uint8_t> const& data, void const* trailing = nullptr, size_t trailingSize = 0);
+  // Waits for the answer to a request. Queries also receive a result and data.
+  bool receiveReply(std::string* result = nullptr, std::vector<uint8_t>* data = nullptr);
+  bool fail(std::string const& error);
+
+  int socket_ = -1;
+  uint32_t nextId_ = 1;
+  std::string error_;
+};
+
+}
@@ -0,0 +1,109 @@
+// Measures how many tiles per second the viewer absorbs: streams tiles into an
+// image held by the viewer as fast as the socket takes them and waits for the
+// viewer to catch up at the end. Also reports how long the viewer takes to
+// answer in between, which grows if it falls behind.
+//
+//   hdrv-load-generator [seconds [tile size [float|half [width height]]]]
+
+#include <HdrvClient.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Finite, positive and normal values only.
+uint16_t toHalf(float value)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+  exponent = std::clamp(exponent, 1, 30);
+  return uint16_t((exponent << 10) | ((bits >> 13) & 0x3ff));
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  double duration = argc > 1 ? std::atof(argv[1]) : 5.0;
+  int tile = argc > 2 ? std::atoi(argv[2]) : 64;
+  bool half = argc > 3 && std::strcmp(argv[3], "half") == 0;
+  int width = argc > 5 ? std::atoi(argv[4]) : 2048;
+  int height = argc > 5 ? std::atoi(argv[5]) : 2048;
+  if (duration <= 0.0 || tile <= 0 || width < tile || height < tile) {
+    std::fprintf(stderr, "usage: %s [seconds [tile size [float|half [width height]]]]\n", argv[0]);
+    return 2;
+  }
+
+  hdrv::client::Connection viewer;
+  if (!viewer.open()) {
+    std::fprintf(stderr, "%s\n", viewer.error().c_str());
+    return 1;
+  }
+  auto image = viewer.createTiledImage("load generator", width, height, { { "", 4 } });
+  if (!image) {
+    std::fprintf(stderr, "%s\n", viewer.error().c_str());
+    return 1;
+  }
+
+  // A few differently colored tiles, so the updates are visible.
+  constexpr int variants = 8;
+  size_t values = size_t(tile) * tile * 4;
+  std::vector<std::vector<float>> floats(variants, std::vector<float>(values));
+  std::vector<std::vector<uint16_t>> halves(variants, std::vector<uint16_t>(values));
+  for (int v = 0; v < variants; ++v) {
+    for (size_t i = 0; i < values; ++i) {
+      float value = i % 4 == 3 ? 1.0f : std::exp2(float((v + int(i % 4)) % variants) - 3.0f);
+      floats[v][i] = value;
+      halves[v][i] = toHalf(value);
+    }
+  }
+
+  std::mt19937 random(1);
+  int columns = width / tile;
+  int rows = height / tile;
+  auto start = Clock::now();
+  long long tiles = 0;
+  double maxSync = 0.0;
+  while (secondsSince(start) < duration) {
+    for (int i = 0; i < 256; ++i, ++tiles) {
+      int x = int(random() % columns) * tile;
+      int y = int(random() % rows) * tile;
+      int v = int(random() % variants);
+      void const* pixels = half ? static_cast<void const*>(halves[v].data()) : floats[v].data();
+      auto type = half ? hdrv::client::PixelType::Half : hdrv::client::PixelType::Float;
+      if (!viewer.sendTile(*image, x, y, tile, tile, pixels, type)) {
+        std::fprintf(stderr, "%s\n", viewer.error().c_str());
+        return 1;
+      }
+    }
+    auto before = Clock::now();
+    if (!viewer.sync()) {
+      std::fprintf(stderr, "%s\n", viewer.error().c_str());
+      return 1;
+    }
+    maxSync = std::max(maxSync, secondsSince(before));
+  }
+  double seconds = secondsSince(start);
+  viewer.closeImage(*image);
+
+  double megabytes = double(tiles) * values * (half ? 2 : 4) / (1 << 20);
+  std::printf("%lld %dx%d %s tiles in %.2f s: %.0f tiles/s, %.1f MB/s, %.1f Mpixels/s, slowest sync %.1f ms\n",
+    tiles, tile, tile, half ? "half" : "float", seconds, tiles / seconds, megabytes / seconds,
+    double(tiles) * tile * tile / seconds / 1e6, maxSync * 1000.0);
+  return 0;
+}
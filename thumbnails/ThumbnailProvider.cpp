@@ -2,8 +2,8 @@
 #include "Thumbnails.hpp"
 
 #include <image/Image.hpp>
+#include <image/Thumbnail.hpp>
 #include <sstream>
-#include <math.h>
 #include <algorithm>
 #include <cstdlib>
 
@@ -139,19 +139,9 @@ IFACEMETHODIMP ThumbnailProvider::GetThumbnail(UINT cx, HBITMAP* phbmp,
     OutputDebugStringA(err.c_str());
     return E_FAIL;
   }
-  auto pic = std::move(img).value();
-  streamBuffer = {};
-
   // Downscale image to desired maximum resolution cx
-  int maxIterations = 16;
-  while ((uint32_t)pic.width() > cx || (uint32_t)pic.height() > cx) {
-    if (--maxIterations == 0) {
-      OutputDebugStringA("hdrv.thumbnail error: too many iterations");
-      return E_FAIL;
-    }
-
-    pic = pic.scaleByHalf().value();
-  }
+  auto pic = hdrv::reduceToSize(img.value(), int(cx));
+  streamBuffer = {};
 
   // Put everything into a bitmap
   uint32_t nWidth = pic.width(), nHeight = pic.height();
@@ -170,30 +160,13 @@ IFACEMETHODIMP ThumbnailProvider::GetThumbnail(UINT cx, HBITMAP* phbmp,
     *phbmp = hbmp;
     *pdwAlpha = (pic.channels() > 3) ? WTSAT_ARGB : WTSAT_RGB;
 
-    // Simple gamma correction, clamping and 8 bit conversion
-    // (will break on negative input, e.g. normal maps)
-    auto gamma = [](float in)->uint8_t {
-      return (uint8_t)std::min(powf(in, 1.f / 2.2f) * 255.f, 255.f);
-    };
-
-    for (uint32_t x = 0; x < nWidth; ++x) {
-      for (uint32_t y = 0; y < nHeight; ++y)
-      {
-        const int pixelstride = 4;
-        const int linestride = pixelstride * nWidth;
-
-        uint8_t r = 0, g = 0, b = 0, a = 255;
-
-        r = g = b = gamma(pic.value(x, y, 0));
-        if (pic.channels() > 1) g = gamma(pic.value(x, y, 1));
-        if (pic.channels() > 2) b = gamma(pic.value(x, y, 2));
-        if (pic.channels() > 3) a = gamma(pic.value(x, y, 3));
-
-        pBits[linestride * y + pixelstride * x + 0] = b;
-        pBits[linestride * y + pixelstride * x + 1] = g;
-        pBits[linestride * y + pixelstride * x + 2] = r;
-        pBits[linestride * y + pixelstride * x + 3] = a;
-      }
+    // Same tone mapping as the Linux thumbnailer, swizzled to BGRA
+    auto pixels = hdrv::thumbnailPixels(pic);
+    for (size_t i = 0; i < pixels.size(); i += 4) {
+      pBits[i + 0] = pixels[i + 2];
+      pBits[i + 1] = pixels[i + 1];
+      pBits[i + 2] = pixels[i + 0];
+      pBits[i + 3] = pixels[i + 3];
     }
   }
   return hr;
@@ -0,0 +1,61 @@
+// Thumbnailer for Linux file browsers, following the freedesktop.org
+// thumbnail specification: hdrv-thumbnailer -s <size> <input> <output.png>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QImage>
+
+#include <image/PreviewCache.hpp>
+#include <image/Thumbnail.hpp>
+
+#include <cstdio>
+
+int main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("hdrv-thumbnailer");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Writes PNG thumbnails of HDR images (EXR, Radiance PIC/HDR, PFM).");
+  parser.addHelpOption();
+  QCommandLineOption sizeOption({ "s", "size" }, "Maximum width and height of the thumbnail.", "pixels", "256");
+  parser.addOption(sizeOption);
+  parser.addPositionalArgument("input", "Image file to create a thumbnail for.");
+  parser.addPositionalArgument("output", "PNG file to write.");
+  parser.process(app);
+
+  auto arguments = parser.positionalArguments();
+  bool ok = false;
+  int size = parser.value(sizeOption).toInt(&ok);
+  if (arguments.size() != 2 || !ok || size <= 0) {
+    parser.showHelp(1);
+  }
+  QString input = arguments[0];
+  QString output = arguments[1];
+
+  // Files opened in the viewer before come from the preview cache. Thumbnails
+  // are not added to it: a reduced read does not tell the size of the image,
+  // which the cache needs to know whether its levels cover a request.
+  std::string path = QFile::encodeName(input).toStdString();
+  auto cached = hdrv::PreviewCache::shared().find(path);
+  hdrv::Image const* level = cached ? cached->level(size) : nullptr;
+  auto loaded = level ? hdrv::Result<hdrv::Image>(hdrv::reduceToSize(*level, size)) : hdrv::loadThumbnail(path, size);
+  if (!loaded) {
+    std::fprintf(stderr, "%s: %s\n", qPrintable(input), loaded.error().c_str());
+    return 1;
+  }
+  auto const& image = loaded.value();
+  auto pixels = hdrv::thumbnailPixels(image);
+  QImage thumbnail(pixels.data(), image.width(), image.height(), image.width() * 4, QImage::Format_RGBA8888);
+  if (image.channels() < 4) {
+    thumbnail = thumbnail.convertToFormat(QImage::Format_RGB888);
+  }
+  // File browsers add Thumb::URI and Thumb::MTime themselves.
+  thumbnail.setText("Software", "hdrv-thumbnailer");
+  if (!thumbnail.save(output, "PNG")) {
+    std::fprintf(stderr, "Could not write %s\n", qPrintable(output));
+    return 1;
+  }
+  return 0;
+}
@@ -1,9 +1,13 @@
+#include <QCoreApplication>
 #include <QGuiApplication>
 #include <QQmlComponent>
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
 #include <QQmlProperty>
 
+#include <cli/Commands.hpp>
+#include <image/Metrics.hpp>
+#include <image/Trace.hpp>
 #include <model/ImageDocument.hpp>
 #include <model/ImageCollection.hpp>
 #include <model/Settings.hpp>
@@ -11,8 +15,65 @@
 #include <view/IPCServer.hpp>
 #include <view/IPCClient.hpp>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
 using namespace hdrv;
 
+// The executable uses the GUI subsystem on Windows, command line modes print to
+// the console they were started from.
+void attachConsole()
+{
+#ifdef _WIN32
+  if (AttachConsole(ATTACH_PARENT_PROCESS)) {
+    std::freopen("CONOUT$", "w", stdout);
+    std::freopen("CONOUT$", "w", stderr);
+  }
+#endif
+}
+
+// `--trace=<file>` anywhere on the command line, or HDRV_TRACE=<file>, records
+// a timeline (see image/Trace.hpp). The option is removed from the arguments.
+void startTrace(int& argc, char* argv[])
+{
+  std::string path = qEnvironmentVariable("HDRV_TRACE").toStdString();
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--trace=", 8) == 0) {
+      path = argv[i] + 8;
+      std::copy(argv + i + 1, argv + argc, argv + i);
+      argv[--argc] = nullptr;
+      break;
+    }
+  }
+  if (!path.empty()) {
+#ifdef HDRV_TRACING
+    trace::start(path);
+#else
+    std::fprintf(stderr, "Tracing was disabled at compile time (HDRV_TRACING).\n");
+#endif
+  }
+}
+
+// Metrics (see image/Metrics.hpp) go to the file named by HDRV_METRICS on exit,
+// a timeline to the one given to startTrace().
+int writeDiagnostics(int exitCode)
+{
+  auto path = qEnvironmentVariable("HDRV_METRICS");
+  if (!path.isEmpty() && !metrics::writeJson(path.toStdString())) {
+    std::fprintf(stderr, "Could not write metrics to %s\n", qPrintable(path));
+  }
+  if (trace::isEnabled() && !trace::stop()) {
+    std::fprintf(stderr, "Could not write the trace.\n");
+  }
+  return exitCode;
+}
+
 void moveToForeground()
 {
   QWindowList l = QGuiApplication::allWindows();
@@ -27,6 +88,24 @@ void moveToForeground()
 
 int main(int argc, char * argv[])
 {
+  startTrace(argc, argv);
+  if (argc > 1 && std::strcmp(argv[1], "diff") == 0) {
+    attachConsole();
+    QCoreApplication app(argc, argv);
+    return writeDiagnostics(runDiff(app.arguments().mid(2)));
+  }
+  if (argc > 1 && std::strcmp(argv[1], "convert") == 0) {
+    attachConsole();
+    QCoreApplication app(argc, argv);
+    return writeDiagnostics(runConvert(app.arguments().mid(2)));
+  }
+  if (argc > 1 && std::strcmp(argv[1], "--headless") == 0) {
+    attachConsole();
+    // QImage decodes without a GUI application, so this runs on machines without a display.
+    QCoreApplication app(argc, argv);
+    return writeDiagnostics(runHeadless(app.arguments().mid(2)));
+  }
+
   QGuiApplication app(argc, argv);
   qmlRegisterType<ImageDocument>("Hdrv", 1, 0, "ImageDocument");
   qmlRegisterType<ImageCollection>("Hdrv", 1, 0, "ImageCollection");
@@ -49,18 +128,24 @@ int main(int argc, char * argv[])
 
   QObject::connect(&server, SIGNAL(openFile(QUrl const &)), &images, SLOT(load(QUrl const &)));
   QObject::connect(&server, &IPCServer::openFile, &moveToForeground);
+  QObject::connect(&server, &IPCServer::openDocument, &images, [&images](ImageDocument * document) {
+    document->setParent(&images);
+    images.add(document);
+  });
+
+  QObject::connect(&server, &IPCServer::openFiles, &images, qOverload<QList<QUrl> const&>(&ImageCollection::load));
+  QObject::connect(&server, &IPCServer::openFiles, &moveToForeground);
 
-  bool fileOpened = false;
+  // All files go to a running instance over one connection, or are opened here.
+  QList<QUrl> urls;
   for (int i = 1; i < app.arguments().count(); ++i) {
-    auto url = QUrl::fromLocalFile(app.arguments()[i]);
-    if (!client.remoteOpenFile(url)) {
-      images.load(url);
-      fileOpened = true;
-    }
+    urls.push_back(QUrl::fromLocalFile(app.arguments()[i]));
   }
-
-  if (app.arguments().count() > 1 && !fileOpened) {
-    return 0;
+  if (!urls.empty()) {
+    if (client.remoteOpenFiles(urls)) {
+      return 0;
+    }
+    images.load(urls);
   }
 
   if (settings.singleInstance() && !client.isServerAvailable()) {
@@ -69,5 +154,5 @@ int main(int argc, char * argv[])
 
   engine.load(QUrl("qrc:/hdrv/view/Main.qml"));
 
-  return app.exec();
+  return writeDiagnostics(app.exec());
 }
@@ -0,0 +1,16 @@
+#include <cli/Commands.hpp>
+
+#include <QImageReader>
+
+namespace hdrv {
+
+QStringList imageNameFilters()
+{
+  QStringList filters = { "*.hdr", "*.pic", "*.pfm", "*.ppm", "*.exr" };
+  for (auto const& format : QImageReader::supportedImageFormats()) {
+    filters.push_back("*." + QString::fromLatin1(format));
+  }
+  return filters;
+}
+
+}
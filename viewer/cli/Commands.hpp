@@ -0,0 +1,26 @@
+#pragma once
+
+#include <QStringList>
+
+namespace hdrv {
+
+// Command line modes of hdrv. They run without a window, arguments exclude the
+// program name and the command.
+
+enum ExitCode { ExitSuccess = 0, ExitThresholdExceeded = 1, ExitError = 2 };
+
+// `hdrv diff [options] <a> <b>` compares two images or all images with
+// matching names in two directories.
+int runDiff(QStringList const& arguments);
+
+// `hdrv convert [options] <inputs...>` converts images between formats.
+int runConvert(QStringList const& arguments);
+
+// `hdrv --headless [options]` answers queries about image files on the local
+// socket until a client sends "exit".
+int runHeadless(QStringList const& arguments);
+
+// Wildcards of all file types that can be loaded.
+QStringList imageNameFilters();
+
+}
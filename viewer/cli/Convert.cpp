@@ -0,0 +1,344 @@
+#include <cli/Commands.hpp>
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSemaphore>
+#include <QTemporaryFile>
+#include <QThread>
+#include <QThreadPool>
+
+#include <image/Exposure.hpp>
+#include <image/Image.hpp>
+#include <image/Scanlines.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <type_traits>
+
+namespace hdrv {
+
+namespace {
+
+struct ConvertOptions
+{
+  QString layer; // name or index, all layers if empty
+  int downscale = 0; // number of halvings
+  int maxSize = 0;
+  float exposure = 0.0f; // stops
+  bool autoExposure = false;
+  float gamma = 2.2f;
+  EXROptions exr;
+};
+
+struct Job
+{
+  QString input;
+  QString output;
+  bool stream = false; // convert row by row
+};
+
+int findLayer(Image const& image, QString const& layer)
+{
+  auto const& layers = image.layers();
+  for (int i = 0; i < int(layers.size()); ++i) {
+    if (layer == QString::fromStdString(layers[i].name)) {
+      return i;
+    }
+  }
+  bool ok = false;
+  int index = layer.toInt(&ok);
+  return ok && index >= 0 && index < std::max(1, int(layers.size())) ? index : -1;
+}
+
+// A file of its own next to the target, keeping the suffix that selects the
+// format. Empty if it could not be created.
+QString temporaryPath(QString const& path)
+{
+  QFileInfo file(path);
+  QTemporaryFile temp(file.dir().filePath("." + file.completeBaseName() + ".XXXXXX.hdrv-export." + file.suffix()));
+  temp.setAutoRemove(false);
+  return temp.open() ? temp.fileName() : QString();
+}
+
+// Outputs are written next to the target and renamed, a failed or interrupted
+// conversion never leaves a truncated file under the final name. Replaces the
+// target in one step, unlike QFile::rename.
+QString replaceOutput(QString const& tempPath, QString const& output)
+{
+  std::error_code error;
+  std::filesystem::rename(std::filesystem::u8path(tempPath.toStdString()),
+    std::filesystem::u8path(output.toStdString()), error);
+  if (error) {
+    QFile::remove(tempPath);
+    return "Could not replace " + output + ": " + QString::fromStdString(error.message());
+  }
+  return {};
+}
+
+bool isFloatFormat(QString const& path)
+{
+  static QStringList const extensions = { "hdr", "pic", "pfm", "ppm", "exr" };
+  return extensions.contains(QFileInfo(path).suffix().toLower());
+}
+
+QByteArray readFile(QString const& path)
+{
+  QFile file(path);
+  return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+// Converts without holding the image in memory. Returns nothing if the file
+// must be loaded as a whole instead, eg. tiled EXR files or layers selected by index.
+std::optional<QString> convertStreaming(Job const& job, ConvertOptions const& options)
+{
+  QString tempPath = temporaryPath(job.output);
+  if (tempPath.isEmpty()) {
+    return "Could not create a file next to " + job.output;
+  }
+  auto streamed = streamImage(job.input.toStdString(), tempPath.toStdString(), options.layer.toStdString(), options.exr);
+  if (!streamed) {
+    QFile::remove(tempPath);
+    return std::nullopt;
+  }
+  return replaceOutput(tempPath, job.output);
+}
+
+// Decode, transform, encode and write of one file. Returns an error message, empty on success.
+QString convert(Job const& job, QByteArray const& bytes, ConvertOptions const& options)
+{
+  auto extension = QFileInfo(job.input).suffix().toLower().toStdString();
+  auto loaded = Image::load(reinterpret_cast<std::byte const*>(bytes.constData()), size_t(bytes.size()), extension);
+  if (!loaded) {
+    return "Failed to load: " + QString::fromStdString(loaded.error());
+  }
+  Image image = std::move(loaded).value();
+
+  if (!options.layer.isEmpty()) {
+    int layer = findLayer(image, options.layer);
+    if (layer < 0) {
+      return "No layer '" + options.layer + "'";
+    }
+    image = image.layerImage(layer);
+  }
+
+  int halvings = options.downscale;
+  if (options.maxSize > 0) {
+    for (int size = std::max(image.width(), image.height()) >> halvings; size > options.maxSize; size >>= 1) {
+      ++halvings;
+    }
+  }
+  if (halvings > 0 && image.layers().size() > 1) {
+    return "Resizing an image with several layers needs --layer";
+  }
+  for (int i = 0; i < halvings; ++i) {
+    auto scaled = image.scaleByHalf();
+    if (!scaled) {
+      return "Failed to resize: " + QString::fromStdString(scaled.error());
+    }
+    image = std::move(scaled).value();
+  }
+
+  float exposure = options.autoExposure ? estimateExposure(image, 0, {}) : options.exposure;
+  QString tempPath = temporaryPath(job.output);
+  if (tempPath.isEmpty()) {
+    return "Could not create a file next to " + job.output;
+  }
+  auto stored = image.store(tempPath.toStdString(), std::exp2(exposure), 1.0f / options.gamma, options.exr);
+  if (!stored) {
+    QFile::remove(tempPath);
+    return "Failed to write: " + QString::fromStdString(stored.error());
+  }
+  return replaceOutput(tempPath, job.output);
+}
+
+template<typename T>
+bool parseChoice(QString const& value, std::map<QString, T> const& choices, T& result)
+{
+  auto i = choices.find(value.toLower());
+  if (i == choices.end()) {
+    return false;
+  }
+  result = i->second;
+  return true;
+}
+
+}
+
+int runConvert(QStringList const& arguments)
+{
+  ConvertOptions options;
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+    "Converts images between PFM, PIC/HDR, EXR and LDR formats. Formats without floating point support are tone "
+    "mapped with exposure and gamma.\nExit code 0 if all files were converted, 2 on errors.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("inputs", "Images or directories of images.", "<inputs...>");
+  QCommandLineOption outputOption({ "o", "output" },
+    "Output file for a single input, otherwise a directory (default: next to the inputs).", "path");
+  QCommandLineOption formatOption("format", "File extension of the converted images (default exr).", "ext");
+  QCommandLineOption layerOption("layer", "Only convert the layer with this name or index.", "layer");
+  QCommandLineOption downscaleOption("downscale", "Halve the resolution <n> times.", "n");
+  QCommandLineOption maxSizeOption("max-size", "Halve the resolution until width and height are at most <px>.", "px");
+  QCommandLineOption exposureOption("exposure", "Exposure in stops for LDR formats (default 0).", "stops");
+  QCommandLineOption autoExposureOption("auto-exposure", "Choose the exposure for LDR formats from the histogram.");
+  QCommandLineOption gammaOption("gamma", "Gamma for LDR formats (default 2.2).", "gamma");
+  QCommandLineOption compressionOption("compression", "EXR compression: none, rle, zips, zip (default) or piz.", "method");
+  QCommandLineOption halfOption("half", "Store EXR floating point channels as 16 bit half.");
+  QCommandLineOption tiledOption("tiled", "Store EXR images tiled with mip levels.");
+  QCommandLineOption exrLayersOption("exr-layers", "EXR layer layout: first, channels (default) or parts.", "layout");
+  QCommandLineOption jobsOption("jobs", "Number of files converted in parallel (default: number of cores).", "n");
+  parser.addOptions({ outputOption, formatOption, layerOption, downscaleOption, maxSizeOption, exposureOption,
+    autoExposureOption, gammaOption, compressionOption, halfOption, tiledOption, exrLayersOption, jobsOption });
+
+  if (!parser.parse(QStringList("hdrv convert") + arguments)) {
+    std::fprintf(stderr, "%s\n", qPrintable(parser.errorText()));
+    return ExitError;
+  }
+  if (parser.isSet("help")) {
+    std::printf("%s", qPrintable(parser.helpText()));
+    return ExitSuccess;
+  }
+  auto inputs = parser.positionalArguments();
+  if (inputs.isEmpty()) {
+    std::fprintf(stderr, "Expected at least one image or directory.\n%s", qPrintable(parser.helpText()));
+    return ExitError;
+  }
+
+  bool ok = true;
+  auto number = [&](QCommandLineOption const& option, auto& value, double minimum) {
+    if (parser.isSet(option)) {
+      bool valid = false;
+      using T = std::decay_t<decltype(value)>;
+      value = std::is_integral_v<T> ? T(parser.value(option).toInt(&valid)) : T(parser.value(option).toDouble(&valid));
+      if (!valid || !(value >= minimum)) {
+        std::fprintf(stderr, "Invalid value for --%s.\n", qPrintable(option.names().back()));
+        ok = false;
+      }
+    }
+  };
+  int jobs = QThread::idealThreadCount();
+  number(downscaleOption, options.downscale, 0);
+  number(maxSizeOption, options.maxSize, 1);
+  number(exposureOption, options.exposure, -HUGE_VAL);
+  number(gammaOption, options.gamma, 0.01);
+  number(jobsOption, jobs, 1);
+  if (!ok) {
+    return ExitError;
+  }
+  options.layer = parser.value(layerOption);
+  options.autoExposure = parser.isSet(autoExposureOption);
+  options.exr.half = parser.isSet(halfOption);
+  options.exr.tiled = parser.isSet(tiledOption);
+  if (parser.isSet(compressionOption) && !parseChoice<EXROptions::Compression>(parser.value(compressionOption),
+      { { "none", EXROptions::None }, { "rle", EXROptions::RLE }, { "zips", EXROptions::ZIPS },
+        { "zip", EXROptions::ZIP }, { "piz", EXROptions::PIZ } }, options.exr.compression)) {
+    std::fprintf(stderr, "Unknown EXR compression %s.\n", qPrintable(parser.value(compressionOption)));
+    return ExitError;
+  }
+  if (parser.isSet(exrLayersOption) && !parseChoice<EXROptions::Layers>(parser.value(exrLayersOption),
+      { { "first", EXROptions::FirstLayer }, { "channels", EXROptions::LayersAsChannels },
+        { "parts", EXROptions::LayersAsParts } }, options.exr.layers)) {
+    std::fprintf(stderr, "Unknown EXR layer layout %s.\n", qPrintable(parser.value(exrLayersOption)));
+    return ExitError;
+  }
+  QString format = parser.isSet(formatOption) ? parser.value(formatOption).toLower() : QString("exr");
+  // Conversions between floating point formats without resizing go row by row.
+  bool transformed = options.downscale > 0 || options.maxSize > 0 || options.autoExposure;
+
+  // Expand directories and decide where every file goes.
+  QString output = parser.value(outputOption);
+  QFileInfo outputInfo(output);
+  bool singleFile = inputs.size() == 1 && QFileInfo(inputs[0]).isFile();
+  bool outputIsFile = singleFile && !output.isEmpty() && !outputInfo.isDir() && !outputInfo.suffix().isEmpty();
+  if (!output.isEmpty() && !outputIsFile && !QDir().mkpath(output)) {
+    std::fprintf(stderr, "Could not create %s.\n", qPrintable(output));
+    return ExitError;
+  }
+  std::vector<Job> queue;
+  std::map<QString, QString> sources; // absolute target path -> input written there
+  for (auto const& input : inputs) {
+    QFileInfo info(input);
+    QStringList files;
+    if (info.isDir()) {
+      for (auto const& name : QDir(input).entryList(imageNameFilters(), QDir::Files, QDir::Name)) {
+        files.push_back(QDir(input).filePath(name));
+      }
+    } else if (info.isFile()) {
+      files.push_back(input);
+    } else {
+      std::fprintf(stderr, "%s does not exist.\n", qPrintable(input));
+      return ExitError;
+    }
+    for (auto const& file : files) {
+      QFileInfo source(file);
+      QString target = outputIsFile ? output
+        : QDir(output.isEmpty() ? source.path() : output).filePath(source.completeBaseName() + "." + format);
+      if (QFileInfo(target).absoluteFilePath() == source.absoluteFilePath()) {
+        std::fprintf(stderr, "Skipping %s, it would be overwritten.\n", qPrintable(file));
+        continue;
+      }
+      // Eg. a.exr and a.hdr converted to the same directory, checked before anything is written.
+      auto [previous, added] = sources.emplace(QFileInfo(target).absoluteFilePath(), file);
+      if (!added) {
+        std::fprintf(stderr, "%s and %s would both be written to %s.\n", qPrintable(previous->second),
+          qPrintable(file), qPrintable(target));
+        return ExitError;
+      }
+      queue.push_back({ file, target, !transformed && !options.exr.tiled && isFloatFormat(file) && isFloatFormat(target) });
+    }
+  }
+
+  // Two stage pipeline: a small I/O pool reads files while the global pool
+  // decodes, transforms, encodes and writes them. Image operations inside a job
+  // are themselves parallel, so cores stay busy even with few large files. The
+  // semaphore bounds the number of files between reading and writing, which
+  // caps memory use independently of the batch size. Streamed files skip the
+  // read stage, they only hold a few rows in memory.
+  QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+  QThreadPool io;
+  io.setMaxThreadCount(2);
+  int inFlight = 2 * jobs;
+  QSemaphore slots(inFlight);
+  std::vector<QString> errors(queue.size());
+  std::atomic<int> done = 0;
+  auto process = [&](size_t i, QByteArray bytes) {
+    QThreadPool::globalInstance()->start([&, i, bytes = std::move(bytes)]() {
+      auto const& job = queue[i];
+      std::optional<QString> streamed = job.stream ? convertStreaming(job, options) : std::nullopt;
+      if (streamed) {
+        errors[i] = *streamed;
+      } else {
+        QByteArray data = bytes.isEmpty() ? readFile(job.input) : bytes;
+        errors[i] = data.isEmpty() ? "Could not read " + job.input : convert(job, data, options);
+      }
+      if (errors[i].isEmpty()) {
+        std::printf("[%d/%d] %s -> %s\n", ++done, int(queue.size()), qPrintable(job.input), qPrintable(job.output));
+      } else {
+        std::fprintf(stderr, "%s: %s\n", qPrintable(job.input), qPrintable(errors[i]));
+      }
+      slots.release();
+    });
+  };
+  for (size_t i = 0; i < queue.size(); ++i) {
+    slots.acquire();
+    if (queue[i].stream) {
+      process(i, {});
+    } else {
+      io.start([&, i]() { process(i, readFile(queue[i].input)); });
+    }
+  }
+  slots.acquire(inFlight);
+
+  int failed = int(std::count_if(errors.begin(), errors.end(), [](QString const& e) { return !e.isEmpty(); }));
+  std::printf("%d converted, %d failed\n", int(queue.size()) - failed, failed);
+  return failed > 0 ? ExitError : ExitSuccess;
+}
+
+}
@@ -0,0 +1,381 @@
+#include <cli/Commands.hpp>
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtConcurrent>
+
+#include <image/Image.hpp>
+#include <image/ImageMetrics.hpp>
+#include <image/Parallel.hpp>
+#include <image/TileHashes.hpp>
+#include <model/ImageQueries.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+
+namespace hdrv {
+
+namespace {
+
+struct Threshold
+{
+  char const* option;
+  char const* description;
+  bool isMaximum;
+  double ChannelMetrics::* metric; // null for the perceptual error
+  std::optional<double> value;
+
+  double valueOf(ImageMetrics const& metrics) const { return metric ? metrics.color.*metric : metrics.perceptual; }
+  bool exceeded(double v) const { return isMaximum ? !(v <= *value) : !(v >= *value); }
+};
+
+struct DiffOptions
+{
+  QString layer; // name or index, all layers if empty
+  QString output;
+  QString format = "exr";
+  bool json = false;
+  std::vector<Threshold> thresholds = {
+    { "max-mse", "Fail if the MSE exceeds <value>.", true, &ChannelMetrics::mse, {} },
+    { "max-rmse", "Fail if the RMSE exceeds <value>.", true, &ChannelMetrics::rmse, {} },
+    { "max-relmse", "Fail if the relative MSE exceeds <value>.", true, &ChannelMetrics::relativeMse, {} },
+    { "min-psnr", "Fail if the PSNR is below <value> dB.", false, &ChannelMetrics::psnr, {} },
+    { "min-ssim", "Fail if the SSIM is below <value>.", false, &ChannelMetrics::ssim, {} },
+    { "max-perceptual", "Fail if the perceptual error exceeds <value>.", true, nullptr, {} },
+  };
+};
+
+struct LayerReport
+{
+  std::string name;
+  ImageMetrics metrics;
+};
+
+struct PairReport
+{
+  QString name;
+  QString error;
+  bool identicalFiles = false;
+  std::vector<LayerReport> layers;
+  QStringList violations;
+};
+
+QString channelName(int channel, int channels)
+{
+  static char const* const gray[] = { "L", "A" };
+  static char const* const color[] = { "R", "G", "B", "A" };
+  if (channels <= 2) {
+    return gray[channel];
+  } else if (channels <= 4) {
+    return color[channel];
+  }
+  return QString::number(channel);
+}
+
+std::vector<std::string> layerNames(Image const& image)
+{
+  std::vector<std::string> names;
+  for (auto const& layer : image.layers()) {
+    names.push_back(layer.name);
+  }
+  if (names.empty()) {
+    names.push_back("");
+  }
+  return names;
+}
+
+// Absolute per-channel difference of a layer as a float image, LDR values normalized to [0, 1].
+Image differenceImage(Image const& a, int layerA, Image const& b, int layerB)
+{
+  int w = a.width();
+  int h = a.height();
+  int c = a.channels(layerA);
+  bool integer = layerA < int(a.layers().size()) && a.layers()[layerA].display == Image::Integer;
+  auto valueOf = [&](Image const& image, int layer, int x, int y, int ch) {
+    float v = image.value(x, y, ch, layer);
+    if (integer) {
+      uint32_t i;
+      std::memcpy(&i, &v, sizeof(float));
+      return float(i);
+    }
+    return image.format() == Image::Float ? v : v / 255.0f;
+  };
+  // Identical tiles stay zero.
+  int size = TileHashes::tileSize;
+  int columns = a.tileHashes()->columns;
+  auto identical = identicalTiles(a, layerA, b, layerB);
+  std::vector<uint8_t> data(size_t(w) * h * c * sizeof(float), 0);
+  float* dst = reinterpret_cast<float*>(data.data());
+  parallelFor(h, [&](int begin, int end) {
+    for (int y = begin; y < end; ++y) {
+      for (int column = 0; column < columns; ++column) {
+        if (identical[size_t(y / size) * columns + column]) {
+          continue;
+        }
+        for (int x = column * size; x < std::min((column + 1) * size, w); ++x) {
+          for (int ch = 0; ch < c; ++ch) {
+            dst[(size_t(y) * w + x) * c + ch] = std::abs(valueOf(a, layerA, x, y, ch) - valueOf(b, layerB, x, y, ch));
+          }
+        }
+      }
+    }
+  });
+  return Image(w, h, c, Image::Float, std::move(data), Image::TopDown);
+}
+
+PairReport diffPair(QString const& name, QString const& pathA, QString const& pathB, QString const& output,
+  DiffOptions const& options)
+{
+  PairReport report;
+  report.name = name;
+  // Reported without decoding. A difference image is still written if requested.
+  if (output.isEmpty() && filesIdentical(pathA.toStdString(), pathB.toStdString())) {
+    report.identicalFiles = true;
+    return report;
+  }
+  auto a = Image::load(pathA.toStdString());
+  if (!a) {
+    report.error = "Failed to load " + pathA + ": " + QString::fromStdString(a.error());
+    return report;
+  }
+  auto b = Image::load(pathB.toStdString());
+  if (!b) {
+    report.error = "Failed to load " + pathB + ": " + QString::fromStdString(b.error());
+    return report;
+  }
+
+  // Layers are matched by name, the second image is the reference.
+  auto namesA = layerNames(a.value());
+  auto namesB = layerNames(b.value());
+  std::vector<std::pair<int, int>> layers;
+  for (int i = 0; i < int(namesA.size()); ++i) {
+    bool selected = options.layer.isEmpty() || options.layer == QString::fromStdString(namesA[i])
+      || options.layer == QString::number(i);
+    auto match = std::find(namesB.begin(), namesB.end(), namesA[i]);
+    if (!selected) {
+      continue;
+    } else if (match == namesB.end()) {
+      report.error = "Layer '" + QString::fromStdString(namesA[i]) + "' is missing in " + pathB;
+      return report;
+    }
+    layers.emplace_back(i, int(match - namesB.begin()));
+  }
+  if (layers.empty()) {
+    report.error = "No layer '" + options.layer + "' in " + pathA;
+    return report;
+  }
+
+  for (auto [layerA, layerB] : layers) {
+    auto metrics = computeMetrics(a.value(), b.value(), layerA, layerB);
+    if (!metrics) {
+      report.error = QString::fromStdString(metrics.error());
+      return report;
+    }
+    report.layers.push_back({ namesA[layerA], std::move(metrics).value() });
+    for (auto const& threshold : options.thresholds) {
+      double value = threshold.valueOf(report.layers.back().metrics);
+      if (threshold.value && threshold.exceeded(value)) {
+        QString layer = namesA[layerA].empty() ? QString() : " (" + QString::fromStdString(namesA[layerA]) + ")";
+        report.violations.push_back(QString("%1: %2 %3 %4%5").arg(QString::fromLatin1(threshold.option)).arg(value)
+          .arg(QString(threshold.isMaximum ? ">" : "<")).arg(*threshold.value).arg(layer));
+      }
+    }
+  }
+
+  if (!output.isEmpty()) {
+    auto [layerA, layerB] = layers.front();
+    auto difference = differenceImage(a.value(), layerA, b.value(), layerB);
+    auto stored = difference.store(output.toStdString(), 1.0f, 1.0f / 2.2f);
+    if (!stored) {
+      report.error = "Failed to write " + output + ": " + QString::fromStdString(stored.error());
+    }
+  }
+  return report;
+}
+
+QJsonObject toJson(PairReport const& report)
+{
+  QJsonObject object { { "name", report.name } };
+  if (!report.error.isEmpty()) {
+    object["error"] = report.error;
+  }
+  QJsonArray layers;
+  for (auto const& layer : report.layers) {
+    QJsonArray channels;
+    for (auto const& channel : layer.metrics.channels) {
+      channels.append(toJson(channel));
+    }
+    QJsonArray regions;
+    for (auto const& region : layer.metrics.changedRegions) {
+      regions.append(QJsonArray { region.x, region.y, region.width, region.height });
+    }
+    layers.append(QJsonObject {
+      { "name", QString::fromStdString(layer.name) },
+      { "channels", channels },
+      { "color", toJson(layer.metrics.color) },
+      { "perceptual", layer.metrics.perceptual },
+      { "invalidPixels", qint64(layer.metrics.invalidPixels) },
+      { "identical", layer.metrics.identical },
+      { "changedRegions", regions },
+    });
+  }
+  object["identicalFiles"] = report.identicalFiles;
+  object["layers"] = layers;
+  object["violations"] = QJsonArray::fromStringList(report.violations);
+  object["passed"] = report.error.isEmpty() && report.violations.empty();
+  return object;
+}
+
+void printMetrics(QString const& label, ChannelMetrics const& m)
+{
+  std::printf("    %-6s mse %-12.6g rmse %-12.6g relmse %-12.6g psnr %-8.3g ssim %-8.5f max %.6g\n",
+    qPrintable(label), m.mse, m.rmse, m.relativeMse, m.psnr, m.ssim, m.maxError);
+}
+
+void printReport(PairReport const& report)
+{
+  bool passed = report.error.isEmpty() && report.violations.empty();
+  std::printf("%s %s%s\n", passed ? "PASS" : "FAIL", qPrintable(report.name), report.identicalFiles ? " (identical files)" : "");
+  for (auto const& layer : report.layers) {
+    auto const& metrics = layer.metrics;
+    std::printf("  layer %s: perceptual %.5f", layer.name.empty() ? "-" : layer.name.c_str(), metrics.perceptual);
+    if (metrics.invalidPixels > 0) {
+      std::printf(", %llu pixels with NaN/Inf skipped", (unsigned long long)metrics.invalidPixels);
+    }
+    if (metrics.identical) {
+      std::printf(", identical");
+    } else {
+      std::printf(", %d changed regions:", int(metrics.changedRegions.size()));
+      for (auto const& region : metrics.changedRegions) {
+        std::printf(" %d,%d %dx%d", region.x, region.y, region.width, region.height);
+      }
+    }
+    std::printf("\n");
+    int channels = int(metrics.channels.size());
+    for (int c = 0; c < channels; ++c) {
+      printMetrics(channelName(c, channels), metrics.channels[c]);
+    }
+    printMetrics("color", metrics.color);
+  }
+  if (!report.error.isEmpty()) {
+    std::printf("  error: %s\n", qPrintable(report.error));
+  }
+  for (auto const& violation : report.violations) {
+    std::printf("  exceeded: %s\n", qPrintable(violation));
+  }
+}
+
+}
+
+int runDiff(QStringList const& arguments)
+{
+  DiffOptions options;
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+    "Compares two images, or all images with matching names in two directories. The second image is the reference.\n"
+    "Exit code 0 if all comparisons are within the thresholds, 1 if a threshold is exceeded, 2 on errors.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("a", "Image or directory.");
+  parser.addPositionalArgument("b", "Reference image or directory.");
+  QCommandLineOption layerOption("layer", "Only compare the layer with this name or index.", "layer");
+  QCommandLineOption outputOption({ "o", "output" },
+    "Write the absolute difference of the first compared layer to <path>, a directory when comparing directories.", "path");
+  QCommandLineOption formatOption("format", "File extension of difference images written to a directory (default exr).", "ext");
+  QCommandLineOption jsonOption("json", "Print the results as JSON.");
+  parser.addOptions({ layerOption, outputOption, formatOption, jsonOption });
+  std::vector<QCommandLineOption> thresholdOptions;
+  for (auto const& threshold : options.thresholds) {
+    thresholdOptions.emplace_back(threshold.option, threshold.description, "value");
+    parser.addOption(thresholdOptions.back());
+  }
+
+  if (!parser.parse(QStringList("hdrv diff") + arguments)) {
+    std::fprintf(stderr, "%s\n", qPrintable(parser.errorText()));
+    return ExitError;
+  }
+  if (parser.isSet("help")) {
+    std::printf("%s", qPrintable(parser.helpText()));
+    return ExitSuccess;
+  }
+  auto positional = parser.positionalArguments();
+  if (positional.size() != 2) {
+    std::fprintf(stderr, "Expected two images or directories.\n%s", qPrintable(parser.helpText()));
+    return ExitError;
+  }
+  options.layer = parser.value(layerOption);
+  options.output = parser.value(outputOption);
+  options.json = parser.isSet(jsonOption);
+  if (parser.isSet(formatOption)) {
+    options.format = parser.value(formatOption);
+  }
+  for (size_t i = 0; i < options.thresholds.size(); ++i) {
+    if (parser.isSet(thresholdOptions[i])) {
+      bool ok = false;
+      options.thresholds[i].value = parser.value(thresholdOptions[i]).toDouble(&ok);
+      if (!ok) {
+        std::fprintf(stderr, "Invalid value for --%s.\n", options.thresholds[i].option);
+        return ExitError;
+      }
+    }
+  }
+
+  QFileInfo a(positional[0]);
+  QFileInfo b(positional[1]);
+  QList<PairReport> reports;
+  if (a.isDir() && b.isDir()) {
+    if (!options.output.isEmpty() && !QDir().mkpath(options.output)) {
+      std::fprintf(stderr, "Could not create %s.\n", qPrintable(options.output));
+      return ExitError;
+    }
+    // Pairs run in parallel on the global pool. The metrics of each pair are then
+    // computed on the thread running it, which keeps the number of images in memory bounded.
+    QString dirA = a.filePath();
+    QString dirB = b.filePath();
+    QStringList names = QDir(dirA).entryList(imageNameFilters(), QDir::Files, QDir::Name);
+    reports = QtConcurrent::blockingMapped(names, [&](QString const& name) {
+      QString pathB = dirB + "/" + name;
+      if (!QFileInfo::exists(pathB)) {
+        PairReport report;
+        report.name = name;
+        report.error = "Missing in " + dirB;
+        return report;
+      }
+      // The input suffix stays part of the name, a.exr and a.hdr must not write the same file.
+      QString output = options.output.isEmpty() ? QString() : options.output + "/" + name + "." + options.format;
+      return diffPair(name, dirA + "/" + name, pathB, output, options);
+    });
+  } else if (a.isDir() || b.isDir()) {
+    std::fprintf(stderr, "Either two images or two directories are expected.\n");
+    return ExitError;
+  } else {
+    reports.push_back(diffPair(a.fileName() + " vs " + b.fileName(), a.filePath(), b.filePath(), options.output, options));
+  }
+
+  int failed = 0;
+  int errors = 0;
+  QJsonArray json;
+  for (auto const& report : reports) {
+    errors += !report.error.isEmpty();
+    failed += report.error.isEmpty() && !report.violations.empty();
+    if (options.json) {
+      json.append(toJson(report));
+    } else {
+      printReport(report);
+    }
+  }
+  if (options.json) {
+    std::printf("%s", QJsonDocument(json).toJson().constData());
+  } else if (reports.size() > 1) {
+    std::printf("%d compared, %d exceeded thresholds, %d errors\n", int(reports.size()), failed, errors);
+  }
+  return errors > 0 ? ExitError : (failed > 0 ? ExitThresholdExceeded : ExitSuccess);
+}
+
+}
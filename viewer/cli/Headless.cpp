@@ -0,0 +1,52 @@
+#include <cli/Commands.hpp>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+
+#include <model/ImageQueries.hpp>
+#include <view/IPCServer.hpp>
+
+#include <cstdio>
+
+namespace hdrv {
+
+int runHeadless(QStringList const& arguments)
+{
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+    "Answers queries about image files on the local socket without showing a window, see ImageQueries.hpp. "
+    "Decoded images stay in memory between queries.\nRuns until a client sends \"exit\".");
+  parser.addHelpOption();
+  QCommandLineOption serverOption("server", "Name of the local socket (default hdrv).", "name");
+  QCommandLineOption cacheOption("cache-size", "Memory for decoded images in MB (default 4096).", "MB");
+  parser.addOptions({ serverOption, cacheOption });
+
+  if (!parser.parse(QStringList("hdrv --headless") + arguments)) {
+    std::fprintf(stderr, "%s\n", qPrintable(parser.errorText()));
+    return ExitError;
+  }
+  if (parser.isSet("help")) {
+    std::printf("%s", qPrintable(parser.helpText()));
+    return ExitSuccess;
+  }
+  bool valid = true;
+  qulonglong megabytes = parser.isSet(cacheOption) ? parser.value(cacheOption).toULongLong(&valid) : 4096;
+  if (!valid) {
+    std::fprintf(stderr, "Invalid value for --cache-size.\n");
+    return ExitError;
+  }
+
+  ImageQueries queries(uint64_t(megabytes) << 20);
+  IPCServer server;
+  server.setQueries(&queries);
+  QString name = parser.isSet(serverOption) ? parser.value(serverOption) : QString("hdrv");
+  server.start(name);
+  if (!server.isRunning()) {
+    std::fprintf(stderr, "Could not listen on %s, is another instance running?\n", qPrintable(name));
+    return ExitError;
+  }
+  QObject::connect(&server, &IPCServer::runningChanged, QCoreApplication::instance(), &QCoreApplication::quit);
+  return QCoreApplication::exec();
+}
+
+}
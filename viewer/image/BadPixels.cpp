@@ -0,0 +1,128 @@
+#include <image/BadPixels.hpp>
+#include <image/Image.hpp>
+#include <image/Parallel.hpp>
+#include <image/Simd.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace hdrv {
+
+namespace {
+
+uint8_t kindsOf(float v)
+{
+  if (std::isnan(v)) return BadPixel::NaN;
+  if (std::isinf(v)) return v < 0.0f ? BadPixel::Infinite | BadPixel::Negative : BadPixel::Infinite;
+  return v < 0.0f ? BadPixel::Negative : 0;
+}
+
+struct Chunk
+{
+  std::vector<BadPixel> pixels;
+  uint64_t count = 0;
+  uint64_t nanCount = 0;
+  uint64_t infCount = 0;
+  uint64_t negativeCount = 0;
+  bool truncated = false;
+
+  void add(BadPixel const& pixel, size_t limit)
+  {
+    ++count;
+    nanCount += (pixel.kinds & BadPixel::NaN) != 0;
+    infCount += (pixel.kinds & BadPixel::Infinite) != 0;
+    negativeCount += (pixel.kinds & BadPixel::Negative) != 0;
+    if (pixels.size() < limit) {
+      pixels.push_back(pixel);
+    } else {
+      truncated = true;
+    }
+  }
+};
+
+// Vectorized check of a row, pixels are only inspected one by one if a group
+// of four values contains a bad one.
+void scanRow(float const* row, int width, int channels, int y, int layer, size_t limit, Chunk& chunk)
+{
+  Float4 zero(0.0f);
+  Float4 inf(std::numeric_limits<float>::infinity());
+  int count = width * channels;
+  int pending = -1; // pixel collecting kinds from its channels
+  uint8_t kinds = 0;
+  auto inspect = [&](int i) {
+    uint8_t k = kindsOf(row[i]);
+    if (k) {
+      int pixel = i / channels;
+      if (pixel != pending) {
+        if (pending >= 0) {
+          chunk.add({ pending, y, uint16_t(layer), kinds }, limit);
+        }
+        pending = pixel;
+        kinds = 0;
+      }
+      kinds |= k;
+    }
+  };
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    Float4 v = Float4::load(row + i);
+    if (!allOf(((zero < v) | (zero == v)) & (v < inf))) {
+      for (int j = i; j < i + 4; ++j) {
+        inspect(j);
+      }
+    }
+  }
+  for (; i < count; ++i) {
+    inspect(i);
+  }
+  if (pending >= 0) {
+    chunk.add({ pending, y, uint16_t(layer), kinds }, limit);
+  }
+}
+
+}
+
+BadPixelIndex findBadPixels(Image const& image)
+{
+  BadPixelIndex result;
+  if (image.format() != Image::Float) {
+    return result;
+  }
+  int layers = std::max(1, int(image.layers().size()));
+  int h = image.height();
+  int threads = std::max(1, QThreadPool::globalInstance()->maxThreadCount());
+  int chunkCount = std::clamp(h / 16, 1, threads * 4);
+  size_t limit = BadPixelIndex::maxIndexed / (size_t(layers) * chunkCount);
+
+  for (int layer = 0; layer < layers; ++layer) {
+    if (layer < int(image.layers().size()) && image.layers()[layer].display == Image::Integer) {
+      continue;
+    }
+    int c = image.channels(layer);
+    std::vector<Chunk> chunks(chunkCount);
+    parallelFor(chunkCount, [&](int begin, int end) {
+      for (int chunk = begin; chunk < end; ++chunk) {
+        int y0 = int(int64_t(h) * chunk / chunkCount);
+        int y1 = int(int64_t(h) * (chunk + 1) / chunkCount);
+        for (int y = y0; y < y1; ++y) {
+          auto values = reinterpret_cast<float const*>(image.row(y, layer));
+          scanRow(values, image.width(), c, y, layer, limit, chunks[chunk]);
+        }
+      }
+    }, 1);
+
+    // Merged in order, the index stays sorted.
+    for (auto& chunk : chunks) {
+      result.pixels.insert(result.pixels.end(), chunk.pixels.begin(), chunk.pixels.end());
+      result.count += chunk.count;
+      result.nanCount += chunk.nanCount;
+      result.infCount += chunk.infCount;
+      result.negativeCount += chunk.negativeCount;
+      result.truncated |= chunk.truncated;
+    }
+  }
+  return result;
+}
+
+}
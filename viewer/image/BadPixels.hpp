@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace hdrv {
+
+class Image;
+
+// Location of a pixel with a NaN, infinite or negative value in any channel.
+struct BadPixel
+{
+  enum Kind : uint8_t { NaN = 1, Infinite = 2, Negative = 4 };
+
+  int32_t x;
+  int32_t y; // from the top
+  uint16_t layer;
+  uint8_t kinds;
+};
+
+// Bad pixels of all floating point layers, ordered by layer, row and column.
+// Counts are exact, the index is capped to keep degenerate images (eg. all
+// negative) cheap and may then skip pixels.
+struct BadPixelIndex
+{
+  static constexpr size_t maxIndexed = 1 << 20;
+
+  std::vector<BadPixel> pixels;
+  uint64_t count = 0;
+  uint64_t nanCount = 0;
+  uint64_t infCount = 0;
+  uint64_t negativeCount = 0;
+  bool truncated = false;
+};
+
+// Scans all layers in a single multi-threaded pass. Prefer Image::badPixels()
+// which caches the result.
+BadPixelIndex findBadPixels(Image const& image);
+
+}
@@ -0,0 +1,107 @@
+#include <image/Exposure.hpp>
+#include <image/Image.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace hdrv {
+
+namespace {
+
+struct LuminanceSamples
+{
+  Histogram histogram;
+  double logSum = 0.0;
+  uint64_t count = 0;
+};
+
+float luminance(Image const& image, int layer, int x, int y)
+{
+  // LDR values are displayed normalized.
+  float scale = image.format() == Image::Float ? 1.0f : 1.0f / 255.0f;
+  if (image.channels(layer) >= 3) {
+    return scale * (0.2126f * image.value(x, y, 0, layer) + 0.7152f * image.value(x, y, 1, layer)
+      + 0.0722f * image.value(x, y, 2, layer));
+  }
+  return scale * image.value(x, y, 0, layer);
+}
+
+LuminanceSamples sample(Image const& image, int layer, int step)
+{
+  LuminanceSamples samples;
+  float minimum = std::ldexp(1.0f, Histogram::minExponent);
+  for (int y = step / 2; y < image.height(); y += step) {
+    for (int x = step / 2; x < image.width(); x += step) {
+      float l = luminance(image, layer, x, y);
+      if (std::isfinite(l)) {
+        l = std::max(l, 0.0f);
+        ++samples.histogram.bins[Histogram::binOf(l)];
+        samples.logSum += std::log2(std::max(l, minimum));
+        ++samples.count;
+      }
+    }
+  }
+  return samples;
+}
+
+LuminanceSamples sampleLuminance(Image const& image, int layer, double percentile)
+{
+  // Start with about 64K samples, which is equivalent to a coarse mip level.
+  constexpr double initialSamples = 65536.0;
+  constexpr double minTailSamples = 64.0;
+  // The tail of higher percentiles is hardly populated even by every pixel,
+  // they would only ever end in a scan of the whole image.
+  percentile = std::min(percentile, 0.999);
+  int step = std::max(1, int(std::sqrt(double(image.width()) * image.height() / initialSamples)));
+  while (true) {
+    auto samples = sample(image, layer, step);
+    // Bright highlights which only cover a few pixels are easily missed by a
+    // sparse grid, so sample more densely until the tail is well populated.
+    double tail = (1.0 - percentile) * double(samples.count);
+    if (step == 1 || tail >= minTailSamples) {
+      return samples;
+    }
+    step = std::max(1, step / 4);
+  }
+}
+
+bool hasLuminance(Image const& image, int layer)
+{
+  return layer >= int(image.layers().size()) || image.layers()[layer].display != Image::Integer;
+}
+
+}
+
+float estimateExposure(Image const& image, int layer, ExposureOptions const& options)
+{
+  if (!hasLuminance(image, layer)) {
+    return 0.0f;
+  }
+  auto percentile = options.mode == ExposureOptions::Percentile ? options.percentile : 0.5;
+  auto samples = sampleLuminance(image, layer, percentile);
+  if (samples.count == 0) {
+    return 0.0f;
+  }
+  if (options.mode == ExposureOptions::Key) {
+    double logAverage = samples.logSum / double(samples.count);
+    return float(std::log2(options.key) - logAverage);
+  }
+  float white = samples.histogram.percentile(options.percentile, 0.0f);
+  return white > 0.0f ? -std::log2(white) : 0.0f;
+}
+
+float estimateGamma(Image const& image, int layer, float brightness)
+{
+  if (!hasLuminance(image, layer)) {
+    return 1.0f;
+  }
+  auto samples = sampleLuminance(image, layer, 0.5);
+  float median = samples.histogram.percentile(0.5, 0.0f) * std::exp2(brightness);
+  if (samples.count == 0 || median <= 0.0f || median >= 1.0f) {
+    return 1.0f;
+  }
+  // Display value is median^(1/gamma), solve for 0.5.
+  return -std::log2(median);
+}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+namespace hdrv {
+
+class Image;
+
+struct ExposureOptions
+{
+  enum Mode { Percentile, Key };
+
+  Mode mode = Percentile;
+  double percentile = 0.99; // luminance which is mapped to white, below 1
+  float key = 0.18f;        // target for the log-average luminance
+};
+
+// Brightness (as log2 scale) that fits the luminance of a layer to the display
+// according to the options. Only a sparse grid of pixels is evaluated; it is
+// refined if the chosen percentile is not backed by enough samples.
+float estimateExposure(Image const& image, int layer, ExposureOptions const& options);
+
+// Gamma that maps the median luminance to middle grey after applying brightness.
+float estimateGamma(Image const& image, int layer, float brightness);
+
+}
@@ -6,20 +6,26 @@
 #include <pic/pic_input_file.hpp>
 #include <pic/pic_output_file.hpp>
 
-#ifdef _MSC_VER
-#pragma warning(push)
-#pragma warning(disable:4018)
-#endif
-#define TINYEXR_IMPLEMENTATION
+// Implemented in Scanlines.cpp.
 #include <tinyexr.h>
-#ifdef _MSC_VER
-#pragma warning(pop)
-#endif
 
+#include <image/Metrics.hpp>
+#include <image/Parallel.hpp>
+#include <image/ToneMapping.hpp>
+#include <image/Trace.hpp>
+
+#include <QFloat16>
+#include <QFile>
 #include <QImage>
+#include <QImageReader>
+#include <QSysInfo>
 
+#include <algorithm>
 #include <array>
+#include <cctype>
 #include <fstream>
+#include <map>
+#include <mutex>
 #include <string>
 #include <string_view>
 
@@ -27,16 +33,57 @@ using namespace std::literals;
 
 namespace hdrv {
 
-Image::Image(int w, int h, int c, Format f, std::vector<uint8_t>&& data)
+bool reportProgress(Progress const& progress, int done, int total)
+{
+  return !progress || progress(float(done) / float(total));
+}
+
+Result<bool> exportCancelled()
+{
+  return Result<bool>("Export cancelled.");
+}
+
+// Counts what a loader read from its file, once the image was decoded.
+void countBytesRead(std::istream& stream)
+{
+  stream.clear();
+  auto position = stream.tellg();
+  if (position > 0) {
+    metrics::counter("load.bytesRead").add(int64_t(position));
+  }
+}
+
+Image::Image(int w, int h, int c, Format f, std::shared_ptr<uint8_t const> data, size_t stride, Orientation o,
+  ChannelOrder order)
   : width_(w)
   , height_(h)
   , channels_(c)
   , format_(f)
+  , orientation_(o)
+  , channelOrder_(order)
+  , stride_(stride)
   , data_(std::move(data))
+  , cache_(std::make_shared<Cache>())
 {}
 
-Image::Image(int w, int h, Format f, std::vector<uint8_t>&& data, std::vector<Layer>&& layers)
-  : Image(w, h, layers[0].channels, f, std::move(data))
+std::shared_ptr<uint8_t const> adopt(std::vector<uint8_t>&& data)
+{
+  auto owner = std::make_shared<std::vector<uint8_t>>(std::move(data));
+  return std::shared_ptr<uint8_t const>(owner, owner->data());
+}
+
+Image::Image(int w, int h, int c, Format f, std::vector<uint8_t>&& data, Orientation o)
+  : Image(w, h, c, f, adopt(std::move(data)), size_t(w) * c * (f == Byte ? 1 : (f == Short ? 2 : 4)), o)
+{}
+
+Image::Image(int w, int h, Format f, std::vector<uint8_t>&& data, std::vector<Layer>&& layers, Orientation o)
+  : Image(w, h, layers[0].channels, f, std::move(data), o)
+{
+  layers_ = std::move(layers);
+}
+
+Image::Image(int w, int h, Format f, std::shared_ptr<uint8_t const> data, std::vector<Layer>&& layers, Orientation o)
+  : Image(w, h, layers[0].channels, f, std::move(data), size_t(w) * layers[0].channels * (f == Byte ? 1 : (f == Short ? 2 : 4)), o)
 {
   layers_ = std::move(layers);
 }
@@ -47,16 +94,114 @@ Image Image::makeEmpty()
   return Image(1, 1, 1, Byte, std::move(data));
 }
 
-float Image::value(int x, int y, int channel, int layer) const
+// Results derived from the pixels, shared by copies of the image since pixels are
+// immutable (except for live images, which reset them in pixelsChanged()).
+struct Image::Cache
+{
+  std::mutex mutex;
+  std::map<int, std::shared_ptr<LayerStatistics const>> statistics;
+  std::shared_ptr<TileHashes const> tileHashes;
+  std::shared_ptr<BadPixelIndex const> badPixels;
+};
+
+std::shared_ptr<LayerStatistics const> Image::statistics(int layer) const
+{
+  {
+    std::lock_guard<std::mutex> lock(cache_->mutex);
+    if (auto i = cache_->statistics.find(layer); i != cache_->statistics.end()) {
+      return i->second;
+    }
+  }
+  // Computed outside the lock, concurrent requests for the same layer at worst
+  // do the work twice.
+  auto result = std::make_shared<LayerStatistics const>(computeStatistics(*this, layer));
+  std::lock_guard<std::mutex> lock(cache_->mutex);
+  return cache_->statistics.emplace(layer, std::move(result)).first->second;
+}
+
+void Image::setStatistics(int layer, std::shared_ptr<LayerStatistics const> statistics) const
+{
+  std::lock_guard<std::mutex> lock(cache_->mutex);
+  cache_->statistics[layer] = std::move(statistics);
+}
+
+void Image::pixelsChanged() const
+{
+  std::lock_guard<std::mutex> lock(cache_->mutex);
+  cache_->statistics.clear();
+  cache_->tileHashes = nullptr;
+  cache_->badPixels = nullptr;
+}
+
+std::shared_ptr<TileHashes const> Image::tileHashes() const
+{
+  {
+    std::lock_guard<std::mutex> lock(cache_->mutex);
+    if (cache_->tileHashes) {
+      return cache_->tileHashes;
+    }
+  }
+  auto result = std::make_shared<TileHashes const>(computeTileHashes(*this));
+  std::lock_guard<std::mutex> lock(cache_->mutex);
+  if (!cache_->tileHashes) {
+    cache_->tileHashes = std::move(result);
+  }
+  return cache_->tileHashes;
+}
+
+std::shared_ptr<BadPixelIndex const> Image::badPixels() const
+{
+  {
+    std::lock_guard<std::mutex> lock(cache_->mutex);
+    if (cache_->badPixels) {
+      return cache_->badPixels;
+    }
+  }
+  auto result = std::make_shared<BadPixelIndex const>(findBadPixels(*this));
+  std::lock_guard<std::mutex> lock(cache_->mutex);
+  if (!cache_->badPixels) {
+    cache_->badPixels = std::move(result);
+  }
+  return cache_->badPixels;
+}
+
+int Image::pixelSizeInBytes() const
+{
+  switch (format_) {
+    case Byte: return sizeof(uint8_t);
+    case Short: return sizeof(uint16_t);
+    default: return sizeof(float);
+  }
+}
+
+size_t Image::stride(int layer) const
+{
+  return layer == 0 ? stride_ : size_t(width_) * channels(layer) * pixelSizeInBytes();
+}
+
+uint8_t const* Image::row(int y, int layer) const
 {
-  auto i = ((height() - y - 1) * width() + x) * channels(layer) + channel;
   auto offset = layer == 0 ? 0 : layers_[layer].offset;
-  if (format_ == Float) {
-    float result;
-    memcpy(&result, data() + offset + i * sizeof(float), sizeof(float));
-    return result;
-  } else {
-    return (float)data_[offset + i];
+  auto r = orientation_ == BottomUp ? height_ - y - 1 : y;
+  return data() + offset + r * stride(layer);
+}
+
+float Image::value(int x, int y, int channel, int layer) const
+{
+  auto p = row(y, layer) + (size_t(x) * channels(layer) + channelIndex(channel)) * pixelSizeInBytes();
+  switch (format_) {
+    case Float: {
+      float result;
+      memcpy(&result, p, sizeof(float));
+      return result;
+    }
+    case Short: {
+      uint16_t result;
+      memcpy(&result, p, sizeof(uint16_t));
+      return (float)result / 257.0f; // same 0-255 range as Byte
+    }
+    default:
+      return (float)*p;
   }
 }
 
@@ -111,7 +256,11 @@ Result<Image> Image::loadPFM(std::string const& path)
 {
   try {
     std::ifstream stream(path, std::ios::binary);
-    return loadPFM(stream);
+    auto result = loadPFM(stream);
+    if (result) {
+      countBytesRead(stream);
+    }
+    return result;
   }
   catch (std::exception const& e) {
     return Result<Image>(std::string("PFM loader: ") + e.what());
@@ -120,6 +269,7 @@ Result<Image> Image::loadPFM(std::string const& path)
 
 Result<Image> Image::loadPFM(std::istream & stream)
 {
+  HDRV_TRACE_SCOPE("PFM decode");
   try {
     pfm::pfm_input_file file(stream);
 
@@ -149,7 +299,7 @@ Result<Image> Image::loadPFM(std::istream & stream)
   }
 }
 
-Result<bool> Image::storePFM(std::string const& path) const
+Result<bool> Image::storePFM(std::string const& path, Progress const& progress) const
 {
   if (format() != Float) {
     return Result<bool>("Cannot store LDR image as HDR image.");
@@ -167,6 +317,9 @@ Result<bool> Image::storePFM(std::string const& path) const
         scanline[x][2] = value(x, y, 2);
       }
       file.write_color_scanline(scanline.get(), width());
+      if (!reportProgress(progress, height() - y, height())) {
+        return exportCancelled();
+      }
     }
     return Result<bool>(true);
 
@@ -177,11 +330,37 @@ Result<bool> Image::storePFM(std::string const& path) const
 
 // Radiance PIC
 
+// Writes the transpose of a rows x cols matrix of pixels to dst. Works on square
+// blocks small enough that both source and destination lines stay in cache.
+template<typename Pixel>
+void transposeBlocked(Pixel const* src, Pixel* dst, int rows, int cols)
+{
+  constexpr int blockSize = 32;
+  int blockRows = (rows + blockSize - 1) / blockSize;
+  parallelFor(blockRows, [&](int begin, int end) {
+    for (int br = begin * blockSize; br < std::min(end * blockSize, rows); br += blockSize) {
+      for (int bc = 0; bc < cols; bc += blockSize) {
+        int rowEnd = std::min(br + blockSize, rows);
+        int colEnd = std::min(bc + blockSize, cols);
+        for (int r = br; r < rowEnd; ++r) {
+          for (int c = bc; c < colEnd; ++c) {
+            dst[size_t(c) * rows + r] = src[size_t(r) * cols + c];
+          }
+        }
+      }
+    }
+  }, 1);
+}
+
 Result<Image> Image::loadPIC(std::string const& path)
 {
   try {
     std::ifstream stream(path, std::ios::binary);
-    return loadPIC(stream);
+    auto result = loadPIC(stream);
+    if (result) {
+      countBytesRead(stream);
+    }
+    return result;
   }
   catch (std::exception const& e) {
     return Result<Image>(std::string("Radiance PIC loader: ") + e.what());
@@ -190,6 +369,7 @@ Result<Image> Image::loadPIC(std::string const& path)
 
 Result<Image> Image::loadPIC(std::istream & stream)
 {
+  HDRV_TRACE_SCOPE("PIC decode");
   try {
     pic::pic_input_file file(stream);
 
@@ -203,32 +383,47 @@ Result<Image> Image::loadPIC(std::istream & stream)
     pic::resolution_string_type resolutionType;
     size_t width, height;
     file.read_resolution_string(resolutionType, width, height);
-    if (resolutionType != pic::neg_y_pos_x) {
-      return Result<Image>("Radiance PIC loader: resolution type not supported.");
-    }
     int w = (int)width;
     int h = (int)height;
 
-    std::vector<uint8_t> data(w * h * 3 * sizeof(float));
-    float* d = reinterpret_cast<float*>(data.data());
-    std::unique_ptr<pic::pixel[]> scanline(new pic::pixel[w]);
-    for (int y = 0; y < h; ++y) {
-      file.read_scanline(scanline.get(), w);
-      for (int x = 0; x < w; ++x) {
-        int index = (h - y - 1) * 3 * w + x * 3;
-        pic::rgbe_to_rgb(scanline[x][0], scanline[x][1], scanline[x][2], scanline[x][3],
-          d[index], d[index + 1], d[index + 2]);
+    // The resolution string tells in which order scanlines appear in the file,
+    // and whether they are rows or columns. Rows are stored as they come, with
+    // the orientation telling whether the first one is at the top or bottom.
+    // Right to left scanlines are mirrored while decoding. Columns are collected
+    // in a separate buffer first and then transposed.
+    bool columns = resolutionType >= pic::pos_x_pos_y;
+    bool reverseScanlines = resolutionType == pic::neg_x_pos_y || resolutionType == pic::neg_x_neg_y;
+    bool mirrorScanline = resolutionType == pic::neg_y_neg_x || resolutionType == pic::pos_y_neg_x;
+    bool topDown = resolutionType == pic::neg_y_pos_x || resolutionType == pic::neg_y_neg_x
+      || resolutionType == pic::pos_x_neg_y || resolutionType == pic::neg_x_neg_y;
+    int scanlineCount = columns ? w : h;
+    int scanlineLength = columns ? h : w;
+
+    std::vector<uint8_t> data(size_t(w) * h * 3 * sizeof(float));
+    std::vector<uint8_t> transposed(columns ? data.size() : 0);
+    float* d = reinterpret_cast<float*>(columns ? transposed.data() : data.data());
+    std::unique_ptr<pic::pixel[]> scanline(new pic::pixel[scanlineLength]);
+    for (int s = 0; s < scanlineCount; ++s) {
+      file.read_scanline(scanline.get(), scanlineLength);
+      float* dst = d + size_t(reverseScanlines ? scanlineCount - s - 1 : s) * scanlineLength * 3;
+      for (int i = 0; i < scanlineLength; ++i) {
+        float* p = dst + (mirrorScanline ? scanlineLength - i - 1 : i) * 3;
+        pic::rgbe_to_rgb(scanline[i][0], scanline[i][1], scanline[i][2], scanline[i][3], p[0], p[1], p[2]);
       }
     }
+    if (columns) {
+      using RGB = std::array<float, 3>;
+      transposeBlocked(reinterpret_cast<RGB const*>(transposed.data()), reinterpret_cast<RGB*>(data.data()), w, h);
+    }
 
-    return Result<Image>(Image(w, h, 3, Float, std::move(data)));
+    return Result<Image>(Image(w, h, 3, Float, std::move(data), topDown ? TopDown : BottomUp));
 
   } catch (std::exception const& e) {
     return Result<Image>(std::string("Radiance PIC loader: ") + e.what());
   }
 }
 
-Result<bool> Image::storePIC(std::string const& path) const
+Result<bool> Image::storePIC(std::string const& path, Progress const& progress) const
 {
   if (format() != Float) {
     return Result<bool>("Cannot store LDR image as HDR image.");
@@ -247,6 +442,9 @@ Result<bool> Image::storePIC(std::string const& path) const
           scanline[x][0], scanline[x][1], scanline[x][2], scanline[x][3]);
       }
       file.write_scanline(scanline.get(), width());
+      if (!reportProgress(progress, y + 1, height())) {
+        return exportCancelled();
+      }
     }
     return Result<bool>(true);
 
@@ -344,13 +542,20 @@ Result<Image> Image::loadEXR(std::byte const* inputMemory, size_t size)
   for (auto& i : exrImages) {
     InitEXRImage(&i);
   }
-  if (exrVersion.multipart) {
-    EXR_CHECK(LoadEXRMultipartImageFromMemory(exrImages.data(), (const EXRHeader**)exrHeaders, exrHeaderCount, memory, size, &err),
-              "Failed to decode multipart EXR images");
-  } else {
-    EXR_CHECK(LoadEXRImageFromMemory(exrImages.data(), &exrHeader, memory, size, &err),
-              "Failed to decode EXR image");
+  metrics::Timer decodeTimer(metrics::histogram("load.exr.decode"));
+  {
+    HDRV_TRACE_SCOPE("EXR decode");
+    if (exrVersion.multipart) {
+      EXR_CHECK(LoadEXRMultipartImageFromMemory(exrImages.data(), (const EXRHeader**)exrHeaders, exrHeaderCount, memory, size, &err),
+                "Failed to decode multipart EXR images");
+    } else {
+      EXR_CHECK(LoadEXRImageFromMemory(exrImages.data(), &exrHeader, memory, size, &err),
+                "Failed to decode EXR image");
+    }
   }
+  decodeTimer.stop();
+  metrics::Timer convertTimer(metrics::histogram("load.exr.convert"));
+  HDRV_TRACE_SCOPE("EXR convert");
 
   EXRLayer defaultLayer;
   std::vector<EXRLayer> layers;
@@ -418,7 +623,7 @@ Result<Image> Image::loadEXR(std::byte const* inputMemory, size_t size)
     resultLayers[l].offset = dataOffset;
 
     // EXR contains one buffer per channel, so we need to convert to interlaced
-    // RGBA pixel format (supporting 1-4 channels). This also does a vertical flip.
+    // RGBA pixel format (supporting 1-4 channels). Rows stay in file order (top-down).
     for (int c = 0; c < layer.channelCount; ++c) {
       auto& channel = layer.channels[c];
       resultLayers[l].channels += 1;
@@ -429,7 +634,7 @@ Result<Image> Image::loadEXR(std::byte const* inputMemory, size_t size)
         for (int y = 0; y < tileHeight; ++y) {
           for (int x = 0; x < tileWidth; ++x) {
             int srcCoord = y * tileStride + x;
-            int dstCoord = (height - offsetY - y - 1) * width + (offsetX + x);
+            int dstCoord = (offsetY + y) * width + (offsetX + x);
             auto src = pixels + srcCoord * sizeof(float);
             auto dst = resultData.data() + dataOffset
               + (dstCoord * layer.channelCount + c) * sizeof(float);
@@ -469,93 +674,350 @@ Result<Image> Image::loadEXR(std::byte const* inputMemory, size_t size)
     FreeEXRHeader(exrHeaderPtr);
   }
 
-  return Image(width, height, Image::Float, std::move(resultData), std::move(resultLayers));
+  return Image(width, height, Image::Float, std::move(resultData), std::move(resultLayers), TopDown);
 }
 
 Result<Image> Image::loadEXR(std::string const& path)
 {
   std::ifstream stream(path, std::ios::in | std::ios::binary);
-  stream.seekg(0, std::ios::end);
-  size_t size = stream.tellg();
-  stream.seekg(0, std::ios::beg);
-  std::vector<std::byte> memory(size);
-  stream.read(reinterpret_cast<char*>(memory.data()), size);
-  if (!stream.good()) {
-    return Result<Image>(std::string("Could not read file ") + path);
+  if (!stream) {
+    return Result<Image>(std::string("Could not open file ") + path);
+  }
+  metrics::Timer ioTimer(metrics::histogram("load.exr.io"));
+  std::vector<std::byte> memory;
+  {
+    HDRV_TRACE_SCOPE("EXR read");
+    stream.seekg(0, std::ios::end);
+    memory.resize(size_t(stream.tellg()));
+    stream.seekg(0, std::ios::beg);
+    stream.read(reinterpret_cast<char*>(memory.data()), memory.size());
+    if (!stream.good()) {
+      return Result<Image>(std::string("Could not read file ") + path);
+    }
+  }
+  ioTimer.stop();
+  auto result = loadEXR(memory.data(), memory.size());
+  if (result) {
+    metrics::counter("load.bytesRead").add(int64_t(memory.size()));
   }
-  return loadEXR(memory.data(), size);
+  return result;
 }
 
-Result<bool> Image::storeEXR(std::string const& path) const
+std::vector<Image::Layer> layerList(Image const& image)
 {
+  if (image.layers().empty()) {
+    auto display = image.channels() == 1 ? Image::Luminance : Image::Color;
+    return { Image::Layer{"", image.channels(), display, 0} };
+  }
+  return image.layers();
+}
+
+std::array<char const*, 4> exrChannelNames(Image::Layer const& layer)
+{
+  if (layer.display == Image::Luminance) {
+    return { "L", "A", "B", "C" };
+  } else if (layer.display == Image::Depth && layer.channels == 1) {
+    return { "Z", "", "", "" };
+  } else if (layer.display == Image::Normal) {
+    return { "X", "Y", "Z", "A" };
+  }
+  return { "R", "G", "B", "A" };
+}
+
+struct EXROutputChannel
+{
+  std::string name;
+  int pixelType;
+  int layerIndex;
+  int channel;
+};
+
+struct EXROutputPart
+{
+  std::string name;
+  std::vector<EXROutputChannel> channels;
+
+  // Storage referenced by the tinyexr structures
+  EXRHeader header;
+  std::vector<EXRChannelInfo> infos;
+  std::vector<int> pixelTypes;
+  std::vector<std::vector<uint8_t>> planes;          // scanline: [channel]
+  std::vector<unsigned char*> planePointers;
+  std::vector<EXRImage> levels;                      // tiled: [level]
+  std::vector<std::vector<EXRTile>> tiles;           // tiled: [level][tile]
+  std::vector<std::vector<std::vector<uint8_t>>> tileBuffers; // tiled: [tile of any level][channel]
+  std::vector<std::vector<unsigned char*>> tilePointers;
+};
+
+// Copies one channel of a layer into a planar buffer with rows ordered top to
+// bottom as EXR expects. Values are copied bitwise to preserve integer channels.
+std::vector<float> extractPlane(Image const& image, int layer, int channel)
+{
+  int w = image.width();
+  int h = image.height();
+  std::vector<float> plane(size_t(w) * h);
+  parallelFor(h, [&](int begin, int end) {
+    size_t pixelSize = image.channels(layer) * sizeof(float);
+    for (int y = begin; y < end; ++y) {
+      auto src = image.row(y, layer) + channel * sizeof(float);
+      auto dst = plane.data() + size_t(y) * w;
+      for (int x = 0; x < w; ++x) {
+        std::memcpy(dst + x, src + x * pixelSize, sizeof(float));
+      }
+    }
+  });
+  return plane;
+}
+
+// Next smaller mip level, sizes are rounded down like in EXR files. Integer
+// channels are point sampled since averaging their bits makes no sense.
+std::vector<float> downsamplePlane(std::vector<float> const& src, int w, int h, int nw, int nh, bool integer)
+{
+  std::vector<float> dst(size_t(nw) * nh);
+  parallelFor(nh, [&](int begin, int end) {
+    for (int y = begin; y < end; ++y) {
+      float const* row0 = src.data() + size_t(std::min(2 * y, h - 1)) * w;
+      float const* row1 = src.data() + size_t(std::min(2 * y + 1, h - 1)) * w;
+      float* out = dst.data() + size_t(y) * nw;
+      for (int x = 0; x < nw; ++x) {
+        int x0 = std::min(2 * x, w - 1);
+        int x1 = std::min(2 * x + 1, w - 1);
+        if (integer) {
+          std::memcpy(out + x, row0 + x0, sizeof(float));
+        } else {
+          out[x] = 0.25f * (row0[x0] + row0[x1] + row1[x0] + row1[x1]);
+        }
+      }
+    }
+  });
+  return dst;
+}
+
+// Converts a block of a plane into the pixel type written to the file.
+void convertBlock(float const* src, size_t srcStride, int width, int height, int pixelType, uint8_t* dst, size_t dstStride)
+{
+  for (int y = 0; y < height; ++y) {
+    if (pixelType == TINYEXR_PIXELTYPE_HALF) {
+      qFloatToFloat16(reinterpret_cast<qfloat16*>(dst) + y * dstStride, src + y * srcStride, width);
+    } else {
+      std::memcpy(dst + y * dstStride * sizeof(float), src + y * srcStride, width * sizeof(float));
+    }
+  }
+}
+
+size_t exrPixelSize(int pixelType)
+{
+  return pixelType == TINYEXR_PIXELTYPE_HALF ? sizeof(qfloat16) : sizeof(float);
+}
+
+static_assert(EXROptions::None == TINYEXR_COMPRESSIONTYPE_NONE && EXROptions::RLE == TINYEXR_COMPRESSIONTYPE_RLE
+  && EXROptions::ZIPS == TINYEXR_COMPRESSIONTYPE_ZIPS && EXROptions::ZIP == TINYEXR_COMPRESSIONTYPE_ZIP
+  && EXROptions::PIZ == TINYEXR_COMPRESSIONTYPE_PIZ, "EXR compression types must match tinyexr");
+
+Result<bool> Image::storeEXR(std::string const& path, EXROptions const& options, Progress const& progress) const
+{
+  if (format() != Float) {
+    return Result<bool>("Cannot store LDR image as HDR image.");
+  }
   try {
     int w = width();
     int h = height();
 
-    EXRHeader header;
-    InitEXRHeader(&header);
-
-    EXRImage image;
-    InitEXRImage(&image);
-    image.num_channels = channels();
-    image.width = width();
-    image.height = height();
-
-    float const* interlaced = reinterpret_cast<float const*>(data());
-    std::vector<float> perChannel(w * h * channels());
-    float* pixelPointers[4] = {};
-    EXRChannelInfo channelInfos[4] = {};
-    int pixelTypes[4] = {};
-    int requestedPixelTypes[4] = {};
-
-    int channelsAdded = 0;
-    auto addChannel = [&](int index, char const* name) {      
-      Q_ASSERT(index >= 0 && index <= 4);
-      for (int y = 0; y < h; ++y) {
-        for (int x = 0; x < w; ++x) {
-          int interlacedIndex = ((h - y - 1) * w + x) * channels() + index;
-          int perChannelIndex = index * w * h + y * w + x;
-          Q_ASSERT(interlacedIndex < w * h * channels());
-          Q_ASSERT(perChannelIndex < perChannel.size());
-          perChannel[perChannelIndex] = interlaced[interlacedIndex];
+    // Distribute layers to parts and name their channels.
+    auto layers = layerList(*this);
+    if (options.layers == EXROptions::FirstLayer) {
+      layers.resize(1);
+    }
+    std::vector<EXROutputPart> parts;
+    for (int l = 0; l < int(layers.size()); ++l) {
+      auto const& layer = layers[l];
+      if (parts.empty() || options.layers == EXROptions::LayersAsParts) {
+        std::string name = layer.name.empty() ? "default" : layer.name;
+        auto sameName = [&](auto const& p) { return p.name == name; };
+        for (int i = 2; std::any_of(parts.begin(), parts.end(), sameName); ++i) {
+          name = (layer.name.empty() ? "default" : layer.name) + " " + std::to_string(i);
         }
+        parts.emplace_back();
+        parts.back().name = std::move(name);
+      }
+      auto names = exrChannelNames(layer);
+      for (int c = 0; c < layer.channels; ++c) {
+        std::string name = names[c];
+        if (options.layers == EXROptions::LayersAsChannels && !layer.name.empty()) {
+          name = layer.name + "." + name;
+        }
+        int pixelType = layer.display == Integer ? TINYEXR_PIXELTYPE_UINT
+          : (options.half ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT);
+        parts.back().channels.push_back(EXROutputChannel{std::move(name), pixelType, l, c});
       }
-      int d = channelsAdded++;
-      pixelPointers[d] = perChannel.data() + index * w * h;
-      snprintf(channelInfos[d].name, 256, "%s", name);
-      pixelTypes[d] = TINYEXR_PIXELTYPE_FLOAT;
-      requestedPixelTypes[d] = TINYEXR_PIXELTYPE_FLOAT;
-    };
-
-    // Add channels in alphabetical order (like OpenEXR does)
-    if (channels() >= 4) {
-      addChannel(3, "A");
-    }
-    if (channels() >= 3) {
-      addChannel(2, "B");
     }
-    if (channels() >= 2) {
-      addChannel(1, "G");
+
+    int tileWidth = std::min(options.tileSize, w);
+    int tileHeight = std::min(options.tileSize, h);
+    int levelCount = 1;
+    while (options.tiled && (std::max(w, h) >> levelCount) > 0) {
+      ++levelCount;
     }
-    if (channels() >= 1) {
-      addChannel(0, "R");
+    auto levelWidth = [&](int level) { return std::max(1, w >> level); };
+    auto levelHeight = [&](int level) { return std::max(1, h >> level); };
+
+    int totalChannels = 0;
+    for (auto const& part : parts) {
+      totalChannels += int(part.channels.size());
     }
-    Q_ASSERT(channelsAdded == channels());
+    int channelsDone = 0;
+
+    for (auto& part : parts) {
+      // Channels must be sorted by name (OpenEXR orders them alphabetically).
+      std::sort(part.channels.begin(), part.channels.end(),
+        [](auto const& a, auto const& b) { return a.name < b.name; });
+
+      int channelCount = int(part.channels.size());
+      part.infos.resize(channelCount);
+      part.pixelTypes.resize(channelCount);
+      for (int c = 0; c < channelCount; ++c) {
+        part.infos[c] = EXRChannelInfo{};
+        snprintf(part.infos[c].name, 256, "%s", part.channels[c].name.c_str());
+        part.pixelTypes[c] = part.channels[c].pixelType;
+      }
+
+      if (options.tiled) {
+        part.levels.resize(levelCount);
+        part.tiles.resize(levelCount);
+        for (int l = 0; l < levelCount; ++l) {
+          int tilesX = (levelWidth(l) + tileWidth - 1) / tileWidth;
+          int tilesY = (levelHeight(l) + tileHeight - 1) / tileHeight;
+          part.tiles[l].resize(tilesX * tilesY);
+          for (int t = 0; t < tilesX * tilesY; ++t) {
+            auto& tile = part.tiles[l][t];
+            tile.offset_x = t % tilesX;
+            tile.offset_y = t / tilesX;
+            tile.level_x = l;
+            tile.level_y = l;
+            tile.width = std::min(tileWidth, levelWidth(l) - tile.offset_x * tileWidth);
+            tile.height = std::min(tileHeight, levelHeight(l) - tile.offset_y * tileHeight);
+            part.tileBuffers.emplace_back(channelCount);
+            part.tilePointers.emplace_back(channelCount, nullptr);
+          }
+        }
+      } else {
+        part.planes.resize(channelCount);
+        part.planePointers.resize(channelCount);
+      }
 
-    image.images = reinterpret_cast<unsigned char**>(pixelPointers);
+      for (int c = 0; c < channelCount; ++c) {
+        auto const& channel = part.channels[c];
+        size_t pixelSize = exrPixelSize(channel.pixelType);
+        auto plane = extractPlane(*this, channel.layerIndex, channel.channel);
+
+        if (!options.tiled) {
+          auto& out = part.planes[c];
+          out.resize(size_t(w) * h * pixelSize);
+          parallelFor(h, [&](int begin, int end) {
+            convertBlock(plane.data() + size_t(begin) * w, w, w, end - begin, channel.pixelType,
+              out.data() + size_t(begin) * w * pixelSize, w);
+          });
+          part.planePointers[c] = out.data();
+        } else {
+          // Tiles of all levels are stored consecutively in tileBuffers.
+          size_t firstTile = 0;
+          for (int l = 0; l < levelCount; ++l) {
+            if (l > 0) {
+              plane = downsamplePlane(plane, levelWidth(l - 1), levelHeight(l - 1), levelWidth(l), levelHeight(l),
+                channel.pixelType == TINYEXR_PIXELTYPE_UINT);
+            }
+            auto& tiles = part.tiles[l];
+            int stride = levelWidth(l);
+            parallelFor(int(tiles.size()), [&](int begin, int end) {
+              for (int t = begin; t < end; ++t) {
+                auto const& tile = tiles[t];
+                auto& buffer = part.tileBuffers[firstTile + t][c];
+                buffer.resize(size_t(tileWidth) * tileHeight * pixelSize);
+                size_t offset = size_t(tile.offset_y) * tileHeight * stride + size_t(tile.offset_x) * tileWidth;
+                convertBlock(plane.data() + offset, stride, tile.width, tile.height, channel.pixelType,
+                  buffer.data(), tileWidth);
+                part.tilePointers[firstTile + t][c] = buffer.data();
+              }
+            }, 1);
+            firstTile += tiles.size();
+          }
+        }
+        if (!reportProgress(progress, ++channelsDone, totalChannels + 1)) {
+          return exportCancelled();
+        }
+      }
 
-    header.num_channels = channelsAdded;
-    header.channels = channelInfos;
-    header.pixel_types = pixelTypes;
-    header.requested_pixel_types = requestedPixelTypes;
+      if (options.tiled) {
+        size_t firstTile = 0;
+        for (int l = 0; l < levelCount; ++l) {
+          for (size_t t = 0; t < part.tiles[l].size(); ++t) {
+            part.tiles[l][t].images = part.tilePointers[firstTile + t].data();
+          }
+          firstTile += part.tiles[l].size();
+          auto& level = part.levels[l];
+          InitEXRImage(&level);
+          level.tiles = part.tiles[l].data();
+          level.num_tiles = int(part.tiles[l].size());
+          level.next_level = l + 1 < levelCount ? &part.levels[l + 1] : nullptr;
+          level.level_x = l;
+          level.level_y = l;
+          level.width = levelWidth(l);
+          level.height = levelHeight(l);
+          level.num_channels = channelCount;
+        }
+      } else {
+        part.levels.resize(1);
+        auto& image = part.levels[0];
+        InitEXRImage(&image);
+        image.images = part.planePointers.data();
+        image.width = w;
+        image.height = h;
+        image.num_channels = channelCount;
+      }
+
+      auto& header = part.header;
+      InitEXRHeader(&header);
+      header.num_channels = channelCount;
+      header.channels = part.infos.data();
+      header.pixel_types = part.pixelTypes.data();
+      header.requested_pixel_types = part.pixelTypes.data();
+      header.compression_type = options.compression;
+      header.data_window = EXRBox2i{0, 0, w - 1, h - 1};
+      header.display_window = header.data_window;
+      header.long_name = std::any_of(part.channels.begin(), part.channels.end(),
+        [](auto const& c) { return c.name.size() > 31; }) ? 1 : 0;
+      if (options.tiled) {
+        header.tiled = 1;
+        header.tile_size_x = tileWidth;
+        header.tile_size_y = tileHeight;
+        header.tile_level_mode = TINYEXR_TILE_MIPMAP_LEVELS;
+        header.tile_rounding_mode = TINYEXR_TILE_ROUND_DOWN;
+      }
+      if (parts.size() > 1) {
+        EXRSetNameAttr(&header, part.name.c_str());
+      }
+    }
 
+    // Chunks are compressed in parallel by tinyexr (TINYEXR_USE_THREAD).
     char const* err = nullptr;
-    int ret = SaveEXRImageToFile(&image, &header, path.c_str(), &err);
+    int ret;
+    if (parts.size() == 1) {
+      ret = SaveEXRImageToFile(&parts[0].levels[0], &parts[0].header, path.c_str(), &err);
+    } else {
+      std::vector<EXRImage> images;
+      std::vector<EXRHeader const*> headers;
+      for (auto const& part : parts) {
+        images.push_back(part.levels[0]);
+        headers.push_back(&part.header);
+      }
+      ret = SaveEXRMultipartImageToFile(images.data(), headers.data(), unsigned(parts.size()), path.c_str(), &err);
+    }
     if (ret != TINYEXR_SUCCESS) {
-      std::string errString(err);
+      std::string errString = err ? err : "Failed to write " + path;
       FreeEXRErrorMessage(err);
       return Result<bool>(std::move(errString));
     }
+    reportProgress(progress, 1, 1);
     return true;
 
   } catch (std::exception const& e) {
@@ -565,49 +1027,273 @@ Result<bool> Image::storeEXR(std::string const& path) const
 
 // Qt LDR Image
 
-Result<bool> Image::storeImage(std::string const& path, float brightness, float gamma) const
+Result<bool> Image::storeImage(std::string const& path, float brightness, float gamma, Progress const& progress) const
 {
   if (channels() == 2 || channels() > 4) return Result<bool>("Unsupported number of channels.");
 
-  auto format = channels() == 1 ? QImage::Format_Mono :
+  auto format = channels() == 1 ? QImage::Format_Grayscale8 :
     (channels() == 3 ? QImage::Format_RGB888 : QImage::Format_RGBA8888);
 
-  QImage img(width(), height(), format);
-  for (int y = 0; y < height(); ++y) {
-    for (int x = 0; x < width(); ++x) {
-      auto p = img.bits() + y * img.bytesPerLine() + x * channels();
-      for (int c = 0; c < channels(); ++c) {
-        p[c] = std::max(std::min(std::pow(brightness * value(x, y, c), gamma), 1.0f), 0.0f) * 255.0f;
+  int w = width();
+  int h = height();
+  size_t rowSize = size_t(w) * channels();
+  if (format_ == Byte) {
+    brightness /= 255.0f; // LDR values are displayed normalized
+  } else if (format_ == Short) {
+    brightness /= 65535.0f;
+  }
+
+  // Scanlines of the formats above are laid out exactly like our interleaved
+  // rows, so every row is tone mapped straight into the image in one go.
+  // Rows are processed in bands to report progress in between.
+  QImage img(w, h, format);
+  uint8_t* bits = img.bits();
+  size_t bytesPerLine = img.bytesPerLine();
+  int bandSize = std::max(64, h / 100);
+  for (int band = 0; band < h; band += bandSize) {
+    parallelFor(std::min(bandSize, h - band), [&](int begin, int end) {
+      std::vector<float> converted(format_ != Float ? rowSize : 0);
+      for (int y = band + begin; y < band + end; ++y) {
+        auto src = row(y);
+        auto values = reinterpret_cast<float const*>(src);
+        if (format_ == Byte) {
+          std::copy(src, src + rowSize, converted.begin());
+          if (channelOrder_ == BGRA) {
+            for (size_t i = 0; i < rowSize; i += 4) {
+              std::swap(converted[i], converted[i + 2]);
+            }
+          }
+          values = converted.data();
+        } else if (format_ == Short) {
+          auto shorts = reinterpret_cast<uint16_t const*>(src);
+          std::copy(shorts, shorts + rowSize, converted.begin());
+          values = converted.data();
+        }
+        toneMap(values, bits + y * bytesPerLine, rowSize, brightness, gamma);
       }
+    }, 4);
+    if (!reportProgress(progress, std::min(band + bandSize, h), h)) {
+      return exportCancelled();
     }
   }
-  img.save(path.c_str());
+  if (!img.save(path.c_str())) {
+    return Result<bool>("Failed to write " + path);
+  }
 
   return Result<bool>(true);
 }
 
+struct QImageLayout
+{
+  QImage::Format format;
+  int channels;
+  Image::Format type;
+  Image::ChannelOrder order = Image::RGBA;
+};
+
+// Picks the QImage format closest to the decoded one that maps directly to our
+// interleaved layout. Only premultiplied, half float, indexed and packed formats
+// need to be converted. RGB32 and ARGB32 (what most 8 bit decoders produce) are
+// 0xAARRGGBB words, which little endian machines store as B, G, R, A bytes.
+QImageLayout imageLayout(QImage const& img)
+{
+  switch (img.format()) {
+    case QImage::Format_Grayscale8:
+      return { img.format(), 1, Image::Byte };
+    case QImage::Format_RGB888:
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBX8888:
+      return { img.format(), img.format() == QImage::Format_RGB888 ? 3 : 4, Image::Byte };
+    case QImage::Format_Grayscale16:
+      return { img.format(), 1, Image::Short };
+    case QImage::Format_RGBX64:
+    case QImage::Format_RGBA64:
+      return { img.format(), 4, Image::Short };
+    case QImage::Format_RGBA64_Premultiplied:
+    case QImage::Format_BGR30:
+    case QImage::Format_A2BGR30_Premultiplied:
+    case QImage::Format_RGB30:
+    case QImage::Format_A2RGB30_Premultiplied:
+      return { img.hasAlphaChannel() ? QImage::Format_RGBA64 : QImage::Format_RGBX64, 4, Image::Short };
+    case QImage::Format_RGBX32FPx4:
+    case QImage::Format_RGBA32FPx4:
+      return { img.format(), 4, Image::Float };
+    case QImage::Format_RGBX16FPx4:
+    case QImage::Format_RGBA16FPx4:
+    case QImage::Format_RGBA16FPx4_Premultiplied:
+    case QImage::Format_RGBA32FPx4_Premultiplied:
+      return { img.hasAlphaChannel() ? QImage::Format_RGBA32FPx4 : QImage::Format_RGBX32FPx4, 4, Image::Float };
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+      if (QSysInfo::ByteOrder == QSysInfo::LittleEndian) {
+        return { img.format(), 4, Image::Byte, Image::BGRA };
+      }
+      [[fallthrough]];
+    default:
+      if (img.isGrayscale()) {
+        return { QImage::Format_Grayscale8, 1, Image::Byte };
+      }
+      return { img.hasAlphaChannel() ? QImage::Format_RGBA8888 : QImage::Format_RGB888,
+               img.hasAlphaChannel() ? 4 : 3, Image::Byte };
+  }
+}
+
+Result<Image> adoptQImage(QImage&& img)
+{
+  auto layout = imageLayout(img);
+  if (img.format() != layout.format) {
+    img.convertTo(layout.format);
+  }
+  // The image takes over the decoded pixels. QImage rows are top-down and may
+  // be padded for alignment, which the orientation and stride account for.
+  auto owner = std::make_shared<QImage>(std::move(img));
+  std::shared_ptr<uint8_t const> pixels(owner, owner->constBits());
+  return Result<Image>(Image(owner->width(), owner->height(), layout.channels, layout.type, std::move(pixels),
+    owner->bytesPerLine(), Image::TopDown, layout.order));
+}
+
+std::string extensionOf(std::string const& path)
+{
+  auto dot = path.find_last_of('.');
+  auto separator = path.find_last_of("/\\");
+  if (dot == std::string::npos || (separator != std::string::npos && dot < separator)) {
+    return {};
+  }
+  std::string extension = path.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+  return extension;
+}
+
+// Extension as part of metric names. Files of other types share one, names
+// stay valid and the registry does not grow with every extension seen.
+std::string metricsExtension(std::string const& extension)
+{
+  static std::string const known[] = { "hdr", "pic", "pfm", "ppm", "exr", "png", "jpg", "jpeg", "bmp", "gif", "tif",
+    "tiff", "webp" };
+  return std::find(std::begin(known), std::end(known), extension) != std::end(known) ? extension : "other";
+}
+
 Result<Image> Image::loadImage(std::string const& path)
 {
+  auto stage = "load." + metricsExtension(extensionOf(path));
+  metrics::Timer decodeTimer(metrics::histogram(stage + ".decode"));
+  // Read through a QFile of our own to count the bytes, the reader still picks
+  // the format from the suffix like QImage::load().
+  QFile file(QString::fromStdString(path));
   QImage img;
-  if (img.load(path.c_str())) {
-    img = img.convertToFormat(img.hasAlphaChannel() ? QImage::Format_RGBA8888 : QImage::Format_RGB888);
-
-    int w = img.width();
-    int h = img.height();
-    int c = img.hasAlphaChannel() ? 4 : 3;
-
-    std::vector<uint8_t> data(w * h * c);
-    // Copy pixels line by line. QImage pixel lines are not necessarily packed, they have an alignment
-    // requirement, so for odd resolutions there might be padding after each line. Our buffers are packed.
-    size_t stride = img.bytesPerLine();
-    Q_ASSERT(stride >= w * c);
-    for (int y = 0; y < h; ++y) {
-      std::memcpy(data.data() + y * w * c, img.bits() + (h - y - 1) * stride, w * c);
-    }
-    return Result<Image>(Image(w, h, c, Byte, std::move(data)));
+  bool loaded;
+  {
+    HDRV_TRACE_SCOPE("QImage decode");
+    QImageReader reader(&file);
+    loaded = reader.read(&img);
+  }
+  if (loaded) {
+    decodeTimer.stop();
+    metrics::counter("load.bytesRead").add(int64_t(file.pos()));
+    metrics::Timer convertTimer(metrics::histogram(stage + ".convert"));
+    HDRV_TRACE_SCOPE("QImage convert");
+    return adoptQImage(std::move(img));
+  } else {
+    return Result<Image>(std::string("Image loader failed."));
+  }
+}
+
+Result<Image> Image::loadImage(std::byte const* data, size_t size)
+{
+  QImage img;
+  if (img.loadFromData(reinterpret_cast<uchar const*>(data), int(size))) {
+    return adoptQImage(std::move(img));
   } else {
     return Result<Image>(std::string("Image loader failed."));
   }
 }
 
+Result<Image> Image::load(std::string const& path)
+{
+  auto extension = extensionOf(path);
+  metrics::Timer timer(metrics::histogram("load." + metricsExtension(extension) + ".total"));
+  HDRV_TRACE_SCOPE_DETAIL("Image::load", path);
+  // PFM and PIC files are read while decoding, their time only shows in the total.
+  if (extension == "hdr" || extension == "pic") {
+    return loadPIC(path);
+  } else if (extension == "pfm" || extension == "ppm") {
+    return loadPFM(path);
+  } else if (extension == "exr") {
+    return loadEXR(path);
+  } else {
+    return loadImage(path);
+  }
+}
+
+namespace {
+
+// Read-only stream over memory, without copying it.
+class MemoryBuffer : public std::streambuf
+{
+public:
+  MemoryBuffer(std::byte const* data, size_t size)
+  {
+    char* begin = const_cast<char*>(reinterpret_cast<char const*>(data));
+    setg(begin, begin, begin + size);
+  }
+};
+
+}
+
+Result<Image> Image::load(std::byte const* data, size_t size, std::string const& extension)
+{
+  if (extension == "hdr" || extension == "pic") {
+    MemoryBuffer buffer(data, size);
+    std::istream stream(&buffer);
+    return loadPIC(stream);
+  } else if (extension == "pfm" || extension == "ppm") {
+    MemoryBuffer buffer(data, size);
+    std::istream stream(&buffer);
+    return loadPFM(stream);
+  } else if (extension == "exr") {
+    return loadEXR(data, size);
+  } else {
+    return loadImage(data, size);
+  }
+}
+
+Image Image::layerImage(int layer) const
+{
+  if (layers_.empty()) {
+    return *this;
+  }
+  std::shared_ptr<uint8_t const> pixels(data_, data_.get() + layers_[layer].offset);
+  Image result(width_, height_, layers_[layer].channels, format_, std::move(pixels), stride(layer), orientation_,
+    channelOrder_);
+  result.layers_ = { Layer{ layers_[layer].name, layers_[layer].channels, layers_[layer].display, 0 } };
+  return result;
+}
+
+Image Image::crop(int x, int y, int width, int height, int layer) const
+{
+  Image single = layerImage(layer);
+  // The lowest row in memory is the top one only for top-down images.
+  auto first = single.row(orientation_ == TopDown ? y : y + height - 1);
+  std::shared_ptr<uint8_t const> pixels(single.data_, first + size_t(x) * single.channels_ * pixelSizeInBytes());
+  Image result(width, height, single.channels_, format_, std::move(pixels), single.stride_, orientation_,
+    channelOrder_);
+  result.layers_ = single.layers_;
+  return result;
+}
+
+Result<bool> Image::store(std::string const& path, float brightness, float gamma, EXROptions const& exrOptions,
+  Progress const& progress) const
+{
+  auto extension = extensionOf(path);
+  if (extension == "hdr" || extension == "pic") {
+    return storePIC(path, progress);
+  } else if (extension == "pfm" || extension == "ppm") {
+    return storePFM(path, progress);
+  } else if (extension == "exr") {
+    return storeEXR(path, exrOptions, progress);
+  } else {
+    return storeImage(path, brightness, gamma, progress);
+  }
+}
+
 }
@@ -4,8 +4,13 @@
 #include <memory>
 #include <vector>
 #include <optional>
+#include <functional>
 #include <cstddef>
 
+#include <image/BadPixels.hpp>
+#include <image/ImageStatistics.hpp>
+#include <image/TileHashes.hpp>
+
 namespace hdrv {
 
 template<typename T>
@@ -19,17 +24,37 @@ public:
 
   Result(T && v) : value_(std::move(v)) {}
   Result(std::string const& error) : error_(error) {}
+  // Otherwise string literals would convert to Result<bool>(true).
+  Result(char const* error) : error_(error) {}
 
 private:
   std::string error_;
   std::optional<T> value_;
 };
 
+// Called by long running operations with the fraction of work done so far.
+// Returning false requests the operation to be cancelled.
+using Progress = std::function<bool(float)>;
+
+struct EXROptions
+{
+  enum Compression { None, RLE, ZIPS, ZIP, PIZ };
+  enum Layers { FirstLayer, LayersAsChannels, LayersAsParts };
+
+  Compression compression = ZIP;
+  Layers layers = LayersAsChannels;
+  bool half = false;     // store floating point channels as 16 bit half
+  bool tiled = false;    // store tiles with a full chain of mip levels
+  int tileSize = 64;
+};
+
 class Image
 {
 public:
-  enum Format { Byte, Float };
+  enum Format { Byte, Short, Float };
   enum Display { Color, Luminance, Depth, Normal, Integer };
+  enum Orientation { BottomUp, TopDown }; // order of rows in memory
+  enum ChannelOrder { RGBA, BGRA }; // order of color channels in memory, BGRA only for 4 channel Byte images
 
   struct Layer {
     std::string name;
@@ -44,6 +69,11 @@ public:
   static Result<Image> loadPIC(std::string const& path);
   static Result<Image> loadEXR(std::string const& path);
   static Result<Image> loadImage(std::string const& path);
+  static Result<Image> loadImage(std::byte const*, size_t);
+  // Picks the loader from the file extension.
+  static Result<Image> load(std::string const& path);
+  // Decodes a file already read into memory, extension in lower case.
+  static Result<Image> load(std::byte const* data, size_t size, std::string const& extension);
 
   static Result<Image> loadPFM(std::istream& stream);
   static Result<Image> loadPIC(std::istream& stream);
@@ -52,23 +82,57 @@ public:
   int width() const { return width_; }
   int height() const { return height_; }
   int channels(int layer = 0) const { return layer == 0 ? channels_ : layers_[layer].channels; }
-  int pixelSizeInBytes() const { return format_ == Byte ? sizeof(uint8_t) : sizeof(float); }
-  int sizeInBytes() const { return width_ * height_ * channels_ * pixelSizeInBytes(); }
+  int pixelSizeInBytes() const;
+  size_t sizeInBytes() const { return height_ * stride_; }
   Format format() const { return format_; }
-  uint8_t const* data() const { return data_.data(); }
+  Orientation orientation() const { return orientation_; }
+  ChannelOrder channelOrder() const { return channelOrder_; }
+  // Position of a channel within a pixel in memory.
+  int channelIndex(int channel) const { return channelOrder_ == BGRA && channel < 3 ? 2 - channel : channel; }
+  uint8_t const* data() const { return data_.get(); }
+  // Bytes from one row to the next. Only the first layer may have padding.
+  size_t stride(int layer = 0) const;
+  // Start of row y counted from the top, independent of orientation.
+  uint8_t const* row(int y, int layer = 0) const;
   float value(int x, int y, int channel, int layer = 0) const;
 
   std::vector<Layer> const& layers() const { return layers_; }
 
-  Result<bool> storePFM(std::string const& path) const;
-  Result<bool> storePIC(std::string const& path) const;
-  Result<bool> storeEXR(std::string const& path) const;
-  Result<bool> storeImage(std::string const& path, float brightness, float gamma) const;
+  // Statistics of a layer, computed on first use and cached. Thread safe.
+  std::shared_ptr<LayerStatistics const> statistics(int layer = 0) const;
+  // Statistics known beforehand (eg. from the preview cache), returned by
+  // statistics() instead of computing them.
+  void setStatistics(int layer, std::shared_ptr<LayerStatistics const> statistics) const;
+  // Drops the cached statistics, hashes and bad pixels after the pixels were
+  // changed in place (only live images shared with another process are).
+  void pixelsChanged() const;
+  // Hashes of 64x64 tiles of all layers, computed on first use and cached. Thread safe.
+  std::shared_ptr<TileHashes const> tileHashes() const;
+  // NaN, infinite and negative pixels of all layers, computed on first use and cached. Thread safe.
+  std::shared_ptr<BadPixelIndex const> badPixels() const;
+
+  Result<bool> storePFM(std::string const& path, Progress const& progress = {}) const;
+  Result<bool> storePIC(std::string const& path, Progress const& progress = {}) const;
+  Result<bool> storeEXR(std::string const& path, EXROptions const& options = {}, Progress const& progress = {}) const;
+  Result<bool> storeImage(std::string const& path, float brightness, float gamma, Progress const& progress = {}) const;
+  // Picks the writer from the file extension. Formats without floating point
+  // support are tone mapped with brightness and gamma.
+  Result<bool> store(std::string const& path, float brightness, float gamma, EXROptions const& exrOptions = {},
+    Progress const& progress = {}) const;
 
   Result<Image> scaleByHalf() const;
-
-  Image(int w, int h, int c, Format f, std::vector<uint8_t>&& data);
-  Image(int w, int h, Format f, std::vector<uint8_t>&& data, std::vector<Layer>&& layers);
+  // A single layer as an image of its own, sharing the pixels.
+  Image layerImage(int layer) const;
+  // A rectangle of a layer (from the top-left corner) as an image of its own,
+  // sharing the pixels. The rectangle must lie inside the image.
+  Image crop(int x, int y, int width, int height, int layer = 0) const;
+
+  Image(int w, int h, int c, Format f, std::vector<uint8_t>&& data, Orientation o = BottomUp);
+  Image(int w, int h, Format f, std::vector<uint8_t>&& data, std::vector<Layer>&& layers, Orientation o = BottomUp);
+  // Wraps pixels owned by someone else (eg. a decoded QImage), which the pointer keeps alive.
+  Image(int w, int h, int c, Format f, std::shared_ptr<uint8_t const> data, size_t stride, Orientation o,
+    ChannelOrder order = RGBA);
+  Image(int w, int h, Format f, std::shared_ptr<uint8_t const> data, std::vector<Layer>&& layers, Orientation o);
 
 private:
 
@@ -76,8 +140,14 @@ private:
   int height_;
   int channels_;
   Format format_;
-  std::vector<uint8_t> data_;
+  Orientation orientation_;
+  ChannelOrder channelOrder_;
+  size_t stride_;
+  std::shared_ptr<uint8_t const> data_;
   std::vector<Layer> layers_;
+
+  struct Cache;
+  std::shared_ptr<Cache> cache_;
 };
 
 }
\ No newline at end of file
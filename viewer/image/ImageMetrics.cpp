@@ -0,0 +1,552 @@
+#include <image/ImageMetrics.hpp>
+#include <image/Parallel.hpp>
+#include <image/Simd.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace hdrv {
+
+namespace {
+
+// Images are processed in bands of one tile row. Each band converts the range
+// of its rows that contains changed tiles (plus the pixels needed by SSIM
+// windows and the edge filter) to planar floats once. Tiles with equal hashes
+// contribute no error and are skipped.
+constexpr int bandHeight = TileHashes::tileSize;
+constexpr int ssimWindow = 8;
+constexpr int ssimStep = 4;
+
+struct Planes
+{
+  int x0 = 0;
+  int width = 0;
+  int y0 = 0;
+  int rows = 0;
+  int channels = 0;
+  std::vector<float> data;
+
+  // Rows start at column x0.
+  float* row(int c, int y) { return data.data() + (size_t(c) * rows + (y - y0)) * width; }
+  float const* row(int c, int y) const { return data.data() + (size_t(c) * rows + (y - y0)) * width; }
+};
+
+// Copies the block [x0, x1) x [y0, y1) of a layer into planes, LDR values normalized to [0, 1].
+void extract(Image const& image, int layer, bool integer, int x0, int x1, int y0, int y1, Planes& planes)
+{
+  int c = image.channels(layer);
+  planes.x0 = x0;
+  planes.width = x1 - x0;
+  planes.y0 = y0;
+  planes.rows = y1 - y0;
+  planes.channels = c;
+  planes.data.resize(size_t(c) * planes.rows * planes.width);
+  for (int y = y0; y < y1; ++y) {
+    auto src = image.row(y, layer);
+    for (int ch = 0; ch < c; ++ch) {
+      float* dst = planes.row(ch, y) - x0;
+      for (int x = x0; x < x1; ++x) {
+        size_t i = size_t(x) * c + image.channelIndex(ch);
+        switch (image.format()) {
+          case Image::Byte:
+            dst[x] = src[i] / 255.0f;
+            break;
+          case Image::Short: {
+            uint16_t v;
+            std::memcpy(&v, src + i * sizeof(uint16_t), sizeof(uint16_t));
+            dst[x] = v / 65535.0f;
+            break;
+          }
+          default:
+            if (integer) {
+              uint32_t v;
+              std::memcpy(&v, src + i * sizeof(float), sizeof(float));
+              dst[x] = float(v);
+            } else {
+              std::memcpy(dst + x, src + i * sizeof(float), sizeof(float));
+            }
+        }
+      }
+    }
+  }
+}
+
+// Pixels in [x0, x1) x [y0, y1) with a non-finite value in any channel.
+uint64_t countInvalid(Image const& image, int layer, bool integer, int x0, int x1, int y0, int y1)
+{
+  if (image.format() != Image::Float || integer || x0 >= x1) {
+    return 0;
+  }
+  int c = image.channels(layer);
+  uint64_t count = 0;
+  for (int y = y0; y < y1; ++y) {
+    auto src = image.row(y, layer);
+    for (int x = x0; x < x1; ++x) {
+      bool invalid = false;
+      for (int ch = 0; ch < c; ++ch) {
+        float v;
+        std::memcpy(&v, src + (size_t(x) * c + ch) * sizeof(float), sizeof(float));
+        invalid |= !std::isfinite(v);
+      }
+      count += invalid;
+    }
+  }
+  return count;
+}
+
+struct BandResult
+{
+  std::vector<double> squared;
+  std::vector<double> relative;
+  std::vector<double> ssim;
+  std::vector<float> maxSquared;
+  uint64_t valid = 0;
+  uint64_t invalid = 0;
+  uint64_t ssimWindows = 0;
+  double perceptual = 0.0;
+
+  explicit BandResult(int channels)
+    : squared(channels, 0.0), relative(channels, 0.0), ssim(channels, 0.0), maxSquared(channels, 0.0f) {}
+};
+
+Float4 clamp01(Float4 x)
+{
+  return min(max(x, Float4(0.0f)), Float4(1.0f)); // maps NaN to 0
+}
+
+// Squared and relative squared errors of a row segment of a channel, masked by
+// validity. Returns the largest squared error of the segment.
+float accumulateErrors(float const* a, float const* b, float const* valid, int w, BandResult& result, int c)
+{
+  Float4 zero(0.0f);
+  Float4 one(1.0f);
+  Float4 epsilon(0.01f);
+  Float4 squared = zero, relative = zero, maxSquared = zero;
+  int x = 0;
+  for (; x + 4 <= w; x += 4) {
+    Float4 m = Float4::load(valid + x) == one;
+    Float4 ref = Float4::load(b + x);
+    Float4 d = Float4::load(a + x) - ref;
+    Float4 d2 = select(m, d * d, zero);
+    squared = squared + d2;
+    relative = relative + select(m, d2 / (ref * ref + epsilon), zero);
+    maxSquared = max(maxSquared, d2);
+  }
+  float maxLanes[4];
+  maxSquared.store(maxLanes);
+  result.squared[c] += horizontalSum(squared);
+  result.relative[c] += horizontalSum(relative);
+  float segmentMax = std::max({ maxLanes[0], maxLanes[1], maxLanes[2], maxLanes[3] });
+  for (; x < w; ++x) {
+    if (valid[x] == 1.0f) {
+      float d = a[x] - b[x];
+      result.squared[c] += d * d;
+      result.relative[c] += d * d / (b[x] * b[x] + 0.01f);
+      segmentMax = std::max(segmentMax, d * d);
+    }
+  }
+  result.maxSquared[c] = std::max(result.maxSquared[c], segmentMax);
+  return segmentMax;
+}
+
+// SSIM of an 8x8 window of display values at (x, y).
+double windowSsim(Planes const& a, Planes const& b, int c, int x, int y)
+{
+  Float4 sa(0.0f), sb(0.0f), saa(0.0f), sbb(0.0f), sab(0.0f);
+  for (int r = y; r < y + ssimWindow; ++r) {
+    float const* ra = a.row(c, r) + x;
+    float const* rb = b.row(c, r) + x;
+    for (int i = 0; i < ssimWindow; i += 4) {
+      Float4 va = clamp01(Float4::load(ra + i));
+      Float4 vb = clamp01(Float4::load(rb + i));
+      sa = sa + va;
+      sb = sb + vb;
+      saa = saa + va * va;
+      sbb = sbb + vb * vb;
+      sab = sab + va * vb;
+    }
+  }
+  constexpr double n = ssimWindow * ssimWindow;
+  constexpr double c1 = 0.01 * 0.01;
+  constexpr double c2 = 0.03 * 0.03;
+  double ma = horizontalSum(sa) / n;
+  double mb = horizontalSum(sb) / n;
+  double va = std::max(0.0, horizontalSum(saa) / n - ma * ma);
+  double vb = std::max(0.0, horizontalSum(sbb) / n - mb * mb);
+  double cov = horizontalSum(sab) / n - ma * mb;
+  return ((2.0 * ma * mb + c1) * (2.0 * cov + c2)) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+}
+
+struct Lab
+{
+  float l, a, b;
+};
+
+Lab toLab(float r, float g, float b)
+{
+  auto clamp = [](float v) { return std::isfinite(v) ? std::clamp(v, 0.0f, 1.0f) : 0.0f; };
+  r = clamp(r);
+  g = clamp(g);
+  b = clamp(b);
+  // Linear sRGB to XYZ relative to the D65 white point
+  float x = (0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.9505f;
+  float y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+  float z = (0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.0890f;
+  auto f = [](float t) { return t > 0.008856f ? std::cbrt(t) : 7.787f * t + 4.0f / 29.0f; };
+  float fx = f(x), fy = f(y), fz = f(z);
+  return { 116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz) };
+}
+
+float hyab(Lab const& p, Lab const& q)
+{
+  return std::abs(p.l - q.l) + std::hypot(p.a - q.a, p.b - q.b);
+}
+
+// Largest HyAB distance between colors in the sRGB gamut (green to blue).
+float const maxHyab = hyab(toLab(0.0f, 1.0f, 0.0f), toLab(0.0f, 0.0f, 1.0f));
+
+void toLabPlane(Planes const& planes, int y, std::vector<Lab>& dst)
+{
+  int c = planes.channels;
+  bool color = c >= 3;
+  float const* r = planes.row(0, y);
+  float const* g = planes.row(color ? 1 : 0, y);
+  float const* b = planes.row(color ? 2 : 0, y);
+  for (int x = 0; x < planes.width; ++x) {
+    dst[x] = toLab(r[x], g[x], b[x]);
+  }
+}
+
+// Sobel gradient magnitude of normalized lightness, in [0, sqrt(2)].
+float edge(std::vector<Lab> const* rows[3], int x, int w)
+{
+  int x0 = std::max(x - 1, 0);
+  int x1 = std::min(x + 1, w - 1);
+  auto l = [&](int r, int i) { return (*rows[r])[i].l / 100.0f; };
+  float gx = (l(0, x1) + 2.0f * l(1, x1) + l(2, x1)) - (l(0, x0) + 2.0f * l(1, x0) + l(2, x0));
+  float gy = (l(2, x0) + 2.0f * l(2, x) + l(2, x1)) - (l(0, x0) + 2.0f * l(0, x) + l(0, x1));
+  return std::hypot(gx, gy) / 4.0f;
+}
+
+void accumulatePerceptual(Planes const& a, Planes const& b, int y0, int y1, int h,
+                          std::vector<float> const& valid, BandResult& result)
+{
+  int w = a.width;
+  // Lightness of the row above, current row and row below (clamped to the image).
+  // Edges of the planes are clamped too, they only contain unchanged pixels or
+  // the image border.
+  std::vector<Lab> labA[3], labB[3];
+  for (int i = 0; i < 3; ++i) {
+    labA[i].resize(w);
+    labB[i].resize(w);
+  }
+  auto convert = [&](int slot, int y) {
+    y = std::clamp(y, 0, h - 1);
+    toLabPlane(a, y, labA[slot]);
+    toLabPlane(b, y, labB[slot]);
+  };
+  convert(0, y0 - 1);
+  convert(1, y0);
+  for (int y = y0; y < y1; ++y) {
+    convert(2, y + 1);
+    std::vector<Lab> const* rowsA[3] = { &labA[0], &labA[1], &labA[2] };
+    std::vector<Lab> const* rowsB[3] = { &labB[0], &labB[1], &labB[2] };
+    float const* validRow = valid.data() + size_t(y - y0) * w;
+    for (int x = 0; x < w; ++x) {
+      if (validRow[x] != 1.0f) {
+        continue;
+      }
+      float color = std::pow(std::min(hyab(labA[1][x], labB[1][x]) / maxHyab, 1.0f), 0.7f);
+      float feature = std::sqrt(std::min(std::abs(edge(rowsA, x, w) - edge(rowsB, x, w)) / std::sqrt(2.0f), 1.0f));
+      if (color > 0.0f) {
+        result.perceptual += std::pow(color, 1.0f - feature);
+      }
+    }
+    std::swap(labA[0], labA[1]);
+    std::swap(labA[1], labA[2]);
+    std::swap(labB[0], labB[1]);
+    std::swap(labB[1], labB[2]);
+  }
+}
+
+struct Comparison
+{
+  Image const& image;
+  Image const& reference;
+  int layer;
+  int referenceLayer;
+  bool integer;
+  int columns;
+  std::vector<bool> identical;  // per tile, from hashes
+  std::vector<uint8_t> changed; // per tile, from pixel values
+};
+
+void processBand(Comparison& comparison, int band, BandResult& result)
+{
+  Image const& image = comparison.image;
+  int w = image.width();
+  int h = image.height();
+  int c = image.channels(comparison.layer);
+  int y0 = band * bandHeight;
+  int y1 = std::min(y0 + bandHeight, h);
+  int size = TileHashes::tileSize;
+
+  // Columns of tiles which need to be compared. SSIM windows reach into the next
+  // tile row, changes there count too.
+  int rows = (h + size - 1) / size;
+  int first = comparison.columns;
+  int last = -1;
+  for (int row = band; row < std::min(band + 2, rows); ++row) {
+    for (int column = 0; column < comparison.columns; ++column) {
+      if (!comparison.identical[size_t(row) * comparison.columns + column]) {
+        first = std::min(first, column);
+        last = std::max(last, column);
+      }
+    }
+  }
+  int windowRows = 0;
+  for (int y = (y0 + ssimStep - 1) / ssimStep * ssimStep; y < y1 && y + ssimWindow <= h; y += ssimStep) {
+    ++windowRows;
+  }
+  int windowsPerRow = w >= ssimWindow ? (w - ssimWindow) / ssimStep + 1 : 0;
+
+  if (last < 0) {
+    // Identical band: no error, every SSIM window is 1, only invalid pixels are counted.
+    result.invalid = countInvalid(image, comparison.layer, comparison.integer, 0, w, y0, y1);
+    result.valid = uint64_t(y1 - y0) * w - result.invalid;
+    result.ssimWindows = uint64_t(windowRows) * windowsPerRow;
+    for (int ch = 0; ch < c; ++ch) {
+      result.ssim[ch] = double(result.ssimWindows);
+    }
+    return;
+  }
+
+  int lo = first * size;
+  int hi = std::min((last + 1) * size, w);
+  int x0 = std::max(lo - ssimWindow, 0);
+  int x1 = std::min(hi + ssimWindow, w);
+  int extractBegin = std::max(y0 - 1, 0);
+  int extractEnd = std::min(y1 + ssimWindow, h);
+
+  Planes a, b;
+  extract(image, comparison.layer, comparison.integer, x0, x1, extractBegin, extractEnd, a);
+  extract(comparison.reference, comparison.referenceLayer, comparison.integer, x0, x1, extractBegin, extractEnd, b);
+  int width = x1 - x0;
+  uint8_t* changed = comparison.changed.data() + size_t(band) * comparison.columns;
+
+  // Pixels with a non-finite value in any channel of either image are skipped.
+  std::vector<float> valid(size_t(y1 - y0) * width, 1.0f);
+  for (int y = y0; y < y1; ++y) {
+    float* v = valid.data() + size_t(y - y0) * width;
+    for (int ch = 0; ch < c; ++ch) {
+      float const* ra = a.row(ch, y);
+      float const* rb = b.row(ch, y);
+      for (int x = 0; x < width; ++x) {
+        if (!std::isfinite(ra[x]) || !std::isfinite(rb[x])) {
+          v[x] = 0.0f;
+          if (std::memcmp(ra + x, rb + x, sizeof(float)) != 0) {
+            changed[(x0 + x) / size] = 1;
+          }
+        }
+      }
+    }
+    for (int x = 0; x < width; ++x) {
+      result.valid += v[x] == 1.0f;
+    }
+  }
+  result.invalid = uint64_t(y1 - y0) * width - result.valid;
+  result.invalid += countInvalid(image, comparison.layer, comparison.integer, 0, x0, y0, y1);
+  result.invalid += countInvalid(image, comparison.layer, comparison.integer, x1, w, y0, y1);
+  result.valid = uint64_t(y1 - y0) * w - result.invalid;
+
+  // Errors are accumulated per tile to find the tiles that changed.
+  for (int ch = 0; ch < c; ++ch) {
+    for (int y = y0; y < y1; ++y) {
+      float const* v = valid.data() + size_t(y - y0) * width;
+      for (int begin = x0; begin < x1; begin = (begin / size + 1) * size) {
+        int end = std::min((begin / size + 1) * size, x1);
+        int i = begin - x0;
+        if (accumulateErrors(a.row(ch, y) + i, b.row(ch, y) + i, v + i, end - begin, result, ch) > 0.0f) {
+          changed[begin / size] = 1;
+        }
+      }
+    }
+  }
+
+  // SSIM windows are assigned to the band containing their top row. Windows
+  // outside the changed columns compare equal pixels.
+  for (int y = (y0 + ssimStep - 1) / ssimStep * ssimStep; y < y1 && y + ssimWindow <= h; y += ssimStep) {
+    for (int x = 0; x + ssimWindow <= w; x += ssimStep) {
+      bool compare = x + ssimWindow > lo && x < hi;
+      for (int ch = 0; ch < c; ++ch) {
+        result.ssim[ch] += compare ? windowSsim(a, b, ch, x - x0, y) : 1.0;
+      }
+      ++result.ssimWindows;
+    }
+  }
+
+  if (!comparison.integer) {
+    accumulatePerceptual(a, b, y0, y1, h, valid, result);
+  }
+}
+
+// Bounding boxes of 8-connected groups of changed tiles.
+std::vector<ImageMetrics::Region> changedRegions(std::vector<uint8_t> const& changed, int columns, int w, int h)
+{
+  int size = TileHashes::tileSize;
+  int rows = columns > 0 ? int(changed.size()) / columns : 0;
+  std::vector<bool> visited(changed.size(), false);
+  std::vector<ImageMetrics::Region> regions;
+  for (int start = 0; start < int(changed.size()); ++start) {
+    if (!changed[start] || visited[start]) {
+      continue;
+    }
+    int minX = columns, minY = rows, maxX = -1, maxY = -1;
+    std::vector<int> stack = { start };
+    visited[start] = true;
+    while (!stack.empty()) {
+      int tile = stack.back();
+      stack.pop_back();
+      int tx = tile % columns;
+      int ty = tile / columns;
+      minX = std::min(minX, tx);
+      maxX = std::max(maxX, tx);
+      minY = std::min(minY, ty);
+      maxY = std::max(maxY, ty);
+      for (int ny = std::max(ty - 1, 0); ny <= std::min(ty + 1, rows - 1); ++ny) {
+        for (int nx = std::max(tx - 1, 0); nx <= std::min(tx + 1, columns - 1); ++nx) {
+          int neighbor = ny * columns + nx;
+          if (changed[neighbor] && !visited[neighbor]) {
+            visited[neighbor] = true;
+            stack.push_back(neighbor);
+          }
+        }
+      }
+    }
+    int x = minX * size;
+    int y = minY * size;
+    regions.push_back({ x, y, std::min((maxX + 1) * size, w) - x, std::min((maxY + 1) * size, h) - y });
+  }
+  return regions;
+}
+
+}
+
+Result<ImageMetrics> computeMetrics(Image const& image, Image const& reference, int layer, int referenceLayer)
+{
+  if (referenceLayer < 0) {
+    referenceLayer = layer;
+  }
+  if (image.width() != reference.width() || image.height() != reference.height()) {
+    return Result<ImageMetrics>("Images have different resolutions.");
+  }
+  int layerCount = std::max(1, int(image.layers().size()));
+  int referenceLayerCount = std::max(1, int(reference.layers().size()));
+  if (layer < 0 || layer >= layerCount || referenceLayer >= referenceLayerCount) {
+    return Result<ImageMetrics>("Layer does not exist in both images.");
+  }
+  if (image.channels(layer) != reference.channels(referenceLayer)) {
+    return Result<ImageMetrics>("Images have a different number of channels.");
+  }
+  bool integer = layer < int(image.layers().size()) && image.layers()[layer].display == Image::Integer;
+
+  int c = image.channels(layer);
+  auto identical = identicalTiles(image, layer, reference, referenceLayer);
+  int columns = image.tileHashes()->columns;
+  Comparison comparison{ image, reference, layer, referenceLayer, integer, columns, identical,
+    std::vector<uint8_t>(identical.size(), 0) };
+  int bands = (image.height() + bandHeight - 1) / bandHeight;
+  std::vector<BandResult> results(bands, BandResult(c));
+  parallelFor(bands, [&](int begin, int end) {
+    for (int band = begin; band < end; ++band) {
+      processBand(comparison, band, results[band]);
+    }
+  }, 1);
+
+  // Merged in band order, so results do not depend on scheduling.
+  BandResult total(c);
+  for (auto const& r : results) {
+    for (int ch = 0; ch < c; ++ch) {
+      total.squared[ch] += r.squared[ch];
+      total.relative[ch] += r.relative[ch];
+      total.ssim[ch] += r.ssim[ch];
+      total.maxSquared[ch] = std::max(total.maxSquared[ch], r.maxSquared[ch]);
+    }
+    total.valid += r.valid;
+    total.invalid += r.invalid;
+    total.ssimWindows += r.ssimWindows;
+    total.perceptual += r.perceptual;
+  }
+
+  auto psnr = [](double mse) {
+    return mse > 0.0 ? 10.0 * std::log10(1.0 / mse) : std::numeric_limits<double>::infinity();
+  };
+  double n = double(std::max<uint64_t>(total.valid, 1));
+  ImageMetrics metrics;
+  metrics.invalidPixels = total.invalid;
+  metrics.changedRegions = changedRegions(comparison.changed, columns, image.width(), image.height());
+  metrics.identical = metrics.changedRegions.empty();
+  metrics.perceptual = integer ? 0.0 : total.perceptual / n;
+  for (int ch = 0; ch < c; ++ch) {
+    ChannelMetrics m;
+    m.mse = total.squared[ch] / n;
+    m.rmse = std::sqrt(m.mse);
+    m.relativeMse = total.relative[ch] / n;
+    m.psnr = psnr(m.mse);
+    m.ssim = total.ssimWindows > 0 ? total.ssim[ch] / double(total.ssimWindows) : 1.0;
+    m.maxError = std::sqrt(double(total.maxSquared[ch]));
+    metrics.channels.push_back(m);
+  }
+
+  int colorChannels = (c == 2 || c == 4) ? c - 1 : c;
+  auto& color = metrics.color;
+  color.ssim = 0.0;
+  for (int ch = 0; ch < colorChannels; ++ch) {
+    color.mse += metrics.channels[ch].mse / colorChannels;
+    color.relativeMse += metrics.channels[ch].relativeMse / colorChannels;
+    color.ssim += metrics.channels[ch].ssim / colorChannels;
+    color.maxError = std::max(color.maxError, metrics.channels[ch].maxError);
+  }
+  color.rmse = std::sqrt(color.mse);
+  color.psnr = psnr(color.mse);
+
+  return Result<ImageMetrics>(std::move(metrics));
+}
+
+ImageMetrics identicalMetrics(int channels)
+{
+  ChannelMetrics m;
+  m.psnr = std::numeric_limits<double>::infinity();
+  ImageMetrics metrics;
+  metrics.channels.assign(channels, m);
+  metrics.color = m;
+  metrics.identical = true;
+  return metrics;
+}
+
+bool filesIdentical(std::string const& pathA, std::string const& pathB)
+{
+  std::ifstream a(pathA, std::ios::binary | std::ios::ate);
+  std::ifstream b(pathB, std::ios::binary | std::ios::ate);
+  if (!a || !b || a.tellg() != b.tellg()) {
+    return false;
+  }
+  a.seekg(0);
+  b.seekg(0);
+  constexpr size_t chunkSize = 1 << 20;
+  std::vector<char> bufferA(chunkSize);
+  std::vector<char> bufferB(chunkSize);
+  while (a && b) {
+    a.read(bufferA.data(), chunkSize);
+    b.read(bufferB.data(), chunkSize);
+    if (a.gcount() != b.gcount() || std::memcmp(bufferA.data(), bufferB.data(), size_t(a.gcount())) != 0) {
+      return false;
+    }
+  }
+  return a.eof() && b.eof();
+}
+
+}
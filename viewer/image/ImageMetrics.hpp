@@ -0,0 +1,62 @@
+#pragma once
+
+#include <image/Image.hpp>
+
+#include <vector>
+
+namespace hdrv {
+
+struct ChannelMetrics
+{
+  double mse = 0.0;
+  double rmse = 0.0;
+  double relativeMse = 0.0; // squared error relative to the squared reference value
+  double psnr = 0.0;        // for a peak value of 1, infinite for identical channels
+  double ssim = 1.0;
+  double maxError = 0.0;
+};
+
+struct ImageMetrics
+{
+  // Rectangle in pixels from the top-left corner.
+  struct Region
+  {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+  };
+
+  std::vector<ChannelMetrics> channels;
+  ChannelMetrics color;    // averaged over color channels, excluding alpha
+  double perceptual = 0.0; // mean FLIP-style error in [0, 1]
+  uint64_t invalidPixels = 0; // NaN or Inf in either image, excluded from all but SSIM
+  bool identical = false;     // no pixel differs
+  // Bounding boxes of connected groups of 64x64 tiles containing differences.
+  std::vector<Region> changedRegions;
+};
+
+// Compares a layer of an image against a layer of a reference image, by default
+// the one with the same index.
+// LDR values are normalized to [0, 1]. SSIM and the perceptual error work on
+// display values, HDR values are clamped to [0, 1] for them.
+//
+// The perceptual error follows the structure of NVIDIA's FLIP: a color term
+// (HyAB distance in L*a*b*) raised to the power of one minus an edge term
+// (difference of Sobel gradient magnitudes of L*). It does not model the
+// contrast sensitivity filtering of the viewing distance.
+//
+// Tiles with equal content hashes (see TileHashes) are not compared pixel by
+// pixel, so the cost is proportional to the changed area.
+Result<ImageMetrics> computeMetrics(Image const& image, Image const& reference, int layer = 0,
+  int referenceLayer = -1);
+
+// Metrics of a layer with the given number of channels compared against
+// itself, for files not decoded because their bytes are identical. Invalid
+// pixels are not counted.
+ImageMetrics identicalMetrics(int channels);
+
+// Whether two files have the same size and contents.
+bool filesIdentical(std::string const& pathA, std::string const& pathB);
+
+}
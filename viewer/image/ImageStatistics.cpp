@@ -0,0 +1,312 @@
+#include <image/ImageStatistics.hpp>
+#include <image/Image.hpp>
+#include <image/Parallel.hpp>
+#include <image/Simd.hpp>
+
+#include <QThreadPool>
+
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace hdrv {
+
+// Histogram
+
+int Histogram::binOf(float value)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(float));
+  int exponent = int((bits >> 23) & 0xff) - 127;
+  if (exponent < minExponent) {
+    return zeroBin;
+  }
+  // The top mantissa bits split each stop into 8 bins.
+  int offset = std::min((exponent - minExponent) * binsPerStop + int((bits >> 20) & 0x7), sideBins - 1);
+  return (bits >> 31) ? zeroBin - 1 - offset : zeroBin + 1 + offset;
+}
+
+float Histogram::lowerBound(int bin)
+{
+  float zero = std::ldexp(1.0f, minExponent);
+  if (bin == zeroBin) {
+    return -zero;
+  } else if (bin > zeroBin) {
+    int offset = bin - zeroBin - 1;
+    return std::ldexp(1.0f + float(offset % binsPerStop) / binsPerStop, minExponent + offset / binsPerStop);
+  } else {
+    return -upperBound(2 * zeroBin - bin);
+  }
+}
+
+float Histogram::upperBound(int bin)
+{
+  float zero = std::ldexp(1.0f, minExponent);
+  if (bin == zeroBin) {
+    return zero;
+  } else if (bin > zeroBin) {
+    int offset = bin - zeroBin;
+    return std::ldexp(1.0f + float(offset % binsPerStop) / binsPerStop, minExponent + offset / binsPerStop);
+  } else {
+    return -lowerBound(2 * zeroBin - bin);
+  }
+}
+
+uint64_t Histogram::total() const
+{
+  return std::accumulate(bins.begin(), bins.end(), uint64_t(0));
+}
+
+float Histogram::percentile(double q, float min, float max) const
+{
+  uint64_t n = total();
+  if (n == 0) {
+    return 0.0f;
+  }
+  double target = std::clamp(q, 0.0, 1.0) * double(n);
+  double cumulative = 0.0;
+  for (int i = 0; i < binCount; ++i) {
+    if (bins[i] > 0 && cumulative + double(bins[i]) >= target) {
+      double t = (target - cumulative) / double(bins[i]);
+      double lower = std::clamp(lowerBound(i), min, max);
+      double upper = std::clamp(upperBound(i), min, max);
+      return float(lower + t * (upper - lower));
+    }
+    cumulative += double(bins[i]);
+  }
+  return std::clamp(upperBound(binCount - 1), min, max);
+}
+
+Histogram& Histogram::operator+=(Histogram const& other)
+{
+  for (int i = 0; i < binCount; ++i) {
+    bins[i] += other.bins[i];
+  }
+  return *this;
+}
+
+float ChannelStatistics::percentile(double q) const
+{
+  return count == 0 ? 0.0f : histogram.percentile(q, min, max);
+}
+
+// Statistics
+
+namespace {
+
+// Adds a partial result (count, mean, sum of squared deviations) using Chan's
+// parallel variance update, which stays accurate for large counts.
+void combine(ChannelStatistics& s, double& m2, double count, double mean, double partialM2)
+{
+  if (count == 0.0) {
+    return;
+  }
+  double total = double(s.count) + count;
+  double delta = mean - s.mean;
+  s.mean += delta * count / total;
+  m2 += partialM2 + delta * delta * double(s.count) * count / total;
+  s.count += uint64_t(count);
+}
+
+struct Accumulator
+{
+  std::vector<ChannelStatistics> channels;
+  std::vector<double> m2;
+
+  explicit Accumulator(int channelCount) : channels(channelCount), m2(channelCount, 0.0) {}
+
+  void merge(Accumulator const& other)
+  {
+    for (size_t c = 0; c < channels.size(); ++c) {
+      auto& s = channels[c];
+      auto const& o = other.channels[c];
+      combine(s, m2[c], double(o.count), o.mean, other.m2[c]);
+      s.min = std::min(s.min, o.min);
+      s.max = std::max(s.max, o.max);
+      s.nanCount += o.nanCount;
+      s.infCount += o.infCount;
+      s.negativeCount += o.negativeCount;
+      s.histogram += o.histogram;
+    }
+  }
+};
+
+// Converts a row of a layer to float values in the range of Image::value().
+float const* rowValues(Image const& image, int layer, bool integer, int y, std::vector<float>& buffer)
+{
+  size_t count = size_t(image.width()) * image.channels(layer);
+  auto row = image.row(y, layer);
+  switch (image.format()) {
+    case Image::Byte:
+      std::copy(row, row + count, buffer.begin());
+      return buffer.data();
+    case Image::Short: {
+      auto shorts = reinterpret_cast<uint16_t const*>(row);
+      std::transform(shorts, shorts + count, buffer.begin(), [](uint16_t v) { return float(v) / 257.0f; });
+      return buffer.data();
+    }
+    default:
+      if (integer) {
+        auto ints = reinterpret_cast<uint32_t const*>(row);
+        std::transform(ints, ints + count, buffer.begin(), [](uint32_t v) { return float(v); });
+        return buffer.data();
+      }
+      return reinterpret_cast<float const*>(row);
+  }
+}
+
+// Values are processed 4 at a time, which for 3 channels only lines up with the
+// channels again after 3 vectors. Every lane of this period keeps its own sums,
+// they are combined per channel after each block.
+constexpr int maxPeriod = 3;
+constexpr int blockVectors = 64; // per period lane, keeps sums in float precise
+
+void accumulateBlock(float const* values, int periods, int period, int channelCount, Accumulator& acc)
+{
+  Float4 inf(std::numeric_limits<float>::infinity());
+  Float4 zero(0.0f);
+  Float4 one(1.0f);
+  Float4 sum[maxPeriod], count[maxPeriod], lo[maxPeriod], hi[maxPeriod], nan[maxPeriod], infinite[maxPeriod], negative[maxPeriod];
+  for (int k = 0; k < period; ++k) {
+    sum[k] = count[k] = nan[k] = infinite[k] = negative[k] = zero;
+    lo[k] = inf;
+    hi[k] = zero - inf;
+  }
+  // First pass: counts, sums and range.
+  for (int i = 0; i < periods; ++i) {
+    for (int k = 0; k < period; ++k) {
+      Float4 x = Float4::load(values + (i * period + k) * 4);
+      Float4 isNumber = x == x;
+      Float4 finite = x * zero == zero;
+      sum[k] = sum[k] + select(finite, x, zero);
+      count[k] = count[k] + select(finite, one, zero);
+      lo[k] = min(lo[k], select(finite, x, inf));
+      hi[k] = max(hi[k], select(finite, x, zero - inf));
+      nan[k] = nan[k] + select(isNumber, zero, one);
+      infinite[k] = infinite[k] + select(isNumber, select(finite, zero, one), zero);
+      negative[k] = negative[k] + select(x < zero, one, zero);
+    }
+  }
+  // Second pass over the (cached) block: squared deviations from the block mean.
+  Float4 mean[maxPeriod], m2[maxPeriod];
+  for (int k = 0; k < period; ++k) {
+    mean[k] = sum[k] / max(count[k], one);
+    m2[k] = zero;
+  }
+  for (int i = 0; i < periods; ++i) {
+    for (int k = 0; k < period; ++k) {
+      Float4 x = Float4::load(values + (i * period + k) * 4);
+      Float4 finite = x * zero == zero;
+      Float4 d = select(finite, x - mean[k], zero);
+      m2[k] = m2[k] + d * d;
+    }
+  }
+  // Distribute lanes to channels.
+  for (int k = 0; k < period; ++k) {
+    float laneCount[4], laneMean[4], laneM2[4], laneMin[4], laneMax[4], laneNan[4], laneInf[4], laneNeg[4];
+    count[k].store(laneCount);
+    mean[k].store(laneMean);
+    m2[k].store(laneM2);
+    lo[k].store(laneMin);
+    hi[k].store(laneMax);
+    nan[k].store(laneNan);
+    infinite[k].store(laneInf);
+    negative[k].store(laneNeg);
+    for (int lane = 0; lane < 4; ++lane) {
+      int c = (k * 4 + lane) % channelCount;
+      auto& s = acc.channels[c];
+      combine(s, acc.m2[c], laneCount[lane], laneMean[lane], laneM2[lane]);
+      s.min = std::min(s.min, laneMin[lane]);
+      s.max = std::max(s.max, laneMax[lane]);
+      s.nanCount += uint64_t(laneNan[lane]);
+      s.infCount += uint64_t(laneInf[lane]);
+      s.negativeCount += uint64_t(laneNeg[lane]);
+    }
+  }
+}
+
+void accumulateScalar(float x, ChannelStatistics& s, double& m2)
+{
+  if (std::isnan(x)) {
+    ++s.nanCount;
+    return;
+  }
+  if (x < 0.0f) {
+    ++s.negativeCount;
+  }
+  if (std::isinf(x)) {
+    ++s.infCount;
+    return;
+  }
+  combine(s, m2, 1.0, x, 0.0);
+  s.min = std::min(s.min, x);
+  s.max = std::max(s.max, x);
+}
+
+void accumulateRow(float const* values, int channelCount, size_t count, Accumulator& acc)
+{
+  int period = std::lcm(channelCount, 4) / 4;
+  Q_ASSERT(period <= maxPeriod);
+  size_t periodSize = size_t(period) * 4;
+  size_t i = 0;
+  while (i + periodSize <= count) {
+    int periods = int(std::min<size_t>(blockVectors, (count - i) / periodSize));
+    accumulateBlock(values + i, periods, period, channelCount, acc);
+    i += periods * periodSize;
+  }
+  for (; i < count; ++i) {
+    int c = int(i % channelCount);
+    accumulateScalar(values[i], acc.channels[c], acc.m2[c]);
+  }
+  for (size_t j = 0; j < count; ++j) {
+    float x = values[j];
+    if (std::isfinite(x)) {
+      ++acc.channels[j % channelCount].histogram.bins[Histogram::binOf(x)];
+    }
+  }
+}
+
+}
+
+LayerStatistics computeStatistics(Image const& image, int layer)
+{
+  int w = image.width();
+  int h = image.height();
+  int channelCount = image.channels(layer);
+  bool integer = layer < int(image.layers().size()) && image.layers()[layer].display == Image::Integer;
+
+  // Rows are split into a fixed number of chunks so results are merged in the
+  // same order every time, independent of thread scheduling.
+  int threads = std::max(1, QThreadPool::globalInstance()->maxThreadCount());
+  int chunkCount = std::clamp(h / 16, 1, threads * 4);
+  std::vector<Accumulator> chunks(chunkCount, Accumulator(channelCount));
+  parallelFor(chunkCount, [&](int begin, int end) {
+    std::vector<float> buffer(size_t(w) * channelCount);
+    for (int chunk = begin; chunk < end; ++chunk) {
+      int rowBegin = int(int64_t(h) * chunk / chunkCount);
+      int rowEnd = int(int64_t(h) * (chunk + 1) / chunkCount);
+      for (int y = rowBegin; y < rowEnd; ++y) {
+        auto values = rowValues(image, layer, integer, y, buffer);
+        accumulateRow(values, channelCount, buffer.size(), chunks[chunk]);
+      }
+    }
+  }, 1);
+
+  Accumulator result(channelCount);
+  for (auto const& chunk : chunks) {
+    result.merge(chunk);
+  }
+  LayerStatistics statistics;
+  statistics.channels = std::move(result.channels);
+  for (int c = 0; c < channelCount; ++c) {
+    auto& s = statistics.channels[c];
+    s.variance = s.count > 0 ? result.m2[c] / double(s.count) : 0.0;
+  }
+  // Rows were accumulated in memory order.
+  if (image.channelOrder() == Image::BGRA) {
+    std::swap(statistics.channels[0], statistics.channels[2]);
+  }
+  return statistics;
+}
+
+}
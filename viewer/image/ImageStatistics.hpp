@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace hdrv {
+
+class Image;
+
+// Histogram over finite values with logarithmic bins: 8 bins per stop between
+// 2^-24 and 2^24, mirrored for negative values. Magnitudes below 2^-24 fall
+// into the zero bin in the middle, larger ones into the outermost bins.
+struct Histogram
+{
+  static constexpr int binsPerStop = 8;
+  static constexpr int minExponent = -24;
+  static constexpr int maxExponent = 24;
+  static constexpr int sideBins = (maxExponent - minExponent) * binsPerStop;
+  static constexpr int zeroBin = sideBins;
+  static constexpr int binCount = 2 * sideBins + 1;
+
+  std::array<uint64_t, binCount> bins = {};
+
+  static int binOf(float value);
+  // Range of values falling into a bin. Bins are ordered by value.
+  static float lowerBound(int bin);
+  static float upperBound(int bin);
+
+  uint64_t total() const;
+  // Approximate value below which the fraction q of all values lies, the error
+  // is bounded by the width of a bin (1/8 stop). Knowing the range of values
+  // narrows the outermost bins.
+  float percentile(double q, float min = -std::numeric_limits<float>::infinity(),
+    float max = std::numeric_limits<float>::infinity()) const;
+
+  Histogram& operator+=(Histogram const& other);
+};
+
+struct ChannelStatistics
+{
+  // Computed over finite values only.
+  float min = std::numeric_limits<float>::infinity();
+  float max = -std::numeric_limits<float>::infinity();
+  double mean = 0.0;
+  double variance = 0.0;
+  uint64_t count = 0;
+
+  uint64_t nanCount = 0;
+  uint64_t infCount = 0;
+  uint64_t negativeCount = 0; // including -inf
+
+  Histogram histogram;
+
+  float percentile(double q) const;
+};
+
+struct LayerStatistics
+{
+  std::vector<ChannelStatistics> channels;
+};
+
+// Computes statistics for all channels of a layer in a single multi-threaded
+// pass. Values are in the same range as Image::value(). Prefer Image::statistics()
+// which caches the result.
+LayerStatistics computeStatistics(Image const& image, int layer);
+
+}
@@ -0,0 +1,145 @@
+#include <image/Metrics.hpp>
+#include <image/Trace.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+
+namespace hdrv::metrics {
+
+namespace {
+
+struct Registry
+{
+  std::mutex mutex;
+  std::map<std::string, std::unique_ptr<Counter>> counters;
+  std::map<std::string, std::unique_ptr<Histogram>> histograms;
+};
+
+// Never destroyed, metrics may still be recorded while statics are torn down.
+Registry& registry()
+{
+  static Registry* registry = new Registry;
+  return *registry;
+}
+
+template<typename T>
+T& lookup(std::map<std::string, std::unique_ptr<T>>& metrics, std::string const& name)
+{
+  std::lock_guard<std::mutex> lock(registry().mutex);
+  auto& metric = metrics[name];
+  if (!metric) {
+    metric = std::make_unique<T>();
+  }
+  return *metric;
+}
+
+int bucketOf(double value)
+{
+  if (!(value >= std::ldexp(1.0, Histogram::minExponent))) {
+    return 0;
+  }
+  int bucket = 1 + int(std::floor((std::log2(value) - Histogram::minExponent) * Histogram::bucketsPerStop));
+  return std::min(bucket, Histogram::bucketCount - 1);
+}
+
+double upperBound(int bucket)
+{
+  return std::exp2(Histogram::minExponent + double(bucket) / Histogram::bucketsPerStop);
+}
+
+std::string number(double value)
+{
+  if (!std::isfinite(value)) {
+    return "null";
+  }
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.6g", value);
+  return text;
+}
+
+}
+
+void Histogram::record(double value)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++count_;
+  sum_ += value;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+  ++buckets_[bucketOf(value)];
+}
+
+Histogram::Summary Histogram::summary() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  Summary summary;
+  summary.count = count_;
+  if (count_ > 0) {
+    summary.sum = sum_;
+    summary.min = min_;
+    summary.max = max_;
+    summary.p50 = percentile(0.5);
+    summary.p90 = percentile(0.9);
+    summary.p99 = percentile(0.99);
+  }
+  return summary;
+}
+
+// Upper bound of the bucket reaching the fraction q of all values, within the
+// observed range.
+double Histogram::percentile(double q) const
+{
+  uint64_t target = uint64_t(std::ceil(q * double(count_)));
+  uint64_t sum = 0;
+  for (int bucket = 0; bucket < bucketCount; ++bucket) {
+    sum += buckets_[bucket];
+    if (sum >= target && sum > 0) {
+      return std::clamp(upperBound(bucket), min_, max_);
+    }
+  }
+  return max_;
+}
+
+Counter& counter(std::string const& name)
+{
+  return lookup(registry().counters, name);
+}
+
+Histogram& histogram(std::string const& name)
+{
+  return lookup(registry().histograms, name);
+}
+
+std::string toJson()
+{
+  auto& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  std::string json = "{\"counters\":{";
+  for (auto i = r.counters.begin(); i != r.counters.end(); ++i) {
+    json += (i == r.counters.begin() ? "\"" : ",\"") + trace::escaped(i->first) + "\":"
+      + std::to_string(i->second->value());
+  }
+  json += "},\"histograms\":{";
+  for (auto i = r.histograms.begin(); i != r.histograms.end(); ++i) {
+    auto s = i->second->summary();
+    json += (i == r.histograms.begin() ? "\"" : ",\"") + trace::escaped(i->first) + "\":{\"count\":"
+      + std::to_string(s.count) + ",\"sum\":" + number(s.sum) + ",\"mean\":" + number(s.count > 0 ? s.sum / double(s.count) : 0.0)
+      + ",\"min\":" + number(s.min) + ",\"p50\":" + number(s.p50) + ",\"p90\":" + number(s.p90)
+      + ",\"p99\":" + number(s.p99) + ",\"max\":" + number(s.max) + "}";
+  }
+  json += "}}";
+  return json;
+}
+
+bool writeJson(std::string const& path)
+{
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file << toJson() << '\n';
+  return bool(file);
+}
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+
+// Counters and histograms of what the viewer spends its time on, eg. load
+// times per file format and stage, cache hit rates and frame times. They are
+// registered by name on first use and live until the process ends. The viewer
+// answers the "stats" command on its socket with all of them as JSON and writes
+// them to the file named by HDRV_METRICS on exit.
+//
+// Names are dot separated, the first part says where they are recorded:
+//   load.<extension>.io/decode/convert/total  milliseconds, per file extension
+//                                             (`other` for unknown types)
+//   load.upload                               milliseconds to create textures
+//   load.bytesRead                            bytes of image files read
+//   previewCache.hits/misses, queryCache.hits/misses
+//   render.paint                              CPU milliseconds per frame
+//   render.uploadStep                         milliseconds per frame streaming textures
+//   render.textureBytes                       estimated GPU memory of textures
+//   jobs.waiting                              loads queued but not started
+//   jobs.queued/cancelled                     loads and exports
+
+namespace hdrv::metrics {
+
+// Counts events or bytes. Gauges (eg. memory in use) also add negative values.
+class Counter
+{
+public:
+  void add(int64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<int64_t> value_{ 0 };
+};
+
+// Distribution of non-negative values (eg. durations in milliseconds) with
+// buckets of a quarter stop between 2^-10 and 2^20, smaller and larger values
+// fall into the first and last bucket. Percentiles are accurate to a bucket.
+class Histogram
+{
+public:
+  static constexpr int bucketsPerStop = 4;
+  static constexpr int minExponent = -10;
+  static constexpr int maxExponent = 20;
+  static constexpr int bucketCount = (maxExponent - minExponent) * bucketsPerStop + 2;
+
+  void record(double value);
+
+  struct Summary
+  {
+    uint64_t count = 0;
+    double sum = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+    double p50 = 0.0;
+    double p90 = 0.0;
+    double p99 = 0.0;
+  };
+  Summary summary() const;
+
+private:
+  double percentile(double q) const;
+
+  mutable std::mutex mutex_;
+  uint64_t count_ = 0;
+  double sum_ = 0.0;
+  double min_ = std::numeric_limits<double>::infinity();
+  double max_ = 0.0;
+  std::array<uint64_t, bucketCount> buckets_ = {};
+};
+
+// Looks up or registers a metric. Hot paths keep the reference.
+Counter& counter(std::string const& name);
+Histogram& histogram(std::string const& name);
+
+// Records the milliseconds from construction to stop() or destruction.
+class Timer
+{
+public:
+  explicit Timer(Histogram& histogram)
+    : histogram_(&histogram)
+    , start_(std::chrono::steady_clock::now())
+  {}
+  ~Timer() { stop(); }
+  Timer(Timer const&) = delete;
+  Timer& operator=(Timer const&) = delete;
+
+  // Records the time so far, later calls do nothing.
+  void stop()
+  {
+    if (histogram_) {
+      histogram_->record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count());
+      histogram_ = nullptr;
+    }
+  }
+
+private:
+  Histogram* histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// All metrics as a JSON object with "counters" and "histograms" by name.
+std::string toJson();
+// Writes toJson() to a file.
+bool writeJson(std::string const& path);
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace hdrv {
+
+// Splits the range [0, count) into contiguous blocks of at least minBlockSize
+// elements and calls fn(begin, end) for each of them on the global thread pool.
+// Returns when all blocks are done. The calling thread takes part in the work,
+// so it is safe to use from inside another pool task.
+template<typename F>
+void parallelFor(int count, F&& fn, int minBlockSize = 16)
+{
+  int threads = std::max(1, QThreadPool::globalInstance()->maxThreadCount());
+  int blocks = std::clamp(count / std::max(1, minBlockSize), 1, threads * 4);
+  if (blocks <= 1) {
+    fn(0, count);
+    return;
+  }
+  std::vector<int> indices(blocks);
+  std::iota(indices.begin(), indices.end(), 0);
+  QtConcurrent::blockingMap(indices, [&](int block) {
+    int begin = int(int64_t(count) * block / blocks);
+    int end = int(int64_t(count) * (block + 1) / blocks);
+    fn(begin, end);
+  });
+}
+
+}
@@ -0,0 +1,454 @@
+#include <image/PreviewCache.hpp>
+#include <image/ImageStatistics.hpp>
+#include <image/Metrics.hpp>
+#include <image/Thumbnail.hpp>
+#include <image/TileHashes.hpp>
+
+#include <QFile>
+#include <QFloat16>
+#include <QSettings>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <system_error>
+#include <thread>
+
+namespace hdrv {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char entryMagic[8] = { 'H', 'D', 'R', 'V', 'P', 'R', 'V', '2' };
+constexpr char entryExtension[] = ".hdrvp";
+constexpr int maxLevels = 16;
+constexpr size_t hashedBytes = 64 * 1024;
+
+enum EntryFlags : uint32_t
+{
+  DisplayValues = 1, // 8 bit source, values are in [0, 1] instead of linear
+  HasStatistics = 2,
+};
+
+// Fixed start of an entry, followed by the key, the levels and the statistics
+// at the recorded offsets. Values are in native byte order, entries do not
+// leave the machine they were made on.
+struct EntryHeader
+{
+  char magic[8];
+  uint32_t keySize;
+  int32_t width;
+  int32_t height;
+  int32_t channels;
+  uint32_t flags;
+  uint32_t levelCount;
+  uint64_t statisticsOffset;
+  uint64_t statisticsSize;
+  struct Level
+  {
+    int32_t width;
+    int32_t height;
+    uint64_t offset;
+  } levels[maxLevels];
+};
+
+// Identifies the current version of a file, empty if it cannot be accessed.
+std::string fileKey(std::string const& path, bool hashContents)
+{
+  std::error_code error;
+  fs::path file = fs::absolute(fs::u8path(path), error).lexically_normal();
+  auto size = error ? 0 : fs::file_size(file, error);
+  auto time = error ? fs::file_time_type() : fs::last_write_time(file, error);
+  if (error) {
+    return {};
+  }
+  std::string key = file.u8string() + '\n' + std::to_string(size) + '\n'
+    + std::to_string(time.time_since_epoch().count());
+  if (hashContents) {
+    // The first and last bytes cover the header and usually some pixels, which
+    // catches files rewritten within the timestamp resolution.
+    std::ifstream stream(file, std::ios::binary);
+    std::vector<char> buffer(hashedBytes);
+    Hasher hasher;
+    stream.read(buffer.data(), buffer.size());
+    hasher.update(reinterpret_cast<uint8_t const*>(buffer.data()), size_t(stream.gcount()));
+    if (size > hashedBytes) {
+      stream.clear();
+      stream.seekg(std::streamoff(std::max<uintmax_t>(size - hashedBytes, hashedBytes)));
+      stream.read(buffer.data(), buffer.size());
+      hasher.update(reinterpret_cast<uint8_t const*>(buffer.data()), size_t(stream.gcount()));
+    }
+    if (!stream && !stream.eof()) {
+      return {};
+    }
+    key += '\n' + std::to_string(hasher.finish());
+  }
+  return key;
+}
+
+std::string hexName(uint64_t hash)
+{
+  char name[17];
+  std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+  return name;
+}
+
+// Appends plain values to an entry.
+struct Writer
+{
+  std::vector<uint8_t> data;
+
+  template<typename T>
+  void put(T const& value)
+  {
+    auto bytes = reinterpret_cast<uint8_t const*>(&value);
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+  }
+
+  void align()
+  {
+    data.resize((data.size() + 15) & ~size_t(15));
+  }
+};
+
+// Reads plain values from a mapped entry, failing at its end.
+struct Reader
+{
+  uint8_t const* position;
+  uint8_t const* end;
+
+  template<typename T>
+  bool get(T& value)
+  {
+    if (size_t(end - position) < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&value, position, sizeof(T));
+    position += sizeof(T);
+    return true;
+  }
+};
+
+void writeStatistics(Writer& writer, LayerStatistics const& statistics)
+{
+  writer.put(uint32_t(statistics.channels.size()));
+  for (auto const& channel : statistics.channels) {
+    writer.put(channel.min);
+    writer.put(channel.max);
+    writer.put(channel.mean);
+    writer.put(channel.variance);
+    writer.put(channel.count);
+    writer.put(channel.nanCount);
+    writer.put(channel.infCount);
+    writer.put(channel.negativeCount);
+    // Mostly empty, only used bins are stored.
+    auto const& bins = channel.histogram.bins;
+    writer.put(uint32_t(std::count_if(bins.begin(), bins.end(), [](uint64_t n) { return n != 0; })));
+    for (uint32_t i = 0; i < bins.size(); ++i) {
+      if (bins[i] != 0) {
+        writer.put(i);
+        writer.put(bins[i]);
+      }
+    }
+  }
+}
+
+std::shared_ptr<LayerStatistics const> readStatistics(Reader reader)
+{
+  auto statistics = std::make_shared<LayerStatistics>();
+  uint32_t channels = 0;
+  if (!reader.get(channels) || channels > 4) {
+    return nullptr;
+  }
+  statistics->channels.resize(channels);
+  for (auto& channel : statistics->channels) {
+    uint32_t used = 0;
+    if (!reader.get(channel.min) || !reader.get(channel.max) || !reader.get(channel.mean)
+        || !reader.get(channel.variance) || !reader.get(channel.count) || !reader.get(channel.nanCount)
+        || !reader.get(channel.infCount) || !reader.get(channel.negativeCount) || !reader.get(used)) {
+      return nullptr;
+    }
+    for (uint32_t i = 0; i < used; ++i) {
+      uint32_t bin = 0;
+      uint64_t count = 0;
+      if (!reader.get(bin) || !reader.get(count) || bin >= channel.histogram.bins.size()) {
+        return nullptr;
+      }
+      channel.histogram.bins[bin] = count;
+    }
+  }
+  return statistics;
+}
+
+// Maps an entry and checks that it belongs to the key, the mapping is released
+// with the returned pointer.
+std::shared_ptr<uint8_t const> mapEntry(std::string const& path, std::string const& key, size_t& size)
+{
+  auto file = std::make_shared<QFile>(QString::fromStdString(path));
+  if (!file->open(QIODevice::ReadOnly) || file->size() < qint64(sizeof(EntryHeader))) {
+    return nullptr;
+  }
+  size = size_t(file->size());
+  uint8_t const* data = file->map(0, file->size());
+  if (!data) {
+    return nullptr;
+  }
+  std::shared_ptr<uint8_t const> mapping(data, [file](uint8_t const* p) { file->unmap(const_cast<uint8_t*>(p)); });
+  EntryHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, entryMagic, sizeof(entryMagic)) != 0 || header.keySize != key.size()
+      || sizeof(header) + key.size() > size || std::memcmp(data + sizeof(header), key.data(), key.size()) != 0) {
+    return nullptr;
+  }
+  return mapping;
+}
+
+}
+
+Image const* CachedPreview::level(int size) const
+{
+  if (levels.empty()) {
+    return nullptr;
+  }
+  auto longer = [](Image const& image) { return std::max(image.width(), image.height()); };
+  if (longer(levels.front()) < size && longer(levels.front()) < std::max(width, height)) {
+    return nullptr;
+  }
+  for (auto i = levels.rbegin(); i != levels.rend(); ++i) {
+    if (longer(*i) >= size) {
+      return &*i;
+    }
+  }
+  return &levels.front();
+}
+
+PreviewCache& PreviewCache::shared()
+{
+  // Read with explicit names, the thumbnailer shares the viewer's settings.
+  static PreviewCache cache = [] {
+    QSettings settings("hdrv", "hdrv");
+    QString location = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/hdrv/previews";
+    uint64_t megabytes = settings.value("Cache/PreviewCacheMB", 512).toULongLong();
+    return PreviewCache(location.toStdString(), megabytes << 20, settings.value("Cache/HashContents", false).toBool());
+  }();
+  return cache;
+}
+
+PreviewCache::PreviewCache(std::string directory, uint64_t maxBytes, bool hashContents)
+  : directory_(std::move(directory))
+  , maxBytes_(maxBytes)
+  , hashContents_(hashContents)
+{
+}
+
+std::string PreviewCache::entryPath(std::string const& key) const
+{
+  Hasher hasher;
+  hasher.update(reinterpret_cast<uint8_t const*>(key.data()), key.size());
+  return (fs::u8path(directory_) / (hexName(hasher.finish()) + entryExtension)).u8string();
+}
+
+std::shared_ptr<CachedPreview const> PreviewCache::find(std::string const& path) const
+{
+  auto preview = read(path);
+  metrics::counter(preview ? "previewCache.hits" : "previewCache.misses").add();
+  return preview;
+}
+
+std::shared_ptr<CachedPreview const> PreviewCache::read(std::string const& path) const
+{
+  std::string key = fileKey(path, hashContents_);
+  if (key.empty() || maxBytes_ == 0) {
+    return nullptr;
+  }
+  std::string entry = entryPath(key);
+  size_t size = 0;
+  auto mapping = mapEntry(entry, key, size);
+  if (!mapping) {
+    return nullptr;
+  }
+  uint8_t const* data = mapping.get();
+  EntryHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (header.width < 1 || header.height < 1 || header.channels < 1 || header.channels > 4 || header.levelCount < 1
+      || header.levelCount > maxLevels) {
+    return nullptr;
+  }
+
+  auto preview = std::make_shared<CachedPreview>();
+  preview->width = header.width;
+  preview->height = header.height;
+  bool display = header.flags & DisplayValues;
+  for (uint32_t i = 0; i < header.levelCount; ++i) {
+    auto const& level = header.levels[i];
+    size_t count = size_t(level.width) * level.height * header.channels;
+    if (level.width < 1 || level.height < 1 || level.offset > size || count * sizeof(qfloat16) > size - level.offset) {
+      return nullptr;
+    }
+    std::vector<float> values(count);
+    qFloatFromFloat16(values.data(), reinterpret_cast<qfloat16 const*>(data + level.offset), qsizetype(count));
+    std::vector<uint8_t> pixels;
+    if (display) {
+      pixels.resize(count);
+      std::transform(values.begin(), values.end(), pixels.begin(),
+        [](float v) { return uint8_t(std::clamp(v * 255.0f + 0.5f, 0.0f, 255.0f)); });
+    } else {
+      pixels.resize(count * sizeof(float));
+      std::memcpy(pixels.data(), values.data(), pixels.size());
+    }
+    preview->levels.emplace_back(level.width, level.height, header.channels, display ? Image::Byte : Image::Float,
+      std::move(pixels), Image::TopDown);
+  }
+  if ((header.flags & HasStatistics) && header.statisticsOffset <= size
+      && header.statisticsSize <= size - header.statisticsOffset) {
+    preview->statistics = readStatistics({ data + header.statisticsOffset,
+      data + header.statisticsOffset + header.statisticsSize });
+  }
+
+  // Hits count as use for the least recently used cleanup.
+  std::error_code error;
+  fs::last_write_time(fs::u8path(entry), fs::file_time_type::clock::now(), error);
+  return preview;
+}
+
+Result<bool> PreviewCache::store(std::string const& path, Image const& image,
+  std::shared_ptr<LayerStatistics const> statistics)
+{
+  if (maxBytes_ == 0) {
+    return Result<bool>(true);
+  }
+  if (!image.layers().empty() && image.layers()[0].display == Image::Integer) {
+    return Result<bool>("Integer layers are not cached.");
+  }
+  std::string key = fileKey(path, hashContents_);
+  if (key.empty()) {
+    return Result<bool>("Cannot access " + path);
+  }
+  std::string entry = entryPath(key);
+  size_t existingSize = 0;
+  if (auto existing = mapEntry(entry, key, existingSize)) {
+    EntryHeader header;
+    std::memcpy(&header, existing.get(), sizeof(header));
+    if ((header.flags & HasStatistics) || !statistics) {
+      return Result<bool>(true);
+    }
+  }
+
+  int channels = std::clamp(image.channels(), 1, 4);
+  bool display = image.format() != Image::Float;
+  std::vector<Image> levels = { reduceToSize(image, previewSize) };
+  while (int(levels.size()) < maxLevels && std::max(levels.back().width(), levels.back().height()) > 1) {
+    auto const& last = levels.back();
+    levels.push_back(reduceToSize(last, std::max(last.width(), last.height()) / 2));
+  }
+
+  EntryHeader header = {};
+  std::memcpy(header.magic, entryMagic, sizeof(entryMagic));
+  header.keySize = uint32_t(key.size());
+  header.width = image.width();
+  header.height = image.height();
+  header.channels = channels;
+  header.flags = (display ? DisplayValues : 0) | (statistics ? HasStatistics : 0);
+  header.levelCount = uint32_t(levels.size());
+
+  Writer writer;
+  writer.put(header);
+  writer.data.insert(writer.data.end(), key.begin(), key.end());
+  std::vector<float> row;
+  for (size_t i = 0; i < levels.size(); ++i) {
+    auto const& level = levels[i];
+    writer.align();
+    header.levels[i] = { level.width(), level.height(), uint64_t(writer.data.size()) };
+    size_t rowValues = size_t(level.width()) * channels;
+    row.resize(rowValues);
+    for (int y = 0; y < level.height(); ++y) {
+      for (int x = 0; x < level.width(); ++x) {
+        for (int c = 0; c < channels; ++c) {
+          float v = level.value(x, y, std::min(c, level.channels() - 1));
+          row[size_t(x) * channels + c] = display ? v / 255.0f : v;
+        }
+      }
+      size_t offset = writer.data.size();
+      writer.data.resize(offset + rowValues * sizeof(qfloat16));
+      qFloatToFloat16(reinterpret_cast<qfloat16*>(writer.data.data() + offset), row.data(), qsizetype(rowValues));
+    }
+  }
+  if (statistics) {
+    writer.align();
+    header.statisticsOffset = writer.data.size();
+    writeStatistics(writer, *statistics);
+    header.statisticsSize = writer.data.size() - header.statisticsOffset;
+  }
+  std::memcpy(writer.data.data(), &header, sizeof(header));
+
+  // Written aside and renamed, readers in other processes never see a partial entry.
+  std::error_code error;
+  fs::create_directories(fs::u8path(directory_), error);
+  auto unique = std::hash<std::thread::id>()(std::this_thread::get_id())
+    ^ uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+  fs::path temporary = fs::u8path(entry + "." + hexName(unique) + ".tmp");
+  {
+    std::ofstream stream(temporary, std::ios::binary);
+    stream.write(reinterpret_cast<char const*>(writer.data.data()), std::streamsize(writer.data.size()));
+    if (!stream) {
+      stream.close();
+      fs::remove(temporary, error);
+      return Result<bool>("Could not write to the preview cache in " + directory_);
+    }
+  }
+  fs::rename(temporary, fs::u8path(entry), error);
+  if (error) {
+    fs::remove(temporary, error);
+    return Result<bool>("Could not write to the preview cache in " + directory_);
+  }
+
+  if (stores_++ % 32 == 0) {
+    trim();
+  }
+  return Result<bool>(true);
+}
+
+void PreviewCache::trim()
+{
+  struct Entry
+  {
+    fs::path path;
+    fs::file_time_type time;
+    uintmax_t size;
+  };
+  std::vector<Entry> entries;
+  uintmax_t total = 0;
+  std::error_code error;
+  for (fs::directory_iterator i(fs::u8path(directory_), error), end; !error && i != end; i.increment(error)) {
+    if (i->path().extension() != entryExtension) {
+      continue;
+    }
+    std::error_code entryError;
+    Entry entry{ i->path(), i->last_write_time(entryError), i->file_size(entryError) };
+    if (!entryError) {
+      total += entry.size;
+      entries.push_back(std::move(entry));
+    }
+  }
+  if (total <= maxBytes_) {
+    return;
+  }
+  // Down to three quarters, so the next stores do not immediately trim again.
+  std::sort(entries.begin(), entries.end(), [](Entry const& a, Entry const& b) { return a.time < b.time; });
+  for (auto const& entry : entries) {
+    if (total <= maxBytes_ / 4 * 3) {
+      break;
+    }
+    if (fs::remove(entry.path, error)) {
+      total -= entry.size;
+    }
+  }
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <image/Image.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hdrv {
+
+// Downsampled preview and statistics of an image file, as stored in the cache.
+struct CachedPreview
+{
+  int width = 0;  // of the original image
+  int height = 0;
+  // Mip chain of the first layer, top-down. The first level's longer side is
+  // at most PreviewCache::previewSize, each further level is half as large.
+  std::vector<Image> levels;
+  // Of the first layer, only present if the preview was made from the full image.
+  std::shared_ptr<LayerStatistics const> statistics;
+
+  // Smallest level whose longer side is at least `size` pixels, or null if
+  // even the first level is smaller (and not the original size).
+  Image const* level(int size) const;
+};
+
+// Persistent cache of previews and statistics written by the viewer and read
+// by the thumbnailer, so reopening a directory does not decode every file again.
+//
+// Entries are files named by a hash of the image path, its size and
+// modification time and optionally a hash of its first and last 64 KiB. A
+// changed file thus misses and its stale entry ages out. Each entry is a fixed
+// header, the full key, the mip levels as 16 bit half floats and the
+// statistics, and is read through a memory mapping. When the cache grows past
+// its limit the least recently used entries are deleted.
+class PreviewCache
+{
+public:
+  static constexpr int previewSize = 256;
+
+  // The cache in the user's cache directory. Size limit and content hashing are
+  // read from the viewer settings (Cache/PreviewCacheMB, Cache/HashContents).
+  static PreviewCache& shared();
+
+  PreviewCache(std::string directory, uint64_t maxBytes, bool hashContents = false);
+
+  std::string const& directory() const { return directory_; }
+
+  // The entry for an image file if there is one for its current version.
+  std::shared_ptr<CachedPreview const> find(std::string const& path) const;
+
+  // Stores a preview of the first layer of the full image loaded from `path`,
+  // not of a reduced one: its size is kept as that of the original. An existing
+  // entry for the same version is only replaced to add statistics. Images
+  // smaller than the preview size are stored as they are.
+  Result<bool> store(std::string const& path, Image const& image,
+    std::shared_ptr<LayerStatistics const> statistics = {});
+
+  // Deletes least recently used entries until the cache fits its size limit.
+  void trim();
+
+private:
+  std::shared_ptr<CachedPreview const> read(std::string const& path) const;
+  std::string entryPath(std::string const& key) const;
+
+  std::string directory_;
+  uint64_t maxBytes_;
+  bool hashContents_;
+  std::atomic<int> stores_{ 0 };
+};
+
+}
@@ -0,0 +1,955 @@
+#include <image/Scanlines.hpp>
+
+#include <pfm/pfm_input_file.hpp>
+#include <pfm/pfm_output_file.hpp>
+
+#include <pic/pic_input_file.hpp>
+#include <pic/pic_output_file.hpp>
+
+// The tinyexr implementation lives in this file, since streaming EXR chunks
+// needs its internal header and codec functions.
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable:4018)
+#endif
+#define TINYEXR_IMPLEMENTATION
+#define TINYEXR_USE_THREAD 1
+#include <tinyexr.h>
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+
+namespace hdrv {
+
+namespace {
+
+std::string lowerExtension(std::string const& path)
+{
+  auto dot = path.find_last_of('.');
+  auto separator = path.find_last_of("/\\");
+  if (dot == std::string::npos || (separator != std::string::npos && dot < separator)) {
+    return {};
+  }
+  std::string extension = path.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+  return extension;
+}
+
+template<typename T>
+Result<std::unique_ptr<T>> opened(std::unique_ptr<T> file, Result<bool> const& status)
+{
+  if (!status) {
+    return Result<std::unique_ptr<T>>(status.error());
+  }
+  return Result<std::unique_ptr<T>>(std::move(file));
+}
+
+// PFM
+
+class PFMReader : public ScanlineReader
+{
+public:
+  Result<bool> open(std::string const& path)
+  {
+    stream_.open(path, std::ios::binary);
+    if (!stream_) {
+      return Result<bool>("Could not open " + path);
+    }
+    pfm::format_type format;
+    size_t width, height;
+    pfm::byte_order_type byteOrder;
+    double scale;
+    file_.read_header(format, width, height, byteOrder, scale);
+    color_ = format == pfm::color_format;
+    width_ = int(width);
+    height_ = int(height);
+    channelNames_ = color_ ? std::vector<std::string>{ "R", "G", "B" } : std::vector<std::string>{ "L" };
+    order_ = Image::BottomUp;
+    return Result<bool>(true);
+  }
+
+  Result<bool> read(float* row) override
+  {
+    if (color_) {
+      file_.read_color_scanline(reinterpret_cast<pfm::color_pixel*>(row), width_);
+    } else {
+      file_.read_grayscale_scanline(reinterpret_cast<pfm::grayscale_pixel*>(row), width_);
+    }
+    return Result<bool>(true);
+  }
+
+  Result<bool> skip() override
+  {
+    stream_.seekg(std::streamoff(width_) * channels() * std::streamoff(sizeof(float)), std::ios::cur);
+    return stream_ ? Result<bool>(true) : Result<bool>("Unexpected end of PFM file");
+  }
+
+private:
+  std::ifstream stream_;
+  pfm::pfm_input_file file_{ stream_ };
+  bool color_ = true;
+};
+
+// PFM files are bottom-up. Top-down rows are written in place, which works
+// because PFM rows are uncompressed and have a fixed size.
+class PFMWriter : public ScanlineWriter
+{
+public:
+  Result<bool> open(std::string const& path, int width, int height, int channels, Image::Orientation order)
+  {
+    stream_.open(path, std::ios::binary);
+    if (!stream_) {
+      return Result<bool>("Could not create " + path);
+    }
+    width_ = width;
+    height_ = height;
+    channels_ = channels;
+    order_ = order;
+    color_ = channels >= 3;
+    file_.write_header(color_ ? pfm::color_format : pfm::grayscale_format, width, height, pfm::host_byte_order, 1.0);
+    dataStart_ = stream_.tellp();
+    scanline_.resize(size_t(width) * (color_ ? 3 : 1));
+    return Result<bool>(true);
+  }
+
+  Result<bool> write(float const* row) override
+  {
+    int stored = color_ ? 3 : 1;
+    for (int x = 0; x < width_; ++x) {
+      for (int c = 0; c < stored; ++c) {
+        scanline_[size_t(x) * stored + c] = row[size_t(x) * channels_ + c];
+      }
+    }
+    if (order_ == Image::TopDown) {
+      auto rowSize = std::streamoff(width_) * stored * std::streamoff(sizeof(float));
+      stream_.seekp(dataStart_ + std::streamoff(height_ - 1 - y_) * rowSize);
+    }
+    if (color_) {
+      file_.write_color_scanline(reinterpret_cast<pfm::color_pixel const*>(scanline_.data()), width_);
+    } else {
+      file_.write_grayscale_scanline(scanline_.data(), width_);
+    }
+    ++y_;
+    return Result<bool>(true);
+  }
+
+  Result<bool> finish() override
+  {
+    stream_.close();
+    return stream_ ? Result<bool>(true) : Result<bool>("Failed to write PFM file.");
+  }
+
+private:
+  std::ofstream stream_;
+  pfm::pfm_output_file file_{ stream_ };
+  std::streampos dataStart_;
+  std::vector<float> scanline_;
+  int width_ = 0;
+  int height_ = 0;
+  int channels_ = 0;
+  int y_ = 0;
+  bool color_ = true;
+  Image::Orientation order_ = Image::BottomUp;
+};
+
+// Radiance PIC
+
+class PICReader : public ScanlineReader
+{
+public:
+  Result<bool> open(std::string const& path)
+  {
+    stream_.open(path, std::ios::binary);
+    if (!stream_) {
+      return Result<bool>("Could not open " + path);
+    }
+    pic::format_type format;
+    double exposure;
+    file_.read_information_header(format, exposure);
+    if (format != pic::_32_bit_rle_rgbe) {
+      return Result<bool>("Radiance PIC: format not supported.");
+    }
+    pic::resolution_string_type resolutionType;
+    size_t width, height;
+    file_.read_resolution_string(resolutionType, width, height);
+    if (resolutionType >= pic::pos_x_pos_y) {
+      return Result<bool>("Radiance PIC files stored in columns cannot be streamed.");
+    }
+    width_ = int(width);
+    height_ = int(height);
+    channelNames_ = { "R", "G", "B" };
+    order_ = resolutionType == pic::neg_y_pos_x || resolutionType == pic::neg_y_neg_x ? Image::TopDown : Image::BottomUp;
+    mirror_ = resolutionType == pic::neg_y_neg_x || resolutionType == pic::pos_y_neg_x;
+    scanline_.reset(new pic::pixel[width]);
+    return Result<bool>(true);
+  }
+
+  Result<bool> read(float* row) override
+  {
+    file_.read_scanline(scanline_.get(), width_);
+    for (int i = 0; i < width_; ++i) {
+      float* p = row + (mirror_ ? width_ - i - 1 : i) * 3;
+      pic::rgbe_to_rgb(scanline_[i][0], scanline_[i][1], scanline_[i][2], scanline_[i][3], p[0], p[1], p[2]);
+    }
+    return Result<bool>(true);
+  }
+
+  // Run length encoded rows have to be parsed, but only their lengths. This is
+  // done on the stream buffer, pic_input_file reads byte by byte through the
+  // stream which dominates the time otherwise.
+  Result<bool> skip() override
+  {
+    if (width_ < 8 || width_ > 0x7fff) {
+      file_.read_scanline(scanline_.get(), width_);
+      return Result<bool>(true);
+    }
+    auto buffer = stream_.rdbuf();
+    char bytes[128];
+    unsigned char header[4];
+    if (buffer->sgetn(reinterpret_cast<char*>(header), 4) != 4) {
+      return Result<bool>("Unexpected end of Radiance PIC file");
+    }
+    if (header[0] != 2 || header[1] != 2) {
+      // Uncompressed row, the header was its first pixel.
+      buffer->pubseekoff(std::streamoff(width_ - 1) * 4, std::ios::cur, std::ios::in);
+      return Result<bool>(true);
+    }
+    if (((header[2] << 8) | header[3]) != width_) {
+      return Result<bool>("Invalid Radiance PIC scanline");
+    }
+    for (int component = 0; component < 4; ++component) {
+      for (int left = width_; left > 0;) {
+        int byte = buffer->sbumpc();
+        int length = byte > 128 ? byte - 128 : byte;
+        if (byte == std::char_traits<char>::eof() || length == 0 || length > left) {
+          return Result<bool>("Invalid Radiance PIC scanline");
+        }
+        // A run is followed by its value, a dump by its bytes.
+        int size = byte > 128 ? 1 : length;
+        if (buffer->sgetn(bytes, size) != size) {
+          return Result<bool>("Unexpected end of Radiance PIC file");
+        }
+        left -= length;
+      }
+    }
+    return Result<bool>(true);
+  }
+
+private:
+  std::ifstream stream_;
+  pic::pic_input_file file_{ stream_ };
+  std::unique_ptr<pic::pixel[]> scanline_;
+  bool mirror_ = false;
+};
+
+// The resolution string tells the row order, so rows are always written as they come.
+class PICWriter : public ScanlineWriter
+{
+public:
+  Result<bool> open(std::string const& path, int width, int height, int channels, Image::Orientation order)
+  {
+    stream_.open(path, std::ios::binary);
+    if (!stream_) {
+      return Result<bool>("Could not create " + path);
+    }
+    width_ = width;
+    channels_ = channels;
+    file_.write_information_header(pic::_32_bit_rle_rgbe, 1.0);
+    file_.write_resolution_string(order == Image::TopDown ? pic::neg_y_pos_x : pic::pos_y_pos_x, width, height);
+    scanline_.reset(new pic::pixel[width]);
+    return Result<bool>(true);
+  }
+
+  Result<bool> write(float const* row) override
+  {
+    // Gray values are replicated, alpha is dropped.
+    int g = channels_ >= 3 ? 1 : 0;
+    int b = channels_ >= 3 ? 2 : 0;
+    for (int x = 0; x < width_; ++x) {
+      float const* p = row + size_t(x) * channels_;
+      pic::rgb_to_rgbe(p[0], p[g], p[b], scanline_[x][0], scanline_[x][1], scanline_[x][2], scanline_[x][3]);
+    }
+    file_.write_scanline(scanline_.get(), width_);
+    return Result<bool>(true);
+  }
+
+  Result<bool> finish() override
+  {
+    stream_.close();
+    return stream_ ? Result<bool>(true) : Result<bool>("Failed to write Radiance PIC file.");
+  }
+
+private:
+  std::ofstream stream_;
+  pic::pic_output_file file_{ stream_ };
+  std::unique_ptr<pic::pixel[]> scanline_;
+  int width_ = 0;
+  int channels_ = 0;
+};
+
+// ILM OpenEXR
+//
+// Scanline files consist of a header, a table with the file offset of every
+// chunk and the chunks of 1, 16 or 32 rows depending on the compression. The
+// table allows reading and writing chunks in any order; only one chunk of rows
+// is decoded or encoded at a time with the codecs of tinyexr.
+
+bool streamable(int compression)
+{
+  return compression == TINYEXR_COMPRESSIONTYPE_NONE || compression == TINYEXR_COMPRESSIONTYPE_RLE
+    || compression == TINYEXR_COMPRESSIONTYPE_ZIPS || compression == TINYEXR_COMPRESSIONTYPE_ZIP
+    || compression == TINYEXR_COMPRESSIONTYPE_PIZ;
+}
+
+int channelOrder(std::string const& name)
+{
+  static char const* const order[] = { "R", "G", "B", "A" };
+  static char const* const vector[] = { "X", "Y", "Z" };
+  for (int i = 0; i < 4; ++i) {
+    if (name == order[i] || (i < 3 && name == vector[i])) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+// Header of an EXR file. It has no size field and is parsed from a growing
+// prefix of the file.
+struct EXRFile
+{
+  ~EXRFile()
+  {
+    if (parsed) {
+      FreeEXRHeader(&header);
+    }
+  }
+
+  Result<bool> open(std::string const& path)
+  {
+    stream.open(path, std::ios::binary);
+    if (!stream) {
+      return Result<bool>("Could not open " + path);
+    }
+    stream.seekg(0, std::ios::end);
+    size = size_t(stream.tellg());
+    std::vector<unsigned char> head;
+    for (size_t prefix = std::min<size_t>(size, 1 << 16);; prefix = std::min(size, prefix * 4)) {
+      head.resize(prefix);
+      stream.seekg(0);
+      stream.read(reinterpret_cast<char*>(head.data()), prefix);
+      if (!stream || ParseEXRVersionFromMemory(&version, head.data(), prefix) != TINYEXR_SUCCESS) {
+        return Result<bool>("Failed to parse EXR version header");
+      }
+      if (version.multipart || version.non_image) {
+        return Result<bool>("Multi-part EXR files must be loaded as a whole.");
+      }
+      InitEXRHeader(&header);
+      char const* err = nullptr;
+      if (ParseEXRHeaderFromMemory(&header, &version, head.data(), prefix, &err) == TINYEXR_SUCCESS) {
+        parsed = true;
+        return Result<bool>(true);
+      }
+      FreeEXRErrorMessage(err);
+      if (prefix == size) {
+        return Result<bool>("Failed to parse EXR header");
+      }
+    }
+  }
+
+  // Reads the chunk offset table that follows the header.
+  Result<bool> readOffsets(tinyexr::tinyexr_uint64* offsets, size_t count)
+  {
+    stream.seekg(8 + header.header_len);
+    stream.read(reinterpret_cast<char*>(offsets), count * sizeof(tinyexr::tinyexr_uint64));
+    for (size_t i = 0; i < count; ++i) {
+      tinyexr::swap8(&offsets[i]);
+      if (!stream || offsets[i] + 8 > size) {
+        return Result<bool>("Invalid EXR chunk offsets");
+      }
+    }
+    return Result<bool>(true);
+  }
+
+  std::ifstream stream;
+  size_t size = 0;
+  EXRVersion version;
+  EXRHeader header;
+  bool parsed = false;
+};
+
+// Groups channels to layers like Image::loadEXR and picks the one with the
+// given name, or the first. Channels are returned as indices into the header
+// in R, G, B, A order, together with their names without the layer prefix.
+Result<bool> selectLayer(EXRHeader const& header, std::string const& layer, std::vector<int>& channels,
+  std::vector<std::string>& channelNames, bool& partial)
+{
+  std::vector<std::string> layerNames;
+  std::vector<std::vector<int>> layerChannels;
+  for (int i = 0; i < header.num_channels; ++i) {
+    std::string fullName = header.channels[i].name;
+    auto n = fullName.rfind('.');
+    std::string name = header.name;
+    if (n != std::string::npos) {
+      name = (name.empty() ? "" : name + " - ") + fullName.substr(0, n);
+    }
+    auto l = std::find(layerNames.begin(), layerNames.end(), name);
+    if (l == layerNames.end()) {
+      // Channels without a layer prefix come first.
+      bool front = n == std::string::npos;
+      l = layerNames.insert(front ? layerNames.begin() : layerNames.end(), name);
+      layerChannels.insert(layerChannels.begin() + (l - layerNames.begin()), std::vector<int>());
+    }
+    auto& grouped = layerChannels[l - layerNames.begin()];
+    if (grouped.size() < 4) {
+      grouped.push_back(i);
+    }
+  }
+  size_t index = 0;
+  if (!layer.empty()) {
+    index = std::find(layerNames.begin(), layerNames.end(), layer) - layerNames.begin();
+    if (index == layerNames.size()) {
+      return Result<bool>("No layer '" + layer + "'");
+    }
+  }
+  if (layerChannels.empty()) {
+    return Result<bool>("EXR file has no channels.");
+  }
+  partial = layerNames.size() > 1;
+  channels = layerChannels[index];
+  auto shortName = [&](int i) {
+    std::string name = header.channels[i].name;
+    auto n = name.rfind('.');
+    return n == std::string::npos ? name : name.substr(n + 1);
+  };
+  std::stable_sort(channels.begin(), channels.end(),
+    [&](int a, int b) { return channelOrder(shortName(a)) < channelOrder(shortName(b)); });
+  channelNames.clear();
+  for (int i : channels) {
+    if (header.pixel_types[i] == TINYEXR_PIXELTYPE_UINT) {
+      return Result<bool>("Integer EXR channels cannot be read partially.");
+    }
+    channelNames.push_back(shortName(i));
+  }
+  return Result<bool>(true);
+}
+
+class EXRReader : public ScanlineReader
+{
+public:
+  Result<bool> open(std::string const& path, std::string const& layer)
+  {
+    auto opened = file_.open(path);
+    if (!opened) {
+      return opened;
+    }
+    if (file_.header.tiled) {
+      return Result<bool>("Only single part scanline EXR files can be streamed.");
+    }
+    if (!streamable(file_.header.compression_type)) {
+      return Result<bool>("EXR compression not supported for streaming.");
+    }
+
+    width_ = file_.header.data_window.max_x - file_.header.data_window.min_x + 1;
+    height_ = file_.header.data_window.max_y - file_.header.data_window.min_y + 1;
+    order_ = Image::TopDown;
+    linesPerChunk_ = tinyexr::NumScanlines(file_.header.compression_type);
+    offsets_.resize((height_ + linesPerChunk_ - 1) / linesPerChunk_);
+    auto offsets = file_.readOffsets(offsets_.data(), offsets_.size());
+    if (!offsets) {
+      return offsets;
+    }
+
+    auto selected = selectLayer(file_.header, layer, channels_, channelNames_, partial_);
+    if (!selected) {
+      return selected;
+    }
+
+    size_t channelOffset = 0;
+    tinyexr::ComputeChannelLayout(&channelOffsets_, &pixelDataSize_, &channelOffset, file_.header.num_channels, file_.header.channels);
+    planes_.resize(file_.header.num_channels);
+    planePointers_.resize(file_.header.num_channels);
+    requestedTypes_.resize(file_.header.num_channels);
+    for (int c = 0; c < file_.header.num_channels; ++c) {
+      planes_[c].resize(size_t(width_) * linesPerChunk_ * sizeof(float));
+      planePointers_[c] = planes_[c].data();
+      requestedTypes_[c] = file_.header.pixel_types[c] == TINYEXR_PIXELTYPE_UINT ? TINYEXR_PIXELTYPE_UINT : TINYEXR_PIXELTYPE_FLOAT;
+    }
+    return Result<bool>(true);
+  }
+
+  Result<bool> read(float* row) override
+  {
+    int chunk = y_ / linesPerChunk_;
+    if (chunk != chunk_) {
+      auto decoded = decodeChunk(chunk);
+      if (!decoded) {
+        return decoded;
+      }
+    }
+    size_t line = size_t(y_ - chunk * linesPerChunk_) * width_;
+    int c = channels();
+    for (int i = 0; i < c; ++i) {
+      float const* plane = reinterpret_cast<float const*>(planes_[channels_[i]].data()) + line;
+      for (int x = 0; x < width_; ++x) {
+        row[size_t(x) * c + i] = plane[x];
+      }
+    }
+    ++y_;
+    return Result<bool>(true);
+  }
+
+  // Chunks are decoded on the first read of one of their rows, skipping whole
+  // chunks costs nothing.
+  Result<bool> skip() override
+  {
+    ++y_;
+    return Result<bool>(true);
+  }
+
+private:
+  Result<bool> decodeChunk(int chunk)
+  {
+    int32_t header[2];
+    file_.stream.seekg(offsets_[chunk]);
+    file_.stream.read(reinterpret_cast<char*>(header), sizeof(header));
+    tinyexr::swap4(&header[0]);
+    tinyexr::swap4(&header[1]);
+    int lineNo = header[0] - file_.header.data_window.min_y;
+    if (!file_.stream || lineNo != chunk * linesPerChunk_ || header[1] <= 0
+        || offsets_[chunk] + 8 + size_t(header[1]) > file_.size) {
+      return Result<bool>("Invalid EXR chunk");
+    }
+    compressed_.resize(header[1]);
+    file_.stream.read(reinterpret_cast<char*>(compressed_.data()), header[1]);
+    int lines = std::min(linesPerChunk_, height_ - lineNo);
+    // Decoded as if the chunk was a whole image of its rows.
+    if (!file_.stream || !tinyexr::DecodePixelData(planePointers_.data(), requestedTypes_.data(), compressed_.data(),
+        compressed_.size(), file_.header.compression_type, 0, width_, lines, width_, 0, 0, lines,
+        size_t(pixelDataSize_), size_t(file_.header.num_custom_attributes), file_.header.custom_attributes,
+        size_t(file_.header.num_channels), file_.header.channels, channelOffsets_)) {
+      return Result<bool>("Failed to decode EXR chunk");
+    }
+    chunk_ = chunk;
+    return Result<bool>(true);
+  }
+
+  EXRFile file_;
+  int linesPerChunk_ = 1;
+  std::vector<tinyexr::tinyexr_uint64> offsets_;
+  std::vector<int> channels_; // file channel of each channel read
+  std::vector<size_t> channelOffsets_;
+  int pixelDataSize_ = 0;
+  std::vector<int> requestedTypes_;
+  std::vector<std::vector<uint8_t>> planes_; // rows of the decoded chunk, one plane per file channel
+  std::vector<unsigned char*> planePointers_;
+  std::vector<unsigned char> compressed_;
+  int chunk_ = -1;
+  int y_ = 0;
+};
+
+class EXRWriter : public ScanlineWriter
+{
+public:
+  Result<bool> open(std::string const& path, int width, int height, std::vector<std::string> const& channelNames,
+    Image::Orientation order, EXROptions const& options)
+  {
+    if (options.tiled) {
+      return Result<bool>("Tiled EXR files cannot be streamed.");
+    }
+    stream_.open(path, std::ios::binary);
+    if (!stream_) {
+      return Result<bool>("Could not create " + path);
+    }
+    width_ = width;
+    height_ = height;
+    order_ = order;
+    compression_ = options.compression;
+    linesPerChunk_ = tinyexr::NumScanlines(compression_);
+    y_ = order == Image::TopDown ? 0 : height - 1;
+
+    // Channels are stored sorted by name, rows keep the given order.
+    int channelCount = int(channelNames.size());
+    for (int c = 0; c < channelCount; ++c) {
+      storedChannels_.push_back(c);
+    }
+    std::sort(storedChannels_.begin(), storedChannels_.end(),
+      [&](int a, int b) { return channelNames[a] < channelNames[b]; });
+    for (int c : storedChannels_) {
+      tinyexr::ChannelInfo info;
+      info.name = channelNames[c];
+      info.pixel_type = options.half ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT;
+      info.x_sampling = 1;
+      info.y_sampling = 1;
+      info.p_linear = 0;
+      channels_.push_back(info);
+      size_t size = info.pixel_type == TINYEXR_PIXELTYPE_HALF ? sizeof(uint16_t) : sizeof(float);
+      channelOffsets_.push_back(size_t(pixelDataSize_));
+      pixelDataSize_ += int(size);
+    }
+    // Rows are converted to the stored pixel type before encoding.
+    half_ = options.half;
+    requestedTypes_.assign(channelCount, channels_[0].pixel_type);
+    planes_.assign(channelCount, std::vector<uint8_t>(size_t(width) * linesPerChunk_ * (half_ ? 2 : 4)));
+    for (auto& plane : planes_) {
+      planePointers_.push_back(reinterpret_cast<unsigned char const*>(plane.data()));
+    }
+
+    std::vector<unsigned char> header = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+    auto attribute = [&](char const* name, char const* type, void const* data, int size) {
+      tinyexr::WriteAttributeToMemory(&header, name, type, reinterpret_cast<unsigned char const*>(data), size);
+    };
+    auto littleEndian = [](auto value) {
+      tinyexr::swap4(&value);
+      return value;
+    };
+    std::vector<unsigned char> channelList;
+    tinyexr::WriteChannelInfo(channelList, channels_);
+    attribute("channels", "chlist", channelList.data(), int(channelList.size()));
+    unsigned char compression = static_cast<unsigned char>(compression_);
+    attribute("compression", "compression", &compression, 1);
+    int window[4] = { littleEndian(0), littleEndian(0), littleEndian(width - 1), littleEndian(height - 1) };
+    attribute("dataWindow", "box2i", window, sizeof(window));
+    attribute("displayWindow", "box2i", window, sizeof(window));
+    // Chunks may appear in any order, the line order is only a hint for readers.
+    // Increasing is used throughout since some readers misinterpret decreasing.
+    unsigned char lineOrder = 0;
+    attribute("lineOrder", "lineOrder", &lineOrder, 1);
+    float aspectRatio = littleEndian(1.0f);
+    attribute("pixelAspectRatio", "float", &aspectRatio, sizeof(float));
+    float center[2] = { 0.0f, 0.0f };
+    attribute("screenWindowCenter", "v2f", center, sizeof(center));
+    float windowWidth = littleEndian(1.0f);
+    attribute("screenWindowWidth", "float", &windowWidth, sizeof(float));
+    header.push_back(0);
+
+    // The offset table is filled in by finish().
+    offsets_.resize((height + linesPerChunk_ - 1) / linesPerChunk_);
+    stream_.write(reinterpret_cast<char const*>(header.data()), header.size());
+    tableStart_ = stream_.tellp();
+    std::vector<char> table(offsets_.size() * sizeof(tinyexr::tinyexr_uint64), 0);
+    stream_.write(table.data(), table.size());
+    return stream_ ? Result<bool>(true) : Result<bool>("Failed to write EXR header");
+  }
+
+  Result<bool> write(float const* row) override
+  {
+    int chunk = y_ / linesPerChunk_;
+    int line = y_ - chunk * linesPerChunk_;
+    int channelCount = int(planes_.size());
+    for (int c = 0; c < channelCount; ++c) {
+      int source = storedChannels_[c];
+      if (half_) {
+        auto plane = reinterpret_cast<uint16_t*>(planes_[c].data()) + size_t(line) * width_;
+        for (int x = 0; x < width_; ++x) {
+          tinyexr::FP32 f;
+          f.f = row[size_t(x) * channelCount + source];
+          plane[x] = tinyexr::float_to_half_full(f).u;
+        }
+      } else {
+        auto plane = reinterpret_cast<float*>(planes_[c].data()) + size_t(line) * width_;
+        for (int x = 0; x < width_; ++x) {
+          plane[x] = row[size_t(x) * channelCount + source];
+        }
+      }
+    }
+    int lines = std::min(linesPerChunk_, height_ - chunk * linesPerChunk_);
+    bool complete = order_ == Image::TopDown ? line == lines - 1 : line == 0;
+    y_ += order_ == Image::TopDown ? 1 : -1;
+    return complete ? writeChunk(chunk, lines) : Result<bool>(true);
+  }
+
+  Result<bool> finish() override
+  {
+    stream_.seekp(tableStart_);
+    for (auto offset : offsets_) {
+      tinyexr::swap8(&offset);
+      stream_.write(reinterpret_cast<char const*>(&offset), sizeof(offset));
+    }
+    stream_.close();
+    return stream_ ? Result<bool>(true) : Result<bool>("Failed to write EXR file.");
+  }
+
+private:
+  Result<bool> writeChunk(int chunk, int lines)
+  {
+    encoded_.clear();
+    tinyexr::EncodePixelData(encoded_, planePointers_.data(), requestedTypes_.data(), compression_, 0, width_, lines,
+      width_, 0, lines, size_t(pixelDataSize_), channels_, channelOffsets_);
+    int32_t header[2] = { chunk * linesPerChunk_, int32_t(encoded_.size()) };
+    tinyexr::swap4(&header[0]);
+    tinyexr::swap4(&header[1]);
+    offsets_[chunk] = tinyexr::tinyexr_uint64(stream_.tellp());
+    stream_.write(reinterpret_cast<char const*>(header), sizeof(header));
+    stream_.write(reinterpret_cast<char const*>(encoded_.data()), encoded_.size());
+    return stream_ ? Result<bool>(true) : Result<bool>("Failed to write EXR chunk");
+  }
+
+  std::ofstream stream_;
+  int width_ = 0;
+  int height_ = 0;
+  Image::Orientation order_ = Image::TopDown;
+  int compression_ = TINYEXR_COMPRESSIONTYPE_ZIP;
+  int linesPerChunk_ = 1;
+  int y_ = 0; // next row from the top
+  std::vector<int> storedChannels_; // input channel of each stored channel
+  std::vector<tinyexr::ChannelInfo> channels_;
+  std::vector<size_t> channelOffsets_;
+  int pixelDataSize_ = 0;
+  std::vector<int> requestedTypes_;
+  bool half_ = false;
+  std::vector<std::vector<uint8_t>> planes_; // rows of the current chunk, one plane per stored channel
+  std::vector<unsigned char const*> planePointers_;
+  std::vector<unsigned char> encoded_;
+  std::streampos tableStart_;
+  std::vector<tinyexr::tinyexr_uint64> offsets_;
+};
+
+}
+
+Result<bool> ScanlineReader::skip()
+{
+  std::vector<float> row(size_t(width_) * channels());
+  return read(row.data());
+}
+
+Result<std::unique_ptr<ScanlineReader>> openScanlineReader(std::string const& path, std::string const& layer)
+{
+  auto extension = lowerExtension(path);
+  try {
+    if (extension == "hdr" || extension == "pic") {
+      auto reader = std::make_unique<PICReader>();
+      auto status = reader->open(path);
+      return opened<ScanlineReader>(std::move(reader), status);
+    } else if (extension == "pfm" || extension == "ppm") {
+      auto reader = std::make_unique<PFMReader>();
+      auto status = reader->open(path);
+      return opened<ScanlineReader>(std::move(reader), status);
+    } else if (extension == "exr") {
+      auto reader = std::make_unique<EXRReader>();
+      auto status = reader->open(path, layer);
+      return opened<ScanlineReader>(std::move(reader), status);
+    }
+  } catch (std::exception const& e) {
+    return Result<std::unique_ptr<ScanlineReader>>(std::string("Failed to read ") + path + ": " + e.what());
+  }
+  return Result<std::unique_ptr<ScanlineReader>>("Cannot stream ." + extension + " files.");
+}
+
+Result<std::unique_ptr<ScanlineWriter>> createScanlineWriter(std::string const& path, int width, int height,
+  std::vector<std::string> const& channelNames, Image::Orientation order, EXROptions const& options)
+{
+  auto extension = lowerExtension(path);
+  int channels = int(channelNames.size());
+  try {
+    if (extension == "hdr" || extension == "pic") {
+      auto writer = std::make_unique<PICWriter>();
+      auto status = writer->open(path, width, height, channels, order);
+      return opened<ScanlineWriter>(std::move(writer), status);
+    } else if (extension == "pfm" || extension == "ppm") {
+      auto writer = std::make_unique<PFMWriter>();
+      auto status = writer->open(path, width, height, channels, order);
+      return opened<ScanlineWriter>(std::move(writer), status);
+    } else if (extension == "exr") {
+      auto writer = std::make_unique<EXRWriter>();
+      auto status = writer->open(path, width, height, channelNames, order, options);
+      return opened<ScanlineWriter>(std::move(writer), status);
+    }
+  } catch (std::exception const& e) {
+    return Result<std::unique_ptr<ScanlineWriter>>(std::string("Failed to write ") + path + ": " + e.what());
+  }
+  return Result<std::unique_ptr<ScanlineWriter>>("Cannot stream ." + extension + " files.");
+}
+
+Result<bool> streamImage(std::string const& input, std::string const& output, std::string const& layer,
+  EXROptions const& options, Progress const& progress)
+{
+  auto opened = openScanlineReader(input, layer);
+  if (!opened) {
+    return Result<bool>(opened.error());
+  }
+  auto reader = std::move(opened).value();
+  if (reader->partial() && layer.empty() && lowerExtension(output) == "exr") {
+    return Result<bool>("Streaming would drop the other layers of " + input);
+  }
+  auto created = createScanlineWriter(output, reader->width(), reader->height(), reader->channelNames(),
+    reader->order(), options);
+  if (!created) {
+    return Result<bool>(created.error());
+  }
+  auto writer = std::move(created).value();
+
+  try {
+    std::vector<float> row(size_t(reader->width()) * reader->channels());
+    for (int y = 0; y < reader->height(); ++y) {
+      auto read = reader->read(row.data());
+      if (!read) {
+        return read;
+      }
+      auto written = writer->write(row.data());
+      if (!written) {
+        return written;
+      }
+      if (progress && !progress(float(y + 1) / float(reader->height()))) {
+        return Result<bool>("Export cancelled.");
+      }
+    }
+    return writer->finish();
+  } catch (std::exception const& e) {
+    return Result<bool>(std::string("Streaming conversion failed: ") + e.what());
+  }
+}
+
+Result<Image> loadEXRPreview(std::string const& path)
+{
+  try {
+    EXRFile file;
+    auto opened = file.open(path);
+    if (!opened) {
+      return Result<Image>(opened.error());
+    }
+    for (int i = 0; i < file.header.num_custom_attributes; ++i) {
+      auto const& attribute = file.header.custom_attributes[i];
+      if (std::strcmp(attribute.type, "preview") != 0 || attribute.size < 8) {
+        continue;
+      }
+      uint32_t size[2];
+      std::memcpy(size, attribute.value, sizeof(size));
+      tinyexr::swap4(&size[0]);
+      tinyexr::swap4(&size[1]);
+      size_t bytes = size_t(size[0]) * size[1] * 4;
+      if (size[0] == 0 || size[1] == 0 || bytes != size_t(attribute.size) - 8) {
+        return Result<Image>("Invalid EXR preview image");
+      }
+      std::vector<uint8_t> data(attribute.value + 8, attribute.value + 8 + bytes);
+      return Result<Image>(Image(int(size[0]), int(size[1]), 4, Image::Byte, std::move(data), Image::TopDown));
+    }
+  } catch (std::exception const& e) {
+    return Result<Image>(std::string("Failed to read ") + path + ": " + e.what());
+  }
+  return Result<Image>("EXR file has no preview image.");
+}
+
+Result<Image> loadEXRLevel(std::string const& path, int size)
+{
+  try {
+    EXRFile file;
+    auto opened = file.open(path);
+    if (!opened) {
+      return Result<Image>(opened.error());
+    }
+    auto const& header = file.header;
+    if (!header.tiled || header.tile_level_mode == TINYEXR_TILE_ONE_LEVEL) {
+      return Result<Image>("EXR file has no mip levels.");
+    }
+    if (!streamable(header.compression_type)) {
+      return Result<Image>("EXR compression not supported for partial reads.");
+    }
+    std::vector<int> channels;
+    std::vector<std::string> channelNames;
+    bool partial = false;
+    auto selected = selectLayer(header, {}, channels, channelNames, partial);
+    if (!selected) {
+      return Result<Image>(selected.error());
+    }
+
+    // The offset table lists the tiles of all levels, largest level first.
+    std::vector<int> xTiles, yTiles;
+    tinyexr::PrecalculateTileInfo(xTiles, yTiles, &header);
+    tinyexr::OffsetData offsets;
+    int tileCount = tinyexr::InitTileOffsets(offsets, &header, xTiles, yTiles);
+    std::vector<tinyexr::tinyexr_uint64> table(tileCount);
+    auto read = file.readOffsets(table.data(), table.size());
+    if (!read) {
+      return Result<Image>(read.error());
+    }
+    auto next = table.begin();
+    for (auto& level : offsets.offsets) {
+      for (auto& row : level) {
+        for (auto& offset : row) {
+          offset = *next++;
+        }
+      }
+    }
+
+    // Smallest level that still covers the requested size.
+    int width = header.data_window.max_x - header.data_window.min_x + 1;
+    int height = header.data_window.max_y - header.data_window.min_y + 1;
+    int levels = int(std::min(xTiles.size(), yTiles.size()));
+    int level = 0;
+    int levelWidth = width, levelHeight = height;
+    for (int l = levels - 1; l > 0; --l) {
+      int w = tinyexr::LevelSize(width, l, header.tile_rounding_mode);
+      int h = tinyexr::LevelSize(height, l, header.tile_rounding_mode);
+      if (std::max(w, h) >= size) {
+        level = l;
+        levelWidth = w;
+        levelHeight = h;
+        break;
+      }
+    }
+    auto const& tiles = offsets.offsets[tinyexr::LevelIndex(level, level, header.tile_level_mode, offsets.num_x_levels)];
+
+    std::vector<size_t> channelOffsets;
+    int pixelDataSize = 0;
+    size_t channelOffset = 0;
+    tinyexr::ComputeChannelLayout(&channelOffsets, &pixelDataSize, &channelOffset, header.num_channels, header.channels);
+    size_t tilePixels = size_t(header.tile_size_x) * header.tile_size_y;
+    std::vector<std::vector<float>> planes(header.num_channels, std::vector<float>(tilePixels));
+    std::vector<unsigned char*> planePointers;
+    std::vector<int> requestedTypes;
+    for (int c = 0; c < header.num_channels; ++c) {
+      planePointers.push_back(reinterpret_cast<unsigned char*>(planes[c].data()));
+      // Integer channels of other layers are decoded as such but not used.
+      requestedTypes.push_back(header.pixel_types[c] == TINYEXR_PIXELTYPE_UINT ? TINYEXR_PIXELTYPE_UINT : TINYEXR_PIXELTYPE_FLOAT);
+    }
+
+    int c = int(channels.size());
+    std::vector<uint8_t> data(size_t(levelWidth) * levelHeight * c * sizeof(float));
+    float* pixels = reinterpret_cast<float*>(data.data());
+    std::vector<unsigned char> compressed;
+    for (auto const& row : tiles) {
+      for (auto offset : row) {
+        int32_t tile[5]; // x, y, level x, level y, size
+        file.stream.seekg(offset);
+        file.stream.read(reinterpret_cast<char*>(tile), sizeof(tile));
+        for (auto& value : tile) {
+          tinyexr::swap4(&value);
+        }
+        if (!file.stream || tile[0] < 0 || tile[1] < 0 || tile[2] != level || tile[3] != level || tile[4] <= 0
+            || offset + sizeof(tile) + size_t(tile[4]) > file.size) {
+          return Result<Image>("Invalid EXR tile");
+        }
+        compressed.resize(tile[4]);
+        file.stream.read(reinterpret_cast<char*>(compressed.data()), tile[4]);
+        int tileWidth = 0, tileHeight = 0;
+        if (!file.stream || !tinyexr::DecodeTiledPixelData(planePointers.data(), &tileWidth, &tileHeight,
+            requestedTypes.data(), compressed.data(), compressed.size(), header.compression_type, header.line_order,
+            levelWidth, levelHeight, tile[0], tile[1], header.tile_size_x, header.tile_size_y, size_t(pixelDataSize),
+            size_t(header.num_custom_attributes), header.custom_attributes, size_t(header.num_channels),
+            header.channels, channelOffsets)) {
+          return Result<Image>("Failed to decode EXR tile");
+        }
+        int x0 = tile[0] * header.tile_size_x;
+        int y0 = tile[1] * header.tile_size_y;
+        for (int y = 0; y < tileHeight; ++y) {
+          float* out = pixels + (size_t(y0 + y) * levelWidth + x0) * c;
+          for (int x = 0; x < tileWidth; ++x) {
+            for (int i = 0; i < c; ++i) {
+              out[size_t(x) * c + i] = planes[channels[i]][size_t(y) * header.tile_size_x + x];
+            }
+          }
+        }
+      }
+    }
+    return Result<Image>(Image(levelWidth, levelHeight, c, Image::Float, std::move(data), Image::TopDown));
+  } catch (std::exception const& e) {
+    return Result<Image>(std::string("Failed to read ") + path + ": " + e.what());
+  }
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <image/Image.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hdrv {
+
+// Row by row access to a floating point image file, for conversions that must
+// not hold the whole image in memory. Only the rows of the current chunk of the
+// file are buffered.
+class ScanlineReader
+{
+public:
+  virtual ~ScanlineReader() = default;
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int channels() const { return int(channelNames_.size()); }
+  // Names as they would be stored in EXR files (R, G, B, A / L / ...).
+  std::vector<std::string> const& channelNames() const { return channelNames_; }
+  // TopDown if the first row read is the top row of the image.
+  Image::Orientation order() const { return order_; }
+  // True if the file has other layers that are not read.
+  bool partial() const { return partial_; }
+
+  // Reads the next row as width() * channels() interleaved floats.
+  virtual Result<bool> read(float* row) = 0;
+  // Moves past the next row, cheaper than reading it where the format allows
+  // (PFM rows are seeked over, EXR chunks without rows read are not decoded).
+  virtual Result<bool> skip();
+
+protected:
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<std::string> channelNames_;
+  Image::Orientation order_ = Image::TopDown;
+  bool partial_ = false;
+};
+
+class ScanlineWriter
+{
+public:
+  virtual ~ScanlineWriter() = default;
+
+  // Writes the next row of interleaved floats, in the order the writer was created with.
+  virtual Result<bool> write(float const* row) = 0;
+  // Completes the file after the last row.
+  virtual Result<bool> finish() = 0;
+};
+
+// PFM, PIC/HDR and single part scanline EXR files, picked by the file extension.
+// Of EXR files only the layer with the given name, or the first one, is read.
+// Other files (tiled or multi-part EXR, PIC files stored in columns) must be
+// loaded as a whole.
+Result<std::unique_ptr<ScanlineReader>> openScanlineReader(std::string const& path, std::string const& layer = {});
+
+// PFM, PIC/HDR and scanline EXR files, picked by the file extension. Rows are
+// written in the given order, PFM files are written in place if it differs from
+// their bottom-up layout. Tiled EXR files and layer layouts are not supported.
+Result<std::unique_ptr<ScanlineWriter>> createScanlineWriter(std::string const& path, int width, int height,
+  std::vector<std::string> const& channelNames, Image::Orientation order, EXROptions const& options = {});
+
+// Converts a file with a reader and writer as above, memory use is independent
+// of the image size.
+Result<bool> streamImage(std::string const& input, std::string const& output, std::string const& layer = {},
+  EXROptions const& options = {}, Progress const& progress = {});
+
+// Reduced versions stored in EXR files, read without decoding the full image.
+// The 8 bit RGBA preview image of the header (top-down, display referred).
+Result<Image> loadEXRPreview(std::string const& path);
+// The smallest mip level of the first layer of a tiled file whose longer side
+// is still at least `size` pixels. Fails for files without mip levels.
+Result<Image> loadEXRLevel(std::string const& path, int size);
+
+}
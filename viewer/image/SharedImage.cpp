@@ -0,0 +1,108 @@
+#include <image/SharedImage.hpp>
+
+#include <QFloat16>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace hdrv {
+
+size_t layoutLayers(int width, int height, Image::Format format, std::vector<Image::Layer>& layers)
+{
+  size_t pixelSize = format == Image::Byte ? 1 : (format == Image::Short ? 2 : 4);
+  size_t size = 0;
+  for (auto& layer : layers) {
+    if (layer.channels < 1 || layer.channels > 4) {
+      return 0;
+    }
+    layer.offset = size;
+    size += size_t(width) * height * layer.channels * pixelSize;
+  }
+  return size;
+}
+
+Result<Image> mapSharedImage(std::string const& name, int width, int height, Image::Format format,
+  std::vector<Image::Layer>&& layers)
+{
+  if (width <= 0 || height <= 0 || layers.empty()) {
+    return Result<Image>("Image is empty.");
+  }
+  size_t size = layoutLayers(width, height, format, layers);
+  if (size == 0) {
+    return Result<Image>("Layers need 1 to 4 channels.");
+  }
+#if defined(__unix__) || defined(__APPLE__)
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return Result<Image>("Could not open shared memory " + name + ".");
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || size_t(status.st_size) < size) {
+    close(fd);
+    return Result<Image>("Shared memory " + name + " is smaller than the image.");
+  }
+  void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return Result<Image>("Could not map shared memory " + name + ".");
+  }
+  std::shared_ptr<uint8_t const> data(static_cast<uint8_t const*>(mapped), [size](uint8_t const* p) {
+    munmap(const_cast<uint8_t*>(p), size);
+  });
+  return Result<Image>(Image(width, height, format, std::move(data), std::move(layers), Image::TopDown));
+#else
+  return Result<Image>("Shared memory images are only supported on Unix.");
+#endif
+}
+
+bool copyTile(Image const& image, uint8_t* pixels, TileRegion const& tile, void const* data, size_t size)
+{
+  int layerCount = std::max(1, int(image.layers().size()));
+  if (image.format() != Image::Float || tile.layer < 0 || tile.layer >= layerCount) {
+    return false;
+  }
+  int channels = image.channels(tile.layer);
+  size_t valueSize = tile.half ? sizeof(qfloat16) : sizeof(float);
+  size_t rowValues = size_t(std::max(tile.width, 0)) * std::max(tile.channels, 0);
+  // Values come straight from the socket, compared without sums that could overflow.
+  bool fits = tile.x >= 0 && tile.y >= 0 && tile.width > 0 && tile.height > 0
+    && tile.x < image.width() && tile.width <= image.width() - tile.x
+    && tile.y < image.height() && tile.height <= image.height() - tile.y
+    && tile.firstChannel >= 0 && tile.channels > 0 && tile.firstChannel < channels
+    && tile.channels <= channels - tile.firstChannel;
+  if (!fits || size != rowValues * tile.height * valueSize) {
+    return false;
+  }
+  size_t offset = image.layers().empty() ? 0 : image.layers()[tile.layer].offset;
+  auto source = static_cast<uint8_t const*>(data);
+  std::vector<qfloat16> halfRow(tile.half ? rowValues : 0);
+  std::vector<float> floatRow(tile.channels < channels ? rowValues : 0);
+  for (int row = 0; row < tile.height; ++row, source += rowValues * valueSize) {
+    float* out = reinterpret_cast<float*>(pixels + offset)
+      + (size_t(tile.y + row) * image.width() + tile.x) * channels + tile.firstChannel;
+    // Whole pixels are converted straight into the image, some channels of
+    // them through a row of floats. The payload may not be aligned.
+    float* converted = tile.channels < channels ? floatRow.data() : out;
+    if (tile.half) {
+      std::memcpy(halfRow.data(), source, rowValues * sizeof(qfloat16));
+      qFloatFromFloat16(converted, halfRow.data(), qsizetype(rowValues));
+    } else {
+      std::memcpy(converted, source, rowValues * sizeof(float));
+    }
+    if (converted != out) {
+      for (int x = 0; x < tile.width; ++x) {
+        std::memcpy(out + size_t(x) * channels, converted + size_t(x) * tile.channels, tile.channels * sizeof(float));
+      }
+    }
+  }
+  return true;
+}
+
+}
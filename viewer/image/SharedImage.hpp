@@ -0,0 +1,40 @@
+#pragma once
+
+#include <image/Image.hpp>
+
+#include <string>
+#include <vector>
+
+namespace hdrv {
+
+// Sets the offsets of layers following each other without padding, as in live
+// images, and returns the size of all pixels. 0 if a layer has not 1 to 4 channels.
+size_t layoutLayers(int width, int height, Image::Format format, std::vector<Image::Layer>& layers);
+
+// Maps a POSIX shared memory object written by another process (eg. a renderer
+// streaming its progress) as a top-down image without copying it. The layers
+// follow each other, rows have no padding. The mapping is read only and stays
+// valid after the object is unlinked, until the last copy of the image is gone.
+// Only available on Unix.
+Result<Image> mapSharedImage(std::string const& name, int width, int height, Image::Format format,
+  std::vector<Image::Layer>&& layers);
+
+// Pixels of some channels of a layer, from a client streaming an image in tiles.
+struct TileRegion
+{
+  int x = 0;  // from the top-left corner
+  int y = 0;
+  int width = 0;
+  int height = 0;
+  int layer = 0;
+  int firstChannel = 0;
+  int channels = 0;
+  bool half = false;  // 16 bit half floats, otherwise 32 bit
+};
+
+// Writes a tile into the pixels of a top-down float image laid out by
+// layoutLayers. `data` holds the selected channels of each pixel, rows from top
+// to bottom. False if the tile is outside the image or has the wrong size.
+bool copyTile(Image const& image, uint8_t* pixels, TileRegion const& tile, void const* data, size_t size);
+
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define HDRV_SSE2
+# include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace hdrv {
+
+// Minimal 4-wide float vector used by the pixel processing kernels. Maps to SSE2
+// where available, otherwise to plain scalar code with identical results.
+// Comparisons return masks with all bits of a lane set, which select() consumes.
+#ifdef HDRV_SSE2
+
+struct Float4
+{
+  __m128 v;
+
+  Float4() = default;
+  Float4(__m128 x) : v(x) {}
+  Float4(float x) : v(_mm_set1_ps(x)) {}
+
+  static Float4 load(float const* p) { return _mm_loadu_ps(p); }
+  void store(float* p) const { _mm_storeu_ps(p, v); }
+};
+
+inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+inline Float4 operator<(Float4 a, Float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Float4 operator==(Float4 a, Float4 b) { return _mm_cmpeq_ps(a.v, b.v); }
+inline Float4 operator&(Float4 a, Float4 b) { return _mm_and_ps(a.v, b.v); }
+inline Float4 operator|(Float4 a, Float4 b) { return _mm_or_ps(a.v, b.v); }
+
+// True if all lanes of a comparison mask are set.
+inline bool allOf(Float4 mask) { return _mm_movemask_ps(mask.v) == 0xf; }
+
+// Like the SSE instructions both return b if either argument is NaN.
+inline Float4 min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+
+inline Float4 select(Float4 mask, Float4 a, Float4 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+
+inline Float4 roundToInt(Float4 x) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(x.v)); }
+
+// Unbiased exponent and mantissa in [1, 2) of positive normal numbers.
+inline Float4 exponentOf(Float4 x)
+{
+  __m128i e = _mm_srli_epi32(_mm_castps_si128(x.v), 23);
+  return _mm_cvtepi32_ps(_mm_sub_epi32(e, _mm_set1_epi32(127)));
+}
+
+inline Float4 mantissaOf(Float4 x)
+{
+  __m128i m = _mm_and_si128(_mm_castps_si128(x.v), _mm_set1_epi32(0x007fffff));
+  return _mm_castsi128_ps(_mm_or_si128(m, _mm_set1_epi32(0x3f800000)));
+}
+
+// 2^n for integral n in [-126, 127].
+inline Float4 exp2i(Float4 n)
+{
+  __m128i e = _mm_add_epi32(_mm_cvtps_epi32(n.v), _mm_set1_epi32(127));
+  return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+}
+
+// Truncates lanes in [0, 255] and stores them as 4 consecutive bytes.
+inline void storeBytes(Float4 x, uint8_t* dst)
+{
+  __m128i i = _mm_cvttps_epi32(x.v);
+  i = _mm_packs_epi32(i, i);
+  i = _mm_packus_epi16(i, i);
+  int32_t packed = _mm_cvtsi128_si32(i);
+  std::memcpy(dst, &packed, 4);
+}
+
+#else
+
+struct Float4
+{
+  float v[4];
+
+  Float4() = default;
+  Float4(float x) : v{ x, x, x, x } {}
+
+  static Float4 load(float const* p) { Float4 r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+  void store(float* p) const { std::memcpy(p, v, sizeof(v)); }
+};
+
+namespace detail {
+
+template<typename F>
+Float4 map(Float4 a, Float4 b, F f)
+{
+  Float4 r;
+  for (int i = 0; i < 4; ++i) r.v[i] = f(a.v[i], b.v[i]);
+  return r;
+}
+
+inline uint32_t bits(float x) { uint32_t u; std::memcpy(&u, &x, 4); return u; }
+inline float fromBits(uint32_t u) { float x; std::memcpy(&x, &u, 4); return x; }
+inline float mask(bool b) { return fromBits(b ? 0xffffffffu : 0u); }
+
+}
+
+inline Float4 operator+(Float4 a, Float4 b) { return detail::map(a, b, [](float x, float y) { return x + y; }); }
+inline Float4 operator-(Float4 a, Float4 b) { return detail::map(a, b, [](float x, float y) { return x - y; }); }
+inline Float4 operator*(Float4 a, Float4 b) { return detail::map(a, b, [](float x, float y) { return x * y; }); }
+inline Float4 operator/(Float4 a, Float4 b) { return detail::map(a, b, [](float x, float y) { return x / y; }); }
+inline Float4 operator<(Float4 a, Float4 b) { return detail::map(a, b, [](float x, float y) { return detail::mask(x < y); }); }
+inline Float4 operator==(Float4 a, Float4 b) { return detail::map(a, b, [](float x, float y) { return detail::mask(x == y); }); }
+inline Float4 operator&(Float4 a, Float4 b) { return detail::map(a, b, [](float x, float y) { return detail::fromBits(detail::bits(x) & detail::bits(y)); }); }
+inline Float4 operator|(Float4 a, Float4 b) { return detail::map(a, b, [](float x, float y) { return detail::fromBits(detail::bits(x) | detail::bits(y)); }); }
+
+inline bool allOf(Float4 mask)
+{
+  for (int i = 0; i < 4; ++i) {
+    if (detail::bits(mask.v[i]) == 0) return false;
+  }
+  return true;
+}
+
+inline Float4 min(Float4 a, Float4 b) { return detail::map(a, b, [](float x, float y) { return x < y ? x : y; }); }
+inline Float4 max(Float4 a, Float4 b) { return detail::map(a, b, [](float x, float y) { return x > y ? x : y; }); }
+
+inline Float4 select(Float4 mask, Float4 a, Float4 b)
+{
+  Float4 r;
+  for (int i = 0; i < 4; ++i) {
+    uint32_t m = detail::bits(mask.v[i]);
+    r.v[i] = detail::fromBits((m & detail::bits(a.v[i])) | (~m & detail::bits(b.v[i])));
+  }
+  return r;
+}
+
+inline Float4 roundToInt(Float4 x)
+{
+  Float4 r;
+  for (int i = 0; i < 4; ++i) r.v[i] = std::nearbyint(x.v[i]);
+  return r;
+}
+
+inline Float4 exponentOf(Float4 x)
+{
+  Float4 r;
+  for (int i = 0; i < 4; ++i) r.v[i] = float(int(detail::bits(x.v[i]) >> 23) - 127);
+  return r;
+}
+
+inline Float4 mantissaOf(Float4 x)
+{
+  Float4 r;
+  for (int i = 0; i < 4; ++i) r.v[i] = detail::fromBits((detail::bits(x.v[i]) & 0x007fffffu) | 0x3f800000u);
+  return r;
+}
+
+inline Float4 exp2i(Float4 n)
+{
+  Float4 r;
+  for (int i = 0; i < 4; ++i) r.v[i] = detail::fromBits(uint32_t(int(n.v[i]) + 127) << 23);
+  return r;
+}
+
+inline void storeBytes(Float4 x, uint8_t* dst)
+{
+  for (int i = 0; i < 4; ++i) dst[i] = uint8_t(x.v[i]);
+}
+
+#endif // HDRV_SSE2
+
+inline float horizontalSum(Float4 x)
+{
+  float lanes[4];
+  x.store(lanes);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+}
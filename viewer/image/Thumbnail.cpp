@@ -0,0 +1,229 @@
+#include <image/Thumbnail.hpp>
+#include <image/Parallel.hpp>
+#include <image/Scanlines.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+
+namespace hdrv {
+
+namespace {
+
+bool isEXR(std::string const& path)
+{
+  if (path.size() < 4) {
+    return false;
+  }
+  std::string extension = path.substr(path.size() - 4);
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+  return extension == ".exr";
+}
+
+// Extent of a side when the longer side is reduced to at most `size` pixels.
+int reducedExtent(int extent, int longer, int size)
+{
+  int reduced = std::min(size, longer);
+  return std::max(1, int((int64_t(extent) * reduced + longer / 2) / longer));
+}
+
+// First source pixel of a reduced pixel, the next one's is the end.
+int sourceStart(int index, int extent, int reduced)
+{
+  return int(int64_t(index) * extent / reduced);
+}
+
+// Reads the middle row of the rows covered by each reduced row and averages it
+// horizontally, the rows in between are skipped by the reader. Scanline EXR
+// files are split into bands with a reader each, so their chunks are decoded
+// in parallel.
+Result<Image> loadDecimated(std::string const& path, int size)
+{
+  auto opened = openScanlineReader(path);
+  if (!opened) {
+    return Result<Image>(opened.error());
+  }
+  auto first = std::move(opened).value();
+  int w = first->width();
+  int h = first->height();
+  int c = first->channels();
+  if (w <= 0 || h <= 0 || c <= 0) {
+    return Result<Image>("Image is empty.");
+  }
+  int outWidth = reducedExtent(w, std::max(w, h), size);
+  int outHeight = reducedExtent(h, std::max(w, h), size);
+  bool topDown = first->order() == Image::TopDown;
+  // Reduced row of each row in file order, -1 if it is skipped.
+  std::vector<int> sampled(h, -1);
+  for (int y = 0; y < outHeight; ++y) {
+    int row = (sourceStart(y, h, outHeight) + sourceStart(y + 1, h, outHeight) - 1) / 2;
+    sampled[topDown ? row : h - 1 - row] = y;
+  }
+
+  std::vector<uint8_t> data(size_t(outWidth) * outHeight * c * sizeof(float));
+  float* pixels = reinterpret_cast<float*>(data.data());
+  auto decode = [&](ScanlineReader& reader, int begin, int end) {
+    std::vector<float> row(size_t(w) * c);
+    for (int i = 0; i < end; ++i) {
+      int y = sampled[i];
+      auto status = y >= 0 && i >= begin ? reader.read(row.data()) : reader.skip();
+      if (!status) {
+        return status;
+      }
+      if (y < 0 || i < begin) {
+        continue;
+      }
+      float* out = pixels + size_t(y) * outWidth * c;
+      for (int x = 0; x < outWidth; ++x) {
+        int x0 = sourceStart(x, w, outWidth);
+        int x1 = std::max(x0 + 1, sourceStart(x + 1, w, outWidth));
+        for (int k = 0; k < c; ++k) {
+          float sum = 0.0f;
+          for (int xi = x0; xi < x1; ++xi) {
+            sum += row[size_t(xi) * c + k];
+          }
+          out[size_t(x) * c + k] = sum / float(x1 - x0);
+        }
+      }
+    }
+    return Result<bool>(true);
+  };
+
+  int threads = std::max(1, QThreadPool::globalInstance()->maxThreadCount());
+  int bands = isEXR(path) ? std::clamp(outHeight / 16, 1, threads) : 1;
+  std::vector<std::string> errors(bands);
+  parallelFor(bands, [&](int begin, int end) {
+    for (int band = begin; band < end; ++band) {
+      std::unique_ptr<ScanlineReader> reader;
+      if (band > 0) {
+        auto other = openScanlineReader(path);
+        if (!other) {
+          errors[band] = other.error();
+          continue;
+        }
+        reader = std::move(other).value();
+      }
+      auto status = decode(band == 0 ? *first : *reader, int(int64_t(h) * band / bands), int(int64_t(h) * (band + 1) / bands));
+      if (!status) {
+        errors[band] = status.error();
+      }
+    }
+  }, 1);
+  for (auto const& error : errors) {
+    if (!error.empty()) {
+      return Result<Image>(error);
+    }
+  }
+  return Result<Image>(Image(outWidth, outHeight, c, Image::Float, std::move(data), Image::TopDown));
+}
+
+}
+
+Result<Image> loadThumbnail(std::string const& path, int size)
+{
+  if (size <= 0) {
+    return Result<Image>("Invalid thumbnail size.");
+  }
+  try {
+    if (isEXR(path)) {
+      auto preview = loadEXRPreview(path);
+      if (preview && std::max(preview.value().width(), preview.value().height()) >= size) {
+        return Result<Image>(reduceToSize(preview.value(), size));
+      }
+      auto level = loadEXRLevel(path, size);
+      if (level) {
+        return Result<Image>(reduceToSize(level.value(), size));
+      }
+    }
+    auto decimated = loadDecimated(path, size);
+    if (decimated) {
+      return decimated;
+    }
+  } catch (std::exception const&) {
+    // Damaged files are left to the full loader, which reports the error.
+  }
+  auto image = Image::load(path);
+  if (!image) {
+    return image;
+  }
+  return Result<Image>(reduceToSize(image.value(), size));
+}
+
+Image reduceToSize(Image const& image, int size)
+{
+  Image layer = image.layers().size() > 1 ? image.layerImage(0) : image;
+  int w = layer.width();
+  int h = layer.height();
+  if (std::max(w, h) <= size) {
+    return layer;
+  }
+  int outWidth = reducedExtent(w, std::max(w, h), size);
+  int outHeight = reducedExtent(h, std::max(w, h), size);
+  int c = layer.channels();
+  int bytes = layer.pixelSizeInBytes();
+  Image::Format format = layer.format();
+  std::vector<uint8_t> data(size_t(outWidth) * outHeight * c * bytes);
+  parallelFor(outHeight, [&](int begin, int end) {
+    for (int y = begin; y < end; ++y) {
+      int y0 = sourceStart(y, h, outHeight);
+      int y1 = std::max(y0 + 1, sourceStart(y + 1, h, outHeight));
+      for (int x = 0; x < outWidth; ++x) {
+        int x0 = sourceStart(x, w, outWidth);
+        int x1 = std::max(x0 + 1, sourceStart(x + 1, w, outWidth));
+        for (int k = 0; k < c; ++k) {
+          float sum = 0.0f;
+          for (int yi = y0; yi < y1; ++yi) {
+            for (int xi = x0; xi < x1; ++xi) {
+              sum += layer.value(xi, yi, k);
+            }
+          }
+          float v = sum / float((x1 - x0) * (y1 - y0));
+          uint8_t* out = data.data() + ((size_t(y) * outWidth + x) * c + k) * bytes;
+          if (format == Image::Float) {
+            std::memcpy(out, &v, sizeof(float));
+          } else if (format == Image::Short) {
+            uint16_t s = uint16_t(std::clamp(v * 257.0f + 0.5f, 0.0f, 65535.0f));
+            std::memcpy(out, &s, sizeof(uint16_t));
+          } else {
+            *out = uint8_t(std::clamp(v + 0.5f, 0.0f, 255.0f));
+          }
+        }
+      }
+    }
+  }, 8);
+  return Image(outWidth, outHeight, c, format, std::move(data), Image::TopDown);
+}
+
+std::vector<uint8_t> thumbnailPixels(Image const& image)
+{
+  int w = image.width();
+  int h = image.height();
+  int c = image.channels();
+  bool linear = image.format() == Image::Float;
+  auto color = [linear](float v) -> uint8_t {
+    if (linear) {
+      // Also maps NaN to black.
+      v = v > 0.0f ? std::pow(std::min(v, 1.0f), 1.0f / 2.2f) * 255.0f : 0.0f;
+    }
+    return uint8_t(std::clamp(v + 0.5f, 0.0f, 255.0f));
+  };
+  auto alpha = [linear](float v) -> uint8_t {
+    v = linear ? (v > 0.0f ? std::min(v, 1.0f) * 255.0f : 0.0f) : v;
+    return uint8_t(std::clamp(v + 0.5f, 0.0f, 255.0f));
+  };
+
+  std::vector<uint8_t> pixels(size_t(w) * h * 4);
+  for (int y = 0; y < h; ++y) {
+    uint8_t* out = pixels.data() + size_t(y) * w * 4;
+    for (int x = 0; x < w; ++x, out += 4) {
+      out[0] = color(image.value(x, y, 0));
+      out[1] = c >= 3 ? color(image.value(x, y, 1)) : out[0];
+      out[2] = c >= 3 ? color(image.value(x, y, 2)) : out[0];
+      out[3] = c >= 4 ? alpha(image.value(x, y, 3)) : 255;
+    }
+  }
+  return pixels;
+}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <image/Image.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace hdrv {
+
+// Thumbnails for the file browser integrations of the platforms.
+
+// Loads the first layer of an image reduced so its longer side is at most
+// `size` pixels, decoding as little of the file as the format allows: EXR
+// preview images and mip levels are used when large enough, scanline files
+// (PFM, PIC, scanline EXR) are read in every n-th row only. Other files are
+// loaded as a whole.
+Result<Image> loadThumbnail(std::string const& path, int size);
+
+// Box filters the first layer of an image so its longer side is at most
+// `size` pixels. The format is kept.
+Image reduceToSize(Image const& image, int size);
+
+// Top-down 8 bit RGBA pixels. Floating point values are clamped to [0, 1] and
+// gamma corrected with 2.2, byte images are taken as they are. Images without
+// alpha are opaque.
+std::vector<uint8_t> thumbnailPixels(Image const& image);
+
+}
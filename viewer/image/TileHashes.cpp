@@ -0,0 +1,64 @@
+#include <image/TileHashes.hpp>
+#include <image/Image.hpp>
+#include <image/Parallel.hpp>
+
+#include <cstring>
+
+namespace hdrv {
+
+namespace {
+
+int layerCount(Image const& image)
+{
+  return std::max(1, int(image.layers().size()));
+}
+
+}
+
+TileHashes computeTileHashes(Image const& image)
+{
+  constexpr int size = TileHashes::tileSize;
+  TileHashes result;
+  result.columns = (image.width() + size - 1) / size;
+  result.rows = (image.height() + size - 1) / size;
+  result.layers.assign(layerCount(image), std::vector<uint64_t>(result.count()));
+
+  parallelFor(result.rows, [&](int begin, int end) {
+    for (int layer = 0; layer < layerCount(image); ++layer) {
+      size_t pixelSize = size_t(image.channels(layer)) * image.pixelSizeInBytes();
+      for (int row = begin; row < end; ++row) {
+        int y0 = row * size;
+        int y1 = std::min(y0 + size, image.height());
+        for (int column = 0; column < result.columns; ++column) {
+          int x0 = column * size;
+          int x1 = std::min(x0 + size, image.width());
+          Hasher hasher;
+          for (int y = y0; y < y1; ++y) {
+            hasher.update(image.row(y, layer) + x0 * pixelSize, (x1 - x0) * pixelSize);
+          }
+          result.layers[layer][size_t(row) * result.columns + column] = hasher.finish();
+        }
+      }
+    }
+  }, 1);
+  return result;
+}
+
+std::vector<bool> identicalTiles(Image const& a, int layerA, Image const& b, int layerB)
+{
+  auto const& hashesA = a.tileHashes();
+  std::vector<bool> result(hashesA->count(), false);
+  if (a.width() != b.width() || a.height() != b.height() || a.format() != b.format()
+      || a.channels(layerA) != b.channels(layerB) || a.channelOrder() != b.channelOrder()) {
+    return result;
+  }
+  auto const& hashesB = b.tileHashes();
+  auto const& tilesA = hashesA->layers[layerA];
+  auto const& tilesB = hashesB->layers[layerB];
+  for (size_t i = 0; i < result.size(); ++i) {
+    result[i] = tilesA[i] == tilesB[i];
+  }
+  return result;
+}
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace hdrv {
+
+class Image;
+
+// 64 bit hash in the spirit of xxHash: four independent accumulators consume
+// 32 bytes per step, so throughput is not limited by multiplication latency.
+// Not cryptographic, but good enough to tell file contents apart.
+class Hasher
+{
+public:
+  void update(uint8_t const* data, size_t size)
+  {
+    length_ += size;
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+      for (int lane = 0; lane < 4; ++lane) {
+        lanes_[lane] = round(lanes_[lane], read(data + i + lane * 8));
+      }
+    }
+    for (; i + 8 <= size; i += 8) {
+      lanes_[0] = round(lanes_[0], read(data + i));
+    }
+    if (i < size) {
+      uint64_t tail = 0;
+      std::memcpy(&tail, data + i, size - i);
+      lanes_[1] = round(lanes_[1], tail);
+    }
+  }
+
+  uint64_t finish() const
+  {
+    uint64_t h = rotl(lanes_[0], 1) + rotl(lanes_[1], 7) + rotl(lanes_[2], 12) + rotl(lanes_[3], 18);
+    h ^= length_;
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+  }
+
+private:
+  static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+  static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+  static constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+
+  static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+  static uint64_t read(uint8_t const* p) { uint64_t v; std::memcpy(&v, p, sizeof(v)); return v; }
+  static uint64_t round(uint64_t acc, uint64_t input) { return rotl(acc + input * prime2, 31) * prime1; }
+
+  uint64_t lanes_[4] = { prime1 + prime2, prime2, 0, 0 - prime1 };
+  uint64_t length_ = 0;
+};
+
+// Content hashes of square tiles, per layer. Tiles are numbered row by row from
+// the top-left corner, the last row and column may be smaller. Equal hashes of
+// images with the same size, format and channels mean equal bytes (with very
+// high probability), which lets comparisons skip identical regions.
+struct TileHashes
+{
+  static constexpr int tileSize = 64;
+
+  int columns = 0;
+  int rows = 0;
+  std::vector<std::vector<uint64_t>> layers;
+
+  int count() const { return columns * rows; }
+};
+
+// Hashes all layers in a single multi-threaded pass. Prefer Image::tileHashes()
+// which caches the result.
+TileHashes computeTileHashes(Image const& image);
+
+// Flags tiles whose pixels are known to be equal in a layer of both images.
+// All flags are false if the layers are not stored the same way.
+std::vector<bool> identicalTiles(Image const& a, int layerA, Image const& b, int layerB);
+
+}
@@ -0,0 +1,73 @@
+#include <image/ToneMapping.hpp>
+#include <image/Simd.hpp>
+
+#include <cfloat>
+
+namespace hdrv {
+
+namespace {
+
+// log2 of positive normal numbers: x = m * 2^e, log2(m) = 2/ln(2) * atanh(t)
+// with t = (m - 1) / (m + 1) in [0, 1/3). The series is cut after t^11, the
+// truncation error is below 2e-7.
+Float4 log2Approx(Float4 x)
+{
+  Float4 m = mantissaOf(x);
+  Float4 t = (m - Float4(1.0f)) / (m + Float4(1.0f));
+  Float4 t2 = t * t;
+  Float4 p = Float4(2.8853900818f / 11.0f);
+  p = p * t2 + Float4(2.8853900818f / 9.0f);
+  p = p * t2 + Float4(2.8853900818f / 7.0f);
+  p = p * t2 + Float4(2.8853900818f / 5.0f);
+  p = p * t2 + Float4(2.8853900818f / 3.0f);
+  p = p * t2 + Float4(2.8853900818f);
+  return exponentOf(x) + p * t;
+}
+
+// 2^y for y in [-126, 0]: 2^n * e^(f ln 2) with n = round(y), |f ln 2| <= 0.347.
+// Taylor series up to degree 6, the truncation error is below 2e-7.
+Float4 exp2Approx(Float4 y)
+{
+  Float4 n = roundToInt(y);
+  Float4 f = (y - n) * Float4(0.6931471806f);
+  Float4 p = Float4(1.0f / 720.0f);
+  p = p * f + Float4(1.0f / 120.0f);
+  p = p * f + Float4(1.0f / 24.0f);
+  p = p * f + Float4(1.0f / 6.0f);
+  p = p * f + Float4(0.5f);
+  p = p * f + Float4(1.0f);
+  p = p * f + Float4(1.0f);
+  return p * exp2i(n);
+}
+
+Float4 toneMap4(Float4 v, Float4 brightness, Float4 gamma)
+{
+  // Clamping the input to (0, 1] first keeps the exponent in range. The order
+  // of max() arguments maps NaN to the lower bound, the final select to zero.
+  Float4 scaled = v * brightness;
+  Float4 x = min(max(scaled, Float4(FLT_MIN)), Float4(1.0f));
+  Float4 y = max(gamma * log2Approx(x), Float4(-126.0f));
+  Float4 result = min(exp2Approx(y) * Float4(255.0f), Float4(255.0f));
+  return select(Float4(0.0f) < scaled, result, Float4(0.0f));
+}
+
+}
+
+void toneMap(float const* src, uint8_t* dst, size_t count, float brightness, float gamma)
+{
+  Float4 b(brightness);
+  Float4 g(gamma);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    storeBytes(toneMap4(Float4::load(src + i), b, g), dst + i);
+  }
+  if (i < count) {
+    float in[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    uint8_t out[4];
+    std::copy(src + i, src + count, in);
+    storeBytes(toneMap4(Float4::load(in), b, g), out);
+    std::copy(out, out + (count - i), dst + i);
+  }
+}
+
+}
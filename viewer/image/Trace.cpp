@@ -0,0 +1,144 @@
+#include <image/Trace.hpp>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace hdrv::trace {
+
+namespace {
+
+struct Event
+{
+  char const* name;
+  std::string detail;
+  int64_t start; // microseconds since trace::start()
+  int64_t duration;
+};
+
+// Events of one thread. Owned by the recorder, so they outlive pool threads
+// that exit before the trace is written.
+struct ThreadEvents
+{
+  int id = 0;
+  std::mutex mutex; // only contended while the trace is written
+  std::vector<Event> events;
+};
+
+struct Recorder
+{
+  std::atomic<bool> enabled{ false };
+  std::mutex mutex;
+  std::string path;
+  std::chrono::steady_clock::time_point origin;
+  std::vector<std::unique_ptr<ThreadEvents>> threads;
+};
+
+Recorder& recorder()
+{
+  static Recorder* recorder = new Recorder;
+  return *recorder;
+}
+
+ThreadEvents& currentThread()
+{
+  thread_local ThreadEvents* events = [] {
+    auto& r = recorder();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.threads.push_back(std::make_unique<ThreadEvents>());
+    r.threads.back()->id = int(r.threads.size());
+    return r.threads.back().get();
+  }();
+  return *events;
+}
+
+int64_t microseconds(std::chrono::steady_clock::duration duration)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+}
+
+std::string escaped(std::string const& text)
+{
+  std::string result;
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char code[8];
+      std::snprintf(code, sizeof(code), "\\u%04x", unsigned(c));
+      result += code;
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+
+void start(std::string const& path)
+{
+  auto& r = recorder();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  r.path = path;
+  r.origin = std::chrono::steady_clock::now();
+  r.enabled = true;
+}
+
+bool isEnabled()
+{
+  return recorder().enabled.load(std::memory_order_acquire);
+}
+
+bool stop()
+{
+  auto& r = recorder();
+  if (!r.enabled.exchange(false)) {
+    return false;
+  }
+  // The thread writing the trace is the one that started it, normally the UI thread.
+  int mainThread = currentThread().id;
+  std::lock_guard<std::mutex> lock(r.mutex);
+  std::ofstream file(r.path, std::ios::binary | std::ios::trunc);
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  for (auto const& thread : r.threads) {
+    std::lock_guard<std::mutex> threadLock(thread->mutex);
+    if (thread->events.empty() && thread->id != mainThread) {
+      continue;
+    }
+    std::string name = thread->id == mainThread ? "Main" : "Thread " + std::to_string(thread->id);
+    file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id
+         << ",\"args\":{\"name\":\"" << name << "\"}}";
+    first = false;
+    for (auto const& event : thread->events) {
+      file << ",\n{\"name\":\"" << escaped(event.name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+           << ",\"ts\":" << event.start << ",\"dur\":" << event.duration;
+      if (!event.detail.empty()) {
+        file << ",\"args\":{\"detail\":\"" << escaped(event.detail) << "\"}";
+      }
+      file << "}";
+    }
+    thread->events.clear();
+  }
+  file << "\n]}\n";
+  return bool(file);
+}
+
+Scope::~Scope()
+{
+  if (!name_) {
+    return;
+  }
+  auto end = std::chrono::steady_clock::now();
+  auto origin = recorder().origin;
+  auto& thread = currentThread();
+  std::lock_guard<std::mutex> lock(thread.mutex);
+  thread.events.push_back(Event{ name_, std::move(detail_), microseconds(start_ - origin), microseconds(end - start_) });
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Timeline of what each thread does, written as Chrome trace events (JSON)
+// which chrome://tracing and ui.perfetto.dev show with a track per thread.
+//
+// Scopes are marked with HDRV_TRACE_SCOPE("name") or, with a detail such as a
+// file name, HDRV_TRACE_SCOPE_DETAIL("name", detail). Names must be string
+// literals. Without HDRV_TRACING defined at compile time the macros expand to
+// nothing. Otherwise a scope costs a check of a flag until trace::start() is
+// called, the viewer does so for `--trace=<file>` or HDRV_TRACE=<file>.
+
+namespace hdrv::trace {
+
+// Starts recording, events are written to `path` by stop().
+void start(std::string const& path);
+// Writes the recorded events. False if tracing was not started or the file
+// could not be written.
+bool stop();
+bool isEnabled();
+
+// Text escaped for a JSON string, also used by the metrics.
+std::string escaped(std::string const& text);
+
+// Records a complete event from construction to destruction.
+class Scope
+{
+public:
+  explicit Scope(char const* name)
+    : name_(isEnabled() ? name : nullptr)
+  {
+    if (name_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  Scope(char const* name, std::string detail)
+    : Scope(name)
+  {
+    if (name_) {
+      detail_ = std::move(detail);
+    }
+  }
+  ~Scope();
+  Scope(Scope const&) = delete;
+  Scope& operator=(Scope const&) = delete;
+
+private:
+  char const* name_;
+  std::string detail_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}
+
+#ifdef HDRV_TRACING
+#define HDRV_TRACE_CONCAT2(a, b) a##b
+#define HDRV_TRACE_CONCAT(a, b) HDRV_TRACE_CONCAT2(a, b)
+#define HDRV_TRACE_SCOPE(name) ::hdrv::trace::Scope HDRV_TRACE_CONCAT(traceScope, __LINE__)(name)
+#define HDRV_TRACE_SCOPE_DETAIL(name, detail) \
+  ::hdrv::trace::Scope HDRV_TRACE_CONCAT(traceScope, __LINE__)(name, detail)
+#else
+#define HDRV_TRACE_SCOPE(name) static_cast<void>(0)
+#define HDRV_TRACE_SCOPE_DETAIL(name, detail) static_cast<void>(0)
+#endif
@@ -32,6 +32,24 @@ void ImageCollection::load(QUrl const& url)
   add(new ImageDocument(url, this));
 }
 
+void ImageCollection::load(QList<QUrl> const& urls)
+{
+  if (urls.empty()) {
+    return;
+  }
+  if (items_.size() == 1 && items_[0]->isDefault()) {
+    items_.clear();
+  }
+  currentIndex_ = (int)items_.size();
+  // Views are notified once for the whole batch.
+  for (int i = 0; i < urls.size(); ++i) {
+    items_.emplace_back(new ImageDocument(urls[i], this, -i));
+  }
+  emit itemsChanged();
+  emit currentIndexChanged();
+  emit currentChanged();
+}
+
 void ImageCollection::replace(int index, QUrl const& url)
 {
   auto item = items_[index];
@@ -40,6 +40,8 @@ public:
 
   void add(ImageDocument * image);
   Q_INVOKABLE void load(QUrl const& url);
+  // Opens files in new tabs and selects the first, which is loaded first.
+  Q_INVOKABLE void load(QList<QUrl> const& urls);
   Q_INVOKABLE void remove(int index);
   Q_INVOKABLE void replace(int index, QUrl const& url);
   Q_INVOKABLE void compare(int index);
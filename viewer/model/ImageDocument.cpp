@@ -1,16 +1,29 @@
 #include <model/ImageDocument.hpp>
 
 #include <QtConcurrent>
+#include <QCoreApplication>
 #include <QDir>
+#include <QFile>
 #include <QFileInfo>
 #include <QFutureWatcher>
 #include <QFileSystemWatcher>
 #include <QSettings>
+#include <QTemporaryFile>
+#include <QThread>
+#include <QThreadPool>
 #include <QTimer>
 
+#include <image/Exposure.hpp>
+#include <image/Metrics.hpp>
+#include <image/Trace.hpp>
+#include <image/PreviewCache.hpp>
 #include <model/ImageCollection.hpp>
+#include <model/Settings.hpp>
 
 #include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <utility>
 
 namespace hdrv {
 
@@ -22,11 +35,49 @@ std::shared_ptr<Image> createDefaultImage()
 QUrl defaultUrl() { return QUrl("file:////HDRV"); }
 QString nameFromUrl(QUrl const& url) { return QFileInfo(url.fileName()).completeBaseName(); }
 
-ImageDocument::ImageDocument(QUrl const& url, QObject * parent)
+// A pool of its own using half of the cores, owned by the application.
+QThreadPool* boundedPool()
+{
+  auto* pool = new QThreadPool(QCoreApplication::instance());
+  pool->setMaxThreadCount(std::max(2, QThread::idealThreadCount() / 2));
+  return pool;
+}
+
+// Exports run on their own bounded pool, so writing a few large files at once
+// neither blocks the UI nor starves image loading in the global pool.
+QThreadPool* exportPool()
+{
+  static QThreadPool* pool = boundedPool();
+  return pool;
+}
+
+// Loads run on their own bounded pool, in order of priority: of many files
+// opened at once the first is decoded first instead of all of them sharing the
+// machine. Work inside a load (eg. decoding EXR chunks) uses the global pool.
+QThreadPool* loadPool()
+{
+  static QThreadPool* pool = boundedPool();
+  return pool;
+}
+
+// Exports are written next to the target file and only moved into place once
+// complete, so a cancelled or failed export leaves an existing file untouched.
+// Every export gets a file of its own, two exports to the same target do not
+// write into each other. Keeps the suffix, it selects the format. Empty if the
+// file could not be created.
+QString temporaryExportPath(QFileInfo const& file)
+{
+  QTemporaryFile temp(file.dir().filePath("." + file.completeBaseName() + ".XXXXXX.hdrv-export." + file.suffix()));
+  temp.setAutoRemove(false);
+  return temp.open() ? temp.fileName() : QString();
+}
+
+ImageDocument::ImageDocument(QUrl const& url, QObject * parent, int loadPriority)
   : QObject(parent)
   , name_(nameFromUrl(url))
   , url_(url)
   , image_(createDefaultImage())
+  , loadPriority_(loadPriority)
 {
   init();
 
@@ -58,6 +109,32 @@ ImageDocument::ImageDocument(QObject * parent)
   init();
 }
 
+ImageDocument::ImageDocument(QString const& name, std::shared_ptr<Image> image, QObject * parent, bool live)
+  : QObject(parent)
+  , name_(name)
+  , url_(QUrl((live ? "hdrv-live:" : "hdrv-memory:") + name))
+  , image_(std::move(image))
+  , loaded_(true)
+  , live_(live)
+{
+  init();
+
+  if (live_) {
+    // Statistics follow the pixels, but not on every single update.
+    liveRefresh_ = new QTimer(this);
+    liveRefresh_->setSingleShot(true);
+    liveRefresh_->setInterval(250);
+    connect(liveRefresh_, &QTimer::timeout, [this]() {
+      image_->pixelsChanged();
+      updateStatistics();
+      updateBadPixels();
+      emit pixelValueChanged();
+    });
+  }
+  updateStatistics();
+  updateBadPixels();
+}
+
 void ImageDocument::init()
 {
   QSettings settings;
@@ -229,29 +306,347 @@ void ImageDocument::setComparisonSeparator(float value)
   }
 }
 
+void ImageDocument::setHighlightChanges(bool value)
+{
+  if (comparison_ && comparison_->highlightChanges != value) {
+    comparison_->highlightChanges = value;
+    emit highlightChangesChanged();
+    emit propertyChanged();
+  }
+}
+
 void ImageDocument::setLayer(int layer)
 {
   if (layer_ != layer) {
     layer_ = layer;
     emit layerChanged();
     emit propertyChanged();
+    updateStatistics();
+    updateMetrics();
   }
 }
 
+int ImageDocument::currentLayer() const
+{
+  return std::clamp(layer_, 0, std::max(0, int(image_->layers().size()) - 1));
+}
+
+void ImageDocument::autoExposure()
+{
+  float value = estimateExposure(*image_, currentLayer(), Settings::exposureOptions());
+  setBrightness(std::clamp(qreal(std::round(value * 10.0f) / 10.0f), minBrightness(), maxBrightness()));
+}
+
+void ImageDocument::autoGamma()
+{
+  if (isFloat()) {
+    float value = estimateGamma(*image_, currentLayer(), float(brightness()));
+    setGamma(std::clamp(qreal(std::round(value * 10.0f) / 10.0f), minGamma(), maxGamma()));
+  }
+}
+
+QVariantList ImageDocument::statistics() const
+{
+  QVariantList result;
+  if (!statistics_) {
+    return result;
+  }
+  for (auto const& channel : statistics_->channels) {
+    QVariantMap map;
+    map["min"] = channel.min;
+    map["max"] = channel.max;
+    map["mean"] = channel.mean;
+    map["stdDev"] = std::sqrt(channel.variance);
+    map["median"] = channel.percentile(0.5);
+    map["p1"] = channel.percentile(0.01);
+    map["p99"] = channel.percentile(0.99);
+    map["nanCount"] = qulonglong(channel.nanCount);
+    map["infCount"] = qulonglong(channel.infCount);
+    map["negativeCount"] = qulonglong(channel.negativeCount);
+    result.push_back(map);
+  }
+  return result;
+}
+
+void ImageDocument::updateStatistics()
+{
+  if (!statisticsWatcher_) {
+    statisticsWatcher_ = new QFutureWatcher<StatisticsResult>(this);
+    connect(statisticsWatcher_, &QFutureWatcher<StatisticsResult>::finished, [this]() {
+      statistics_ = statisticsWatcher_->result();
+      emit statisticsChanged();
+    });
+  }
+  // Cached on the image, so switching back to a layer is instant.
+  int layer = currentLayer();
+  std::string path = isDefault() ? std::string() : url_.toLocalFile().toStdString();
+  statisticsWatcher_->setFuture(QtConcurrent::run([image = image_, layer, path]() {
+    auto statistics = image->statistics(layer);
+    // The preview cache keeps them for the next time the file is opened.
+    // Writing the preview does not hold up showing the statistics.
+    if (layer == 0 && !path.empty()) {
+      QThreadPool::globalInstance()->start([image, path, statistics]() {
+        PreviewCache::shared().store(path, *image, statistics);
+      });
+    }
+    return statistics;
+  }));
+}
+
+void ImageDocument::updateBadPixels()
+{
+  if (!badPixelsWatcher_) {
+    badPixelsWatcher_ = new QFutureWatcher<BadPixelsResult>(this);
+    connect(badPixelsWatcher_, &QFutureWatcher<BadPixelsResult>::finished, [this]() {
+      badPixels_ = badPixelsWatcher_->result();
+      if (badPixel_ >= int(badPixels_->pixels.size())) {
+        badPixel_ = -1;
+      }
+      emit badPixelsChanged();
+    });
+  }
+  // Cached on the image, instant for loaded files which find them on the loader thread.
+  badPixelsWatcher_->setFuture(QtConcurrent::run([image = image_]() { return image->badPixels(); }));
+}
+
+QVariantMap ImageDocument::badPixels() const
+{
+  // Until the scan is done there are none.
+  auto index = badPixels_ ? badPixels_ : std::make_shared<BadPixelIndex const>();
+  QVariantMap map;
+  map["count"] = qulonglong(index->count);
+  map["nanCount"] = qulonglong(index->nanCount);
+  map["infCount"] = qulonglong(index->infCount);
+  map["negativeCount"] = qulonglong(index->negativeCount);
+  map["truncated"] = index->truncated;
+  map["current"] = badPixel_ + 1;
+  map["indexed"] = int(index->pixels.size());
+  return map;
+}
+
+void ImageDocument::nextBadPixel()
+{
+  auto index = badPixels_;
+  if (!index || index->pixels.empty()) {
+    return;
+  }
+  badPixel_ = (badPixel_ + 1) % int(index->pixels.size());
+  auto const& pixel = index->pixels[badPixel_];
+  if (pixel.layer != layer_ && hasLayers()) {
+    setLayer(pixel.layer);
+  }
+  // Zoomed in far enough to make out single pixels, centered on the bad one.
+  constexpr qreal minScale = 16.0;
+  setScale(std::max(scale(), minScale));
+  QPointF center(pixel.x + 0.5 - 0.5 * width(), pixel.y + 0.5 - 0.5 * height());
+  setPosition(center * scale());
+  setCurrentPixel(QPoint(pixel.x, pixel.y));
+  emit badPixelsChanged();
+}
+
+void ImageDocument::updateRegion(QRect const& region)
+{
+  QRect bounded = region & QRect(0, 0, width(), height());
+  if (!live_ || bounded.isEmpty()) {
+    return;
+  }
+  // Regions pending since the last frame are uploaded together, a burst of
+  // updates costs a single render.
+  bool pending = !changedRegions_.empty();
+  bool merged = false;
+  for (auto& r : changedRegions_) {
+    // Neighbouring tiles in a row or column of a bucket renderer become one upload.
+    bool row = r.top() == bounded.top() && r.height() == bounded.height()
+      && (r.right() + 1 >= bounded.left() && bounded.right() + 1 >= r.left());
+    bool column = r.left() == bounded.left() && r.width() == bounded.width()
+      && (r.bottom() + 1 >= bounded.top() && bounded.bottom() + 1 >= r.top());
+    if (r.contains(bounded) || row || column) {
+      r |= bounded;
+      merged = true;
+      break;
+    }
+  }
+  // Beyond a few dozen separate regions a single upload of the bounding box is
+  // cheaper than one call per region.
+  constexpr size_t maxRegions = 64;
+  if (!merged && changedRegions_.size() >= maxRegions) {
+    QRect bounds = bounded;
+    for (auto const& r : changedRegions_) {
+      bounds |= r;
+    }
+    changedRegions_ = { bounds };
+  } else if (!merged) {
+    changedRegions_.push_back(bounded);
+  }
+  if (!liveRefresh_->isActive()) {
+    liveRefresh_->start();
+  }
+  if (!pending) {
+    emit pixelsChanged();
+  }
+}
+
+std::vector<QRect> ImageDocument::takeChangedRegions()
+{
+  return std::exchange(changedRegions_, {});
+}
+
+QVariantMap ImageDocument::metrics() const
+{
+  QVariantMap map;
+  if (!metrics_) {
+    return map;
+  }
+  if (!*metrics_) {
+    map["error"] = QString::fromStdString(metrics_->error());
+    return map;
+  }
+  auto const& metrics = metrics_->value();
+  map["mse"] = metrics.color.mse;
+  map["rmse"] = metrics.color.rmse;
+  map["relMse"] = metrics.color.relativeMse;
+  map["psnr"] = metrics.color.psnr;
+  map["ssim"] = metrics.color.ssim;
+  map["maxError"] = metrics.color.maxError;
+  map["perceptual"] = metrics.perceptual;
+  map["invalidPixels"] = qulonglong(metrics.invalidPixels);
+  map["identical"] = metrics.identical;
+  map["changedRegions"] = int(metrics.changedRegions.size());
+  return map;
+}
+
+void ImageDocument::updateMetrics()
+{
+  if (!comparison_) {
+    return;
+  }
+  // Known without waiting for the base image, there is nothing to highlight.
+  if (identicalFiles_) {
+    metrics_ = std::make_shared<Result<ImageMetrics>>(identicalMetrics(channels()));
+    comparison_->changedRegions.clear();
+    emit metricsChanged();
+    emit propertyChanged();
+    return;
+  }
+  // Both images need to be loaded.
+  if (watcher_ && watcher_->isRunning()) {
+    return;
+  }
+  if (!metricsWatcher_) {
+    metricsWatcher_ = new QFutureWatcher<MetricsResult>(this);
+    connect(metricsWatcher_, &QFutureWatcher<MetricsResult>::finished, [this]() {
+      // Superseded by the files turning out identical.
+      if (identicalFiles_) {
+        return;
+      }
+      metrics_ = metricsWatcher_->result();
+      if (comparison_) {
+        comparison_->changedRegions.clear();
+        if (*metrics_) {
+          for (auto const& region : metrics_->value().changedRegions) {
+            comparison_->changedRegions.push_back(QRect(region.x, region.y, region.width, region.height));
+          }
+        }
+      }
+      emit metricsChanged();
+      emit propertyChanged();
+    });
+  }
+  // The comparison image is the reference, as in the difference view.
+  int layer = currentLayer();
+  metricsWatcher_->setFuture(QtConcurrent::run([image = image_, reference = comparison_->image, layer]() {
+    return std::make_shared<Result<ImageMetrics>>(computeMetrics(*image, *reference, layer));
+  }));
+}
+
+qreal ImageDocument::exportProgress() const
+{
+  if (exports_.empty()) {
+    return 0.0;
+  }
+  qreal sum = 0.0;
+  for (auto* watcher : exports_) {
+    int range = std::max(1, watcher->progressMaximum() - watcher->progressMinimum());
+    sum += qreal(watcher->progressValue() - watcher->progressMinimum()) / range;
+  }
+  return sum / exports_.size();
+}
+
 void ImageDocument::store(QUrl const& url)
 {
   QFileInfo file(url.toLocalFile());
-  if (file.suffix() == "hdr" || file.suffix() == "pic") {
-    check(image()->storePIC(file.absoluteFilePath().toStdString()), ErrorCategory::Generic);
-  } else if (file.suffix() == "pfm" || file.suffix() == "ppm") {
-    check(image()->storePFM(file.absoluteFilePath().toStdString()), ErrorCategory::Generic);
-  } else if (file.suffix() == "exr") {
-    check(image()->storeEXR(file.absoluteFilePath().toStdString()), ErrorCategory::Generic);
-  } else if (file.suffix() == "png") {
-    check(image()->storeImage(file.absoluteFilePath().toStdString(), pow(2.0f, brightness()), 1.0f / gamma()), ErrorCategory::Generic);
-  } else {
-    setError("Unsupported file extension: " + file.suffix(), ErrorCategory::Generic);
+  QString suffix = file.suffix();
+  QStringList supported = { "hdr", "pic", "pfm", "ppm", "exr", "png" };
+  if (!supported.contains(suffix)) {
+    setError("Unsupported file extension: " + suffix, ErrorCategory::Generic);
+    return;
+  }
+
+  QString path = file.absoluteFilePath();
+  QString tempPath = temporaryExportPath(file);
+  if (tempPath.isEmpty()) {
+    setError("Could not write to " + file.absolutePath(), ErrorCategory::Generic);
+    return;
+  }
+  float exportBrightness = pow(2.0f, brightness());
+  float exportGamma = 1.0f / gamma();
+  EXROptions exrOptions = Settings::exrOptions();
+
+  auto* watcher = new QFutureWatcher<StoreResult>(this);
+  connect(watcher, SIGNAL(progressValueChanged(int)), this, SIGNAL(exportProgressChanged()));
+  connect(
+    watcher, &QFutureWatcher<StoreResult>::finished,
+    std::bind(&ImageDocument::storeFinished, this, watcher, path));
+
+  // The job holds its own reference to the image, it stays valid if the document
+  // is reloaded or closed while the export is still running.
+  QFuture<StoreResult> future = QtConcurrent::run(exportPool(),
+    [image = image_, path, tempPath, exportBrightness, exportGamma, exrOptions](QPromise<StoreResult>& promise) {
+      promise.setProgressRange(0, 1000);
+      Progress progress = [&promise](float p) {
+        promise.setProgressValue(int(p * 1000.0f));
+        return !promise.isCanceled();
+      };
+      auto result = std::make_shared<Result<bool>>(
+        image->store(tempPath.toStdString(), exportBrightness, exportGamma, exrOptions, progress));
+      if (*result && !promise.isCanceled()) {
+        // Replaces the target in one step, unlike QFile::rename.
+        std::error_code error;
+        std::filesystem::rename(std::filesystem::u8path(tempPath.toStdString()),
+          std::filesystem::u8path(path.toStdString()), error);
+        if (error) {
+          *result = Result<bool>("Could not replace " + path.toStdString() + ": " + error.message());
+        }
+      }
+      QFile::remove(tempPath);
+      promise.addResult(result);
+    });
+  watcher->setFuture(future);
+  metrics::counter("jobs.queued").add();
+
+  exports_.push_back(watcher);
+  emit exportingChanged();
+  emit exportProgressChanged();
+}
+
+void ImageDocument::cancelExport()
+{
+  for (auto* watcher : exports_) {
+    watcher->cancel();
+  }
+}
+
+void ImageDocument::storeFinished(QFutureWatcher<StoreResult>* watcher, QString const& path)
+{
+  if (!watcher->isCanceled() && watcher->future().resultCount() > 0) {
+    check(*watcher->result(), ErrorCategory::Generic, "Failed to export " + path + ": ");
+  } else if (watcher->isCanceled()) {
+    metrics::counter("jobs.cancelled").add();
   }
+  exports_.erase(std::find(exports_.begin(), exports_.end(), watcher));
+  watcher->deleteLater();
+  emit exportingChanged();
+  emit exportProgressChanged();
 }
 
 QVector4D ImageDocument::pixelValue() const
@@ -280,35 +675,108 @@ QVector4D ImageDocument::pixelValue() const
 
 void ImageDocument::load(QString const& path, QFutureWatcher<LoadResult>* watcher)
 {
-  QFuture<LoadResult> future = QtConcurrent::run([path]() {
+  HDRV_TRACE_SCOPE_DETAIL("ImageDocument::load", path.toStdString());
+  metrics::counter("jobs.queued").add();
+  metrics::counter("jobs.waiting").add();
+  // Looked up before loading, a file changing in between is reloaded anyway.
+  // Files opened for the first time show the cached preview until they are
+  // decoded, reloads keep showing the image they had.
+  std::string absolutePath = QFileInfo(path).absoluteFilePath().toStdString();
+  QFuture<PreviewResult> preview = QtConcurrent::run([absolutePath]() {
+    return PreviewCache::shared().find(absolutePath);
+  });
+  if (watcher == watcher_ && !loaded_) {
+    if (!previewWatcher_) {
+      previewWatcher_ = new QFutureWatcher<PreviewResult>(this);
+      connect(previewWatcher_, &QFutureWatcher<PreviewResult>::finished,
+        [this]() { showPlaceholder(previewWatcher_->result()); });
+    }
+    previewWatcher_->setFuture(preview);
+  }
+  // A comparison file with the same bytes as the base file is not decoded,
+  // the base image is compared against itself. No result stands for that.
+  QString base = watcher == comparisonWatcher_ ? QFileInfo(url_.toLocalFile()).absoluteFilePath() : QString();
+  QFuture<LoadResult> future = QtConcurrent::task([path, preview, base]() {
+    HDRV_TRACE_SCOPE_DETAIL("load task", path.toStdString());
+    metrics::counter("jobs.waiting").add(-1);
     QFileInfo file(path);
     std::string path = file.absoluteFilePath().toStdString();
     if (!file.exists()) {
       return std::make_shared<Result<Image>>("File " + path + " does not exist.");
     }
-    if (file.suffix() == "hdr" || file.suffix() == "pic") {
-      return std::make_shared<Result<Image>>(Image::loadPIC(path));
-    } else if (file.suffix() == "pfm" || file.suffix() == "ppm") {
-      return std::make_shared<Result<Image>>(Image::loadPFM(path));
-    } else if (file.suffix() == "exr") {
-      return std::make_shared<Result<Image>>(Image::loadEXR(path));
-    } else {
-      return std::make_shared<Result<Image>>(Image::loadImage(path));
+    if (!base.isEmpty() && filesIdentical(base.toStdString(), path)) {
+      return LoadResult();
     }
-  });
+    auto cached = preview.result();
+    auto result = std::make_shared<Result<Image>>(Image::load(path));
+    if (*result) {
+      // Files seen before skip computing the statistics of the first layer.
+      if (cached && cached->statistics) {
+        result->value().setStatistics(0, cached->statistics);
+      }
+      // Computed while still on the loader thread: comparisons use the hashes to
+      // skip identical tiles, bad pixels are shown right away.
+      result->value().tileHashes();
+      result->value().badPixels();
+    }
+    return result;
+  }).onThreadPool(*loadPool()).withPriority(loadPriority_).spawn();
   watcher->setFuture(future);
+  // The changed base file may no longer match the comparison file.
+  if (watcher == watcher_ && identicalFiles_) {
+    load(comparisonUrl_.toLocalFile(), comparisonWatcher_);
+  }
+}
+
+void ImageDocument::showPlaceholder(PreviewResult const& preview)
+{
+  if (loaded_ || !preview || preview->levels.empty()) {
+    return;
+  }
+  placeholder_ = std::make_shared<Image>(preview->levels.front());
+  placeholderSize_ = QSize(preview->width, preview->height);
+  emit propertyChanged();
 }
 
 void ImageDocument::loadFinished(QFutureWatcher<LoadResult>* watcher, QUrl const& url, bool comparison)
 {
+  HDRV_TRACE_SCOPE_DETAIL("ImageDocument::loadFinished", url.toLocalFile().toStdString());
   auto result = watcher->result();
+  if (!result) {
+    identicalFiles_ = true;
+    comparison_ = Comparison(image_);
+    emit isComparisonChanged();
+    updateMetrics();
+    setError("", ErrorCategory::Comparison);
+    emit errorTextChanged();
+    emit fileTypeChanged();
+    emit propertyChanged();
+    return;
+  }
+  if (!comparison) {
+    loaded_ = loaded_ || bool(*result);
+    placeholder_ = nullptr;
+  }
   if (check(*result, comparison ? ErrorCategory::Comparison : ErrorCategory::Image, "Failed to load " + url.toLocalFile() + ": ")) {
     if (!comparison) {
       image_ = std::make_shared<Image>(std::move(*result).value());
+      if (identicalFiles_) {
+        comparison_->image = image_;
+      }
+      badPixels_ = nullptr;
+      badPixel_ = -1;
+      emit badPixelsChanged();
+      updateBadPixels();
+      updateStatistics();
+      if (Settings::autoExposureOnLoad()) {
+        autoExposure();
+      }
     } else {
+      identicalFiles_ = false;
       comparison_ = Comparison(std::make_shared<Image>(std::move(*result).value()));
       emit isComparisonChanged();
     }
+    updateMetrics();
     setError("", comparison ? ErrorCategory::Comparison : ErrorCategory::Image);
     emit errorTextChanged();
     emit fileTypeChanged();
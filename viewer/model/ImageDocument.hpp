@@ -7,20 +7,29 @@
 #include <QObject>
 #include <QSize>
 #include <QPoint>
+#include <QRect>
 #include <QUrl>
+#include <QVariantList>
+#include <QVariantMap>
 #include <QVector4D>
 #include <QFutureWatcher>
+#include <QTimer>
 
 #include <image/Image.hpp>
+#include <image/ImageMetrics.hpp>
 
 namespace hdrv {
 
+struct CachedPreview;
+
 class ImageDocument : public QObject
 {
   Q_OBJECT
   Q_PROPERTY(QString name READ name CONSTANT FINAL)
   Q_PROPERTY(QUrl url READ url CONSTANT FINAL)
   Q_PROPERTY(bool busy READ busy NOTIFY busyChanged)
+  Q_PROPERTY(bool exporting READ exporting NOTIFY exportingChanged)
+  Q_PROPERTY(qreal exportProgress READ exportProgress NOTIFY exportProgressChanged)
   Q_PROPERTY(QStringList errorText READ errorText NOTIFY errorTextChanged)
   Q_PROPERTY(QUrl directory READ directory CONSTANT FINAL)
   Q_PROPERTY(QString fileType READ fileType NOTIFY fileTypeChanged)
@@ -41,9 +50,13 @@ class ImageDocument : public QObject
   Q_PROPERTY(bool isComparison READ isComparison NOTIFY isComparisonChanged)
   Q_PROPERTY(ComparisonMode comparisonMode READ comparisonMode WRITE setComparisonMode NOTIFY comparisonModeChanged)
   Q_PROPERTY(float comparisonSeparator READ comparisonSeparator WRITE setComparisonSeparator NOTIFY comparisonSeparatorChanged)
+  Q_PROPERTY(bool highlightChanges READ highlightChanges WRITE setHighlightChanges NOTIFY highlightChangesChanged)
   Q_PROPERTY(bool hasLayers READ hasLayers NOTIFY propertyChanged)
   Q_PROPERTY(QList<QString> layers READ layers NOTIFY propertyChanged)
   Q_PROPERTY(int layer READ layer WRITE setLayer NOTIFY layerChanged)
+  Q_PROPERTY(QVariantList statistics READ statistics NOTIFY statisticsChanged)
+  Q_PROPERTY(QVariantMap metrics READ metrics NOTIFY metricsChanged)
+  Q_PROPERTY(QVariantMap badPixels READ badPixels NOTIFY badPixelsChanged)
 
 public:
   enum class ComparisonMode { Difference, SideBySide };
@@ -57,20 +70,28 @@ public:
     std::shared_ptr<Image> image;
     ComparisonMode mode = ComparisonMode::Difference;
     float separator = 0.5f;
+    bool highlightChanges = true;
+    std::vector<QRect> changedRegions; // from the comparison metrics, in pixels from the top-left corner
 
     Comparison() = default;
     Comparison(std::shared_ptr<Image> i) : image(std::move(i)) {}
   };
 
-  ImageDocument(QUrl const& url, QObject * parent = nullptr);
+  // Loads with a higher priority start before others still waiting.
+  ImageDocument(QUrl const& url, QObject * parent = nullptr, int loadPriority = 0);
   ImageDocument(QUrl const& base, QUrl const& comparison, QObject * parent = nullptr);
   ImageDocument(QObject * parent = nullptr);
+  // A live image whose pixels are written in place by another process, see
+  // IPCSession. Not live, an image in memory shown as if loaded from a file.
+  ImageDocument(QString const& name, std::shared_ptr<Image> image, QObject * parent = nullptr, bool live = true);
 
   void init();
 
   QString const& name() const { return name_; }
   QUrl const& url() const { return url_; }
   bool busy() const { return (watcher_ && watcher_->isRunning()) || (comparisonWatcher_ && comparisonWatcher_->isRunning()); }
+  bool exporting() const { return !exports_.empty(); }
+  qreal exportProgress() const;
   QStringList const& errorText() const { return errorText_; }
   QUrl directory() const;
   QString fileType() const;
@@ -90,16 +111,27 @@ public:
   DisplayMode displayMode() const { return displayMode_; }
   void const* pixels() const { return image_->data(); }
   std::shared_ptr<Image> const& image() { return image_; }
+  // Reduced image from the preview cache drawn at `placeholderSize()` while a
+  // file is decoded for the first time, null otherwise.
+  std::shared_ptr<Image> const& placeholder() const { return placeholder_; }
+  QSize placeholderSize() const { return placeholderSize_; }
+  // False until the file is decoded, the image is an empty default meanwhile.
+  bool isLoaded() const { return loaded_; }
   QPoint pixelPosition() const { return pixelPosition_; }
   QVector4D pixelValue() const;
   bool isDefault() const;
+  bool isLive() const { return live_; }
   bool isComparison() const { return (bool)comparison_; }
   std::optional<Comparison> const& comparison() const { return comparison_; }
-  ComparisonMode comparisonMode() const { return comparison_.value_or(Comparison()).mode; }
-  float comparisonSeparator() const { return comparison_.value_or(Comparison()).separator; }
+  ComparisonMode comparisonMode() const { return comparison_ ? comparison_->mode : Comparison().mode; }
+  float comparisonSeparator() const { return comparison_ ? comparison_->separator : Comparison().separator; }
+  bool highlightChanges() const { return comparison_ && comparison_->highlightChanges; }
   bool hasLayers() const { return image_->layers().size() > 1; }
   QList<QString> layers() const;
   int layer() const { return layer_; }
+  QVariantList statistics() const;
+  QVariantMap metrics() const;
+  QVariantMap badPixels() const;
 
   enum class ErrorCategory { Image, Comparison, Generic };
   void setError(QString const& errorText, ErrorCategory category);
@@ -113,13 +145,26 @@ public:
   void setCurrentPixel(QPoint index);
   void setComparisonMode(ComparisonMode mode);
   void setComparisonSeparator(float value);
+  void setHighlightChanges(bool value);
   void setLayer(int layer);
 
   Q_INVOKABLE void resetError();
   Q_INVOKABLE void store(QUrl const& url);
+  Q_INVOKABLE void cancelExport();
+  Q_INVOKABLE void autoExposure();
+  Q_INVOKABLE void autoGamma();
+  // Centers the view on the next NaN, infinite or negative pixel and selects it.
+  Q_INVOKABLE void nextBadPixel();
+
+  // Marks pixels of a live image as written, in pixels from the top-left corner.
+  void updateRegion(QRect const& region);
+  // Regions changed since the last call, for the renderer to upload.
+  std::vector<QRect> takeChangedRegions();
 
 signals:
   void busyChanged();
+  void exportingChanged();
+  void exportProgressChanged();
   void errorTextChanged();
   void propertyChanged();
   void positionChanged();
@@ -132,8 +177,13 @@ signals:
   void isComparisonChanged();
   void comparisonModeChanged();
   void comparisonSeparatorChanged();
+  void highlightChangesChanged();
   void fileTypeChanged();
   void layerChanged();
+  void statisticsChanged();
+  void metricsChanged();
+  void badPixelsChanged();
+  void pixelsChanged();
 
 private:
   typedef std::shared_ptr<Result<Image>> LoadResult;
@@ -141,6 +191,23 @@ private:
   void load(QString const& path, QFutureWatcher<LoadResult>* watcher);
   void loadFinished(QFutureWatcher<LoadResult>* watcher, QUrl const& url, bool comparison);
 
+  int currentLayer() const;
+
+  typedef std::shared_ptr<CachedPreview const> PreviewResult;
+  void showPlaceholder(PreviewResult const& preview);
+
+  typedef std::shared_ptr<LayerStatistics const> StatisticsResult;
+  void updateStatistics();
+
+  typedef std::shared_ptr<BadPixelIndex const> BadPixelsResult;
+  void updateBadPixels();
+
+  typedef std::shared_ptr<Result<ImageMetrics>> MetricsResult;
+  void updateMetrics();
+
+  typedef std::shared_ptr<Result<bool>> StoreResult;
+  void storeFinished(QFutureWatcher<StoreResult>* watcher, QString const& path);
+
   template<class T>
   bool check(Result<T> const& result, ErrorCategory category, QString const& prefix = "") {
     if (!result) {
@@ -165,6 +232,23 @@ private:
   int layer_ = 0;
   QFutureWatcher<LoadResult>* watcher_ = nullptr;
   QFutureWatcher<LoadResult>* comparisonWatcher_ = nullptr;
+  QFutureWatcher<PreviewResult>* previewWatcher_ = nullptr;
+  std::shared_ptr<Image> placeholder_;
+  QSize placeholderSize_;
+  bool loaded_ = false; // has its image: decoded, live or in memory
+  bool identicalFiles_ = false; // comparison file has the bytes of the base file and is not decoded
+  std::vector<QFutureWatcher<StoreResult>*> exports_;
+  QFutureWatcher<StatisticsResult>* statisticsWatcher_ = nullptr;
+  StatisticsResult statistics_;
+  QFutureWatcher<MetricsResult>* metricsWatcher_ = nullptr;
+  MetricsResult metrics_;
+  QFutureWatcher<BadPixelsResult>* badPixelsWatcher_ = nullptr;
+  BadPixelsResult badPixels_;
+  int badPixel_ = -1; // index of the pixel last jumped to
+  int loadPriority_ = 0;
+  bool live_ = false;
+  std::vector<QRect> changedRegions_;
+  QTimer* liveRefresh_ = nullptr;
 };
 
 using ImageComparison = ImageDocument::Comparison;
@@ -0,0 +1,383 @@
+#include <model/ImageQueries.hpp>
+
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QRect>
+
+#include <image/Metrics.hpp>
+#include <image/PreviewCache.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace hdrv {
+
+namespace {
+
+// Largest region returned as a JSON array, larger ones need binary data.
+constexpr qint64 maxJsonValues = 1 << 24;
+
+int layerCount(Image const& image)
+{
+  return std::max(1, int(image.layers().size()));
+}
+
+bool isInteger(Image const& image, int layer)
+{
+  return layer < int(image.layers().size()) && image.layers()[layer].display == Image::Integer;
+}
+
+// Integer layers hold 32 bit integers in the bits of floats, as in ImageDocument::pixelValue().
+float pixelValue(Image const& image, int x, int y, int channel, int layer, bool integer)
+{
+  float value = image.value(x, y, channel, layer);
+  if (integer) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    value = float(bits);
+  }
+  return value;
+}
+
+// JSON has no NaN and infinity, they are written as strings.
+QJsonValue number(double value)
+{
+  if (std::isnan(value)) {
+    return "nan";
+  } else if (std::isinf(value)) {
+    return value > 0 ? "inf" : "-inf";
+  }
+  return value;
+}
+
+Result<int> layerOf(Image const& image, QJsonValue const& value)
+{
+  if (value.isUndefined() || value.isNull()) {
+    return int(0);
+  }
+  if (value.isDouble()) {
+    int layer = value.toInt(-1);
+    if (layer >= 0 && layer < layerCount(image)) {
+      return int(layer);
+    }
+  } else if (value.isString()) {
+    auto name = value.toString().toStdString();
+    for (int i = 0; i < int(image.layers().size()); ++i) {
+      if (image.layers()[i].name == name) {
+        return int(i);
+      }
+    }
+  }
+  return "No layer " + value.toVariant().toString().toStdString() + " in the image.";
+}
+
+Result<QRect> regionOf(Image const& image, QJsonValue const& value)
+{
+  QRect bounds(0, 0, image.width(), image.height());
+  if (value.isUndefined() || value.isNull()) {
+    return QRect(bounds);
+  }
+  auto array = value.toArray();
+  QRect region(array.at(0).toInt(), array.at(1).toInt(), array.at(2).toInt(), array.at(3).toInt());
+  if (array.size() != 4 || region.isEmpty() || !bounds.contains(region)) {
+    return "The region must be [x, y, width, height] inside the image.";
+  }
+  return QRect(region);
+}
+
+char const* formatName(Image::Format format)
+{
+  switch (format) {
+    case Image::Byte: return "byte";
+    case Image::Short: return "short";
+    default: return "float";
+  }
+}
+
+char const* displayName(Image::Display display)
+{
+  switch (display) {
+    case Image::Luminance: return "luminance";
+    case Image::Depth: return "depth";
+    case Image::Normal: return "normal";
+    case Image::Integer: return "integer";
+    default: return "color";
+  }
+}
+
+// Decoded size, including all layers.
+uint64_t bytesOf(Image const& image)
+{
+  uint64_t bytes = image.sizeInBytes();
+  for (int layer = 1; layer < int(image.layers().size()); ++layer) {
+    bytes += uint64_t(image.height()) * image.stride(layer);
+  }
+  return bytes;
+}
+
+QJsonObject info(Image const& image)
+{
+  QJsonArray layers;
+  for (int layer = 0; layer < layerCount(image); ++layer) {
+    bool named = layer < int(image.layers().size());
+    layers.append(QJsonObject {
+      { "name", named ? QString::fromStdString(image.layers()[layer].name) : QString() },
+      { "channels", image.channels(layer) },
+      { "display", displayName(named ? image.layers()[layer].display : Image::Color) },
+    });
+  }
+  return QJsonObject {
+    { "width", image.width() },
+    { "height", image.height() },
+    { "format", formatName(image.format()) },
+    { "layers", layers },
+  };
+}
+
+Result<QJsonObject> pixels(Image const& image, int layer, QJsonObject const& request, QByteArray * data)
+{
+  int channels = image.channels(layer);
+  bool integer = isInteger(image, layer);
+  if (request.contains("points")) {
+    QJsonArray values;
+    for (auto const& point : request["points"].toArray()) {
+      auto p = point.toArray();
+      int x = p.at(0).toInt(-1);
+      int y = p.at(1).toInt(-1);
+      if (p.size() != 2 || x < 0 || y < 0 || x >= image.width() || y >= image.height()) {
+        return "Points must be [x, y] inside the image.";
+      }
+      QJsonArray pixel;
+      for (int c = 0; c < channels; ++c) {
+        pixel.append(number(pixelValue(image, x, y, c, layer, integer)));
+      }
+      values.append(pixel);
+    }
+    return QJsonObject { { "layer", layer }, { "channels", channels }, { "values", values } };
+  }
+
+  auto region = regionOf(image, request["region"]);
+  if (!region) {
+    return region.error();
+  }
+  auto r = region.value();
+  QJsonObject result {
+    { "layer", layer },
+    { "region", QJsonArray { r.x(), r.y(), r.width(), r.height() } },
+    { "channels", channels },
+  };
+  qint64 count = qint64(r.width()) * r.height() * channels;
+  if (request["binary"].toBool() && data) {
+    std::vector<float> row(size_t(r.width()) * channels);
+    data->reserve(data->size() + count * qint64(sizeof(float)));
+    for (int y = r.top(); y <= r.bottom(); ++y) {
+      for (int x = 0; x < r.width(); ++x) {
+        for (int c = 0; c < channels; ++c) {
+          row[size_t(x) * channels + c] = pixelValue(image, r.x() + x, y, c, layer, integer);
+        }
+      }
+      data->append(reinterpret_cast<char const*>(row.data()), qsizetype(row.size() * sizeof(float)));
+    }
+    result["binary"] = true;
+    return std::move(result);
+  }
+  if (count > maxJsonValues) {
+    return "The region is too large for JSON, ask for binary data.";
+  }
+  QJsonArray values;
+  for (int y = r.top(); y <= r.bottom(); ++y) {
+    for (int x = r.left(); x <= r.right(); ++x) {
+      for (int c = 0; c < channels; ++c) {
+        values.append(number(pixelValue(image, x, y, c, layer, integer)));
+      }
+    }
+  }
+  result["values"] = values;
+  return std::move(result);
+}
+
+QJsonObject statistics(LayerStatistics const& statistics)
+{
+  QJsonArray channels;
+  for (auto const& channel : statistics.channels) {
+    channels.append(QJsonObject {
+      { "min", number(channel.min) },
+      { "max", number(channel.max) },
+      { "mean", channel.mean },
+      { "stdDev", std::sqrt(channel.variance) },
+      { "median", number(channel.percentile(0.5)) },
+      { "p1", number(channel.percentile(0.01)) },
+      { "p99", number(channel.percentile(0.99)) },
+      { "count", qint64(channel.count) },
+      { "nanCount", qint64(channel.nanCount) },
+      { "infCount", qint64(channel.infCount) },
+      { "negativeCount", qint64(channel.negativeCount) },
+    });
+  }
+  return QJsonObject { { "channels", channels } };
+}
+
+QJsonObject metrics(ImageMetrics const& metrics)
+{
+  QJsonArray channels;
+  for (auto const& channel : metrics.channels) {
+    channels.append(toJson(channel));
+  }
+  QJsonArray regions;
+  for (auto const& region : metrics.changedRegions) {
+    regions.append(QJsonArray { region.x, region.y, region.width, region.height });
+  }
+  return QJsonObject {
+    { "channels", channels },
+    { "color", toJson(metrics.color) },
+    { "perceptual", metrics.perceptual },
+    { "invalidPixels", qint64(metrics.invalidPixels) },
+    { "identical", metrics.identical },
+    { "changedRegions", regions },
+  };
+}
+
+}
+
+QJsonObject toJson(ChannelMetrics const& m)
+{
+  // JSON has no infinity, identical images report a PSNR of null.
+  return QJsonObject {
+    { "mse", m.mse },
+    { "rmse", m.rmse },
+    { "relMse", m.relativeMse },
+    { "psnr", std::isfinite(m.psnr) ? QJsonValue(m.psnr) : QJsonValue() },
+    { "ssim", m.ssim },
+    { "maxError", m.maxError },
+  };
+}
+
+ImageQueries::ImageQueries(uint64_t maxBytes)
+  : maxBytes_(maxBytes)
+{}
+
+Result<QJsonObject> ImageQueries::answer(QJsonObject const& request, QByteArray * data)
+{
+  auto command = request["command"].toString();
+  auto path = request["path"].toString();
+  if (command == "forget") {
+    forget(path);
+    return QJsonObject { { "cachedBytes", qint64(cachedBytes_) } };
+  }
+  if (command != "info" && command != "pixels" && command != "statistics" && command != "compare") {
+    return "Unknown command \"" + command.toStdString() + "\".";
+  }
+
+  auto loaded = load(path);
+  if (!loaded) {
+    return loaded.error();
+  }
+  auto const& image = *loaded.value();
+  if (command == "info") {
+    return info(image);
+  }
+  auto layer = layerOf(image, request["layer"]);
+  if (!layer) {
+    return layer.error();
+  }
+  if (command == "pixels") {
+    return pixels(image, layer.value(), request, data);
+  }
+
+  if (command == "statistics") {
+    auto region = regionOf(image, request["region"]);
+    if (!region) {
+      return region.error();
+    }
+    auto r = region.value();
+    // Statistics of whole layers are cached with the image.
+    auto result = r == QRect(0, 0, image.width(), image.height())
+      ? statistics(*image.statistics(layer.value()))
+      : statistics(computeStatistics(image.crop(r.x(), r.y(), r.width(), r.height(), layer.value()), 0));
+    result["layer"] = layer.value();
+    result["region"] = QJsonArray { r.x(), r.y(), r.width(), r.height() };
+    return std::move(result);
+  }
+
+  auto reference = load(request["reference"].toString());
+  if (!reference) {
+    return reference.error();
+  }
+  int referenceLayer = layer.value();
+  if (request.contains("referenceLayer")) {
+    auto chosen = layerOf(*reference.value(), request["referenceLayer"]);
+    if (!chosen) {
+      return chosen.error();
+    }
+    referenceLayer = chosen.value();
+  }
+  auto result = computeMetrics(image, *reference.value(), layer.value(), referenceLayer);
+  if (!result) {
+    return result.error();
+  }
+  return metrics(result.value());
+}
+
+Result<std::shared_ptr<Image const>> ImageQueries::load(QString const& path)
+{
+  QFileInfo file(path);
+  auto key = file.absoluteFilePath();
+  if (path.isEmpty() || !file.exists()) {
+    return "File " + key.toStdString() + " does not exist.";
+  }
+  auto i = images_.find(key);
+  if (i != images_.end()) {
+    if (i->second.modified == file.lastModified() && i->second.fileSize == file.size()) {
+      metrics::counter("queryCache.hits").add();
+      i->second.lastUse = ++useCount_;
+      return std::shared_ptr<Image const>(i->second.image);
+    }
+    forget(key);
+  }
+
+  // Same as opening a document: files seen before skip computing the statistics
+  // of the first layer, the hashes speed up comparisons.
+  metrics::counter("queryCache.misses").add();
+  auto cached = PreviewCache::shared().find(key.toStdString());
+  auto loaded = Image::load(key.toStdString());
+  if (!loaded) {
+    return loaded.error();
+  }
+  auto image = std::make_shared<Image const>(std::move(loaded).value());
+  if (cached && cached->statistics) {
+    image->setStatistics(0, cached->statistics);
+  }
+  image->tileHashes();
+  images_[key] = Entry{ image, file.lastModified(), file.size(), ++useCount_ };
+  cachedBytes_ += bytesOf(*image);
+  trim();
+  return std::shared_ptr<Image const>(image);
+}
+
+void ImageQueries::forget(QString const& path)
+{
+  auto i = images_.find(QFileInfo(path).absoluteFilePath());
+  if (i != images_.end()) {
+    cachedBytes_ -= bytesOf(*i->second.image);
+    images_.erase(i);
+  }
+}
+
+void ImageQueries::trim()
+{
+  // The most recently used image stays even if it alone is over the limit.
+  while (cachedBytes_ > maxBytes_ && images_.size() > 1) {
+    auto oldest = images_.begin();
+    for (auto i = images_.begin(); i != images_.end(); ++i) {
+      if (i->second.lastUse < oldest->second.lastUse) {
+        oldest = i;
+      }
+    }
+    cachedBytes_ -= bytesOf(*oldest->second.image);
+    images_.erase(oldest);
+  }
+}
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QJsonObject>
+#include <QString>
+
+#include <image/Image.hpp>
+#include <image/ImageMetrics.hpp>
+
+#include <map>
+#include <memory>
+
+namespace hdrv {
+
+// Answers questions about image files for scripts and batch tools, without
+// showing them: size and layers, pixel values, statistics of regions and
+// comparison metrics. Decoded images stay in memory, so repeated queries on the
+// same files only pay for the decoding once.
+//
+// A request is a JSON object with a "command" and a "path" to an image file:
+//
+//   {"command": "info", "path": "a.exr"}
+//   {"command": "pixels", "path": "a.exr", "layer": "diffuse", "points": [[x, y], ...]}
+//   {"command": "pixels", "path": "a.exr", "region": [x, y, width, height]}
+//   {"command": "statistics", "path": "a.exr", "layer": 1, "region": [x, y, width, height]}
+//   {"command": "compare", "path": "a.exr", "reference": "b.exr", "layer": 0}
+//   {"command": "forget", "path": "a.exr"}
+//
+// Layers are given by index or name and default to the first one, regions
+// (from the top-left corner) to the whole image. Values are in the range of
+// Image::value(). Pixels of a region are returned row by row with interleaved
+// channels, as a JSON array or, when the caller asks for "binary", as 32 bit
+// floats in `data`.
+class ImageQueries
+{
+public:
+  // Images beyond the limit are dropped, least recently used first.
+  explicit ImageQueries(uint64_t maxBytes);
+
+  Result<QJsonObject> answer(QJsonObject const& request, QByteArray * data = nullptr);
+
+  uint64_t cachedBytes() const { return cachedBytes_; }
+
+private:
+  Result<std::shared_ptr<Image const>> load(QString const& path);
+  void forget(QString const& path);
+  void trim();
+
+  struct Entry
+  {
+    std::shared_ptr<Image const> image;
+    QDateTime modified;
+    qint64 fileSize = 0;
+    uint64_t lastUse = 0;
+  };
+  std::map<QString, Entry> images_;
+  uint64_t maxBytes_;
+  uint64_t cachedBytes_ = 0;
+  uint64_t useCount_ = 0;
+};
+
+QJsonObject toJson(ChannelMetrics const& metrics);
+
+}
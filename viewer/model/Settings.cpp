@@ -1,5 +1,7 @@
 #include <model/Settings.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <sstream>
 
 #include <QDir>
@@ -66,4 +68,121 @@ void Settings::setSingleInstance(bool singleInstance)
   emit singleInstanceChanged(singleInstance);
 }
 
+EXROptions Settings::exrOptions()
+{
+  QSettings settings;
+  EXROptions options;
+  options.compression = EXROptions::Compression(std::clamp(
+    settings.value("Export/EXRCompression", int(EXROptions::ZIP)).toInt(), int(EXROptions::None), int(EXROptions::PIZ)));
+  options.layers = EXROptions::Layers(std::clamp(
+    settings.value("Export/EXRLayers", int(EXROptions::LayersAsChannels)).toInt(),
+    int(EXROptions::FirstLayer), int(EXROptions::LayersAsParts)));
+  options.half = settings.value("Export/EXRHalf", false).toBool();
+  options.tiled = settings.value("Export/EXRTiled", false).toBool();
+  return options;
+}
+
+int Settings::exrCompression() const
+{
+  return exrOptions().compression;
+}
+
+void Settings::setExrCompression(int compression)
+{
+  QSettings settings;
+  settings.setValue("Export/EXRCompression", QVariant(compression));
+
+  emit exrCompressionChanged(compression);
+}
+
+int Settings::exrLayers() const
+{
+  return exrOptions().layers;
+}
+
+void Settings::setExrLayers(int layers)
+{
+  QSettings settings;
+  settings.setValue("Export/EXRLayers", QVariant(layers));
+
+  emit exrLayersChanged(layers);
+}
+
+bool Settings::exrHalf() const
+{
+  return exrOptions().half;
+}
+
+void Settings::setExrHalf(bool half)
+{
+  QSettings settings;
+  settings.setValue("Export/EXRHalf", QVariant(half));
+
+  emit exrHalfChanged(half);
+}
+
+bool Settings::exrTiled() const
+{
+  return exrOptions().tiled;
+}
+
+void Settings::setExrTiled(bool tiled)
+{
+  QSettings settings;
+  settings.setValue("Export/EXRTiled", QVariant(tiled));
+
+  emit exrTiledChanged(tiled);
+}
+
+bool Settings::autoExposureOnLoad()
+{
+  QSettings settings;
+  return settings.value("Rendering/AutoExposure", false).toBool();
+}
+
+ExposureOptions Settings::exposureOptions()
+{
+  QSettings settings;
+  ExposureOptions options;
+  options.mode = ExposureOptions::Mode(std::clamp(
+    settings.value("Rendering/AutoExposureMode", int(ExposureOptions::Percentile)).toInt(),
+    int(ExposureOptions::Percentile), int(ExposureOptions::Key)));
+  options.percentile = std::clamp(settings.value("Rendering/AutoExposurePercentile", 99).toInt(), 50, 99) / 100.0;
+  return options;
+}
+
+void Settings::setAutoExposure(bool enabled)
+{
+  QSettings settings;
+  settings.setValue("Rendering/AutoExposure", QVariant(enabled));
+
+  emit autoExposureChanged(enabled);
+}
+
+int Settings::autoExposureMode() const
+{
+  return exposureOptions().mode;
+}
+
+void Settings::setAutoExposureMode(int mode)
+{
+  QSettings settings;
+  settings.setValue("Rendering/AutoExposureMode", QVariant(mode));
+
+  emit autoExposureModeChanged(mode);
+}
+
+int Settings::autoExposurePercentile() const
+{
+  return int(std::round(exposureOptions().percentile * 100.0));
+}
+
+void Settings::setAutoExposurePercentile(int percentile)
+{
+  QSettings settings;
+  settings.setValue("Rendering/AutoExposurePercentile", QVariant(percentile));
+
+  emit autoExposurePercentileChanged(percentile);
+}
+
 }
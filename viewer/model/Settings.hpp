@@ -1,5 +1,8 @@
 #pragma once
 
+#include <image/Exposure.hpp>
+#include <image/Image.hpp>
+
 #include <QObject>
 
 namespace hdrv {
@@ -9,6 +12,13 @@ class Settings : public QObject
   Q_OBJECT
   Q_PROPERTY(bool thumbnailsAvailable READ thumbnailsAvailable CONSTANT FINAL)
   Q_PROPERTY(bool singleInstance READ singleInstance WRITE setSingleInstance NOTIFY singleInstanceChanged)
+  Q_PROPERTY(int exrCompression READ exrCompression WRITE setExrCompression NOTIFY exrCompressionChanged)
+  Q_PROPERTY(int exrLayers READ exrLayers WRITE setExrLayers NOTIFY exrLayersChanged)
+  Q_PROPERTY(bool exrHalf READ exrHalf WRITE setExrHalf NOTIFY exrHalfChanged)
+  Q_PROPERTY(bool exrTiled READ exrTiled WRITE setExrTiled NOTIFY exrTiledChanged)
+  Q_PROPERTY(bool autoExposure READ autoExposure WRITE setAutoExposure NOTIFY autoExposureChanged)
+  Q_PROPERTY(int autoExposureMode READ autoExposureMode WRITE setAutoExposureMode NOTIFY autoExposureModeChanged)
+  Q_PROPERTY(int autoExposurePercentile READ autoExposurePercentile WRITE setAutoExposurePercentile NOTIFY autoExposurePercentileChanged)
 
 public:
   Settings(QObject * parent = nullptr);
@@ -17,11 +27,41 @@ public:
   bool singleInstance() const;
   void setSingleInstance(bool singleInstance);
 
+  int exrCompression() const;
+  void setExrCompression(int compression);
+  int exrLayers() const;
+  void setExrLayers(int layers);
+  bool exrHalf() const;
+  void setExrHalf(bool half);
+  bool exrTiled() const;
+  void setExrTiled(bool tiled);
+
+  // EXR export options as currently configured, safe to call from any thread.
+  static EXROptions exrOptions();
+
+  bool autoExposure() const { return autoExposureOnLoad(); }
+  void setAutoExposure(bool enabled);
+  int autoExposureMode() const;
+  void setAutoExposureMode(int mode);
+  int autoExposurePercentile() const;
+  void setAutoExposurePercentile(int percentile);
+
+  // Whether brightness is adjusted automatically whenever an image is (re)loaded.
+  static bool autoExposureOnLoad();
+  static ExposureOptions exposureOptions();
+
   Q_INVOKABLE void install();
   Q_INVOKABLE void uninstall();
 
 signals:
   void singleInstanceChanged(bool singleInstance);
+  void exrCompressionChanged(int compression);
+  void exrLayersChanged(int layers);
+  void exrHalfChanged(bool half);
+  void exrTiledChanged(bool tiled);
+  void autoExposureChanged(bool enabled);
+  void autoExposureModeChanged(int mode);
+  void autoExposurePercentileChanged(int percentile);
 
 private:
   bool thumbnailsAvailable_ = false;
@@ -11,25 +11,52 @@ uniform float brightness;
 uniform int display;
 uniform int mode;
 uniform float separator;
+uniform bool flipY;
+uniform bool comparisonFlipY;
+uniform vec4 regions[32]; // x, y, width, height relative to the image size, from the top
+uniform int regionCount;
 
 varying highp vec2 coords;
 
 #define Difference 0
 #define SideBySide 1
 
+// Textures hold rows in memory order, images loaded top-down are flipped here.
+vec2 orient(vec2 pos, bool flip)
+{
+  return flip ? vec2(pos.x, 1.0 - pos.y) : pos;
+}
+
+// Outlines changed regions with a border of about two screen pixels.
+bool onRegionBorder(vec2 pos)
+{
+  vec2 p = vec2(pos.x, 1.0 - pos.y);
+  vec2 border = 2.0 / (scale * regionSize);
+  for (int i = 0; i < regionCount; ++i) {
+    vec2 lo = regions[i].xy;
+    vec2 hi = lo + regions[i].zw;
+    bool inside = all(greaterThanEqual(p, lo)) && all(lessThanEqual(p, hi));
+    bool inner = all(greaterThan(p, lo + border)) && all(lessThan(p, hi - border));
+    if (inside && !inner) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void main()
 {
   vec2 pos = (coords - position) / scale;
   if(pos.x >= 0.0 && pos.x <= 1.0 && pos.y >= 0.0 && pos.y <= 1.0) {
     vec3 checker = (int(floor(0.1*coords.x*regionSize.x) + floor(0.1*coords.y*regionSize.y)) & 1) > 0 ? vec3(0.4) : vec3(0.6);
-    vec4 texel = texture2D(tex, pos);
+    vec4 texel = texture2D(tex, orient(pos, flipY));
 
     if (mode == Difference) {
-      vec4 comp = texture2D(comparison, pos);
+      vec4 comp = texture2D(comparison, orient(pos, comparisonFlipY));
       texel = vec4(abs(comp - texel).xyz, 1.0);
     } else if (mode == SideBySide) {
       if (pos.x > separator) {
-        texel = texture2D(comparison, pos);
+        texel = texture2D(comparison, orient(pos, comparisonFlipY));
       }
     }
 
@@ -51,6 +78,9 @@ void main()
         gl_FragColor = vec4(mix(checker, color.xyz, texel.w), 1.0);
         break;
     }
+    if (onRegionBorder(pos)) {
+      gl_FragColor = vec4(1.0, 0.2, 0.2, 1.0);
+    }
   } else {
     gl_FragColor = vec4(0.0, 0.0, 0.0, 1.0);
   }
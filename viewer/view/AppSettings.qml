@@ -45,6 +45,78 @@ Rectangle {
       onClicked: settings.singleInstance = this.checked
     }
 
+    Text { text: '<b>Auto Exposure</b>' }
+
+    CheckBox {
+      Layout.fillWidth: true
+      text: 'Adjust brightness on load'
+      checked: settings.autoExposure
+      onClicked: settings.autoExposure = this.checked
+    }
+
+    GridLayout {
+      Layout.fillWidth: true
+      columns: 2
+
+      Text { text: 'Mode' }
+      ComboBox {
+        Layout.fillWidth: true
+        model: [ 'Percentile to white', 'Key value 0.18' ]
+        currentIndex: settings.autoExposureMode
+        onActivated: settings.autoExposureMode = currentIndex
+      }
+
+      Text {
+        text: 'Percentile'
+        visible: settings.autoExposureMode == 0
+      }
+      SpinBox {
+        Layout.fillWidth: true
+        visible: settings.autoExposureMode == 0
+        from: 50
+        to: 99
+        value: settings.autoExposurePercentile
+        onValueModified: settings.autoExposurePercentile = value
+      }
+    }
+
+    Text { text: '<b>EXR Export</b>' }
+
+    GridLayout {
+      Layout.fillWidth: true
+      columns: 2
+
+      Text { text: 'Compression' }
+      ComboBox {
+        Layout.fillWidth: true
+        model: [ 'None', 'RLE', 'ZIPS', 'ZIP', 'PIZ' ]
+        currentIndex: settings.exrCompression
+        onActivated: settings.exrCompression = currentIndex
+      }
+
+      Text { text: 'Layers' }
+      ComboBox {
+        Layout.fillWidth: true
+        model: [ 'First layer', 'As channels', 'As parts' ]
+        currentIndex: settings.exrLayers
+        onActivated: settings.exrLayers = currentIndex
+      }
+    }
+
+    CheckBox {
+      Layout.fillWidth: true
+      text: 'Half float (16 bit)'
+      checked: settings.exrHalf
+      onClicked: settings.exrHalf = this.checked
+    }
+
+    CheckBox {
+      Layout.fillWidth: true
+      text: 'Tiled with mip levels'
+      checked: settings.exrTiled
+      onClicked: settings.exrTiled = this.checked
+    }
+
     Text {
       text: '<b>Thumbnails</b>'
       visible: settings.thumbnailsAvailable
@@ -5,8 +5,10 @@ import Qt.labs.platform 1.1
 
 Control {
   property bool exportable: images.current.isFloat && !images.current.isComparison
+  implicitHeight: exportButtons.implicitHeight
 
   RowLayout {
+    id: exportButtons
     anchors.fill: parent
     spacing: 0
 
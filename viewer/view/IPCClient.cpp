@@ -3,6 +3,8 @@
 #include <QLocalSocket>
 #include <QFileInfo>
 
+#include <view/IPCProtocol.hpp>
+
 namespace hdrv {
 
 namespace {
@@ -22,6 +24,35 @@ bool sendCommand(QString const & command) {
   return false;
 }
 
+// Waits for a Reply of the binary protocol, true if it reports success.
+bool receiveReply(QLocalSocket & socket, int timeout)
+{
+  ipc::MessageHeader header;
+  while (socket.bytesAvailable() < qint64(sizeof(header))) {
+    if (!socket.waitForReadyRead(timeout)) {
+      return false;
+    }
+  }
+  socket.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (header.type != ipc::MessageType::Reply || header.size > ipc::maxMessageSize) {
+    return false;
+  }
+  while (socket.bytesAvailable() < qint64(header.size)) {
+    if (!socket.waitForReadyRead(timeout)) {
+      return false;
+    }
+  }
+  QByteArray payload = socket.read(header.size);
+  ipc::MessageReader reply(payload.constData(), size_t(payload.size()));
+  return reply.read<int32_t>() == 0 && reply.ok();
+}
+
+bool sendMessage(QLocalSocket & socket, std::vector<uint8_t> const & data)
+{
+  socket.write(reinterpret_cast<char const *>(data.data()), qint64(data.size()));
+  return socket.waitForBytesWritten(500);
+}
+
 }
 
 bool IPCClient::remoteOpenFile(QUrl const & url)
@@ -30,6 +61,33 @@ bool IPCClient::remoteOpenFile(QUrl const & url)
   return sendCommand(QString("open %1").arg(f.absoluteFilePath()));
 }
 
+bool IPCClient::remoteOpenFiles(QList<QUrl> const & urls)
+{
+  QLocalSocket socket;
+  socket.connectToServer("hdrv");
+  if (!socket.waitForConnected(50)) {
+    return false;
+  }
+  std::vector<uint8_t> hello(ipc::magic, ipc::magic + sizeof(ipc::magic));
+  auto version = reinterpret_cast<uint8_t const *>(&ipc::version);
+  hello.insert(hello.end(), version, version + sizeof(ipc::version));
+
+  ipc::MessageWriter message(ipc::MessageType::OpenFiles);
+  message.write(uint32_t(urls.size()));
+  for (auto const & url : urls) {
+    message.write(QFileInfo(url.toLocalFile()).absoluteFilePath().toStdString());
+  }
+  bool sent = sendMessage(socket, hello) && receiveReply(socket, 500) && sendMessage(socket, message.finish());
+  // Once written the server opens the files, however long it takes to get to
+  // them. Its reply is only waited for so the connection stays up until then,
+  // failing over to opening them here would show every file twice.
+  if (sent) {
+    receiveReply(socket, 2000);
+  }
+  socket.disconnectFromServer();
+  return sent;
+}
+
 bool IPCClient::remoteStopServer()
 {
   return sendCommand("exit");
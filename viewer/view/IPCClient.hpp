@@ -1,5 +1,6 @@
 #pragma once
 
+#include <QList>
 #include <QObject>
 #include <QUrl>
 
@@ -11,6 +12,9 @@ class IPCClient : public QObject
 
 public:
   Q_INVOKABLE bool remoteOpenFile(QUrl const & url);
+  // Opens all files over a single connection. True once the request is
+  // written, false if no server is running or it could not be reached.
+  Q_INVOKABLE bool remoteOpenFiles(QList<QUrl> const & urls);
   Q_INVOKABLE bool remoteStopServer();
   Q_INVOKABLE bool isServerAvailable();
 };
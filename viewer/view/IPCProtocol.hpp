@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Binary messages on the hdrv local socket, shared by the viewer and the client
+// library in client/ (which does not depend on Qt).
+//
+// The text commands "open <path>", "query <JSON>", "stats" (both answered with
+// a line of JSON) and "exit" start with a letter. A binary connection instead starts with
+// the magic bytes below and the protocol version, which the server acknowledges
+// with a Reply. After that both sides send messages, each a MessageHeader
+// followed by `size` bytes of payload.
+// Values are in the byte order of the machine, both ends run on the same one.
+
+namespace hdrv::ipc {
+
+constexpr char magic[8] = { '\0', 'H', 'D', 'R', 'V', 'I', 'P', 'C' };
+constexpr uint32_t version = 1;
+// Larger messages are taken as a broken stream and close the connection.
+constexpr uint32_t maxMessageSize = 256u << 20;
+
+enum class MessageType : uint32_t
+{
+  // Server to client: int32 status (0 on success), string error.
+  Reply = 1,
+  // uint32 image id (chosen by the client), int32 width, int32 height,
+  // uint32 format (Image::Format), string name, string shared memory name,
+  // uint32 layer count, per layer: string name, uint32 channels, uint32 display
+  // (Image::Display). Answered with a Reply.
+  //
+  // The shared memory object holds the layers one after the other, each with
+  // rows from top to bottom and interleaved channels without padding. The
+  // viewer maps it read only, the client may unlink it once the Reply arrived.
+  CreateSharedImage = 2,
+  // uint32 image id, int32 x, y, width, height in pixels from the top-left
+  // corner. The pixels of all layers in the region were written.
+  UpdateRegion = 3,
+  // uint32 image id. The client is done with the image, the viewer keeps
+  // showing it.
+  CloseImage = 4,
+  // For clients that cannot share memory: like CreateSharedImage, but without
+  // format and shared memory name. The viewer holds the pixels as 32 bit float.
+  // Answered with a Reply.
+  CreateImage = 5,
+  // uint32 image id, int32 x, y, width, height in pixels from the top-left
+  // corner, uint32 layer, uint32 first channel, uint32 channel count, uint32
+  // pixel type (PixelType), followed by the pixels of the selected channels,
+  // rows from top to bottom. Written into an image made with CreateImage.
+  Tile = 6,
+  // Answered with a Reply once all earlier messages were handled.
+  Sync = 7,
+  // uint32 count, then as many absolute file paths as strings (UTF-8). Opens
+  // the files in tabs, loading them in order. Answered with a Reply once the
+  // loads are queued.
+  OpenFiles = 8,
+  // string request, a JSON object as described in model/ImageQueries.hpp.
+  // Answered with a Reply, on success followed by string result (a JSON
+  // object) and the binary data asked for, up to the end of the message.
+  // Only a viewer started with --headless answers queries, others fail them.
+  Query = 9,
+  // Answered with a Reply followed by string metrics, a JSON object of all
+  // counters and histograms (see image/Metrics.hpp).
+  Stats = 10,
+};
+
+enum class PixelType : uint32_t { Float = 0, Half = 1 };
+
+struct MessageHeader
+{
+  uint32_t size;
+  MessageType type;
+};
+
+// Builds the payload of a message.
+class MessageWriter
+{
+public:
+  explicit MessageWriter(MessageType type)
+    : data_(sizeof(MessageHeader))
+  {
+    MessageHeader header{ 0, type };
+    std::memcpy(data_.data(), &header, sizeof(header));
+  }
+
+  template<typename T>
+  MessageWriter& write(T value)
+  {
+    auto p = reinterpret_cast<uint8_t const*>(&value);
+    data_.insert(data_.end(), p, p + sizeof(T));
+    return *this;
+  }
+
+  MessageWriter& write(std::string const& value)
+  {
+    write(uint32_t(value.size()));
+    data_.insert(data_.end(), value.begin(), value.end());
+    return *this;
+  }
+
+  MessageWriter& write(void const* data, size_t size)
+  {
+    auto p = static_cast<uint8_t const*>(data);
+    data_.insert(data_.end(), p, p + size);
+    return *this;
+  }
+
+  // Header and payload, ready to be sent. `trailing` bytes of payload are sent
+  // right after, without copying them into the message (eg. pixels).
+  std::vector<uint8_t> const& finish(size_t trailing = 0)
+  {
+    uint32_t size = uint32_t(data_.size() - sizeof(MessageHeader) + trailing);
+    std::memcpy(data_.data(), &size, sizeof(size));
+    return data_;
+  }
+
+private:
+  std::vector<uint8_t> data_;
+};
+
+// Reads the payload of a message. Reading past the end yields zeros and
+// clears ok(), so a message only needs to be checked once at the end.
+class MessageReader
+{
+public:
+  MessageReader(void const* data, size_t size)
+    : p_(static_cast<uint8_t const*>(data))
+    , end_(p_ + size)
+  {}
+
+  bool ok() const { return ok_; }
+  bool atEnd() const { return p_ == end_; }
+  size_t remaining() const { return size_t(end_ - p_); }
+
+  template<typename T>
+  T read()
+  {
+    T value{};
+    if (remaining() < sizeof(T)) {
+      ok_ = false;
+      p_ = end_;
+      return value;
+    }
+    std::memcpy(&value, p_, sizeof(T));
+    p_ += sizeof(T);
+    return value;
+  }
+
+  std::string readString()
+  {
+    auto size = read<uint32_t>();
+    if (remaining() < size) {
+      ok_ = false;
+      p_ = end_;
+      return std::string();
+    }
+    std::string value(reinterpret_cast<char const*>(p_), size);
+    p_ += size;
+    return value;
+  }
+
+  // Raw bytes, null if fewer are left.
+  uint8_t const* readBytes(size_t size)
+  {
+    if (remaining() < size) {
+      ok_ = false;
+      p_ = end_;
+      return nullptr;
+    }
+    auto data = p_;
+    p_ += size;
+    return data;
+  }
+
+private:
+  uint8_t const* p_;
+  uint8_t const* end_;
+  bool ok_ = true;
+};
+
+}
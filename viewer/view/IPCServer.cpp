@@ -1,10 +1,40 @@
 #include "IPCServer.hpp"
+#include "IPCSession.hpp"
 
+#include <QJsonDocument>
 #include <QLocalSocket>
 #include <QUrl>
 
+#include <image/Metrics.hpp>
+#include <image/Trace.hpp>
+
+#include <memory>
+
 namespace hdrv {
 
+namespace {
+
+// A line of JSON for scripts talking to the socket directly: the result, or an
+// object with an "error".
+QByteArray answer(ImageQueries * queries, QByteArray const& request)
+{
+  QJsonObject result;
+  QJsonParseError error;
+  auto document = QJsonDocument::fromJson(request, &error);
+  if (!queries) {
+    result["error"] = "Queries are only answered by hdrv --headless.";
+  } else if (!document.isObject()) {
+    result["error"] = "The request is not a JSON object: " + error.errorString();
+  } else if (auto reply = queries->answer(document.object())) {
+    result = reply.value();
+  } else {
+    result["error"] = QString::fromStdString(reply.error());
+  }
+  return QJsonDocument(result).toJson(QJsonDocument::Compact);
+}
+
+}
+
 IPCServer::IPCServer(QObject * parent)
   : QObject(parent)
   , localServer_(nullptr)
@@ -14,10 +44,10 @@ IPCServer::IPCServer(QObject * parent)
   connect(localServer_, SIGNAL(newConnection()), this, SLOT(newConnection()));
 }
 
-void IPCServer::start()
+void IPCServer::start(QString const& name)
 {
   if (!localServer_->isListening()) {
-    localServer_->listen("hdrv");
+    localServer_->listen(name);
     emit runningChanged();
   }
 }
@@ -35,18 +65,39 @@ bool IPCServer::isRunning()
   return localServer_->isListening();
 }
 
+void IPCServer::setQueries(ImageQueries * queries)
+{
+  queries_ = queries;
+}
+
 void IPCServer::newConnection()
 {
   while (localServer_->hasPendingConnections()) {
     auto * socket = localServer_->nextPendingConnection();
     
     connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
-    connect(socket, &QLocalSocket::readyRead, [&, socket]() {
+    auto readText = std::make_shared<QMetaObject::Connection>();
+    *readText = connect(socket, &QLocalSocket::readyRead, [&, socket, readText]() {
+      // Binary clients start with a zero byte, see IPCProtocol.hpp.
+      char first;
+      if (socket->peek(&first, 1) == 1 && first == '\0') {
+        disconnect(*readText);
+        auto * session = new IPCSession(socket, queries_);
+        connect(session, &IPCSession::openDocument, this, &IPCServer::openDocument);
+        connect(session, &IPCSession::openFiles, this, &IPCServer::openFiles);
+        session->readMessages();
+        return;
+      }
+      HDRV_TRACE_SCOPE("IPC text command");
       while (socket->bytesAvailable() > 0) {
         QString cmd = socket->readLine();
         if (cmd.startsWith("open")) {
           QString filename = cmd.right(cmd.length() - 5);
           emit openFile(QUrl::fromLocalFile(filename));
+        } else if (cmd.startsWith("query")) {
+          socket->write(answer(queries_, cmd.mid(6).toUtf8()) + '\n');
+        } else if (cmd.startsWith("stats")) {
+          socket->write(QByteArray::fromStdString(metrics::toJson()) + '\n');
         } else if (cmd.startsWith("exit")) {
           socket->disconnectFromServer();
           stop();
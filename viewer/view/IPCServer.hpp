@@ -2,6 +2,9 @@
 
 #include <QLocalServer>
 
+#include <model/ImageDocument.hpp>
+#include <model/ImageQueries.hpp>
+
 namespace hdrv {
 
 class IPCServer : public QObject
@@ -12,20 +15,26 @@ class IPCServer : public QObject
 public:
   IPCServer(QObject * parent = nullptr);
 
-  Q_INVOKABLE void start();
+  Q_INVOKABLE void start(QString const& name = "hdrv");
   Q_INVOKABLE void stop();
 
   bool isRunning();
+  // Answers queries from clients, which fail while there is none.
+  void setQueries(ImageQueries * queries);
 
 signals:
   void runningChanged();
   void openFile(QUrl const & url);
+  void openFiles(QList<QUrl> const & urls);
+  // A live image streamed by a client, to be added to the collection.
+  void openDocument(hdrv::ImageDocument * document);
 
 private slots:
   void newConnection();
 
 private:
   QLocalServer* localServer_;
+  ImageQueries* queries_ = nullptr;
 };
 
 }
@@ -0,0 +1,276 @@
+#include <view/IPCSession.hpp>
+
+#include <QDebug>
+#include <QJsonDocument>
+
+#include <image/Metrics.hpp>
+#include <image/SharedImage.hpp>
+#include <image/Trace.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace hdrv {
+
+IPCSession::IPCSession(QLocalSocket * socket, ImageQueries * queries)
+  : QObject(socket)
+  , socket_(socket)
+  , queries_(queries)
+{
+  connect(socket_, &QLocalSocket::readyRead, this, &IPCSession::readMessages);
+}
+
+void IPCSession::readMessages()
+{
+  HDRV_TRACE_SCOPE("IPCSession::readMessages");
+  buffer_ += socket_->readAll();
+  qsizetype offset = 0;
+  if (!greeted_) {
+    if (buffer_.size() < qsizetype(sizeof(ipc::magic) + sizeof(uint32_t))) {
+      return;
+    }
+    uint32_t version;
+    std::memcpy(&version, buffer_.constData() + sizeof(ipc::magic), sizeof(version));
+    if (std::memcmp(buffer_.constData(), ipc::magic, sizeof(ipc::magic)) != 0 || version != ipc::version) {
+      reply("Unsupported protocol version.");
+      fail("unsupported protocol version");
+      return;
+    }
+    greeted_ = true;
+    offset = sizeof(ipc::magic) + sizeof(uint32_t);
+    reply();
+  }
+  // Handles all complete messages, a partial one stays in the buffer.
+  while (buffer_.size() - offset >= qsizetype(sizeof(ipc::MessageHeader))) {
+    ipc::MessageHeader header;
+    std::memcpy(&header, buffer_.constData() + offset, sizeof(header));
+    if (header.size > ipc::maxMessageSize) {
+      fail("message too large");
+      return;
+    }
+    if (buffer_.size() - offset - qsizetype(sizeof(header)) < qsizetype(header.size)) {
+      break;
+    }
+    ipc::MessageReader message(buffer_.constData() + offset + sizeof(header), header.size);
+    offset += sizeof(header) + header.size;
+    if (!handle(header.type, message)) {
+      fail("malformed message");
+      return;
+    }
+  }
+  buffer_.remove(0, offset);
+}
+
+bool IPCSession::handle(ipc::MessageType type, ipc::MessageReader& message)
+{
+  switch (type) {
+    case ipc::MessageType::CreateSharedImage: createSharedImage(message); break;
+    case ipc::MessageType::CreateImage: createImage(message); break;
+    case ipc::MessageType::UpdateRegion: updateRegion(message); break;
+    case ipc::MessageType::Tile: writeTile(message); break;
+    case ipc::MessageType::CloseImage: closeImage(message); break;
+    case ipc::MessageType::Sync: reply(); break;
+    case ipc::MessageType::OpenFiles: openFileList(message); break;
+    case ipc::MessageType::Query: query(message); break;
+    case ipc::MessageType::Stats: replyWith(metrics::toJson()); break;
+    default: return false;
+  }
+  return message.ok();
+}
+
+namespace {
+
+std::vector<Image::Layer> readLayers(ipc::MessageReader& message)
+{
+  auto count = message.read<uint32_t>();
+  std::vector<Image::Layer> layers;
+  for (uint32_t i = 0; i < count && message.ok(); ++i) {
+    Image::Layer layer;
+    layer.name = message.readString();
+    layer.channels = int(message.read<uint32_t>());
+    layer.display = Image::Display(std::min(message.read<uint32_t>(), uint32_t(Image::Normal)));
+    layers.push_back(std::move(layer));
+  }
+  return layers;
+}
+
+}
+
+void IPCSession::createSharedImage(ipc::MessageReader& message)
+{
+  HDRV_TRACE_SCOPE("IPC createSharedImage");
+  auto id = message.read<uint32_t>();
+  auto width = message.read<int32_t>();
+  auto height = message.read<int32_t>();
+  auto format = message.read<uint32_t>();
+  auto name = message.readString();
+  auto memory = message.readString();
+  auto layers = readLayers(message);
+  if (!message.ok()) {
+    return;
+  }
+  if (format > Image::Float) {
+    reply("Unknown pixel format.");
+    return;
+  }
+  auto image = mapSharedImage(memory, width, height, Image::Format(format), std::move(layers));
+  if (!image) {
+    reply(image.error());
+    return;
+  }
+  open(id, name, std::move(image).value(), nullptr);
+}
+
+void IPCSession::createImage(ipc::MessageReader& message)
+{
+  HDRV_TRACE_SCOPE("IPC createImage");
+  auto id = message.read<uint32_t>();
+  auto width = message.read<int32_t>();
+  auto height = message.read<int32_t>();
+  auto name = message.readString();
+  auto layers = readLayers(message);
+  if (!message.ok()) {
+    return;
+  }
+  size_t size = width > 0 && height > 0 ? layoutLayers(width, height, Image::Float, layers) : 0;
+  if (size == 0) {
+    reply("Image is empty or layers do not have 1 to 4 channels.");
+    return;
+  }
+  std::shared_ptr<uint8_t> pixels(new (std::nothrow) uint8_t[size](), std::default_delete<uint8_t[]>());
+  if (!pixels) {
+    reply("Not enough memory for the image.");
+    return;
+  }
+  open(id, name, Image(width, height, Image::Float, pixels, std::move(layers), Image::TopDown), pixels.get());
+}
+
+void IPCSession::open(uint32_t id, std::string const& name, Image&& image, uint8_t * pixels)
+{
+  auto shared = std::make_shared<Image>(std::move(image));
+  auto * document = new ImageDocument(QString::fromStdString(name), shared);
+  images_[id] = LiveImage{ document, shared, pixels };
+  reply();
+  emit openDocument(document);
+}
+
+void IPCSession::updateRegion(ipc::MessageReader& message)
+{
+  HDRV_TRACE_SCOPE("IPC updateRegion");
+  auto id = message.read<uint32_t>();
+  auto x = message.read<int32_t>();
+  auto y = message.read<int32_t>();
+  auto width = message.read<int32_t>();
+  auto height = message.read<int32_t>();
+  auto i = images_.find(id);
+  if (message.ok() && i != images_.end() && i->second.document) {
+    i->second.document->updateRegion(QRect(x, y, width, height));
+  }
+}
+
+void IPCSession::writeTile(ipc::MessageReader& message)
+{
+  HDRV_TRACE_SCOPE("IPC writeTile");
+  auto id = message.read<uint32_t>();
+  TileRegion tile;
+  tile.x = message.read<int32_t>();
+  tile.y = message.read<int32_t>();
+  tile.width = message.read<int32_t>();
+  tile.height = message.read<int32_t>();
+  tile.layer = int(message.read<uint32_t>());
+  tile.firstChannel = int(message.read<uint32_t>());
+  tile.channels = int(message.read<uint32_t>());
+  auto type = message.read<ipc::PixelType>();
+  tile.half = type == ipc::PixelType::Half;
+  size_t size = message.remaining();
+  auto data = message.readBytes(size);
+  auto i = images_.find(id);
+  if (!message.ok() || i == images_.end() || !i->second.pixels || !i->second.document) {
+    return;
+  }
+  // There is no reply to report a tile that does not fit, it is dropped.
+  if (type > ipc::PixelType::Half || !copyTile(*i->second.image, i->second.pixels, tile, data, size)) {
+    qWarning() << "Dropped tile that does not fit image" << id;
+    return;
+  }
+  i->second.document->updateRegion(QRect(tile.x, tile.y, tile.width, tile.height));
+}
+
+void IPCSession::closeImage(ipc::MessageReader& message)
+{
+  HDRV_TRACE_SCOPE("IPC closeImage");
+  images_.erase(message.read<uint32_t>());
+}
+
+void IPCSession::openFileList(ipc::MessageReader& message)
+{
+  HDRV_TRACE_SCOPE("IPC openFileList");
+  auto count = message.read<uint32_t>();
+  QList<QUrl> urls;
+  for (uint32_t i = 0; i < count && message.ok(); ++i) {
+    urls.push_back(QUrl::fromLocalFile(QString::fromStdString(message.readString())));
+  }
+  if (message.ok()) {
+    // Acknowledged before the documents are created, the client need not wait for them.
+    reply();
+    emit openFiles(urls);
+  }
+}
+
+void IPCSession::query(ipc::MessageReader& message)
+{
+  HDRV_TRACE_SCOPE("IPC query");
+  auto request = message.readString();
+  if (!message.ok()) {
+    return;
+  }
+  if (!queries_) {
+    reply("Queries are only answered by hdrv --headless.");
+    return;
+  }
+  QJsonParseError error;
+  auto document = QJsonDocument::fromJson(QByteArray::fromStdString(request), &error);
+  if (!document.isObject()) {
+    reply("The request is not a JSON object: " + error.errorString().toStdString());
+    return;
+  }
+  QByteArray data;
+  auto result = queries_->answer(document.object(), &data);
+  if (!result) {
+    reply(result.error());
+    return;
+  }
+  auto json = QJsonDocument(result.value()).toJson(QJsonDocument::Compact).toStdString();
+  if (json.size() + size_t(data.size()) > ipc::maxMessageSize - 64) {
+    reply("The answer is too large, ask for a smaller region.");
+    return;
+  }
+  replyWith(json, data);
+}
+
+void IPCSession::replyWith(std::string const& result, QByteArray const& data)
+{
+  ipc::MessageWriter writer(ipc::MessageType::Reply);
+  writer.write(int32_t(0)).write(std::string()).write(result);
+  auto const& header = writer.finish(size_t(data.size()));
+  socket_->write(reinterpret_cast<char const*>(header.data()), qint64(header.size()));
+  socket_->write(data);
+}
+
+void IPCSession::reply(std::string const& error)
+{
+  ipc::MessageWriter writer(ipc::MessageType::Reply);
+  writer.write(int32_t(error.empty() ? 0 : 1)).write(error);
+  auto const& data = writer.finish();
+  socket_->write(reinterpret_cast<char const*>(data.data()), qint64(data.size()));
+}
+
+void IPCSession::fail(QString const& reason)
+{
+  qWarning() << "Closing IPC connection:" << reason;
+  buffer_.clear();
+  socket_->disconnectFromServer();
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include <QByteArray>
+#include <QList>
+#include <QLocalSocket>
+#include <QObject>
+#include <QPointer>
+#include <QUrl>
+
+#include <model/ImageDocument.hpp>
+#include <model/ImageQueries.hpp>
+#include <view/IPCProtocol.hpp>
+
+namespace hdrv {
+
+// A connection speaking the binary protocol of IPCProtocol.hpp, which clients
+// use to stream images into the viewer.
+class IPCSession : public QObject
+{
+  Q_OBJECT
+
+public:
+  // Takes over a socket whose first byte announced the binary protocol. The
+  // session is deleted together with the socket. Queries fail without `queries`.
+  IPCSession(QLocalSocket * socket, ImageQueries * queries = nullptr);
+
+signals:
+  void openDocument(hdrv::ImageDocument * document);
+  void openFiles(QList<QUrl> const & urls);
+
+public slots:
+  void readMessages();
+
+private:
+  bool handle(ipc::MessageType type, ipc::MessageReader& message);
+  void createSharedImage(ipc::MessageReader& message);
+  void createImage(ipc::MessageReader& message);
+  void open(uint32_t id, std::string const& name, Image&& image, uint8_t * pixels);
+  void updateRegion(ipc::MessageReader& message);
+  void writeTile(ipc::MessageReader& message);
+  void closeImage(ipc::MessageReader& message);
+  void openFileList(ipc::MessageReader& message);
+  void query(ipc::MessageReader& message);
+  void reply(std::string const& error = std::string());
+  // A successful Reply carrying a result, see ipc::MessageType::Query.
+  void replyWith(std::string const& result, QByteArray const& data = QByteArray());
+  void fail(QString const& reason);
+
+  QLocalSocket * socket_;
+  ImageQueries * queries_;
+  QByteArray buffer_;
+  bool greeted_ = false;
+  struct LiveImage
+  {
+    // Null once the tab was closed, later updates are dropped.
+    QPointer<ImageDocument> document;
+    std::shared_ptr<Image> image;
+    // Where tiles are written, null for shared memory the client writes itself.
+    uint8_t * pixels = nullptr;
+  };
+  std::map<uint32_t, LiveImage> images_;
+};
+
+}
@@ -59,6 +59,7 @@ void ImageArea::sync()
     renderer_->setClearColor(color_);
     renderer_->updateImages(images_->vector());
     renderer_->setCurrent(img.image(), img.layer());
+    renderer_->setPlaceholder(img.placeholder(), img.placeholderSize());
     renderer_->setSettings({QVector2D(img.position()), img.scale(), (float)img.brightness(), (float)img.gamma(), img.displayMode()});
     renderer_->setComparison(img.comparison());
     renderer_->setWindow(window());
@@ -201,6 +202,7 @@ void ImageArea::connectImages()
 {
   for (auto image : images_->vector()) {
     connect(image, &ImageDocument::propertyChanged, window(), &QQuickWindow::update, Qt::UniqueConnection);
+    connect(image, &ImageDocument::pixelsChanged, window(), &QQuickWindow::update, Qt::UniqueConnection);
   }
 }
 
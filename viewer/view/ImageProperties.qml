@@ -37,6 +37,37 @@ Rectangle {
       }
     }
 
+    RowLayout {
+      Layout.fillWidth: true
+      visible: images.current.badPixels.count > 0
+      spacing: 10
+
+      Rectangle {
+        color: '#D32F2F'
+        radius: height / 2
+        implicitWidth: badPixelCount.implicitWidth + 14
+        implicitHeight: badPixelCount.implicitHeight + 6
+        Text {
+          id: badPixelCount
+          anchors.centerIn: parent
+          color: 'white'
+          text: images.current.badPixels.count + ' bad pixels'
+        }
+      }
+      Text {
+        Layout.fillWidth: true
+        wrapMode: Text.Wrap
+        text: images.current.badPixels.nanCount + ' NaN, ' + images.current.badPixels.infCount + ' Inf, '
+              + images.current.badPixels.negativeCount + ' negative'
+      }
+      Button {
+        text: images.current.badPixels.current > 0
+              ? 'Next (' + images.current.badPixels.current + '/' + images.current.badPixels.indexed + ')'
+              : 'Show'
+        onClicked: images.current.nextBadPixel()
+      }
+    }
+
     ColumnLayout {
       Layout.fillWidth: true
       Text {
@@ -77,6 +108,20 @@ Rectangle {
         value: images.current.brightness
         onValueChanged: images.current.brightness = brightnessSlider.value;
       }
+      RowLayout {
+        Layout.fillWidth: true
+        Button {
+          Layout.fillWidth: true
+          text: 'Auto exposure'
+          onClicked: images.current.autoExposure()
+        }
+        Button {
+          Layout.fillWidth: true
+          text: 'Auto gamma'
+          visible: images.current.isFloat
+          onClicked: images.current.autoGamma()
+        }
+      }
 
       Text {
         text: 'Gamma: ' + gammaSlider.value.toFixed(1)
@@ -126,6 +171,45 @@ Rectangle {
           ButtonGroup.group: comparisonModeGroup
         }
       }
+      Text {
+        visible: images.current.isComparison && images.current.metrics.error !== undefined
+        text: '<font color="red">' + images.current.metrics.error + '</font>'
+      }
+      GridLayout {
+        columns: 2
+        columnSpacing: 10
+        visible: images.current.isComparison && images.current.metrics.mse !== undefined
+
+        Text { text: 'MSE' }
+        Text { text: presentFloat(images.current.metrics.mse, 6) }
+        Text { text: 'RMSE' }
+        Text { text: presentFloat(images.current.metrics.rmse, 6) }
+        Text { text: 'relMSE' }
+        Text { text: presentFloat(images.current.metrics.relMse, 6) }
+        Text { text: 'PSNR' }
+        Text { text: isFinite(images.current.metrics.psnr) ? presentFloat(images.current.metrics.psnr, 2) + ' dB' : 'identical' }
+        Text { text: 'SSIM' }
+        Text { text: presentFloat(images.current.metrics.ssim, 4) }
+        Text { text: 'Perceptual' }
+        Text { text: presentFloat(images.current.metrics.perceptual, 4) }
+        Text { text: 'Changes' }
+        Text {
+          text: images.current.metrics.identical ? 'identical'
+                : images.current.metrics.changedRegions + (images.current.metrics.changedRegions == 1 ? ' region' : ' regions')
+        }
+        CheckBox {
+          text: 'Highlight changed regions'
+          visible: !images.current.metrics.identical
+          checked: images.current.highlightChanges
+          onClicked: images.current.highlightChanges = this.checked
+          Layout.columnSpan: 2
+        }
+        Text {
+          visible: images.current.metrics.invalidPixels > 0
+          text: '<font color="red">' + images.current.metrics.invalidPixels + ' pixels with NaN/Inf skipped</font>'
+          Layout.columnSpan: 2
+        }
+      }
       ButtonGroup {
         id: comparisonModeGroup
         checkedButton: images.current.comparisonMode == ImageDocument.Difference ? differenceButton : sideBySideButton
@@ -142,6 +226,18 @@ Rectangle {
       ExportButton {
         Layout.fillWidth: true
       }
+      RowLayout {
+        Layout.fillWidth: true
+        visible: images.current.exporting
+        ProgressBar {
+          Layout.fillWidth: true
+          value: images.current.exportProgress
+        }
+        ToolButton {
+          text: 'Cancel'
+          onClicked: images.current.cancelExport()
+        }
+      }
     }
   }
 
@@ -211,6 +307,26 @@ Rectangle {
 
     Text { text: 'Resolution:' }
     Text { text: images.current.size.width + ' x ' + images.current.size.height }
+    Text {
+      text: 'Channel statistics'
+      visible: images.current.statistics.length > 0
+      Layout.columnSpan: 2
+    }
+    Repeater {
+      model: images.current.statistics
+      Text {
+        property var stats: modelData
+        text: channelName(index, images.current.statistics.length, 'auto') + ': '
+              + presentFloat(stats.min, 3) + ' to ' + presentFloat(stats.max, 3)
+              + ', mean ' + presentFloat(stats.mean, 3) + ' \u00B1 ' + presentFloat(stats.stdDev, 3)
+              + ', median ' + presentFloat(stats.median, 3)
+              + (stats.nanCount + stats.infCount + stats.negativeCount > 0
+                 ? '<br><font color="red">' + stats.nanCount + ' NaN, ' + stats.infCount + ' Inf, '
+                   + stats.negativeCount + ' negative</font>' : '')
+        Layout.columnSpan: 2
+        Layout.leftMargin: 10
+      }
+    }
     Text { text: 'Cursor position:' }
     Text { text: images.current.pixelPosition.x + ', ' + images.current.pixelPosition.y }
     Text { text: 'Cursor texel value'; Layout.columnSpan: 2 }
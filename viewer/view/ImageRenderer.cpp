@@ -1,13 +1,20 @@
 #include <view/ImageRenderer.hpp>
 
+#include <image/Metrics.hpp>
+#include <image/Thumbnail.hpp>
+#include <image/Trace.hpp>
+
 #include <QFile>
 #include <QOpenGLPixelTransferOptions>
 #include <QTextStream>
 #include <QQuickWindow>
 #include <QSGRendererInterface>
+#include <QtConcurrent>
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <set>
 
 float const vertexData[] = {-1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
 
@@ -45,6 +52,14 @@ QOpenGLTexture::TextureFormat format(Image const& image)
         default: return QOpenGLTexture::RGBA32F;
       }
     }
+    case Image::Short: {
+      switch (image.channels()) {
+        case 1: return QOpenGLTexture::R16_UNorm;
+        case 3: return QOpenGLTexture::RGB16_UNorm;
+        case 4: return QOpenGLTexture::RGBA16_UNorm;
+        default: return QOpenGLTexture::RGBA16_UNorm;
+      }
+    }
     case Image::Byte: {
       switch (image.channels()) {
         case 1: return QOpenGLTexture::R8_UNorm;
@@ -57,13 +72,13 @@ QOpenGLTexture::TextureFormat format(Image const& image)
   }
 }
 
-QOpenGLTexture::PixelFormat pixelFormat(int channelCount)
+QOpenGLTexture::PixelFormat pixelFormat(Image const& image, int channelCount)
 {
   switch (channelCount) {
     case 1: return QOpenGLTexture::Luminance;
     case 2: return QOpenGLTexture::RG;
     case 3: return QOpenGLTexture::RGB;
-    case 4: return QOpenGLTexture::RGBA;
+    case 4: return image.channelOrder() == Image::BGRA ? QOpenGLTexture::BGRA : QOpenGLTexture::RGBA;
     default:
       qWarning() << "Cannot render image with " << channelCount << " channels.";
       return QOpenGLTexture::Luminance;
@@ -72,24 +87,47 @@ QOpenGLTexture::PixelFormat pixelFormat(int channelCount)
 
 QOpenGLTexture::PixelType pixelType(Image const& image)
 {
-  return image.format() == Image::Float ? QOpenGLTexture::PixelType::Float32 : QOpenGLTexture::PixelType::UInt8;
+  switch (image.format()) {
+    case Image::Float: return QOpenGLTexture::PixelType::Float32;
+    case Image::Short: return QOpenGLTexture::PixelType::UInt16;
+    default: return QOpenGLTexture::PixelType::UInt8;
+  }
 }
 
-std::unique_ptr<QOpenGLTexture> createTexture(Image const& image, Image::Layer const& layer)
+// Describes how rows of a layer are laid out in memory. Padding to the next
+// multiple of 2, 4 or 8 bytes (as done by QImage) maps to GL_UNPACK_ALIGNMENT,
+// any other stride to GL_UNPACK_ROW_LENGTH.
+QOpenGLPixelTransferOptions transferOptions(Image const& image, int layer)
 {
   QOpenGLPixelTransferOptions options;
-  if (image.format() == Image::Byte) {
-    options.setAlignment(1); // GL_UNPACK_ALIGNMENT
+  size_t pixelSize = image.channels(layer) * image.pixelSizeInBytes();
+  size_t packed = image.width() * pixelSize;
+  size_t stride = image.stride(layer);
+  options.setAlignment(1);
+  if (stride != packed) {
+    for (int alignment : { 2, 4, 8 }) {
+      if ((packed + alignment - 1) / alignment * alignment == stride) {
+        options.setAlignment(alignment);
+        return options;
+      }
+    }
+    Q_ASSERT(stride % pixelSize == 0);
+    options.setRowLength(int(stride / pixelSize));
   }
+  return options;
+}
+
+// Storage for the pixels of a layer and all mip levels.
+std::unique_ptr<QOpenGLTexture> allocateTexture(Image const& image, Image::Layer const& layer)
+{
   auto texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
   texture->setSize(image.width(), image.height());
   texture->setFormat(format(image));
-  texture->allocateStorage(pixelFormat(layer.channels), pixelType(image));
-  texture->setData(pixelFormat(layer.channels), pixelType(image), image.data() + layer.offset, &options);
+  texture->setMipLevels(texture->maximumMipLevels());
+  texture->allocateStorage(pixelFormat(image, layer.channels), pixelType(image));
   texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
   texture->setMagnificationFilter(QOpenGLTexture::Nearest);
   texture->setWrapMode(QOpenGLTexture::ClampToBorder);
-  texture->generateMipMaps();
   if (layer.display == Image::Luminance || layer.display == Image::Depth) {
     texture->setSwizzleMask(QOpenGLTexture::RedValue, QOpenGLTexture::RedValue,
                             QOpenGLTexture::RedValue, QOpenGLTexture::OneValue);
@@ -97,20 +135,82 @@ std::unique_ptr<QOpenGLTexture> createTexture(Image const& image, Image::Layer c
   return texture;
 }
 
-std::vector<std::unique_ptr<QOpenGLTexture>> createTextures(Image const& image)
+std::unique_ptr<QOpenGLTexture> createTexture(Image const& image, Image::Layer const& layer, int index)
+{
+  HDRV_TRACE_SCOPE_DETAIL("createTexture", layer.name);
+  auto options = transferOptions(image, index);
+  auto texture = allocateTexture(image, layer);
+  texture->setData(pixelFormat(image, layer.channels), pixelType(image), image.data() + layer.offset, &options);
+  texture->generateMipMaps();
+  return texture;
+}
+
+// One texture per layer, images without layers have one.
+std::vector<Image::Layer> textureLayers(Image const& image)
 {
-  std::vector<std::unique_ptr<QOpenGLTexture>> result;
   if (image.layers().empty()) {
     auto display = image.channels() == 1 ? Image::Luminance : Image::Color;
-    result.push_back(createTexture(image, Image::Layer{"", image.channels(), display, 0}));
-  } else {
-    for (auto& layer : image.layers()) {
-      result.push_back(createTexture(image, layer));
-    }
+    return { Image::Layer{"", image.channels(), display, 0} };
+  }
+  return image.layers();
+}
+
+std::vector<std::unique_ptr<QOpenGLTexture>> createTextures(Image const& image)
+{
+  std::vector<std::unique_ptr<QOpenGLTexture>> result;
+  auto layers = textureLayers(image);
+  for (int i = 0; i < int(layers.size()); ++i) {
+    result.push_back(createTexture(image, layers[i], i));
   }
   return result;
 }
 
+// Uploads regions of a live image changed in place, given in pixels from the
+// top-left corner. Rows are read straight from the image's memory.
+void updateTextures(std::vector<std::unique_ptr<QOpenGLTexture>>& textures, Image const& image,
+  std::vector<QRect> const& regions)
+{
+  HDRV_TRACE_SCOPE("updateTextures");
+  for (int i = 0; i < int(textures.size()); ++i) {
+    int channels = image.channels(i);
+    size_t pixelSize = size_t(channels) * image.pixelSizeInBytes();
+    QOpenGLPixelTransferOptions options;
+    options.setAlignment(1);
+    options.setRowLength(int(image.stride(i) / pixelSize));
+    for (auto const& r : regions) {
+      // Rows in memory and texture are in the same order, the shader flips top-down images.
+      bool topDown = image.orientation() == Image::TopDown;
+      int first = topDown ? r.y() : r.y() + r.height() - 1;
+      int y = topDown ? r.y() : image.height() - r.y() - r.height();
+      textures[i]->setData(r.x(), y, 0, r.width(), r.height(), 1, pixelFormat(image, channels), pixelType(image),
+        image.row(first, i) + r.x() * pixelSize, &options);
+    }
+    textures[i]->generateMipMaps();
+  }
+}
+
+// GPU memory of the textures of an image, including mip levels.
+int64_t textureBytes(Image const& image)
+{
+  int64_t bytes = 0;
+  for (int layer = 0; layer < std::max(1, int(image.layers().size())); ++layer) {
+    bytes += int64_t(image.width()) * image.height() * image.channels(layer) * image.pixelSizeInBytes();
+  }
+  return bytes * 4 / 3;
+}
+
+// Large images are streamed over several frames, their previous image or a
+// proxy of proxySize is shown meanwhile. Regions of live images are updated
+// in place right away, so they are not.
+int64_t const streamedBytes = 32 << 20;
+size_t const streamBudget = 32 << 20; // per frame
+int const proxySize = 1024;
+
+bool isStreamed(ImageDocument const* doc, Image const& image)
+{
+  return !(doc && doc->isLive()) && textureBytes(image) > streamedBytes;
+}
+
 QVector2D texturePosition(QVector2D regionSize, QVector2D imageSize, QVector2D imagePosition)
 {
   auto offset = (regionSize - imageSize) / 2.0f;
@@ -123,60 +223,220 @@ QVector2D textureScale(QVector2D regionSize, QVector2D imageSize)
   return imageSize / regionSize;
 }
 
+ImageRenderer::~ImageRenderer()
+{
+  for (auto const& textures : textures_) {
+    metrics::counter("render.textureBytes").add(-textureBytes(*textures.first));
+  }
+}
+
 void ImageRenderer::updateImages(std::vector<ImageDocument *> const& images)
 {
+  HDRV_TRACE_SCOPE("ImageRenderer::updateImages");
+  std::set<std::shared_ptr<Image>> used;
+  for (auto doc : images) {
+    used.insert(doc->image());
+    if (auto const& placeholder = doc->placeholder()) {
+      used.insert(placeholder);
+    }
+    if (auto const& c = doc->comparison()) {
+      used.insert(c->image);
+    }
+  }
+  // Stop streaming images no longer shown, keep what stands in for the others
+  for (auto iter = pending_.begin(); iter != pending_.end(); ) {
+    if (!used.count(iter->first)) {
+      streamer_->remove(iter->first);
+      iter = pending_.erase(iter);
+    } else {
+      used.insert(iter->second.previous);
+      used.insert(iter->second.proxy);
+      ++iter;
+    }
+  }
+  // Keep what documents showed until their new images are streamed
+  for (auto iter = shown_.begin(); iter != shown_.end(); ) {
+    auto doc = std::find(images.begin(), images.end(), iter->first);
+    if (doc == images.end()) {
+      iter = shown_.erase(iter);
+    } else {
+      auto const& image = (*doc)->image();
+      bool uploaded = textures_.count(image) && !pending_.count(image);
+      if (image != iter->second && !uploaded && isStreamed(*doc, *image)) {
+        used.insert(iter->second);
+      }
+      ++iter;
+    }
+  }
   // Erase textures for images that no longer exist
   for (auto iter = textures_.begin(); iter != textures_.end(); ) {
-    auto matchImage = [iter](ImageDocument * doc) {
-      return doc->image() == iter->first
-        || (doc->comparison() && doc->comparison()->image == iter->first);
-    };
-    if (std::find_if(images.begin(), images.end(), matchImage) == images.end()) {
+    if (!used.count(iter->first)) {
+      metrics::counter("render.textureBytes").add(-textureBytes(*iter->first));
       textures_.erase(iter++);
     } else {
       ++iter;
     }
   }
   // Create textures for new images
-  auto createTextureFor = [this](std::shared_ptr<Image> const& image) {
+  auto createTextureFor = [this](std::shared_ptr<Image> const& image, ImageDocument const* doc) {
     auto & tex = textures_[image];
-    if (tex.empty()) {
+    if (!tex.empty()) {
+      return;
+    }
+    metrics::counter("render.textureBytes").add(textureBytes(*image));
+    if (!isStreamed(doc, *image)) {
+      metrics::Timer timer(metrics::histogram("load.upload"));
       tex = createTextures(*image);
+      return;
     }
+    std::vector<TextureStreamer::Target> targets;
+    auto layers = textureLayers(*image);
+    for (int i = 0; i < int(layers.size()); ++i) {
+      tex.push_back(allocateTexture(*image, layers[i]));
+      targets.push_back({ tex.back().get(), i, pixelFormat(*image, layers[i].channels), pixelType(*image) });
+    }
+    if (!streamer_) {
+      streamer_ = std::make_unique<TextureStreamer>();
+    }
+    streamer_->add(image, std::move(targets));
+    Pending pending;
+    auto previous = doc ? shown_.find(doc) : shown_.end();
+    if (previous != shown_.end() && textures_.count(previous->second) && !pending_.count(previous->second)) {
+      pending.previous = previous->second;
+    } else {
+      pending.reduced = QtConcurrent::run([image]() { return std::make_shared<Image>(reduceToSize(*image, proxySize)); });
+    }
+    pending_[image] = std::move(pending);
   };
   for (auto doc : images) {
-    createTextureFor(doc->image());
+    if (doc->isLive()) {
+      auto regions = doc->takeChangedRegions();
+      auto i = textures_.find(doc->image());
+      if (i != textures_.end() && !regions.empty()) {
+        metrics::Timer timer(metrics::histogram("load.upload"));
+        updateTextures(i->second, *doc->image(), regions);
+      }
+    }
+    createTextureFor(doc->image(), doc);
     if (auto const& c = doc->comparison()) {
-      createTextureFor(c->image);
+      createTextureFor(c->image, nullptr);
+    }
+    // A placeholder also stands in while the decoded image is streamed. The
+    // empty image of a document not loaded yet does not, a proxy is drawn then.
+    if (auto const& placeholder = doc->placeholder()) {
+      createTextureFor(placeholder, nullptr);
+      shown_[doc] = placeholder;
+    } else if (!pending_.count(doc->image()) && doc->isLoaded()) {
+      shown_[doc] = doc->image();
     }
   }
 }
 
+// Uploads the next bands of streamed textures and the proxies computed since
+// the last frame. Asks for another frame while there is more to do.
+void ImageRenderer::stream()
+{
+  if (pending_.empty()) {
+    return;
+  }
+  for (auto& [image, pending] : pending_) {
+    if (!pending.proxy && pending.reduced.isFinished() && pending.reduced.resultCount() > 0) {
+      pending.proxy = pending.reduced.result();
+      textures_[pending.proxy] = createTextures(*pending.proxy);
+      metrics::counter("render.textureBytes").add(textureBytes(*pending.proxy));
+    }
+  }
+  for (auto const& image : streamer_->step(streamBudget)) {
+    auto i = pending_.find(image);
+    if (auto const& proxy = i->second.proxy) {
+      metrics::counter("render.textureBytes").add(-textureBytes(*proxy));
+      textures_.erase(proxy);
+    }
+    pending_.erase(i);
+  }
+  if (!pending_.empty() && window_) {
+    window_->update();
+  }
+}
+
 void ImageRenderer::init()
 {
   if (!program_) {
-    QSGRendererInterface* rif = window_->rendererInterface();
-    Q_ASSERT(rif->graphicsApi() == QSGRendererInterface::OpenGL || rif->graphicsApi() == QSGRendererInterface::OpenGLRhi);
+    if (window_) {
+      QSGRendererInterface* rif = window_->rendererInterface();
+      Q_ASSERT(rif->graphicsApi() == QSGRendererInterface::OpenGL || rif->graphicsApi() == QSGRendererInterface::OpenGLRhi);
+    }
 
     initializeOpenGLFunctions();
     program_ = createProgram();
   }
 }
 
+// Images drawn in place of others may have fewer layers, their first is shown then.
 QOpenGLTexture& ImageRenderer::findTexture(std::shared_ptr<Image> const& image, int layer)
 {
   auto i = textures_.find(image);
   Q_ASSERT(i != textures_.end());
-  if (i->second.size() == 1) {
+  if (layer >= int(i->second.size())) {
     return *i->second[0];
-  }   
-  Q_ASSERT(layer < i->second.size());
+  }
   return *i->second[layer];
 }
 
+// The image whose textures are drawn for an image: itself, or while it is
+// streamed what stands in for it. Null if there is nothing to draw yet.
+std::shared_ptr<Image> ImageRenderer::drawnFor(std::shared_ptr<Image> const& image) const
+{
+  auto i = pending_.find(image);
+  if (i == pending_.end()) {
+    return image;
+  }
+  return i->second.previous ? i->second.previous : i->second.proxy;
+}
+
+// The shader outlines up to maxRegions boxes, in coordinates relative to the image size.
+void ImageRenderer::setChangedRegions(Image const& image, std::vector<QRect> const& regions)
+{
+  constexpr int maxRegions = 32;
+  QVector4D boxes[maxRegions];
+  int count = std::min(int(regions.size()), maxRegions);
+  for (int i = 0; i < count; ++i) {
+    auto const& r = regions[i];
+    boxes[i] = QVector4D(float(r.x()) / image.width(), float(r.y()) / image.height(),
+                         float(r.width()) / image.width(), float(r.height()) / image.height());
+  }
+  program_->setUniformValueArray("regions", boxes, count);
+  program_->setUniformValue("regionCount", count);
+}
+
 void ImageRenderer::paint()
 {
-  window_->beginExternalCommands();
+  // Time spent issuing the commands, the GPU runs them later.
+  static auto& frameTimes = metrics::histogram("render.paint");
+  metrics::Timer timer(frameTimes);
+  HDRV_TRACE_SCOPE("ImageRenderer::paint");
+  if (window_) {
+    window_->beginExternalCommands();
+  }
+  stream();
+
+  auto const& region = renderRegion_;
+  glViewport(region.offset.x(), region.offset.y(), region.size.width(), region.size.height());
+
+  glDisable(GL_DEPTH_TEST);
+  glClearColor(clearColor_.redF(), clearColor_.greenF(), clearColor_.blueF(), 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+
+  // Sizes are those of the image itself, so what stands in for it covers the same area.
+  auto drawn = placeholder_ ? placeholder_ : drawnFor(current_);
+  auto compared = comparison_ && !placeholder_ ? drawnFor(comparison_->image) : nullptr;
+  QSize size = placeholder_ ? placeholderSize_ : QSize(current_->width(), current_->height());
+  if (!drawn) {
+    if (window_) {
+      window_->endExternalCommands();
+    }
+    return;
+  }
 
   program_->bind();
   program_->enableAttributeArray(0);
@@ -184,11 +444,10 @@ void ImageRenderer::paint()
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   program_->setAttributeArray(0, GL_FLOAT, vertexData, 2);
 
-  auto const& region = renderRegion_;
   auto const& image = *current_;
-  auto& texture = findTexture(current_, layer_);
+  auto& texture = findTexture(drawn, layer_);
   QVector2D regionSize(float(region.size.width()), float(region.size.height()));
-  QVector2D imageSize(float(image.width()) * settings_.scale, float(image.height()) * settings_.scale);
+  QVector2D imageSize(float(size.width()) * settings_.scale, float(size.height()) * settings_.scale);
 
   texture.setBorderColor(clearColor_);
   texture.bind(0);
@@ -197,22 +456,21 @@ void ImageRenderer::paint()
   program_->setUniformValue("scale", textureScale(regionSize, imageSize));
   program_->setUniformValue("regionSize", regionSize);
   program_->setUniformValue("brightness", std::pow(2.0f, settings_.brightness));
-  program_->setUniformValue("gamma", current_->format() == Image::Float ? 1.0f / settings_.gamma : 1.0f);
+  program_->setUniformValue("gamma", drawn->format() == Image::Float ? 1.0f / settings_.gamma : 1.0f);
   program_->setUniformValue("display", (int)settings_.displayMode);
-  if (comparison_) {
-    findTexture(comparison_->image, 0).bind(1);
+  program_->setUniformValue("flipY", (int)(drawn->orientation() == Image::TopDown));
+  if (compared) {
+    findTexture(compared, 0).bind(1);
     program_->setUniformValue("comparison", 1);
+    program_->setUniformValue("comparisonFlipY", (int)(compared->orientation() == Image::TopDown));
     program_->setUniformValue("mode", (int)comparison_->mode);
     program_->setUniformValue("separator", comparison_->separator);
+    setChangedRegions(image, comparison_->highlightChanges ? comparison_->changedRegions : std::vector<QRect>());
   } else {
     program_->setUniformValue("mode", -1);
+    setChangedRegions(image, {});
   }
 
-  glViewport(region.offset.x(), region.offset.y(), region.size.width(), region.size.height());
-
-  glDisable(GL_DEPTH_TEST);
-  glClearColor(clearColor_.redF(), clearColor_.greenF(), clearColor_.blueF(), 1.0f);
-  glClear(GL_COLOR_BUFFER_BIT);
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE);
 
@@ -222,7 +480,9 @@ void ImageRenderer::paint()
   program_->disableAttributeArray(0);
   program_->release();
 
-  window_->endExternalCommands();
+  if (window_) {
+    window_->endExternalCommands();
+  }
 }
 
 }
@@ -5,11 +5,13 @@
 
 #include <QObject>
 #include <QColor>
+#include <QFuture>
 #include <QOpenGLFunctions>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
 
 #include <model/ImageCollection.hpp>
+#include <view/TextureStreamer.hpp>
 
 class QQuickWindow;
 
@@ -37,13 +39,21 @@ class ImageRenderer : public QObject, protected QOpenGLFunctions
 public:
   using ImageTextures = std::map<std::shared_ptr<Image>, std::vector<std::unique_ptr<QOpenGLTexture>>>;
 
+  ~ImageRenderer();
+
   void setRenderRegion(RenderRegion region) { renderRegion_ = region; }
   void setClearColor(QColor color) { clearColor_ = color; }
   void setSettings(ImageSettings settings) { settings_ = settings; }
   void setCurrent(std::shared_ptr<Image> const& image, int layer) { current_ = image; layer_ = layer; }
+  // Drawn at `size` instead of the current image while that is not loaded yet.
+  void setPlaceholder(std::shared_ptr<Image> const& image, QSize size) { placeholder_ = image; placeholderSize_ = size; }
   void setComparison(std::optional<ImageComparison> const& c) { comparison_ = c; }
+  // Without a window (eg. in benchmarks) the renderer draws into whatever the
+  // current OpenGL context has bound.
   void setWindow(QQuickWindow* window) { window_ = window; }
   void updateImages(std::vector<ImageDocument *> const& images);
+  // True while textures of large images are still uploaded over several frames.
+  bool uploading() const { return !pending_.empty(); }
 
 public slots:
   void init();
@@ -51,6 +61,9 @@ public slots:
   
 private:
   QOpenGLTexture& findTexture(std::shared_ptr<Image> const& image, int layer);
+  std::shared_ptr<Image> drawnFor(std::shared_ptr<Image> const& image) const;
+  void stream();
+  void setChangedRegions(Image const& image, std::vector<QRect> const& regions);
 
   RenderRegion renderRegion_;
   QColor clearColor_;
@@ -58,9 +71,25 @@ private:
   ImageTextures textures_;
   int layer_ = 0;
   std::shared_ptr<Image> current_;
+  std::shared_ptr<Image> placeholder_;
+  QSize placeholderSize_;
   std::optional<ImageComparison> comparison_;
   std::unique_ptr<QOpenGLShaderProgram> program_;
-  QQuickWindow* window_;
+
+  // Images whose textures are still streamed and what is drawn instead: the
+  // image the document showed before (eg. the file before it was reloaded, or
+  // its cached preview) or, without one, a reduced copy once it is computed.
+  struct Pending
+  {
+    std::shared_ptr<Image> previous;
+    std::shared_ptr<Image> proxy;
+    QFuture<std::shared_ptr<Image>> reduced;
+  };
+  std::map<std::shared_ptr<Image>, Pending> pending_;
+  // Last image of a document with complete textures, or its placeholder.
+  std::map<ImageDocument const*, std::shared_ptr<Image>> shown_;
+  std::unique_ptr<TextureStreamer> streamer_;
+  QQuickWindow* window_ = nullptr;
 };
 
 }
\ No newline at end of file
@@ -214,6 +214,12 @@ ApplicationWindow {
       }
     }
 
+    Shortcut {
+      sequence: 'B'
+      context: Qt.ApplicationShortcut
+      onActivated: images.current.nextBadPixel()
+    }
+
     Shortcut {
       sequence: 'S'
       context: Qt.ApplicationShortcut
@@ -0,0 +1,212 @@
+#include <view/TextureStreamer.hpp>
+
+#include <image/Metrics.hpp>
+#include <image/Trace.hpp>
+
+#include <QOpenGLContext>
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+namespace hdrv {
+
+namespace {
+
+// Four bands in flight, as many as are uploaded in a frame by default.
+size_t const bufferSize = 8 << 20;
+int const bufferCount = 4;
+
+using BufferStorage = void (QOPENGLF_APIENTRYP)(GLenum target, GLsizeiptr size, void const* data, GLbitfield flags);
+
+BufferStorage bufferStorageFunction(QOpenGLContext* context)
+{
+  if (context->isOpenGLES()
+    || (context->format().version() < qMakePair(4, 4) && !context->hasExtension("GL_ARB_buffer_storage"))) {
+    return nullptr;
+  }
+  return reinterpret_cast<BufferStorage>(context->getProcAddress("glBufferStorage"));
+}
+
+}
+
+TextureStreamer::TextureStreamer()
+{
+  initializeOpenGLFunctions();
+  auto bufferStorage = bufferStorageFunction(QOpenGLContext::currentContext());
+  persistent_ = bufferStorage != nullptr;
+  buffers_.resize(bufferCount);
+  for (auto& buffer : buffers_) {
+    glGenBuffers(1, &buffer.id);
+    if (persistent_) {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+      bufferStorage(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(bufferSize), nullptr, flags);
+      buffer.mapped = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, GLsizeiptr(bufferSize), flags));
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+  for (auto& buffer : buffers_) {
+    if (buffer.fence) {
+      glDeleteSync(buffer.fence);
+    }
+    if (buffer.mapped) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    glDeleteBuffers(1, &buffer.id);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureStreamer::add(std::shared_ptr<Image> const& image, std::vector<Target> targets)
+{
+  Job job;
+  job.image = image;
+  job.targets = std::move(targets);
+  for (auto const& target : job.targets) {
+    // Only the levels filled so far are sampled.
+    target.texture->setMipLevelRange(0, 0);
+  }
+  jobs_.push_back(std::move(job));
+}
+
+void TextureStreamer::remove(std::shared_ptr<Image> const& image)
+{
+  jobs_.erase(std::remove_if(jobs_.begin(), jobs_.end(), [&](Job const& job) { return job.image == image; }),
+    jobs_.end());
+}
+
+std::vector<std::shared_ptr<Image>> TextureStreamer::step(size_t budget)
+{
+  HDRV_TRACE_SCOPE("TextureStreamer::step");
+  metrics::Timer timer(metrics::histogram("render.uploadStep"));
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  size_t uploaded = 0;
+  for (auto& job : jobs_) {
+    while (uploaded < budget && job.target < job.targets.size()) {
+      uploaded += uploadBand(job);
+    }
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  std::vector<std::shared_ptr<Image>> complete;
+  for (auto i = jobs_.begin(); i != jobs_.end();) {
+    if (i->target == i->targets.size() && generateMipLevel(*i)) {
+      complete.push_back(i->image);
+      i = jobs_.erase(i);
+    } else {
+      ++i;
+    }
+  }
+  return complete;
+}
+
+// Uploads as many rows as fit into a buffer. Texture rows are in the order of
+// the image's memory, as for textures created at once.
+size_t TextureStreamer::uploadBand(Job& job)
+{
+  auto const& target = job.targets[job.target];
+  auto const& image = *job.image;
+  size_t rowSize = size_t(image.width()) * image.channels(target.layer) * image.pixelSizeInBytes();
+  int rows = int(std::clamp(bufferSize / rowSize, size_t(1), size_t(image.height() - job.row)));
+  // Rows follow each other in memory, whichever the orientation.
+  auto source = [&](int row) {
+    return image.row(image.orientation() == Image::TopDown ? row : image.height() - row - 1, target.layer);
+  };
+
+  target.texture->bind();
+  uint8_t* pixels = nullptr;
+  if (rowSize <= bufferSize) {
+    auto& buffer = buffers_[next_];
+    next_ = (next_ + 1) % buffers_.size();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+    pixels = map(buffer);
+    if (pixels) {
+      if (image.stride(target.layer) == rowSize) {
+        std::memcpy(pixels, source(job.row), rowSize * size_t(rows));
+      } else {
+        for (int r = 0; r < rows; ++r) {
+          std::memcpy(pixels + size_t(r) * rowSize, source(job.row + r), rowSize);
+        }
+      }
+      unmap();
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, job.row, image.width(), rows, target.format, target.type, nullptr);
+      if (persistent_) {
+        buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+  if (!pixels) {
+    // Rows larger than a buffer, or when it could not be mapped, are read from
+    // the image's memory directly.
+    for (int r = 0; r < rows; ++r) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, job.row + r, image.width(), 1, target.format, target.type,
+        source(job.row + r));
+    }
+  }
+  target.texture->release();
+
+  job.row += rows;
+  if (job.row == image.height()) {
+    job.row = 0;
+    ++job.target;
+  }
+  return size_t(rows) * rowSize;
+}
+
+// Generates the next mip level of all textures of an image from the one
+// before, true once all levels are there.
+bool TextureStreamer::generateMipLevel(Job& job)
+{
+  int levels = job.targets.front().texture->maximumMipLevels();
+  if (job.mipLevel + 1 >= levels) {
+    return true;
+  }
+  ++job.mipLevel;
+  for (auto const& target : job.targets) {
+    target.texture->setMipLevelRange(0, job.mipLevel);
+    target.texture->generateMipMaps(job.mipLevel - 1);
+  }
+  return job.mipLevel + 1 >= levels;
+}
+
+// The buffer bound to GL_PIXEL_UNPACK_BUFFER, for writing a band.
+uint8_t* TextureStreamer::map(Buffer& buffer)
+{
+  if (persistent_) {
+    if (buffer.fence) {
+      // Normally signalled long ago, the buffer was last used a frame before.
+      glClientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+      glDeleteSync(buffer.fence);
+      buffer.fence = nullptr;
+    }
+    return buffer.mapped;
+  }
+  // Orphaning the storage lets the driver hand out new memory while the
+  // previous band is still read.
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(bufferSize), nullptr, GL_STREAM_DRAW);
+  return static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, GLsizeiptr(bufferSize),
+    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+}
+
+void TextureStreamer::unmap()
+{
+  if (!persistent_) {
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  }
+}
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLTexture>
+
+#include <image/Image.hpp>
+
+namespace hdrv {
+
+// Fills the textures of large images a few bands of rows per frame, so the
+// render thread (and with it the UI) does not stall for a whole upload. Rows
+// are copied into pixel buffer objects, mapped persistently where the driver
+// has GL_ARB_buffer_storage, which the GPU reads from asynchronously. Once the
+// first mip level of all layers is complete, one more level is generated per
+// frame. All functions need the OpenGL context of the textures to be current.
+class TextureStreamer : protected QOpenGLExtraFunctions
+{
+public:
+  struct Target
+  {
+    QOpenGLTexture* texture; // with storage for all mip levels allocated
+    int layer;
+    QOpenGLTexture::PixelFormat format;
+    QOpenGLTexture::PixelType type;
+  };
+
+  TextureStreamer();
+  ~TextureStreamer();
+  TextureStreamer(TextureStreamer const&) = delete;
+  TextureStreamer& operator=(TextureStreamer const&) = delete;
+
+  void add(std::shared_ptr<Image> const& image, std::vector<Target> targets);
+  void remove(std::shared_ptr<Image> const& image);
+  bool empty() const { return jobs_.empty(); }
+
+  // Uploads about `budget` bytes, oldest images first, and generates the next
+  // mip level of the images already uploaded. Returns the images whose
+  // textures are complete.
+  std::vector<std::shared_ptr<Image>> step(size_t budget);
+
+private:
+  struct Job
+  {
+    std::shared_ptr<Image> image;
+    std::vector<Target> targets;
+    size_t target = 0; // being uploaded
+    int row = 0;       // next row, in the order of the image's memory
+    int mipLevel = 0;  // last one complete
+  };
+
+  struct Buffer
+  {
+    GLuint id = 0;
+    uint8_t* mapped = nullptr; // persistently
+    GLsync fence = nullptr;    // of the last upload reading it
+  };
+
+  size_t uploadBand(Job& job);
+  bool generateMipLevel(Job& job);
+  uint8_t* map(Buffer& buffer);
+  void unmap();
+
+  std::deque<Job> jobs_;
+  std::vector<Buffer> buffers_;
+  size_t next_ = 0;
+  bool persistent_ = false;
+};
+
+}